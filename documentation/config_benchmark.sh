@@ -0,0 +1,48 @@
+#!/bin/sh
+# Configuration loading benchmark.
+#
+# usage: config_benchmark.sh  kryten  [entries]  [scan-threads]
+#
+# Generates a configuration file of the given number of entries (default
+# 1000000), a mix of range, enumeration, element and command forms, and
+# reports the configuration scan time when read as text and when read from
+# the binary rule cache. The number of scan threads defaults to the number
+# of processors, see KRYTEN_SCAN_THREADS.
+#
+
+if [ $# -lt 1 ] ; then
+    echo "usage: $0  kryten  [entries]  [scan-threads]"
+    exit 1
+fi
+
+kryten="$1"
+entries="${2:-1000000}"
+[ -n "$3" ] && export KRYTEN_SCAN_THREADS="$3"
+
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+conf="$dir/benchmark.conf"
+
+awk -v n="$entries" 'BEGIN {
+    for (j = 0; j < n; j++) {
+        pv = sprintf ("SR%02dBPM%02d:X_%d", j % 100, j % 10, j);
+        k = j % 4;
+        if (k == 0)      print pv " -1.5~1.5 /bin/echo %p %m %v";
+        else if (k == 1) print pv " > 10.0 | < -10.0 /bin/echo %p %v";
+        else if (k == 2) print pv " [2] 1 | 3 ~ 5 /bin/logger %p %e %v";
+        else             print pv " \"Fault\" /bin/echo %p fault %m";
+    }
+}' > "$conf"
+
+echo "entries:      $entries ($(wc -c < "$conf") bytes)"
+echo "scan threads: ${KRYTEN_SCAN_THREADS:-number of processors}"
+
+scan_time () {
+    "$kryten" -s -v -c "$conf" | sed -n 's/^Configuration scanned in \([0-9.]*\) s.*/\1 s/p'
+}
+
+echo "text:         $(scan_time)"
+"$kryten" -s -C "$conf" > /dev/null
+echo "rule cache:   $(scan_time)"
+
+# end
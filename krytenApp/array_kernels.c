@@ -0,0 +1,697 @@
+/* array_kernels.c
+ *
+ * Kryten is a EPICS PV monitoring program that calls a system command
+ * when the value of the PV matches/cease to match specified criteria.
+ *
+ * Copyright (C) 2011-2021  Andrew C. Starritt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact details:
+ * andrew.starritt@gmail.com
+ * PO Box 3118, Prahran East, Victoria 3181, Australia.
+ *
+ * Source code formatting:
+ * indent options:  -kr -pcs -i3 -cli3 -nbbo -nut
+ *
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <db_access.h>
+#include <epicsTypes.h>
+
+#include "array_kernels.h"
+#include "utilities.h"
+
+/* SIMD kernels are only provided for x86 built with gcc/clang. The kernels
+ * are compiled using per function target attributes and selected at run time,
+ * so that a generic build still uses AVX2 on a host that supports it.
+ */
+#if (defined (__x86_64__) || defined (__i386__)) && defined (__GNUC__)
+#define USE_X86_KERNELS  1
+#include <immintrin.h>
+#else
+#define USE_X86_KERNELS  0
+#endif
+
+typedef enum eKernel_Kind {
+   kkUnknown,
+   kkScalar,
+   kkSSE2,
+   kkAVX2
+} Kernel_Kind;
+
+static Kernel_Kind kernel_kind = kkUnknown;
+
+/* Interval bounds converted to the native value type.
+ */
+typedef struct sBounds {
+   unsigned int count;
+   union {
+      double d[MAXIMUM_INTERVALS];
+      float f[MAXIMUM_INTERVALS];
+      epicsInt32 l[MAXIMUM_INTERVALS];
+      epicsInt16 s[MAXIMUM_INTERVALS];
+      epicsUInt16 e[MAXIMUM_INTERVALS];
+      epicsUInt8 c[MAXIMUM_INTERVALS];
+   } lower, upper;
+} Bounds;
+
+
+/*------------------------------------------------------------------------------
+ */
+static Kernel_Kind select_kernel_kind ()
+{
+#if USE_X86_KERNELS
+   __builtin_cpu_init ();
+   if (__builtin_cpu_supports ("avx2")) {
+      return kkAVX2;
+   }
+   if (__builtin_cpu_supports ("sse2")) {
+      return kkSSE2;
+   }
+#endif
+   return kkScalar;
+}                               /* select_kernel_kind */
+
+
+/*------------------------------------------------------------------------------
+ * Convert interval to an integer interval within type_min .. type_max.
+ * Returns false if the interval contains no such integers.
+ */
+static bool integer_bounds (const Interval * interval, const double type_min,
+                            const double type_max, long *lower, long *upper)
+{
+   double lo = ceil (interval->lower);
+   double hi = floor (interval->upper);
+
+   lo = MAX (lo, type_min);
+   hi = MIN (hi, type_max);
+   if (!(lo <= hi)) {
+      return false;
+   }
+
+   *lower = (long) lo;
+   *upper = (long) hi;
+   return true;
+}                               /* integer_bounds */
+
+
+/*------------------------------------------------------------------------------
+ * Convert intervals to the native type - empty intervals are dropped.
+ */
+static void make_bounds (const Interval_Set * set, const short field_type,
+                         Bounds * bounds)
+{
+   unsigned int j;
+   unsigned int n = 0;
+   long lo;
+   long hi;
+   float lo_f;
+   float hi_f;
+
+   for (j = 0; j < set->count; j++) {
+      const Interval *interval = &set->item[j];
+
+      switch (field_type) {
+         case DBF_DOUBLE:
+            if (interval->lower <= interval->upper) {
+               bounds->lower.d[n] = interval->lower;
+               bounds->upper.d[n] = interval->upper;
+               n++;
+            }
+            break;
+
+         case DBF_FLOAT:
+            /* Round the bounds inwards so that the float comparison is
+             * equivalent to comparing the value as a double.
+             */
+            lo_f = (float) interval->lower;
+            if ((double) lo_f < interval->lower) {
+               lo_f = nextafterf (lo_f, INFINITY);
+            }
+            hi_f = (float) interval->upper;
+            if ((double) hi_f > interval->upper) {
+               hi_f = nextafterf (hi_f, -INFINITY);
+            }
+            if (lo_f <= hi_f) {
+               bounds->lower.f[n] = lo_f;
+               bounds->upper.f[n] = hi_f;
+               n++;
+            }
+            break;
+
+         case DBF_LONG:
+            if (integer_bounds (interval, -2147483648.0, 2147483647.0,
+                                &lo, &hi)) {
+               bounds->lower.l[n] = (epicsInt32) lo;
+               bounds->upper.l[n] = (epicsInt32) hi;
+               n++;
+            }
+            break;
+
+         case DBF_SHORT:
+            if (integer_bounds (interval, -32768.0, 32767.0, &lo, &hi)) {
+               bounds->lower.s[n] = (epicsInt16) lo;
+               bounds->upper.s[n] = (epicsInt16) hi;
+               n++;
+            }
+            break;
+
+         case DBF_ENUM:
+            if (integer_bounds (interval, 0.0, 65535.0, &lo, &hi)) {
+               bounds->lower.e[n] = (epicsUInt16) lo;
+               bounds->upper.e[n] = (epicsUInt16) hi;
+               n++;
+            }
+            break;
+
+         case DBF_CHAR:
+            if (integer_bounds (interval, 0.0, 255.0, &lo, &hi)) {
+               bounds->lower.c[n] = (epicsUInt8) lo;
+               bounds->upper.c[n] = (epicsUInt8) hi;
+               n++;
+            }
+            break;
+      }
+   }
+   bounds->count = n;
+}                               /* make_bounds */
+
+
+/*------------------------------------------------------------------------------
+ * Scalar kernels - used for the tail end of the SIMD kernels, for types
+ * without a SIMD kernel, and on hosts without SIMD support.
+ */
+#define SCALAR_COUNT(values, field, first, number, bounds, total) {        \
+   unsigned long j;                                                         \
+   unsigned int k;                                                          \
+   for (j = first; j < number; j++) {                                       \
+      for (k = 0; k < bounds->count; k++) {                                 \
+         if ((values[j] >= bounds->lower.field[k]) &&                       \
+             (values[j] <= bounds->upper.field[k])) {                       \
+            total++;                                                        \
+            break;                                                          \
+         }                                                                  \
+      }                                                                     \
+   }                                                                        \
+}
+
+
+#if USE_X86_KERNELS
+
+/*------------------------------------------------------------------------------
+ * AVX2 kernels. Each kernel processes whole vectors only, returns the count
+ * and sets *done to the number of elements processed.
+ */
+__attribute__ ((target ("avx2")))
+static unsigned long avx2_count_double (const double *values,
+                                        const unsigned long number,
+                                        const Bounds * bounds,
+                                        unsigned long *done)
+{
+   __m256d lower[MAXIMUM_INTERVALS];
+   __m256d upper[MAXIMUM_INTERVALS];
+   unsigned long total = 0;
+   unsigned long j;
+   unsigned int k;
+
+   for (k = 0; k < bounds->count; k++) {
+      lower[k] = _mm256_set1_pd (bounds->lower.d[k]);
+      upper[k] = _mm256_set1_pd (bounds->upper.d[k]);
+   }
+
+   for (j = 0; j + 4 <= number; j += 4) {
+      const __m256d x = _mm256_loadu_pd (&values[j]);
+      __m256d in = _mm256_setzero_pd ();
+      for (k = 0; k < bounds->count; k++) {
+         in = _mm256_or_pd (in, _mm256_and_pd
+                            (_mm256_cmp_pd (x, lower[k], _CMP_GE_OQ),
+                             _mm256_cmp_pd (x, upper[k], _CMP_LE_OQ)));
+      }
+      total += __builtin_popcount (_mm256_movemask_pd (in));
+   }
+
+   *done = j;
+   return total;
+}                               /* avx2_count_double */
+
+
+__attribute__ ((target ("avx2")))
+static unsigned long avx2_count_float (const float *values,
+                                       const unsigned long number,
+                                       const Bounds * bounds,
+                                       unsigned long *done)
+{
+   __m256 lower[MAXIMUM_INTERVALS];
+   __m256 upper[MAXIMUM_INTERVALS];
+   unsigned long total = 0;
+   unsigned long j;
+   unsigned int k;
+
+   for (k = 0; k < bounds->count; k++) {
+      lower[k] = _mm256_set1_ps (bounds->lower.f[k]);
+      upper[k] = _mm256_set1_ps (bounds->upper.f[k]);
+   }
+
+   for (j = 0; j + 8 <= number; j += 8) {
+      const __m256 x = _mm256_loadu_ps (&values[j]);
+      __m256 in = _mm256_setzero_ps ();
+      for (k = 0; k < bounds->count; k++) {
+         in = _mm256_or_ps (in, _mm256_and_ps
+                            (_mm256_cmp_ps (x, lower[k], _CMP_GE_OQ),
+                             _mm256_cmp_ps (x, upper[k], _CMP_LE_OQ)));
+      }
+      total += __builtin_popcount (_mm256_movemask_ps (in));
+   }
+
+   *done = j;
+   return total;
+}                               /* avx2_count_float */
+
+
+/* Integer compares only provide >, so x in [lo, hi] is !(lo > x || x > hi).
+ */
+__attribute__ ((target ("avx2")))
+static unsigned long avx2_count_long (const epicsInt32 * values,
+                                      const unsigned long number,
+                                      const Bounds * bounds,
+                                      unsigned long *done)
+{
+   __m256i lower[MAXIMUM_INTERVALS];
+   __m256i upper[MAXIMUM_INTERVALS];
+   const __m256i ones = _mm256_set1_epi32 (-1);
+   unsigned long total = 0;
+   unsigned long j;
+   unsigned int k;
+
+   for (k = 0; k < bounds->count; k++) {
+      lower[k] = _mm256_set1_epi32 (bounds->lower.l[k]);
+      upper[k] = _mm256_set1_epi32 (bounds->upper.l[k]);
+   }
+
+   for (j = 0; j + 8 <= number; j += 8) {
+      const __m256i x = _mm256_loadu_si256 ((const __m256i *) &values[j]);
+      __m256i in = _mm256_setzero_si256 ();
+      for (k = 0; k < bounds->count; k++) {
+         const __m256i out = _mm256_or_si256
+             (_mm256_cmpgt_epi32 (lower[k], x),
+              _mm256_cmpgt_epi32 (x, upper[k]));
+         in = _mm256_or_si256 (in, _mm256_andnot_si256 (out, ones));
+      }
+      total += __builtin_popcount
+          (_mm256_movemask_ps (_mm256_castsi256_ps (in)));
+   }
+
+   *done = j;
+   return total;
+}                               /* avx2_count_long */
+
+
+__attribute__ ((target ("avx2")))
+static unsigned long avx2_count_short (const epicsInt16 * values,
+                                       const unsigned long number,
+                                       const Bounds * bounds,
+                                       unsigned long *done)
+{
+   __m256i lower[MAXIMUM_INTERVALS];
+   __m256i upper[MAXIMUM_INTERVALS];
+   const __m256i ones = _mm256_set1_epi16 (-1);
+   unsigned long total = 0;
+   unsigned long j;
+   unsigned int k;
+
+   for (k = 0; k < bounds->count; k++) {
+      lower[k] = _mm256_set1_epi16 (bounds->lower.s[k]);
+      upper[k] = _mm256_set1_epi16 (bounds->upper.s[k]);
+   }
+
+   for (j = 0; j + 16 <= number; j += 16) {
+      const __m256i x = _mm256_loadu_si256 ((const __m256i *) &values[j]);
+      __m256i in = _mm256_setzero_si256 ();
+      for (k = 0; k < bounds->count; k++) {
+         const __m256i out = _mm256_or_si256
+             (_mm256_cmpgt_epi16 (lower[k], x),
+              _mm256_cmpgt_epi16 (x, upper[k]));
+         in = _mm256_or_si256 (in, _mm256_andnot_si256 (out, ones));
+      }
+      /* Byte mask - two bits per 16 bit element.
+       */
+      total += __builtin_popcount (_mm256_movemask_epi8 (in)) / 2;
+   }
+
+   *done = j;
+   return total;
+}                               /* avx2_count_short */
+
+
+/*------------------------------------------------------------------------------
+ * SSE2 kernels - as per AVX2 kernels, but half the width.
+ */
+__attribute__ ((target ("sse2")))
+static unsigned long sse2_count_double (const double *values,
+                                        const unsigned long number,
+                                        const Bounds * bounds,
+                                        unsigned long *done)
+{
+   __m128d lower[MAXIMUM_INTERVALS];
+   __m128d upper[MAXIMUM_INTERVALS];
+   unsigned long total = 0;
+   unsigned long j;
+   unsigned int k;
+
+   for (k = 0; k < bounds->count; k++) {
+      lower[k] = _mm_set1_pd (bounds->lower.d[k]);
+      upper[k] = _mm_set1_pd (bounds->upper.d[k]);
+   }
+
+   for (j = 0; j + 2 <= number; j += 2) {
+      const __m128d x = _mm_loadu_pd (&values[j]);
+      __m128d in = _mm_setzero_pd ();
+      for (k = 0; k < bounds->count; k++) {
+         in = _mm_or_pd (in, _mm_and_pd (_mm_cmpge_pd (x, lower[k]),
+                                         _mm_cmple_pd (x, upper[k])));
+      }
+      total += __builtin_popcount (_mm_movemask_pd (in));
+   }
+
+   *done = j;
+   return total;
+}                               /* sse2_count_double */
+
+
+__attribute__ ((target ("sse2")))
+static unsigned long sse2_count_float (const float *values,
+                                       const unsigned long number,
+                                       const Bounds * bounds,
+                                       unsigned long *done)
+{
+   __m128 lower[MAXIMUM_INTERVALS];
+   __m128 upper[MAXIMUM_INTERVALS];
+   unsigned long total = 0;
+   unsigned long j;
+   unsigned int k;
+
+   for (k = 0; k < bounds->count; k++) {
+      lower[k] = _mm_set1_ps (bounds->lower.f[k]);
+      upper[k] = _mm_set1_ps (bounds->upper.f[k]);
+   }
+
+   for (j = 0; j + 4 <= number; j += 4) {
+      const __m128 x = _mm_loadu_ps (&values[j]);
+      __m128 in = _mm_setzero_ps ();
+      for (k = 0; k < bounds->count; k++) {
+         in = _mm_or_ps (in, _mm_and_ps (_mm_cmpge_ps (x, lower[k]),
+                                         _mm_cmple_ps (x, upper[k])));
+      }
+      total += __builtin_popcount (_mm_movemask_ps (in));
+   }
+
+   *done = j;
+   return total;
+}                               /* sse2_count_float */
+
+
+__attribute__ ((target ("sse2")))
+static unsigned long sse2_count_long (const epicsInt32 * values,
+                                      const unsigned long number,
+                                      const Bounds * bounds,
+                                      unsigned long *done)
+{
+   __m128i lower[MAXIMUM_INTERVALS];
+   __m128i upper[MAXIMUM_INTERVALS];
+   const __m128i ones = _mm_set1_epi32 (-1);
+   unsigned long total = 0;
+   unsigned long j;
+   unsigned int k;
+
+   for (k = 0; k < bounds->count; k++) {
+      lower[k] = _mm_set1_epi32 (bounds->lower.l[k]);
+      upper[k] = _mm_set1_epi32 (bounds->upper.l[k]);
+   }
+
+   for (j = 0; j + 4 <= number; j += 4) {
+      const __m128i x = _mm_loadu_si128 ((const __m128i *) &values[j]);
+      __m128i in = _mm_setzero_si128 ();
+      for (k = 0; k < bounds->count; k++) {
+         const __m128i out = _mm_or_si128 (_mm_cmpgt_epi32 (lower[k], x),
+                                           _mm_cmpgt_epi32 (x, upper[k]));
+         in = _mm_or_si128 (in, _mm_andnot_si128 (out, ones));
+      }
+      total += __builtin_popcount (_mm_movemask_ps (_mm_castsi128_ps (in)));
+   }
+
+   *done = j;
+   return total;
+}                               /* sse2_count_long */
+
+
+__attribute__ ((target ("sse2")))
+static unsigned long sse2_count_short (const epicsInt16 * values,
+                                       const unsigned long number,
+                                       const Bounds * bounds,
+                                       unsigned long *done)
+{
+   __m128i lower[MAXIMUM_INTERVALS];
+   __m128i upper[MAXIMUM_INTERVALS];
+   const __m128i ones = _mm_set1_epi16 (-1);
+   unsigned long total = 0;
+   unsigned long j;
+   unsigned int k;
+
+   for (k = 0; k < bounds->count; k++) {
+      lower[k] = _mm_set1_epi16 (bounds->lower.s[k]);
+      upper[k] = _mm_set1_epi16 (bounds->upper.s[k]);
+   }
+
+   for (j = 0; j + 8 <= number; j += 8) {
+      const __m128i x = _mm_loadu_si128 ((const __m128i *) &values[j]);
+      __m128i in = _mm_setzero_si128 ();
+      for (k = 0; k < bounds->count; k++) {
+         const __m128i out = _mm_or_si128 (_mm_cmpgt_epi16 (lower[k], x),
+                                           _mm_cmpgt_epi16 (x, upper[k]));
+         in = _mm_or_si128 (in, _mm_andnot_si128 (out, ones));
+      }
+      total += __builtin_popcount (_mm_movemask_epi8 (in)) / 2;
+   }
+
+   *done = j;
+   return total;
+}                               /* sse2_count_short */
+
+
+/*------------------------------------------------------------------------------
+ * Difference kernels. Each kernel compares whole vectors only and returns the
+ * offset of the first differing byte, or the offset of the first byte not
+ * compared if no difference found.
+ */
+__attribute__ ((target ("avx2")))
+static size_t avx2_next_difference (const epicsUInt8 * a,
+                                    const epicsUInt8 * b,
+                                    size_t from, const size_t size)
+{
+   unsigned int mask;
+
+   for (; from + 32 <= size; from += 32) {
+      mask = (unsigned int) _mm256_movemask_epi8
+          (_mm256_cmpeq_epi8 (_mm256_loadu_si256 ((const __m256i *) &a[from]),
+                              _mm256_loadu_si256 ((const __m256i *) &b[from])));
+      if (mask != 0xFFFFFFFFu) {
+         return from + __builtin_ctz (~mask);
+      }
+   }
+   return from;
+}                               /* avx2_next_difference */
+
+
+__attribute__ ((target ("sse2")))
+static size_t sse2_next_difference (const epicsUInt8 * a,
+                                    const epicsUInt8 * b,
+                                    size_t from, const size_t size)
+{
+   unsigned int mask;
+
+   for (; from + 16 <= size; from += 16) {
+      mask = (unsigned int) _mm_movemask_epi8
+          (_mm_cmpeq_epi8 (_mm_loadu_si128 ((const __m128i *) &a[from]),
+                           _mm_loadu_si128 ((const __m128i *) &b[from])));
+      if (mask != 0xFFFFu) {
+         return from + __builtin_ctz (~mask);
+      }
+   }
+   return from;
+}                               /* sse2_next_difference */
+
+#endif                          /* USE_X86_KERNELS */
+
+
+/*------------------------------------------------------------------------------
+ * Selects SIMD kernel (if any) for given type, followed by scalar kernel for
+ * the remaining elements.
+ */
+#if USE_X86_KERNELS
+#define SIMD_COUNT(avx2_kernel, sse2_kernel, values) {                      \
+   if (kernel_kind == kkAVX2) {                                             \
+      total = avx2_kernel (values, number, &bounds, &done);                 \
+   } else if (kernel_kind == kkSSE2) {                                      \
+      total = sse2_kernel (values, number, &bounds, &done);                 \
+   }                                                                        \
+}
+#else
+#define SIMD_COUNT(avx2_kernel, sse2_kernel, values)  { }
+#endif
+
+
+/*------------------------------------------------------------------------------
+ * PUBLIC FUNCTIONS
+ *------------------------------------------------------------------------------
+ */
+bool Interval_Set_Add (Interval_Set * set, const double lower,
+                       const double upper)
+{
+   if (set->count >= MAXIMUM_INTERVALS) {
+      return false;
+   }
+   set->item[set->count].lower = lower;
+   set->item[set->count].upper = upper;
+   set->count++;
+   return true;
+}                               /* Interval_Set_Add */
+
+
+/*------------------------------------------------------------------------------
+ */
+unsigned long Array_Count_In (const Interval_Set * set,
+                              const short field_type, const void *values,
+                              const unsigned long number)
+{
+   Bounds bounds;
+   unsigned long total = 0;
+   unsigned long done = 0;
+
+   if (kernel_kind == kkUnknown) {
+      kernel_kind = select_kernel_kind ();
+   }
+
+   make_bounds (set, field_type, &bounds);
+   if (bounds.count == 0) {
+      return 0;
+   }
+
+   switch (field_type) {
+
+      case DBF_DOUBLE:{
+            const double *v = (const double *) values;
+            SIMD_COUNT (avx2_count_double, sse2_count_double, v);
+            SCALAR_COUNT (v, d, done, number, (&bounds), total);
+         }
+         break;
+
+      case DBF_FLOAT:{
+            const float *v = (const float *) values;
+            SIMD_COUNT (avx2_count_float, sse2_count_float, v);
+            SCALAR_COUNT (v, f, done, number, (&bounds), total);
+         }
+         break;
+
+      case DBF_LONG:{
+            const epicsInt32 *v = (const epicsInt32 *) values;
+            SIMD_COUNT (avx2_count_long, sse2_count_long, v);
+            SCALAR_COUNT (v, l, done, number, (&bounds), total);
+         }
+         break;
+
+      case DBF_SHORT:{
+            const epicsInt16 *v = (const epicsInt16 *) values;
+            SIMD_COUNT (avx2_count_short, sse2_count_short, v);
+            SCALAR_COUNT (v, s, done, number, (&bounds), total);
+         }
+         break;
+
+      case DBF_ENUM:{
+            const epicsUInt16 *v = (const epicsUInt16 *) values;
+            SCALAR_COUNT (v, e, done, number, (&bounds), total);
+         }
+         break;
+
+      case DBF_CHAR:{
+            const epicsUInt8 *v = (const epicsUInt8 *) values;
+            SCALAR_COUNT (v, c, done, number, (&bounds), total);
+         }
+         break;
+
+      default:
+         total = 0;
+         break;
+   }
+
+   return total;
+}                               /* Array_Count_In */
+
+
+/*------------------------------------------------------------------------------
+ */
+size_t Array_Next_Difference (const void *previous, const void *current,
+                              size_t from, const size_t size)
+{
+   const epicsUInt8 *a = (const epicsUInt8 *) previous;
+   const epicsUInt8 *b = (const epicsUInt8 *) current;
+
+   if (kernel_kind == kkUnknown) {
+      kernel_kind = select_kernel_kind ();
+   }
+
+#if USE_X86_KERNELS
+   if (kernel_kind == kkAVX2) {
+      from = avx2_next_difference (a, b, from, size);
+   } else if (kernel_kind == kkSSE2) {
+      from = sse2_next_difference (a, b, from, size);
+   }
+#endif
+
+   /* Any difference within the last vector (or for a scalar host)
+    */
+   if ((from < size) && (a[from] == b[from])) {
+      for (from++; from < size; from++) {
+         if (a[from] != b[from]) {
+            break;
+         }
+      }
+   }
+   return from;
+}                               /* Array_Next_Difference */
+
+
+/*------------------------------------------------------------------------------
+ */
+const char *Array_Kernels_Image ()
+{
+   if (kernel_kind == kkUnknown) {
+      kernel_kind = select_kernel_kind ();
+   }
+
+   switch (kernel_kind) {
+      case kkAVX2:
+         return "AVX2";
+      case kkSSE2:
+         return "SSE2";
+      default:
+         return "scalar";
+   }
+}                               /* Array_Kernels_Image */
+
+/* end */
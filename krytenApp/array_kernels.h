@@ -0,0 +1,84 @@
+/* array_kernels.h
+ *
+ * Kryten is a EPICS PV monitoring program that calls a system command
+ * when the value of the PV matches/cease to match specified criteria.
+ *
+ * Copyright (C) 2011-2021  Andrew C. Starritt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact details:
+ * andrew.starritt@gmail.com
+ * PO Box 3118, Prahran East, Victoria 3181, Australia.
+ *
+ * Source code formatting:
+ * indent options:  -kr -pcs -i3 -cli3 -nbbo -nut
+ *
+ */
+
+#ifndef ARRAY_KERNELS_H_
+#define ARRAY_KERNELS_H_
+
+#include <stddef.h>
+
+#include "kryten.h"
+
+/* Upper limit on the number of intervals in an interval set. A /= match item
+ * requires two intervals, all other match items require one.
+ */
+#define MAXIMUM_INTERVALS   40
+
+/* Closed interval, i.e. lower <= x <= upper. Open and half open intervals,
+ * e.g. as needed for x > 5.0, are represented using the next/previous
+ * representable value.
+ */
+typedef struct sInterval {
+   double lower;
+   double upper;
+} Interval;
+
+typedef struct sInterval_Set {
+   unsigned int count;
+   Interval item[MAXIMUM_INTERVALS];
+} Interval_Set;
+
+/* Adds an interval to the set - returns false if the set is full.
+ */
+bool Interval_Set_Add (Interval_Set * set, const double lower,
+                       const double upper);
+
+/* Counts the number of array elements within any of the intervals.
+ * The field_type is the basic DBF_xxx (or equivalently DBR_xxx) type of the
+ * values, i.e. as received from Channel Access. DBF_STRING is not supported.
+ *
+ * The count is performed directly on the buffer as received, using SIMD
+ * kernels (AVX2 or SSE2 as supported by the host processor) for float,
+ * double, long and short types, and scalar code otherwise.
+ */
+unsigned long Array_Count_In (const Interval_Set * set,
+                              const short field_type, const void *values,
+                              const unsigned long number);
+
+/* Compares two buffers of size bytes starting from byte offset from, and
+ * returns the offset of the first byte that differs, or size if there are no
+ * differences. The comparison uses the same SIMD selection as Array_Count_In.
+ */
+size_t Array_Next_Difference (const void *previous, const void *current,
+                              size_t from, const size_t size);
+
+/* Returns a description of the kernels selected for this host.
+ */
+const char *Array_Kernels_Image ();
+
+#endif                          /* ARRAY_KERNELS_H_ */
@@ -48,9 +48,11 @@
 #include <cadef.h>
 #include <caerr.h>
 #include <ellLib.h>
+#include <epicsEvent.h>
 #include <epicsMutex.h>
 
 #include "buffered_callbacks.h"
+#include "utilities.h"
 
 /* These functions must be exported by the main application.
  *
@@ -63,6 +65,13 @@ extern void application_event_handler (struct event_handler_args *ptr);
 
 extern void application_printf_handler (char *formatted_text);
 
+extern int application_priority_handler (chid channel_id);
+
+extern int application_queue_handler (chid channel_id);
+
+extern void application_dispatch_handler (const int queue,
+                                          const double latency);
+
 
 /* -----------------------------------------------------------------------------
  * PRIVATE - implementation details
@@ -75,27 +84,46 @@ typedef enum Callback_Kinds {
    NULL_KIND,
    CONNECTION,
    EVENT,
-   PRINTF
+   PRINTF,
+   CALL
 } Callback_Kinds;
 
 
 typedef struct Callback_Items {
    ELLNODE ellnode;
    Callback_Kinds kind;
+   int priority;
+   int queue;
 
    /* perhaps we could use a union here
     */
    struct connection_handler_args cargs;
    struct event_handler_args eargs;
    char *formatted_text;
+   Buffered_Call_Function function;
+   void *arg;
+   chid call_chid;              /* the channel a call is routed by */
+   double loaded_time;          /* monotonic time, when queued */
 } Callback_Items;
 
 
+/* Each queue has its own mutex, and an event signaled when an item is
+ * loaded, and holds one linked list per priority. No list above highest is
+ * loaded, so unloading need not scan the empty higher priority lists.
+ */
+typedef struct Callback_Queues {
+   epicsMutexId mutex;
+   epicsEventId loaded;
+   int highest;                 /* CA_PRIORITY_MIN - 1 when all empty */
+   ELLLIST linked_lists[CA_PRIORITY_MAX + 1];
+} Callback_Queues;
+
+
 /*------------------------------------------------------------------------------
  * Module data
  */
-static epicsMutexId linked_list_mutex = NULL;
-static ELLLIST linked_list = ELLLIST_INIT;
+static Callback_Queues *queues = NULL;
+static int number_queues = 0;
 static unsigned long allocate_fail_count = 0;
 
 
@@ -109,10 +137,14 @@ static Callback_Items *allocate_element (const Callback_Kinds kind)
    pci = (Callback_Items *) malloc (sizeof (Callback_Items));
    if (pci) {
       pci->kind = kind;
+      pci->priority = CA_PRIORITY_MIN;
+      pci->queue = 0;
       /* Just do all pointers irrespective of kind
        */
       pci->eargs.dbr = NULL;
       pci->formatted_text = NULL;
+      pci->function = NULL;
+      pci->arg = NULL;
    } else {
       /* Technically we should protect this with a mutex, but only used
        * as diagnostic so do not have to be that strict.
@@ -132,6 +164,7 @@ static void free_element (Callback_Items * pci)
    switch (pci->kind) {
 
       case CONNECTION:
+      case CALL:
          /* No special action */
          break;
 
@@ -159,38 +192,78 @@ static void free_element (Callback_Items * pci)
 }                               /* free_element */
 
 
+/*------------------------------------------------------------------------------
+ * Sets the item's priority and queue, as per the channel's Channel Access
+ * priority and the application's queue for the channel.
+ */
+static void set_route (Callback_Items * pci, chid channel_id)
+{
+   int priority;
+   int queue;
+
+   priority = application_priority_handler (channel_id);
+   if ((priority >= CA_PRIORITY_MIN) && (priority <= CA_PRIORITY_MAX)) {
+      pci->priority = priority;
+   }
+
+   queue = application_queue_handler (channel_id);
+   if ((queue >= 0) && (queue < number_queues)) {
+      pci->queue = queue;
+   }
+}                               /* set_route */
+
+
 /*------------------------------------------------------------------------------
  */
 static void load_element (Callback_Items * pci)
 {
+   Callback_Queues *q = &queues[pci->queue];
+
+   pci->loaded_time = monotonic_time ();
+
    /* Gain exclusive access to linked list
     */
-   epicsMutexLock (linked_list_mutex);
+   epicsMutexLock (q->mutex);
 
-   ellAdd (&linked_list, (ELLNODE *) pci);
+   ellAdd (&q->linked_lists[pci->priority], (ELLNODE *) pci);
+   if (pci->priority > q->highest) {
+      q->highest = pci->priority;
+   }
 
    /* Release exclusive access to linked list
     */
-   epicsMutexUnlock (linked_list_mutex);
+   epicsMutexUnlock (q->mutex);
+
+   epicsEventSignal (q->loaded);
 }                               /* load_element */
 
 
 /*------------------------------------------------------------------------------
- * unload - is NULL if nothing in the list.
+ * unload - is NULL if nothing in the lists. Items are unloaded in priority
+ * order, highest first, and in arrival order within each priority.
  */
-static Callback_Items *unload_element ()
+static Callback_Items *unload_element (const int queue)
 {
-   Callback_Items *result;
+   Callback_Queues *q = &queues[queue];
+   Callback_Items *result = NULL;
 
    /* Gain exclusive access to linked list
     */
-   epicsMutexLock (linked_list_mutex);
+   epicsMutexLock (q->mutex);
 
-   result = (Callback_Items *) ellGet (&linked_list);
+   /* Lower highest past any lists emptied since it was last raised.
+    */
+   while ((q->highest >= CA_PRIORITY_MIN) &&
+          (ellCount (&q->linked_lists[q->highest]) == 0)) {
+      q->highest--;
+   }
+   if (q->highest >= CA_PRIORITY_MIN) {
+      result = (Callback_Items *) ellGet (&q->linked_lists[q->highest]);
+   }
 
    /* Release exclusive access to linked list
     */
-   epicsMutexUnlock (linked_list_mutex);
+   epicsMutexUnlock (q->mutex);
 
    return result;
 }                               /* unload_element */
@@ -208,6 +281,7 @@ void buffered_connection_handler (struct connection_handler_args args)
 
       /* Copy all fields. */
       pci->cargs = args;
+      set_route (pci, args.chid);
 
       load_element (pci);
    }
@@ -227,6 +301,7 @@ void buffered_event_handler (struct event_handler_args args)
 
       /* Copy all fields. */
       pci->eargs = args;
+      set_route (pci, args.chid);
 
       /* Calculate size of dbr field, and alloc memory for copy iff required
        */
@@ -278,12 +353,52 @@ int buffered_printf_handler (const char *pformat, va_list args)
 
 
 /*------------------------------------------------------------------------------
+ * Queues a function call, routed as per the channel's callbacks.
  */
-void initialise_buffered_callbacks ()
+void buffered_call (chid channel_id, Buffered_Call_Function function,
+                    void *arg)
+{
+   Callback_Items *pci;
+
+   pci = allocate_element (CALL);
+   if (pci) {
+      pci->function = function;
+      pci->arg = arg;
+      pci->call_chid = channel_id;
+      set_route (pci, channel_id);
+
+      load_element (pci);
+   }
+}                               /* buffered_call */
+
+
+/*------------------------------------------------------------------------------
+ */
+void initialise_buffered_callback_queues (const int number)
 {
-   linked_list_mutex = epicsMutexCreate ();
-   ellInit (&linked_list);
+   int j;
+   int p;
+
+   number_queues = (number > 1) ? number : 1;
+   queues = (Callback_Queues *) calloc (number_queues, sizeof (Callback_Queues));
+
+   for (j = 0; j < number_queues; j++) {
+      queues[j].mutex = epicsMutexCreate ();
+      queues[j].loaded = epicsEventCreate (epicsEventEmpty);
+      queues[j].highest = CA_PRIORITY_MIN - 1;
+      for (p = CA_PRIORITY_MIN; p <= CA_PRIORITY_MAX; p++) {
+         ellInit (&queues[j].linked_lists[p]);
+      }
+   }
    allocate_fail_count = 0;
+}                               /* initialise_buffered_callback_queues */
+
+
+/*------------------------------------------------------------------------------
+ */
+void initialise_buffered_callbacks ()
+{
+   initialise_buffered_callback_queues (1);
 }                               /* initialise_buffered_callbacks */
 
 
@@ -292,15 +407,48 @@ void initialise_buffered_callbacks ()
 int number_of_buffered_callbacks ()
 {
    int n;
-   n = ellCount (&linked_list);
+   int j;
+   int p;
+
+   n = 0;
+   for (j = 0; j < number_queues; j++) {
+      for (p = CA_PRIORITY_MIN; p <= CA_PRIORITY_MAX; p++) {
+         n += ellCount (&queues[j].linked_lists[p]);
+      }
+   }
    return n;
 }                               /* number_of_buffered_callbacks */
 
 
 /*------------------------------------------------------------------------------
- * Process callbacks - called from application thread.
  */
-int process_buffered_callbacks (const int max)
+int number_of_buffered_callback_queues ()
+{
+   return number_queues;
+}                               /* number_of_buffered_callback_queues */
+
+
+/*------------------------------------------------------------------------------
+ */
+int number_of_buffered_callbacks_on_queue (const int queue)
+{
+   int n;
+   int p;
+
+   n = 0;
+   if ((queue >= 0) && (queue < number_queues)) {
+      for (p = CA_PRIORITY_MIN; p <= CA_PRIORITY_MAX; p++) {
+         n += ellCount (&queues[queue].linked_lists[p]);
+      }
+   }
+   return n;
+}                               /* number_of_buffered_callbacks_on_queue */
+
+
+/*------------------------------------------------------------------------------
+ * Process callbacks on the given queue - called from application thread.
+ */
+int process_buffered_callback_queue (const int queue, const int max)
 {
    Callback_Items *pci;
    int n;
@@ -314,11 +462,14 @@ int process_buffered_callbacks (const int max)
    n = 0;
    while (1) {
 
-      pci = unload_element ();
+      pci = unload_element (queue);
       if (pci == NULL) {
          break;
       }
 
+      application_dispatch_handler (queue,
+                                    monotonic_time () - pci->loaded_time);
+
       switch (pci->kind) {
 
          case CONNECTION:
@@ -333,6 +484,10 @@ int process_buffered_callbacks (const int max)
             application_printf_handler (pci->formatted_text);
             break;
 
+         case CALL:
+            pci->function (pci->arg);
+            break;
+
          default:
             fprintf (stderr, "*** %s: Unexpected callback kind: %d \n",
                      __FUNCTION__, pci->kind);
@@ -353,21 +508,89 @@ int process_buffered_callbacks (const int max)
    }                            /* end loop */
 
    return n;
+}                               /* process_buffered_callback_queue */
+
+
+/*------------------------------------------------------------------------------
+ * Process callbacks - called from application thread.
+ */
+int process_buffered_callbacks (const int max)
+{
+   return process_buffered_callback_queue (0, max);
 }                               /* process_buffered_callbacks */
 
 
+/*------------------------------------------------------------------------------
+ * Waits until an item is loaded onto the queue, or the timeout expires.
+ */
+void wait_buffered_callbacks (const int queue, const double timeout)
+{
+   (void) epicsEventWaitWithTimeout (queues[queue].loaded, timeout);
+}                               /* wait_buffered_callbacks */
+
+
+/*------------------------------------------------------------------------------
+ * Wakes up any thread waiting on the queue.
+ */
+void wake_buffered_callbacks (const int queue)
+{
+   epicsEventSignal (queues[queue].loaded);
+}                               /* wake_buffered_callbacks */
+
+
 /*------------------------------------------------------------------------------
  * Discard all outstanding callbacks - called from application thread.
  */
 void clear_all_buffered_callbacks ()
 {
    Callback_Items *pci;
+   int j;
 
-   pci = unload_element ();      /* Get first if it exists */
-   while (pci != NULL) {
-      free_element (pci);        /* Free element */
-      pci = unload_element ();   /* Get next if exists */
+   for (j = 0; j < number_queues; j++) {
+      pci = unload_element (j);  /* Get first if it exists */
+      while (pci != NULL) {
+         free_element (pci);     /* Free element */
+         pci = unload_element (j);       /* Get next if exists */
+      }
    }
 }
 
+
+/*------------------------------------------------------------------------------
+ * Discard outstanding callbacks, and calls, for a cleared channel - called from
+ * application thread. The channel id is only compared, never dereferenced.
+ */
+int discard_buffered_callbacks (const chid channel_id)
+{
+   Callback_Items *pci;
+   Callback_Items *next;
+   int n;
+   int j;
+   int p;
+
+   n = 0;
+   for (j = 0; j < number_queues; j++) {
+      epicsMutexLock (queues[j].mutex);
+
+      for (p = CA_PRIORITY_MIN; p <= CA_PRIORITY_MAX; p++) {
+         pci = (Callback_Items *) ellFirst (&queues[j].linked_lists[p]);
+         while (pci != NULL) {
+            next = (Callback_Items *) ellNext ((ELLNODE *) pci);
+            if (((pci->kind == CONNECTION) && (pci->cargs.chid == channel_id))
+                || ((pci->kind == EVENT) && (pci->eargs.chid == channel_id))
+                || ((pci->kind == CALL) && (pci->call_chid == channel_id))) {
+               ellDelete (&queues[j].linked_lists[p], (ELLNODE *) pci);
+               free_element (pci);
+               n++;
+            }
+            pci = next;
+         }
+      }
+
+      epicsMutexUnlock (queues[j].mutex);
+   }
+
+   return n;
+}                               /* discard_buffered_callbacks */
+
 /* end */
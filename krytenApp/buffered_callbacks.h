@@ -44,14 +44,32 @@
  * the queue and calls application_xxx_handler, where xxx is one of connection
  * event or printf. The queue is mutex protected.
  *
+ * The queue is ordered by priority, highest first, and by arrival within each
+ * priority. The priority of connection and event callbacks is obtained from
+ * application_priority_handler, which is called from the Channel Access
+ * thread and which should return the channel's Channel Access priority, i.e.
+ * CA_PRIORITY_MIN to CA_PRIORITY_MAX. Printf callbacks have the lowest
+ * priority.
+ *
+ * There may be more than one queue, e.g. one per application thread. The
+ * queue used for a channel's connection and event callbacks is obtained from
+ * application_queue_handler, also called from the Channel Access thread.
+ * Printf callbacks are always placed on queue 0.
+ *
+ * Just before each item is processed, application_dispatch_handler is called,
+ * from the processing thread, with the queue and the time in seconds since
+ * the item was placed on the queue, i.e. the dispatch latency.
+ *
  * NOTE: There is ONE queue. If the application is running multiple contexts,
  * then the application_xxx_handler functions must manage the re-direct the
  * response to the appropriate context.
  *
- * The application_connection_handler, the application_event_handler and the
- * application_printf_handler functions must be declared in the user program
- * and made available to the "C" world. These are searched for at link time as
- * opposed to being dynamically registered at run time.
+ * The application_connection_handler, the application_event_handler, the
+ * application_printf_handler, the application_priority_handler, the
+ * application_queue_handler and the application_dispatch_handler functions
+ * must be declared in the user program and made available to the "C" world.
+ * These are searched for at link time as opposed to being dynamically
+ * registered at run time.
  *
  * Examples:
  * ---------------------------------------------------------------------------
@@ -78,11 +96,17 @@
  *       void application_connection_handler (struct connection_handler_args *args);
  *       void application_event_handler (struct event_handler_args *args);
  *       void application_printf_handler (char *formated_text);
+ *       int application_priority_handler (chid channel_id);
+ *       int application_queue_handler (chid channel_id);
+ *       void application_dispatch_handler (const int queue, const double latency);
  *    }
  *
  *    void application_connection_handler (struct connection_handler_args *args) { .... }
  *    void application_event_handler (struct event_handler_args *args) { .... }
  *    void application_printf_handler (char *formated_text) { .... }
+ *    int application_priority_handler (chid channel_id) { .... }
+ *    int application_queue_handler (chid channel_id) { .... }
+ *    void application_dispatch_handler (const int queue, const double latency) { .... }
  *
  * ---------------------------------------------------------------------------
  *
@@ -121,10 +145,20 @@ int  buffered_printf_handler (const char *pformat, va_list args);
  */
 void initialise_buffered_callbacks ();
 
+/* As above, but creates number queues, i.e. 0 to number - 1.
+ */
+void initialise_buffered_callback_queues (const int number);
+
 /* Returns number of currently outstanding buffered callbacks
  */
 int number_of_buffered_callbacks ();
 
+/* Returns the number of queues, and the number of outstanding buffered
+ * callbacks on the given queue.
+ */
+int number_of_buffered_callback_queues ();
+int number_of_buffered_callbacks_on_queue (const int queue);
+
 /* This function should be called regularly - say every 10-50 mSeconds.
  * It process a maximum of max buffered items. It returns the actual
  * number of callbacks processed (<= max).
@@ -133,12 +167,38 @@ int number_of_buffered_callbacks ();
  */
 int process_buffered_callbacks (const int max);
 
+/* As above, but processes the given queue. process_buffered_callbacks
+ * processes queue 0.
+ */
+int process_buffered_callback_queue (const int queue, const int max);
+
+/* Waits until a callback is placed on the queue, or the timeout (seconds)
+ * expires. wake_buffered_callbacks wakes up any waiting thread.
+ */
+void wait_buffered_callbacks (const int queue, const double timeout);
+void wake_buffered_callbacks (const int queue);
+
+/* Queues a call of function (arg), routed to the same queue and priority as
+ * the channel's callbacks, and hence processed in order with respect to them.
+ */
+typedef void (*Buffered_Call_Function) (void *arg);
+
+void buffered_call (chid channel_id, Buffered_Call_Function function,
+                    void *arg);
+
 /* This function should be called after Channel Accces no longer required and
  * the EPICS context has been destroyed. It discards and free the memory
  * associated with all outstanding buffered callbacks.
  */
 void clear_all_buffered_callbacks ();
 
+/* This function should be called after a channel has been cleared. It discards
+ * any outstanding buffered connection and event callbacks, and calls, for the
+ * channel, as the channel id is no longer valid. Returns the number of
+ * callbacks discarded.
+ */
+int discard_buffered_callbacks (const chid channel_id);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,635 @@
+/* control.c
+ *
+ * Kryten is a EPICS PV monitoring program that calls a system command
+ * when the value of the PV matches/cease to match specified criteria.
+ *
+ * Copyright (C) 2011-2021  Andrew C. Starritt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact details:
+ * andrew.starritt@gmail.com
+ * PO Box 3118, Prahran East, Victoria 3181, Australia.
+ *
+ * Source code formatting:
+ * indent options:  -kr -pcs -i3 -cli3 -nbbo -nut
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <cantProceed.h>
+#include <ellLib.h>
+#include <epicsEvent.h>
+#include <epicsMutex.h>
+#include <epicsString.h>
+#include <epicsThread.h>
+
+#include "control.h"
+#include "utilities.h"
+
+#define MAXIMUM_LINE_LENGTH    4096
+#define MAXIMUM_PENDING       20000     /* stop reading when reached */
+
+typedef struct sText_Buffer {
+   char *text;
+   size_t length;
+   size_t capacity;
+} Text_Buffer;
+
+struct sControl_Request {
+   ELLNODE node;
+   int connection;
+   unsigned int generation;
+   char *line;
+   Text_Buffer reply;
+};
+
+typedef struct sControl_Connection {
+   int fd;                      /* -1 when not in use */
+   unsigned int generation;     /* distinguishes successive uses of the slot */
+   Text_Buffer input;           /* partial request line */
+   Text_Buffer output;          /* replies not yet sent */
+   bool is_overlong;            /* discarding the rest of an overlong line */
+   bool is_closing;             /* end of input, closes once replies sent */
+   int outstanding;             /* requests queued but not yet replied to */
+} Control_Connection;
+
+static Control_Connection connections[MAXIMUM_CONTROL_CONNECTIONS];
+static ELLLIST pending = ELLLIST_INIT;
+
+/* Protects the pending list, and each connection's fd, generation, output
+ * and outstanding count.
+ */
+static epicsMutexId control_mutex = NULL;
+static epicsEventId done = NULL;
+
+static int listen_fd = -1;
+static int wake_fds[2] = { -1, -1 };    /* wakes the control thread */
+static char *socket_path = NULL;
+static volatile bool stop_requested = false;
+static bool is_started = false;
+
+
+/*------------------------------------------------------------------------------
+ * Appends text to the buffer, enlarging the buffer as required.
+ */
+static void Text_Append (Text_Buffer * buffer, const char *text,
+                         const size_t length)
+{
+   char *enlarged;
+   size_t capacity;
+
+   if (length == 0) {
+      return;
+   }
+
+   if (buffer->length + length + 1 > buffer->capacity) {
+      capacity = MAX (256, 2 * (buffer->length + length + 1));
+      enlarged = (char *) callocMustSucceed (capacity, 1, "Text_Append");
+      if (buffer->length > 0) {
+         memcpy (enlarged, buffer->text, buffer->length);
+      }
+      free (buffer->text);
+      buffer->text = enlarged;
+      buffer->capacity = capacity;
+   }
+
+   memcpy (buffer->text + buffer->length, text, length);
+   buffer->length += length;
+   buffer->text[buffer->length] = '\0';
+}                               /* Text_Append */
+
+
+/*------------------------------------------------------------------------------
+ * Removes the first length characters from the buffer.
+ */
+static void Text_Consume (Text_Buffer * buffer, const size_t length)
+{
+   if (length >= buffer->length) {
+      buffer->length = 0;
+   } else {
+      memmove (buffer->text, buffer->text + length, buffer->length - length);
+      buffer->length -= length;
+   }
+}                               /* Text_Consume */
+
+
+/*------------------------------------------------------------------------------
+ */
+static void Text_Free (Text_Buffer * buffer)
+{
+   free (buffer->text);
+   buffer->text = NULL;
+   buffer->length = 0;
+   buffer->capacity = 0;
+}                               /* Text_Free */
+
+
+/*------------------------------------------------------------------------------
+ */
+static void Free_Request (Control_Request * request)
+{
+   free (request->line);
+   Text_Free (&request->reply);
+   free (request);
+}                               /* Free_Request */
+
+
+/*------------------------------------------------------------------------------
+ */
+static void Wake_Control_Thread ()
+{
+   const char wake = 0;
+
+   (void) write (wake_fds[1], &wake, 1);
+}                               /* Wake_Control_Thread */
+
+
+/*------------------------------------------------------------------------------
+ */
+static void Set_Non_Blocking (const int fd)
+{
+   (void) fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) | O_NONBLOCK);
+}                               /* Set_Non_Blocking */
+
+
+/*------------------------------------------------------------------------------
+ */
+static void Close_Connection (const int j)
+{
+   Control_Connection *connection = &connections[j];
+
+   epicsMutexLock (control_mutex);
+   close (connection->fd);
+   connection->fd = -1;
+   connection->generation++;
+   connection->is_overlong = false;
+   connection->is_closing = false;
+   connection->outstanding = 0;
+   Text_Free (&connection->input);
+   Text_Free (&connection->output);
+   epicsMutexUnlock (control_mutex);
+}                               /* Close_Connection */
+
+
+/*------------------------------------------------------------------------------
+ */
+static void Accept_Connection ()
+{
+   const char *refusal = "error too many connections\n";
+   int fd;
+   int j;
+
+   fd = accept (listen_fd, NULL, NULL);
+   if (fd < 0) {
+      return;
+   }
+
+   for (j = 0; j < MAXIMUM_CONTROL_CONNECTIONS; j++) {
+      if (connections[j].fd < 0) {
+         break;
+      }
+   }
+
+   if (j >= MAXIMUM_CONTROL_CONNECTIONS) {
+      (void) send (fd, refusal, strlen (refusal), MSG_NOSIGNAL);
+      close (fd);
+      return;
+   }
+
+   Set_Non_Blocking (fd);
+   epicsMutexLock (control_mutex);
+   connections[j].fd = fd;
+   epicsMutexUnlock (control_mutex);
+}                               /* Accept_Connection */
+
+
+/*------------------------------------------------------------------------------
+ * Queues a request line for processing by the application.
+ */
+static void Queue_Request (const int j, const char *line, const size_t length)
+{
+   Control_Request *request;
+
+   request = (Control_Request *) callocMustSucceed
+       (1, sizeof (Control_Request), "Queue_Request");
+   request->connection = j;
+   request->line = (char *) callocMustSucceed (length + 1, 1, "Queue_Request");
+   memcpy (request->line, line, length);
+
+   epicsMutexLock (control_mutex);
+   request->generation = connections[j].generation;
+   connections[j].outstanding++;
+   ellAdd (&pending, (ELLNODE *) request);
+   epicsMutexUnlock (control_mutex);
+}                               /* Queue_Request */
+
+
+/*------------------------------------------------------------------------------
+ * Reads the available data, and queues each complete, non empty, line.
+ */
+static void Read_Connection (const int j)
+{
+   const char *overlong = "error line too long\n";
+   Control_Connection *connection = &connections[j];
+   Text_Buffer *input = &connection->input;
+   char data[4096];
+   ssize_t number;
+   size_t start;
+   size_t end;
+   size_t p;
+
+   number = read (connection->fd, data, sizeof (data));
+   if (number == 0) {
+      /* The client may have only shut down its side, so replies to any
+       * outstanding requests are still sent.
+       */
+      connection->is_closing = true;
+      return;
+   }
+   if (number < 0) {
+      if ((errno != EAGAIN) && (errno != EINTR)) {
+         Close_Connection (j);
+      }
+      return;
+   }
+
+   Text_Append (input, data, number);
+
+   start = 0;
+   for (p = 0; p < input->length; p++) {
+      if (input->text[p] != '\n') {
+         continue;
+      }
+
+      end = p;
+      if ((end > start) && (input->text[end - 1] == '\r')) {
+         end--;
+      }
+
+      if (connection->is_overlong) {
+         connection->is_overlong = false;
+         epicsMutexLock (control_mutex);
+         Text_Append (&connection->output, overlong, strlen (overlong));
+         epicsMutexUnlock (control_mutex);
+      } else if (end > start) {
+         Queue_Request (j, input->text + start, end - start);
+      }
+      start = p + 1;
+   }
+   Text_Consume (input, start);
+
+   if (input->length > MAXIMUM_LINE_LENGTH) {
+      connection->is_overlong = true;
+      Text_Consume (input, input->length);
+   }
+}                               /* Read_Connection */
+
+
+/*------------------------------------------------------------------------------
+ * Sends as much of the outstanding reply text as possible.
+ */
+static void Write_Connection (const int j)
+{
+   Control_Connection *connection = &connections[j];
+   ssize_t number;
+   bool is_failed = false;
+
+   epicsMutexLock (control_mutex);
+   number = send (connection->fd, connection->output.text,
+                  connection->output.length, MSG_NOSIGNAL);
+   if (number > 0) {
+      Text_Consume (&connection->output, number);
+   } else if ((number < 0) && (errno != EAGAIN) && (errno != EINTR)) {
+      is_failed = true;
+   }
+   epicsMutexUnlock (control_mutex);
+
+   if (is_failed) {
+      Close_Connection (j);
+   }
+}                               /* Write_Connection */
+
+
+/*------------------------------------------------------------------------------
+ */
+static void Control_Thread (void *arg)
+{
+   struct pollfd fds[MAXIMUM_CONTROL_CONNECTIONS + 2];
+   int slot[MAXIMUM_CONTROL_CONNECTIONS + 2];
+   char discard[64];
+   bool is_full;
+   int number;
+   int j;
+   int k;
+
+   while (!stop_requested) {
+      number = 0;
+      fds[number].fd = wake_fds[0];
+      fds[number].events = POLLIN;
+      slot[number++] = -1;
+      fds[number].fd = listen_fd;
+      fds[number].events = POLLIN;
+      slot[number++] = -1;
+
+      /* Stop reading requests while the application catches up.
+       */
+      epicsMutexLock (control_mutex);
+      is_full = (ellCount (&pending) >= MAXIMUM_PENDING);
+      for (j = 0; j < MAXIMUM_CONTROL_CONNECTIONS; j++) {
+         if (connections[j].fd < 0) {
+            continue;
+         }
+         if (connections[j].is_closing &&
+             (connections[j].outstanding == 0) &&
+             (connections[j].output.length == 0)) {
+            epicsMutexUnlock (control_mutex);
+            Close_Connection (j);
+            epicsMutexLock (control_mutex);
+            continue;
+         }
+         fds[number].fd = connections[j].fd;
+         fds[number].events =
+             ((is_full || connections[j].is_closing) ? 0 : POLLIN) |
+             (connections[j].output.length > 0 ? POLLOUT : 0);
+         slot[number++] = j;
+      }
+      epicsMutexUnlock (control_mutex);
+
+      if (poll (fds, number, 200) <= 0) {
+         continue;
+      }
+
+      if (fds[0].revents & POLLIN) {
+         while (read (wake_fds[0], discard, sizeof (discard)) > 0) {
+            /* more to discard */
+         }
+      }
+
+      if (fds[1].revents & POLLIN) {
+         Accept_Connection ();
+      }
+
+      for (k = 2; k < number; k++) {
+         j = slot[k];
+         if ((fds[k].revents & POLLOUT) && (connections[j].fd >= 0)) {
+            Write_Connection (j);
+         }
+         if ((fds[k].revents & POLLIN) && (connections[j].fd >= 0)) {
+            Read_Connection (j);
+         } else if ((fds[k].revents & (POLLHUP | POLLERR)) &&
+                    (connections[j].fd >= 0) &&
+                    !(fds[k].revents & POLLOUT)) {
+            /* Closed by the client, and nothing more can be sent.
+             */
+            Close_Connection (j);
+         }
+      }
+   }
+
+   epicsEventSignal (done);
+}                               /* Control_Thread */
+
+
+/*------------------------------------------------------------------------------
+ * PUBLIC FUNCTIONS
+ *------------------------------------------------------------------------------
+ */
+bool Control_Start (const char *path)
+{
+   struct sockaddr_un address;
+   struct stat info;
+   mode_t old_mask;
+   int status;
+   int j;
+
+   if (strlen (path) >= sizeof (address.sun_path)) {
+      printf ("control socket path '%s' too long\n", path);
+      return false;
+   }
+
+   for (j = 0; j < MAXIMUM_CONTROL_CONNECTIONS; j++) {
+      connections[j].fd = -1;
+      connections[j].generation = 0;
+      connections[j].is_closing = false;
+      connections[j].outstanding = 0;
+   }
+
+   listen_fd = socket (AF_UNIX, SOCK_STREAM, 0);
+   if (listen_fd < 0) {
+      printf ("control socket failed (%s)\n", strerror (errno));
+      return false;
+   }
+
+   /* Remove any stale socket, but nothing else.
+    */
+   if ((lstat (path, &info) == 0) && S_ISSOCK (info.st_mode)) {
+      (void) unlink (path);
+   }
+
+   memset (&address, 0, sizeof (address));
+   address.sun_family = AF_UNIX;
+   snprintf (address.sun_path, sizeof (address.sun_path), "%s", path);
+
+   /* Control requests can run arbitrary commands, so the socket is created
+    * with mode 0600, i.e. only the user running kryten may connect. The
+    * umask applies at creation, so there is no window in which others may
+    * connect, unlike a chmod afterwards.
+    */
+   old_mask = umask (S_IRWXG | S_IRWXO | S_IXUSR);
+   status = bind (listen_fd, (struct sockaddr *) &address, sizeof (address));
+   (void) umask (old_mask);
+
+   if ((status < 0) || (listen (listen_fd, 16) < 0)) {
+      printf ("control socket '%s' bind/listen failed (%s)\n", path,
+              strerror (errno));
+      close (listen_fd);
+      listen_fd = -1;
+      return false;
+   }
+   Set_Non_Blocking (listen_fd);
+
+   if (pipe (wake_fds) < 0) {
+      printf ("control pipe failed (%s)\n", strerror (errno));
+      close (listen_fd);
+      listen_fd = -1;
+      (void) unlink (path);
+      return false;
+   }
+   Set_Non_Blocking (wake_fds[0]);
+   Set_Non_Blocking (wake_fds[1]);
+
+   socket_path = epicsStrDup (path);
+   control_mutex = epicsMutexCreate ();
+   done = epicsEventCreate (epicsEventEmpty);
+   stop_requested = false;
+
+   if (!epicsThreadCreate ("kryten_control", epicsThreadPriorityLow,
+                           epicsThreadGetStackSize (epicsThreadStackMedium),
+                           Control_Thread, NULL)) {
+      printf ("epicsThreadCreate (kryten_control) failed\n");
+      is_started = true;
+      stop_requested = true;
+      epicsEventSignal (done);
+      Control_Stop ();
+      return false;
+   }
+
+   is_started = true;
+   if (is_verbose) {
+      printf ("Control socket %s\n", path);
+   }
+   return true;
+}                               /* Control_Start */
+
+
+/*------------------------------------------------------------------------------
+ */
+void Control_Stop ()
+{
+   Control_Request *request;
+   int j;
+
+   if (!is_started) {
+      return;
+   }
+
+   stop_requested = true;
+   Wake_Control_Thread ();
+   epicsEventWait (done);
+
+   for (j = 0; j < MAXIMUM_CONTROL_CONNECTIONS; j++) {
+      if (connections[j].fd >= 0) {
+         Close_Connection (j);
+      }
+   }
+
+   while ((request = (Control_Request *) ellGet (&pending)) != NULL) {
+      Free_Request (request);
+   }
+
+   close (listen_fd);
+   close (wake_fds[0]);
+   close (wake_fds[1]);
+   listen_fd = -1;
+   (void) unlink (socket_path);
+   free (socket_path);
+   socket_path = NULL;
+
+   epicsEventDestroy (done);
+   epicsMutexDestroy (control_mutex);
+   is_started = false;
+}                               /* Control_Stop */
+
+
+/*------------------------------------------------------------------------------
+ */
+bool Control_Pending ()
+{
+   bool result;
+
+   if (!is_started) {
+      return false;
+   }
+
+   epicsMutexLock (control_mutex);
+   result = (ellCount (&pending) > 0);
+   epicsMutexUnlock (control_mutex);
+   return result;
+}                               /* Control_Pending */
+
+
+/*------------------------------------------------------------------------------
+ */
+int Control_Process (Control_Handler handler, const int max)
+{
+   Control_Request *request;
+   Control_Connection *connection;
+   int n;
+
+   for (n = 0; n < max; n++) {
+      epicsMutexLock (control_mutex);
+      request = (Control_Request *) ellGet (&pending);
+      epicsMutexUnlock (control_mutex);
+
+      if (request == NULL) {
+         break;
+      }
+
+      handler (request, request->line);
+
+      /* The connection may have closed, and even been re-used, since.
+       */
+      epicsMutexLock (control_mutex);
+      connection = &connections[request->connection];
+      if ((connection->fd >= 0) &&
+          (connection->generation == request->generation)) {
+         connection->outstanding--;
+         Text_Append (&connection->output, request->reply.text,
+                      request->reply.length);
+      }
+      epicsMutexUnlock (control_mutex);
+
+      Free_Request (request);
+   }
+
+   if (n > 0) {
+      Wake_Control_Thread ();
+   }
+   return n;
+}                               /* Control_Process */
+
+
+/*------------------------------------------------------------------------------
+ */
+void Control_Reply (Control_Request * request, const char *format, ...)
+{
+   char text[1024];
+   char *large;
+   va_list args;
+   int length;
+
+   va_start (args, format);
+   length = vsnprintf (text, sizeof (text), format, args);
+   va_end (args);
+
+   if (length < 0) {
+      return;
+   }
+
+   if ((size_t) length < sizeof (text)) {
+      Text_Append (&request->reply, text, length);
+      return;
+   }
+
+   large = (char *) callocMustSucceed (length + 1, 1, "Control_Reply");
+   va_start (args, format);
+   (void) vsnprintf (large, length + 1, format, args);
+   va_end (args);
+   Text_Append (&request->reply, large, length);
+   free (large);
+}                               /* Control_Reply */
+
+/* end */
@@ -0,0 +1,65 @@
+/* control.h
+ *
+ * Kryten is a EPICS PV monitoring program that calls a system command
+ * when the value of the PV matches/cease to match specified criteria.
+ *
+ * Copyright (C) 2011-2021  Andrew C. Starritt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact details:
+ * andrew.starritt@gmail.com
+ * PO Box 3118, Prahran East, Victoria 3181, Australia.
+ *
+ * Source code formatting:
+ * indent options:  -kr -pcs -i3 -cli3 -nbbo -nut
+ *
+ */
+
+#ifndef CONTROL_H_
+#define CONTROL_H_
+
+#include "kryten.h"
+
+#define MAXIMUM_CONTROL_CONNECTIONS   32
+
+/* Runtime control via a Unix domain stream socket. A control thread accepts
+ * connections, and splits the received data into request lines. Requests are
+ * queued, in order, for the application to process by calling Control_Process
+ * from its own thread. Each request's reply is returned to the connection
+ * that sent the request; replies to connections since closed are discarded.
+ */
+typedef struct sControl_Request Control_Request;
+
+/* Called by Control_Process for each request line. The handler uses
+ * Control_Reply to build the reply.
+ */
+typedef void (*Control_Handler) (Control_Request * request, const char *line);
+
+bool Control_Start (const char *path);
+void Control_Stop ();
+
+/* Returns true if any requests are waiting to be processed.
+ */
+bool Control_Pending ();
+
+/* Processes up to max waiting requests. Returns the number processed.
+ */
+int Control_Process (Control_Handler handler, const int max);
+
+/* Appends formatted text to the request's reply.
+ */
+void Control_Reply (Control_Request * request, const char *format, ...);
+
+#endif                          /* CONTROL_H_ */
@@ -0,0 +1,253 @@
+/* expression.c
+ *
+ * Kryten is a EPICS PV monitoring program that calls a system command
+ * when the value of the PV matches/cease to match specified criteria.
+ *
+ * Copyright (C) 2011-2021  Andrew C. Starritt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact details:
+ * andrew.starritt@gmail.com
+ * PO Box 3118, Prahran East, Victoria 3181, Australia.
+ *
+ * Source code formatting:
+ * indent options:  -kr -pcs -i3 -cli3 -nbbo -nut
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cantProceed.h>
+#include <epicsString.h>
+
+#include "expression.h"
+#include "utilities.h"
+
+#define OP_SHIFT     14
+#define TERM_MASK    ((1 << OP_SHIFT) - 1)
+
+#define CODE_WORD(op, term)   ((epicsUInt16) (((op) << OP_SHIFT) | (term)))
+#define CODE_OP(word)         ((Expression_Op) ((word) >> OP_SHIFT))
+#define CODE_TERM(word)       ((word) & TERM_MASK)
+
+
+/*------------------------------------------------------------------------------
+ */
+Expression *Expression_Create (const char *name)
+{
+   Expression *result;
+
+   result = (Expression *) callocMustSucceed
+       (1, sizeof (Expression), "Expression_Create");
+
+   result->name = epicsStrDup (name);
+   result->command = NULL;
+   result->number_terms = 0;
+   result->term_value = NULL;
+   result->length = 0;
+   result->capacity = 16;
+   result->code = (epicsUInt16 *) callocMustSucceed
+       (result->capacity, sizeof (epicsUInt16), "Expression_Create");
+   result->depth = 0;
+   result->maximum_depth = 0;
+   result->stack = NULL;
+   result->last_matched = false;
+   result->number_transitions = 0;
+   result->anchor = NULL;
+
+   return result;
+}                               /* Expression_Create */
+
+
+/*------------------------------------------------------------------------------
+ */
+void Expression_Free (Expression * expression)
+{
+   if (expression) {
+      free (expression->name);
+      free (expression->command);
+      free (expression->term_value);
+      free (expression->code);
+      free (expression->stack);
+      free (expression);
+   }
+}                               /* Expression_Free */
+
+
+/*------------------------------------------------------------------------------
+ */
+bool Expression_Emit (Expression * expression, const Expression_Op op,
+                      const int term)
+{
+   epicsUInt16 *code;
+
+   /* Track stack depth so that underflow is caught at compile time, and
+    * the evaluation stack can be allocated once.
+    */
+   switch (op) {
+      case eoTerm:
+         if ((term < 0) || (term >= expression->number_terms)) {
+            return false;
+         }
+         expression->depth++;
+         break;
+
+      case eoNot:
+         if (expression->depth < 1) {
+            return false;
+         }
+         break;
+
+      case eoAnd:
+      case eoOr:
+         if (expression->depth < 2) {
+            return false;
+         }
+         expression->depth--;
+         break;
+
+      default:
+         return false;
+   }
+
+   expression->maximum_depth = MAX (expression->maximum_depth,
+                                    expression->depth);
+
+   if (expression->length >= expression->capacity) {
+      code = (epicsUInt16 *) callocMustSucceed
+          (2 * expression->capacity, sizeof (epicsUInt16), "Expression_Emit");
+      memcpy (code, expression->code,
+              expression->length * sizeof (epicsUInt16));
+      free (expression->code);
+      expression->code = code;
+      expression->capacity *= 2;
+   }
+
+   expression->code[expression->length++] =
+       CODE_WORD (op, (op == eoTerm) ? term : 0);
+   return true;
+}                               /* Expression_Emit */
+
+
+/*------------------------------------------------------------------------------
+ */
+int Expression_Add_Term (Expression * expression)
+{
+   if (expression->number_terms >= MAXIMUM_EXPRESSION_TERMS) {
+      return -1;
+   }
+   return expression->number_terms++;
+}                               /* Expression_Add_Term */
+
+
+/*------------------------------------------------------------------------------
+ */
+bool Expression_Finalise (Expression * expression)
+{
+   /* Well formed code leaves exactly one item on the stack.
+    */
+   if ((expression->length == 0) || (expression->depth != 1)) {
+      return false;
+   }
+
+   expression->stack = (bool *) callocMustSucceed
+       (expression->maximum_depth, sizeof (bool), "Expression_Finalise");
+   expression->term_value = (epicsUInt8 *) callocMustSucceed
+       (expression->number_terms, sizeof (epicsUInt8), "Expression_Finalise");
+   return true;
+}                               /* Expression_Finalise */
+
+
+/*------------------------------------------------------------------------------
+ */
+void Expression_Set_Term (Expression * expression, const int term,
+                          const bool value)
+{
+   if ((term >= 0) && (term < expression->number_terms)) {
+      expression->term_value[term] = value ? 1 : 0;
+   }
+}                               /* Expression_Set_Term */
+
+
+/*------------------------------------------------------------------------------
+ */
+bool Expression_Evaluate (Expression * expression)
+{
+   const epicsUInt16 *code = expression->code;
+   const int length = expression->length;
+   bool *stack = expression->stack;
+   int top = -1;
+   int pc;
+
+   for (pc = 0; pc < length; pc++) {
+      switch (CODE_OP (code[pc])) {
+         case eoTerm:
+            stack[++top] = expression->term_value[CODE_TERM (code[pc])];
+            break;
+
+         case eoNot:
+            stack[top] = !stack[top];
+            break;
+
+         case eoAnd:
+            top--;
+            stack[top] = stack[top] && stack[top + 1];
+            break;
+
+         case eoOr:
+            top--;
+            stack[top] = stack[top] || stack[top + 1];
+            break;
+      }
+   }
+
+   return (top == 0) ? stack[0] : false;
+}                               /* Expression_Evaluate */
+
+
+/*------------------------------------------------------------------------------
+ */
+const char *Expression_Code_Image (const Expression * expression,
+                                   char *image, const size_t size)
+{
+   size_t n = 0;
+   int pc;
+   epicsUInt16 word;
+
+   image[0] = '\0';
+   for (pc = 0; (pc < expression->length) && (n < size); pc++) {
+      word = expression->code[pc];
+      switch (CODE_OP (word)) {
+         case eoTerm:
+            n += snprintf (image + n, size - n, "%st%d", pc ? " " : "",
+                           CODE_TERM (word));
+            break;
+         case eoNot:
+            n += snprintf (image + n, size - n, " not");
+            break;
+         case eoAnd:
+            n += snprintf (image + n, size - n, " and");
+            break;
+         case eoOr:
+            n += snprintf (image + n, size - n, " or");
+            break;
+      }
+   }
+   return image;
+}                               /* Expression_Code_Image */
+
+/* end */
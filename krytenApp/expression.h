@@ -0,0 +1,105 @@
+/* expression.h
+ *
+ * Kryten is a EPICS PV monitoring program that calls a system command
+ * when the value of the PV matches/cease to match specified criteria.
+ *
+ * Copyright (C) 2011-2021  Andrew C. Starritt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact details:
+ * andrew.starritt@gmail.com
+ * PO Box 3118, Prahran East, Victoria 3181, Australia.
+ *
+ * Source code formatting:
+ * indent options:  -kr -pcs -i3 -cli3 -nbbo -nut
+ *
+ */
+
+#ifndef EXPRESSION_H_
+#define EXPRESSION_H_
+
+#include <epicsTypes.h>
+
+#include "kryten.h"
+
+/* An Expression is a boolean combination of terms, where each term is the
+ * match state of an input client (rule), e.g.
+ *
+ *    BEAM:CURRENT > 100.0 && VAC:GAUGE > 1e-7 && ! SHUTTER:STATUS = Closed
+ *
+ * The expression is compiled once, when the configuration is read, into a
+ * compact stack bytecode (in reverse Polish order), and is re-evaluated only
+ * when an input's match state changes.
+ *
+ * Each code word holds the op code in the top two bits and, for eoTerm, the
+ * term number in the remaining bits.
+ */
+#define MAXIMUM_EXPRESSION_TERMS   64
+
+typedef enum eExpression_Op {
+   eoTerm = 0,                  /* push term value */
+   eoNot,                       /* replace top of stack with its inverse */
+   eoAnd,                       /* replace top two items with their and */
+   eoOr                         /* replace top two items with their or */
+} Expression_Op;
+
+typedef struct sExpression {
+   char *name;                  /* used for %p */
+   char *command;               /* system command to be called */
+   int number_terms;
+   epicsUInt8 *term_value;      /* current match state of each term */
+   int length;                  /* number of code words */
+   int capacity;
+   epicsUInt16 *code;
+   int depth;                   /* stack depth - at compile time */
+   int maximum_depth;
+   bool *stack;                 /* evaluation stack */
+   bool last_matched;
+   unsigned long number_transitions;    /* match state changes */
+   void *anchor;                /* an input channel, used to shard inputs */
+} Expression;
+
+/* The command is assigned once the expression has been parsed.
+ */
+Expression *Expression_Create (const char *name);
+void Expression_Free (Expression * expression);
+
+/* Appends an instruction. The term argument is only used by eoTerm, and the
+ * term must have been allocated with Expression_Add_Term.
+ * Returns false if the instruction is invalid, i.e. stack underflow.
+ */
+bool Expression_Emit (Expression * expression, const Expression_Op op,
+                      const int term);
+
+/* Allocates the next term number, or returns -1 if there are too many.
+ */
+int Expression_Add_Term (Expression * expression);
+
+/* Checks the code and allocates the evaluation stack. Must be called once all
+ * code has been emitted. Returns false if the code is not well formed.
+ */
+bool Expression_Finalise (Expression * expression);
+
+void Expression_Set_Term (Expression * expression, const int term,
+                          const bool value);
+
+bool Expression_Evaluate (Expression * expression);
+
+/* Returns the bytecode image, e.g. "t0 t1 and t2 not and", for diagnostics.
+ */
+const char *Expression_Code_Image (const Expression * expression,
+                                   char *image, const size_t size);
+
+#endif                          /* EXPRESSION_H_ */
@@ -31,43 +31,39 @@
 #include <string.h>
 #include <stdlib.h>
 
+#include <cantProceed.h>
+#include <epicsString.h>
+
 #include "filter.h"
+#include "metrics.h"
 #include "utilities.h"
 
 #define VALUE_IMAGE_SIZE 44
 #define STATE_IMAGE_SIZE 12
-#define INDEX_IMAGE_SIZE 10
-
-#define COMMAND_BUFFER_SIZE (MATCH_COMMAND_LENGTH + MAXIMUM_PVNAME_SIZE + \
-                             STATE_IMAGE_SIZE + VALUE_IMAGE_SIZE +  \
-                             INDEX_IMAGE_SIZE + 12)
+#define INDEX_IMAGE_SIZE 64
 
 /*------------------------------------------------------------------------------
  */
-static void call_command (CA_Client * pClient, const char *state_image,
+static void call_command (const char *match_command, const char *pv_name,
+                          const char *index_image, const char *state_image,
                           const char *value_image)
 {
-   /* We flip flop substituting from command to dnammoc to command
-    */
-   char dnammoc[COMMAND_BUFFER_SIZE];
-   char command[COMMAND_BUFFER_SIZE];
+   char *command;
    char q_val_image[VALUE_IMAGE_SIZE];
-   char index_image[INDEX_IMAGE_SIZE];
+   double start;
    int status;
 
-   /* Create quotted value and index images.
+   /* Create quotted value image.
     */
    snprintf (q_val_image, sizeof (q_val_image), "'%s'", value_image);
-   snprintf (index_image, sizeof (index_image), "%d",
-             pClient->element_index);
 
-   substitute (dnammoc, sizeof (dnammoc), pClient->match_command, "%p",
-               pClient->pv_name);
-   substitute (command, sizeof (command), dnammoc, "%e", index_image);
-   substitute (dnammoc, sizeof (dnammoc), command, "%m", state_image);
+   command = epicsStrDup (match_command);
+   command = substitute_step (command, "%p", pv_name);
+   command = substitute_step (command, "%e", index_image);
+   command = substitute_step (command, "%m", state_image);
    /** We do value last as the value itself may contain %p, %m and or %e.
     **/
-   substitute (command, sizeof (command), dnammoc, "%v", q_val_image);
+   command = substitute_step (command, "%v", q_val_image);
 
    /* Check for built in commands.
     */
@@ -87,22 +83,50 @@ static void call_command (CA_Client * pClient, const char *state_image,
          printf ("calling system (\"%s\")\n", command);
       }
 
+      start = monotonic_time ();
       status = system (command);
+      Metrics_Command (monotonic_time () - start, status != 0);
       if (status != 0) {
          printf ("system (\"%s\") returned %d\n", command, status);
       }
    }
+   free (command);
 }                               /* call_command */
 
 
 /*------------------------------------------------------------------------------
  */
 static bool is_value_a_match (const Variant_Value * value,
-                              const Variant_Range * range)
+                              const Variant_Range * range,
+                              String_Set_Key * key, char *key_image)
 {
    bool result;
 
+   /* Sets and patterns match the value as a string. Calculate the value's
+    * key, i.e. text, length and hash, on first use. Non string values are
+    * matched using their image.
+    */
+   if ((range->set != NULL || range->pattern != NULL) && (key->text == NULL)) {
+      if (value->kind == vkString) {
+         String_Set_Make_Key (key, value->value.sval,
+                              strlen (value->value.sval));
+      } else {
+         key_image[0] = '\0';
+         Variant_Image (key_image, VALUE_IMAGE_SIZE, value);
+         String_Set_Make_Key (key, key_image, strlen (key_image));
+      }
+   }
+
    switch (range->comp) {
+      case ckInSet:
+         result = String_Set_Contains (range->set, key);
+         break;
+
+      case ckRegex:
+      case ckGlob:
+         result = Pattern_Match (range->pattern, key->text, key->length);
+         break;
+
       case ckRange:
          result = Variant_Le (&range->lower, value) &&
                   Variant_Le (value, &range->upper);
@@ -140,52 +164,236 @@ static bool is_value_a_match (const Variant_Value * value,
 }                               /* is_value_a_match */
 
 /*------------------------------------------------------------------------------
+ * The value is the number of elements that match; total is the number of
+ * elements received.
  */
-void Process_PV_Update (CA_Client * pClient)
+static bool is_array_predicate_true (const Array_Predicate * predicate,
+                                     const long count, const long total)
+{
+   const long threshold = predicate->count_threshold;
+   bool result;
+
+   switch (predicate->kind) {
+      case apAny:
+         result = (count > 0);
+         break;
+
+      case apAll:
+         result = (count == total);
+         break;
+
+      case apCount:
+         switch (predicate->count_comp) {
+            case ckEqual:            result = (count == threshold); break;
+            case ckNotEqual:         result = (count != threshold); break;
+            case ckLessThan:         result = (count <  threshold); break;
+            case ckLessThanEqual:    result = (count <= threshold); break;
+            case ckGreaterThan:      result = (count >  threshold); break;
+            case ckGreaterThanEqual: result = (count >= threshold); break;
+            default:                 result = false;                break;
+         }
+         break;
+
+      default:
+         result = false;
+         break;
+   }
+   return result;
+}                               /* is_array_predicate_true */
+
+
+/*------------------------------------------------------------------------------
+ * An input to an expression has changed state - re-evaluate the expression
+ * and call the expression's command if the expression's state has changed.
+ */
+static void process_expression (CA_Client * pClient, const bool matches)
+{
+   Expression *expression = pClient->expression;
+   bool result;
+
+   Expression_Set_Term (expression, pClient->expression_term, matches);
+   result = Expression_Evaluate (expression);
+
+   if (expression->last_matched != result) {
+      expression->number_transitions++;
+      call_command (expression->command, expression->name, "",
+                    result ? "match " : "reject", result ? "1" : "0");
+   }
+   expression->last_matched = result;
+}                               /* process_expression */
+
+
+/*------------------------------------------------------------------------------
+ * A sequence step's input has entered the match state. The command is called
+ * when the sequence completes.
+ */
+static void process_sequence (CA_Client * pClient)
+{
+   Sequence *sequence = pClient->sequence;
+   Sequence_Result result;
+   char value_image[STATE_IMAGE_SIZE];
+
+   result = Sequence_Step_Matched (sequence, pClient->sequence_step,
+                                   monotonic_time ());
+
+   if (is_verbose && (result != srNone)) {
+      printf ("sequence %s step %d matched\n", sequence->name,
+              pClient->sequence_step);
+   }
+
+   if (result == srCompleted) {
+      sequence->number_transitions++;
+      snprintf (value_image, sizeof (value_image), "%d",
+                sequence->number_steps);
+      call_command (sequence->command, sequence->name, "", "match ",
+                    value_image);
+   }
+}                               /* process_sequence */
+
+
+/*------------------------------------------------------------------------------
+ * Evaluates the client's current data value, and calls the command if the
+ * match state has changed.
+ */
+static void process_value (CA_Client * pClient, bool * last_matched,
+                           const char *index_image)
 {
    bool matches;
    unsigned int j;
    char value_image[VALUE_IMAGE_SIZE] = "";
    char *state_image;
+   String_Set_Key key;
+   char key_image[VALUE_IMAGE_SIZE];
 
    /* Hypothesize no match
     */
    matches = false;
+   key.text = NULL;
 
-   /* Check each range in-turn
-    */
-   for (j = 0; j < pClient->match_set_collection.count; j++) {
-      if (is_value_a_match (&pClient->data,
-                            &pClient->match_set_collection.item[j])) {
-         /* Found a match
-          */
-         matches = true;
-         break;
+   if (pClient->array_predicate.kind != apNone) {
+      /* Whole array - the data value is the number of matching elements.
+       */
+      matches = is_array_predicate_true (&pClient->array_predicate,
+                                         pClient->data.value.ival,
+                                         pClient->data_element_count);
+   } else {
+      /* Check each range in-turn
+       */
+      for (j = 0; j < pClient->match_set_collection.count; j++) {
+         if (is_value_a_match (&pClient->data,
+                               &pClient->match_set_collection.item[j], &key,
+                               key_image)) {
+            /* Found a match
+             */
+            matches = true;
+            break;
+         }
       }
    }
 
    /* Has match state changed?
     */
-   if (pClient->last_update_matched != matches) {
+   if ((*last_matched != matches) && (pClient->sequence != NULL)) {
+
+      /** Sequences are driven by transitions into the match state only.
+       */
+      if (matches) {
+         process_sequence (pClient);
+      }
+
+   } else if ((*last_matched != matches) && (pClient->expression != NULL)) {
+
+      /** Expression inputs have no command of their own.
+       */
+      process_expression (pClient, matches);
+
+   } else if (*last_matched != matches) {
 
       /** PV has entered or exited the matched state
        */
+      pClient->number_transitions++;
       state_image = (matches == TRUE) ? "match " : "reject";
 
-      Variant_Image (value_image, sizeof (value_image), &pClient->data);
+      if ((pClient->target != mtValue) && (pClient->data.kind == vkInteger)) {
+         snprintf (value_image, sizeof (value_image), "%s",
+                   Match_Target_Image (pClient->target,
+                                       (int) pClient->data.value.ival));
+      } else {
+         Variant_Image (value_image, sizeof (value_image), &pClient->data);
+      }
 
-      call_command (pClient, state_image, value_image);
+      call_command (pClient->match_command, pClient->pv_name, index_image,
+                    state_image, value_image);
    }
 
-   pClient->last_update_matched = matches;
+   *last_matched = matches;
+}                               /* process_value */
+
+
+/*------------------------------------------------------------------------------
+ */
+void Process_PV_Update (CA_Client * pClient)
+{
+   char index_image[INDEX_IMAGE_SIZE];
+
+   Element_Index_Image (pClient, index_image, sizeof (index_image));
+   process_value (pClient, &pClient->last_update_matched, index_image);
 }                               /* Process_PV_Update */
 
 
+/*------------------------------------------------------------------------------
+ */
+void Process_PV_Element_Update (CA_Client * pClient, const int slot)
+{
+   Element_List *list = pClient->element_list;
+   char index_image[INDEX_IMAGE_SIZE];
+
+   snprintf (index_image, sizeof (index_image), "%d", list->index[slot]);
+   process_value (pClient, &list->matched[slot], index_image);
+}                               /* Process_PV_Element_Update */
+
+
 /*------------------------------------------------------------------------------
  */
 void Process_PV_Disconnect (CA_Client * pClient)
 {
-   call_command (pClient, "disconnect", "");
+   char index_image[INDEX_IMAGE_SIZE];
+
+   Element_Index_Image (pClient, index_image, sizeof (index_image));
+
+   /* For expression inputs, the value is the name of the disconnected PV.
+    */
+   if (pClient->expression) {
+      call_command (pClient->expression->command, pClient->expression->name,
+                    "", "disconnect", pClient->pv_name);
+   } else if (pClient->sequence) {
+      call_command (pClient->sequence->command, pClient->sequence->name,
+                    "", "disconnect", pClient->pv_name);
+   } else {
+      call_command (pClient->match_command, pClient->pv_name, index_image,
+                    "disconnect", "");
+   }
 }                               /* Process_PV_Disconnect */
 
+
+
+/*------------------------------------------------------------------------------
+ */
+void Process_Sequence_Timeouts ()
+{
+   const double now = monotonic_time ();
+   Sequence *sequence;
+   int step;
+   char value_image[STATE_IMAGE_SIZE];
+
+   /* The value is the step that did not match in time.
+    */
+   while ((sequence = Sequence_Next_Expired (now, &step)) != NULL) {
+      sequence->number_transitions++;
+      snprintf (value_image, sizeof (value_image), "%d", step);
+      call_command (sequence->command, sequence->name, "", "reject",
+                    value_image);
+   }
+}                               /* Process_Sequence_Timeouts */
+
 /* end */
@@ -34,6 +34,16 @@
 #include "pv_client.h"
 
 void Process_PV_Update (CA_Client * pClient);
+
+/* As Process_PV_Update, but for the slot'th element of the client's element
+ * list. The client's data is the value of that element.
+ */
+void Process_PV_Element_Update (CA_Client * pClient, const int slot);
 void Process_PV_Disconnect (CA_Client * pClient);
 
+/* Calls the command of each sequence that has timed out, i.e. a step did not
+ * match within the step's time limit. To be called periodically.
+ */
+void Process_Sequence_Timeouts ();
+
 #endif                          /* PV_FILTER_H_ */
@@ -0,0 +1,274 @@
+/* host_events.c
+ *
+ * Kryten is a EPICS PV monitoring program that calls a system command
+ * when the value of the PV matches/cease to match specified criteria.
+ *
+ * Copyright (C) 2011-2021  Andrew C. Starritt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact details:
+ * andrew.starritt@gmail.com
+ * PO Box 3118, Prahran East, Victoria 3181, Australia.
+ *
+ * Source code formatting:
+ * indent options:  -kr -pcs -i3 -cli3 -nbbo -nut
+ *
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <cantProceed.h>
+#include <epicsMutex.h>
+#include <epicsString.h>
+
+#include "host_events.h"
+#include "metrics.h"
+#include "utilities.h"
+
+/* One group per host and event kind currently being aggregated.
+ */
+typedef struct sHost_Group {
+   struct sHost_Group *next;
+   Host_Event_Kind kind;
+   char *host_name;
+   char **pv_names;
+   int count;
+   int capacity;
+   double deadline;             /* monotonic time */
+} Host_Group;
+
+static char *host_command = NULL;
+static double host_window = 1.0;
+static Host_Group *groups = NULL;
+static epicsMutexId groups_mutex = NULL;       /* events may be added by workers */
+
+static const char *kind_images[2] = { "disconnect", "connect" };
+
+
+/*------------------------------------------------------------------------------
+ */
+static void Free_Group (Host_Group * group)
+{
+   int j;
+
+   for (j = 0; j < group->count; j++) {
+      free (group->pv_names[j]);
+   }
+   free (group->pv_names);
+   free (group->host_name);
+   free (group);
+}                               /* Free_Group */
+
+
+/*------------------------------------------------------------------------------
+ * Writes the PV names to the command's standard input, and closes the pipe,
+ * returning the command's status as per pclose. SIGPIPE is blocked in this
+ * thread meanwhile, so that a command which exits without reading all its
+ * input cannot kill kryten - the write just fails. The command itself is
+ * unaffected, as it is started before SIGPIPE is blocked.
+ * Note the writes block whilst the pipe is full, i.e. until the command reads
+ * its input, and pclose waits for the command to exit, so a slow command
+ * delays the main loop.
+ */
+static int Write_And_Close (const Host_Group * group, FILE * pipe)
+{
+   const struct timespec no_wait = { 0, 0 };
+   sigset_t pipe_signal;
+   sigset_t previous;
+   int status;
+   int j;
+
+   sigemptyset (&pipe_signal);
+   sigaddset (&pipe_signal, SIGPIPE);
+   pthread_sigmask (SIG_BLOCK, &pipe_signal, &previous);
+
+   for (j = 0; j < group->count; j++) {
+      if (fprintf (pipe, "%s\n", group->pv_names[j]) < 0) {
+         break;
+      }
+   }
+   status = pclose (pipe);
+
+   /* Discard any SIGPIPE raised by the writes before unblocking.
+    */
+   if (!sigismember (&previous, SIGPIPE)) {
+      while ((sigtimedwait (&pipe_signal, NULL, &no_wait) < 0) &&
+             (errno == EINTR)) {
+         /* retry */
+      }
+      pthread_sigmask (SIG_SETMASK, &previous, NULL);
+   }
+   return status;
+}                               /* Write_And_Close */
+
+
+/*------------------------------------------------------------------------------
+ * Calls the host command, writing the PV names to its standard input.
+ */
+static void Call_Host_Command (const Host_Group * group)
+{
+   char number[16];
+   char *command;
+   FILE *pipe;
+   double start;
+   int status;
+
+   snprintf (number, sizeof (number), "%d", group->count);
+
+   command = epicsStrDup (host_command);
+   command = substitute_step (command, "%p", group->host_name);
+   command = substitute_step (command, "%m", kind_images[group->kind]);
+   command = substitute_step (command, "%v", number);
+
+   if (is_verbose) {
+      printf ("calling popen (\"%s\") with %d PV name%s\n", command,
+              group->count, (group->count == 1) ? "" : "s");
+   }
+
+   start = monotonic_time ();
+   pipe = popen (command, "w");
+   if (pipe == NULL) {
+      printf ("popen (\"%s\") failed\n", command);
+      Metrics_Command (0.0, true);
+      free (command);
+      return;
+   }
+
+   status = Write_And_Close (group, pipe);
+   Metrics_Command (monotonic_time () - start, status != 0);
+   if (status != 0) {
+      printf ("popen (\"%s\") returned %d\n", command, status);
+   }
+   free (command);
+}                               /* Call_Host_Command */
+
+
+/*------------------------------------------------------------------------------
+ * PUBLIC FUNCTIONS
+ *------------------------------------------------------------------------------
+ */
+void Host_Events_Initialise (const char *command, const double window)
+{
+   free (host_command);
+   host_command = NULL;
+   if (command && (command[0] != '\0')) {
+      host_command = epicsStrDup (command);
+   }
+   host_window = window;
+   if (groups_mutex == NULL) {
+      groups_mutex = epicsMutexCreate ();
+   }
+}                               /* Host_Events_Initialise */
+
+
+/*------------------------------------------------------------------------------
+ */
+bool Host_Events_Enabled ()
+{
+   return (host_command != NULL);
+}                               /* Host_Events_Enabled */
+
+
+/*------------------------------------------------------------------------------
+ */
+void Host_Event_Add (const Host_Event_Kind kind, const char *host_name,
+                     const char *pv_name)
+{
+   Host_Group *group;
+   char **pv_names;
+
+   if (host_command == NULL) {
+      return;
+   }
+
+   epicsMutexLock (groups_mutex);
+
+   for (group = groups; group; group = group->next) {
+      if ((group->kind == kind) && (strcmp (group->host_name, host_name) == 0)) {
+         break;
+      }
+   }
+
+   /* First event for this host - open a new window.
+    */
+   if (group == NULL) {
+      group = (Host_Group *) callocMustSucceed
+          (1, sizeof (Host_Group), "Host_Event_Add");
+      group->kind = kind;
+      group->host_name = epicsStrDup (host_name);
+      group->deadline = monotonic_time () + host_window;
+      group->next = groups;
+      groups = group;
+   }
+
+   if (group->count >= group->capacity) {
+      group->capacity = (group->capacity == 0) ? 16 : 2 * group->capacity;
+      pv_names = (char **) callocMustSucceed
+          (group->capacity, sizeof (char *), "Host_Event_Add");
+      if (group->count > 0) {
+         memcpy (pv_names, group->pv_names, group->count * sizeof (char *));
+      }
+      free (group->pv_names);
+      group->pv_names = pv_names;
+   }
+   group->pv_names[group->count++] = epicsStrDup (pv_name);
+
+   epicsMutexUnlock (groups_mutex);
+}                               /* Host_Event_Add */
+
+
+/*------------------------------------------------------------------------------
+ */
+void Process_Host_Events ()
+{
+   const double now = monotonic_time ();
+   Host_Group **link;
+   Host_Group *group;
+   Host_Group *expired = NULL;
+
+   if (host_command == NULL) {
+      return;
+   }
+
+   /* Detach the expired groups, and call the commands without holding the
+    * mutex.
+    */
+   epicsMutexLock (groups_mutex);
+   link = &groups;
+   while ((group = *link) != NULL) {
+      if (now >= group->deadline) {
+         *link = group->next;
+         group->next = expired;
+         expired = group;
+      } else {
+         link = &group->next;
+      }
+   }
+   epicsMutexUnlock (groups_mutex);
+
+   while ((group = expired) != NULL) {
+      expired = group->next;
+      Call_Host_Command (group);
+      Free_Group (group);
+   }
+}                               /* Process_Host_Events */
+
+/* end */
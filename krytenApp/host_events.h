@@ -0,0 +1,59 @@
+/* host_events.h
+ *
+ * Kryten is a EPICS PV monitoring program that calls a system command
+ * when the value of the PV matches/cease to match specified criteria.
+ *
+ * Copyright (C) 2011-2021  Andrew C. Starritt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact details:
+ * andrew.starritt@gmail.com
+ * PO Box 3118, Prahran East, Victoria 3181, Australia.
+ *
+ * Source code formatting:
+ * indent options:  -kr -pcs -i3 -cli3 -nbbo -nut
+ *
+ */
+
+#ifndef HOST_EVENTS_H_
+#define HOST_EVENTS_H_
+
+#include "kryten.h"
+
+/* Host events aggregate the channel disconnects and reconnects of each IOC
+ * host within a short window, so that when an IOC reboots a single host level
+ * command is called as opposed to one command per PV. The command's %p is
+ * replaced by the host name, %m by 'disconnect' or 'connect', and %v by the
+ * number of PVs affected. The affected PV names are written, one per line, to
+ * the command's standard input.
+ */
+typedef enum eHost_Event_Kind {
+   hkDisconnect = 0,
+   hkConnect
+} Host_Event_Kind;
+
+/* The window is in seconds. A null or empty command disables host events.
+ */
+void Host_Events_Initialise (const char *command, const double window);
+bool Host_Events_Enabled ();
+
+void Host_Event_Add (const Host_Event_Kind kind, const char *host_name,
+                     const char *pv_name);
+
+/* Calls the command for each host whose window has expired.
+ */
+void Process_Host_Events ();
+
+#endif                          /* HOST_EVENTS_H_ */
@@ -65,19 +65,76 @@ static const char *intro_text =
 static const char *help_text =
     "Options\n"
     "\n"
+    "--array-filter, -a\n"
+    "    Use server side array filters, e.g. PV.{\"arr\":{\"s\":10,\"e\":20}}, so that\n"
+    "    only the required array elements are sent by the IOC. Channels that do not\n"
+    "    connect using a filter revert to the unfiltered PV name.\n"
+    "\n"
     "--check, -c\n"
     "    Check configuration file and print errors/warnings and quit.\n"
     "\n"
+    "--compile, -C\n"
+    "    Scan the configuration file, print errors/warnings, write the binary rule\n"
+    "    cache configuration-file.cache and quit. When kryten subsequently reads the\n"
+    "    configuration file, including on reload, the cache is used instead if it\n"
+    "    is up to date, i.e. the file has not been modified and the cache was\n"
+    "    written by the same build of kryten. The cache is not written if the\n"
+    "    configuration has errors.\n"
+    "\n"
+    "--contexts, -x  number\n"
+    "    Spread the channels over the specified number of Channel Access contexts\n"
+    "    (1 to 16, default 1), each with its own receive threads. Channels are\n"
+    "    allocated to contexts by PV name. Intended for very large channel counts.\n"
+    "\n"
     "--daemon, -d\n"
     "    Run program as system daemon.\n"
     "\n"
+    "--ioc-command, -i  command\n"
+    "    Aggregate PV disconnects and reconnects per IOC host, and call the command\n"
+    "    once per host as opposed to the disconnect command once per PV. Within the\n"
+    "    command, %%p is replaced by the host name, %%m by disconnect or connect,\n"
+    "    and %%v by the number of PVs. The PV names are written to the command's\n"
+    "    standard input, one per line. Events are aggregated over a window defined\n"
+    "    by the KRYTEN_IOC_WINDOW environment variable (milliseconds, default 1000).\n"
+    "    kryten waits whilst the command's input pipe is full, and until the\n"
+    "    command exits, so the command should read its input promptly.\n"
+    "\n"
+    "--pv-disconnects, -p\n"
+    "    When used with --ioc-command, also call the per PV disconnect commands.\n"
+    "\n"
+    "--metrics, -M  path\n"
+    "    Write runtime metrics in the Prometheus text exposition format to the\n"
+    "    specified file, e.g. for the node exporter textfile collector. The file is\n"
+    "    replaced every 15 seconds, or as per KRYTEN_METRICS_INTERVAL. Metrics are\n"
+    "    events received, callback queue depths, dispatch latency, match state\n"
+    "    changes per specification, commands called, failed and their durations,\n"
+    "    channel connection counts and the process resident memory size.\n"
+    "\n"
     "--monitor, -m  configuration\n"
       "    Use specified string configuration to define required PVs instread of a \n"
-      "    file. Within string, use ';' as specification separator.\n"
-    "\n"
+      "    file. Within string, use ';' as specification separator. As in a\n"
+      "    configuration file, a ';' within quotes does not separate specifications.\n"
+    "\n"
+    "--socket, -u  path\n"
+    "    Accept runtime control requests on the specified Unix domain socket. Each\n"
+    "    request is one line, and each reply ends with an 'ok' or 'error' line:\n"
+    "        add <specification>       add monitor(s), as per a configuration line\n"
+    "        remove <specification>    remove the monitor with the same text\n"
+    "        list                      list all monitor specifications\n"
+    "        state [<pv name>]         connection counts, or per PV state and value\n"
+    "        metrics                   runtime metrics, as per --metrics\n"
+    "    Changes made this way are lost when the configuration file is reloaded.\n"
+    "    The socket is created with mode 0600, so only the user running kryten may\n"
+    "    connect. The define, include and for directives may not be added.\n"    "\n"
     "--suppress, -s\n"
     "    Suppress copyright preamble when program starts.\n"
     "\n"
+    "--threads, -t  number\n"
+    "    Process channel callbacks and call match commands using the specified\n"
+    "    number of worker threads (0 to 64, default 0, i.e. the main thread).\n"
+    "    Each channel is allocated to one worker by PV name; the inputs of an\n"
+    "    expression or sequence are always allocated to the same worker.\n"
+    "\n"
     "--verbose, -v\n"
     "    Output is more verbose.\n"
     "\n"
@@ -97,12 +154,63 @@ static const char *help_text =
     "    Display the program redistribution conditions and quit.\n"
     "\n"
     "\n"
+    "Environment variables\n"
+    "\n"
+    "KRYTEN_CREATE_BATCH\n"
+    "    Number of channels created every 50 mS (default 1000, 0 means create all\n"
+    "    channels at once). Pacing limits the number of concurrent name searches.\n"
+    "\n"
+    "KRYTEN_CONNECT_TIMEOUT\n"
+    "    Time allowed for each channel to connect, measured from the creation of\n"
+    "    that channel, before it is reported as not found (mS, default 2000).\n"
+    "\n"
+    "KRYTEN_TIMEOUT_REPORTS\n"
+    "    Maximum number of connect timeouts individually reported per second\n"
+    "    (default 20), any others are summarised.\n"
+    "\n"
+    "KRYTEN_PARK_AFTER\n"
+    "    Channels not found for this period are parked, i.e. cleared so that they\n"
+    "    no longer generate name searches, and are re-created later (mS, default\n"
+    "    60000, 0 means never park).\n"
+    "\n"
+    "KRYTEN_PARK_RETRY, KRYTEN_PARK_RETRY_MAX\n"
+    "    Initial and maximum parked channel retry interval (mS, default 30000 and\n"
+    "    3600000). The interval doubles each time the channel is still not found.\n"
+    "\n"
+    "KRYTEN_RELOAD_INTERVAL\n"
+    "    Interval at which the configuration file, and any files it includes or\n"
+    "    reads sets from, are checked for changes, and if modified, the\n"
+    "    configuration is reloaded (mS, default 0, meaning only reload on SIGHUP).\n"
+    "\n"
+    "KRYTEN_METRICS_INTERVAL\n"
+    "    Interval at which the --metrics file is written (mS, default 15000).\n"
+    "\n"
+    "KRYTEN_SCAN_THREADS\n"
+    "    Number of threads used to scan large (over 1 MByte) configuration files\n"
+    "    (default the number of processors, maximum 16). When scanning in parallel,\n"
+    "    configuration warnings may be output out of line order.\n"
+    "\n"
+    "Sending the SIGHUP signal to kryten reloads the configuration file. Unchanged\n"
+    "specifications keep their channels and match state; only channels for new or\n"
+    "removed specifications are created or cleared. A specification whose set\n"
+    "file has changed is treated as new. If the configuration file has errors,\n"
+    "the reload is abandoned and the current configuration is kept.\n"
+    "\n"
+    "Sending the SIGUSR1 signal to kryten outputs a diagnostics report, including\n"
+    "the channel connection counts, the parked channels and, when more than one\n"
+    "context is used, the channels, updates and bytes received per context.\n"
+    "\n"
+    "\n"
     "configuration-file\n"
     "\n"
     "The configuration-file parameter is the name of the file that defines the\n"
     "PVs to be monitored together with match critera and the system command to\n"
     "be called.\n"
     "\n"
+    "The same PV may be specified in any number of channel specifications. Each\n"
+    "distinct PV is only connected and subscribed once, irrespective of the number\n"
+    "of channel specifications that reference it.\n"
+    "\n"
     "The expected file format is described below using a Backus Naur like syntax.\n"
     "Blank lines and lines starting with a # character are ignored, the later \n"
     "being useful for comments. Items in {} are primitives and are defined after \n"
@@ -116,19 +224,91 @@ static const char *help_text =
     "    <channel-spec> | <channel-spec> ';' <channel-spec-list>\n"
     "\n"
     "<channel-spec> ::=\n"
-    "    <pv-name> <element-index> <match-list> <command>\n"
+    "    <pv-name> <element-index> <options> <target> <match-list> <command> |\n"
+    "    <expression-spec> | <sequence-spec>\n"
+    "\n"
+    "<sequence-spec> ::=\n"
+    "    'seq' {name} '{' <step> <further-steps> '}' <command>\n"
+    "\n"
+    "<further-steps> ::=\n"
+    "    'then' <step> <within> <further-steps> | <null>\n"
+    "\n"
+    "<step> ::=\n"
+    "    <pv-name> <simple-index> <match-item>\n"
+    "\n"
+    "<within> ::=\n"
+    "    'within' {real number} | <null>\n"
+    "\n"
+    "<expression-spec> ::=\n"
+    "    'expr' {name} '{' <expression> '}' <command>\n"
+    "\n"
+    "<expression> ::=\n"
+    "    <and-expression> | <and-expression> '||' <expression>\n"
+    "\n"
+    "<and-expression> ::=\n"
+    "    <term> | <term> '&&' <and-expression>\n"
+    "\n"
+    "<term> ::=\n"
+    "    '!' <term> | '(' <expression> ')' | <pv-name> <simple-index> <match-item>\n"
+    "\n"
+    "<simple-index> ::=\n"
+    "    '[' {element index} ']' | <null>\n"
     "\n"
     "<pv-name> ::=\n"
     "    {PV name}\n"
     "\n"
     "<element-index> ::=\n"
-    "    '[' {element index} ']' | <null>\n"
+    "    '[' <element-list> ']' | '[' <array-predicate> ']' | <null>\n"
+    "\n"
+    "<element-list> ::=\n"
+    "    <element-item> | <element-item> ',' <element-list>\n"
+    "\n"
+    "<element-item> ::=\n"
+    "    {element index} | {element index} '-' {element index}\n"
+    "\n"
+    "<array-predicate> ::=\n"
+    "    'any' | 'all' | 'count' <qualifier> {integer}\n"
+    "\n"
+    "<options> ::=\n"
+    "    '{' <option-list> '}' | <null>\n"
+    "\n"
+    "<option-list> ::=\n"
+    "    <option> | <option> ',' <option-list>\n"
+    "\n"
+    "<option> ::=\n"
+    "    'deadband' '=' <number> | 'rdeadband' '=' <number> |\n"
+    "    'events' '=' <event-list> | 'priority' '=' <integer>\n"
+    "\n"
+    "<event-list> ::=\n"
+    "    <event> | <event> '|' <event-list>\n"
+    "\n"
+    "<event> ::=\n"
+    "    'value' | 'archive' | 'alarm'\n"
+    "\n"
+    "<number> ::=\n"
+    "    {integer} | {real number}\n"
+    "\n"
+    "<target> ::=\n"
+    "    'severity' | 'status' | <null>\n"
     "\n"
     "<match-list> ::=\n"
     "    <match-item> | <match-item> '|' <match-list>\n"
     "\n"
     "<match-item> ::=\n"
-    "    <value> | <value> '~' <value>\n"
+    "    <value> | <value> '~' <value> | <qualifier> <value> | 'in' <string-set> |\n"
+    "    'regex' '\"' <pattern> '\"' | 'glob' '\"' <pattern> '\"'\n"
+    "\n"
+    "<qualifier> ::=\n"
+    "    '<' | '<=' | '>' | '>=' | '=' | '/='\n"
+    "\n"
+    "<string-set> ::=\n"
+    "    '{' <value-list> '}' | '@' {set file name}\n"
+    "\n"
+    "<value-list> ::=\n"
+    "    <value> | <value> <value-list> | <value> ',' <value-list>\n"
+    "\n"
+    "<pattern> ::=\n"
+    "    '\"'{any text except '\"'}'\"'\n"
     "\n"
     "<value> ::=\n"
     "    {integer} | {real number} | <string-value>\n"
@@ -176,6 +356,44 @@ static const char *help_text =
     "Note: kryten array indexing starts from 1. Rationale: the configuration file\n"
     "      is intended to be maintained by a person, not a C/C++ compiler.\n"
     "\n"
+    "Element List\n"
+    "A list of element indices and/or element index ranges may also be specified,\n"
+    "e.g. [1,5,10-20]. All the listed elements share the one channel and\n"
+    "subscription, but each element has its own match state and the command is\n"
+    "called per element, with %%e replaced by the element index. On each update,\n"
+    "only those listed elements that have changed are re-evaluated. A list may\n"
+    "hold at most 10000 elements, and be at most 255 characters long.\n"
+    "\n"
+    "Array Predicate\n"
+    "Instead of an element index, a whole array predicate may be specified. The\n"
+    "match list is then applied to every element of the array, and the predicate\n"
+    "matches if any element, all the elements, or the specified count of elements\n"
+    "match respectively. Array predicates require numeric match items, but not\n"
+    "string sets or patterns. For array predicates, %%v is replaced by the number\n"
+    "of matching elements, and %%e by the predicate itself.\n"
+    "\n"
+    "Options\n"
+    "Options control what the IOC sends, not the match itself. A deadband or\n"
+    "rdeadband (percentage) option requests a server side dbnd channel filter,\n"
+    "e.g. PV.{\"dbnd\":{\"d\":0.5}}, so that only changes that exceed the deadband\n"
+    "are sent. The events option selects the subscription event mask, the default\n"
+    "being value|alarm. Specifications with different options use distinct\n"
+    "channels. Channels that do not connect using a filter within 2 seconds are\n"
+    "re-connected using the PV name as is.\n"
+    "The priority option sets the Channel Access priority (0 to 99, default 10).\n"
+    "Channel Access uses a separate circuit per priority, and updates received are\n"
+    "processed in priority order, highest first.\n"
+    "\n"
+    "Target\n"
+    "By default the PV value is matched. When severity or status is specified,\n"
+    "the PV's alarm severity or alarm status is matched instead. Values may be\n"
+    "specified by name, e.g. MAJOR or HIHI, or as integers, so that for example\n"
+    "'severity >= MINOR' matches both MINOR and MAJOR alarms. Sets and patterns\n"
+    "match the name. When all the specifications for a PV only match the alarm\n"
+    "severity/status, the PV is subscribed for alarm events only. An element\n"
+    "list or array predicate may not be used with a target.\n"    "When not followed by such a match item, severity and status are just\n"
+    "string values.\n"
+    "\n"
     "Real Number\n"
     "Any real number, i.e. a fixed point numbers or a floating point number.\n"
     "A real number specifically excludes items that are also integer, \n"
@@ -189,7 +407,63 @@ static const char *help_text =
     "identical.\n"
     "\n"
     "Match List\n"
-    "Upto 16 match items may be specified.\n"
+    "Upto 20 match items may be specified.\n"
+    "\n"
+    "String Set\n"
+    "A string set matches if the PV value, as a string, is any one of the set\n"
+    "members. Any number of members may be specified. The set is hashed when the\n"
+    "configuration is read, so a large set costs no more to test than a small\n"
+    "one. Members may also be read from a set file, one member per line; blank\n"
+    "lines and lines starting with a # are ignored. As per include files, a\n"
+    "relative set file name is relative to the including file's directory.\n"
+    "When not followed by '{' or '@', in is just a string value.\n"
+    "\n"
+    "Patterns\n"
+    "A regex pattern is a POSIX extended regular expression, and a glob pattern\n"
+    "is a shell wildcard pattern (*, ? and [...]). Like string sets, patterns are\n"
+    "matched against the PV value as a string. Patterns are compiled once when the\n"
+    "configuration is read. A pattern must be quoted, and may contain any character\n"
+    "other than '\"', including white space, '|', '~' and ';'. When not followed by\n"
+    "a quoted pattern, regex and glob are just string values.\n"
+    "\n"
+    "Expressions\n"
+    "An expression combines the match states of several PVs. Each term is a PV,\n"
+    "optional element index, and a single match item. The expression is compiled\n"
+    "once when the configuration is read, and is re-evaluated only when a term's\n"
+    "match state changes. The command is called only when the expression itself\n"
+    "becomes true (match) or false (reject); %%p is replaced by the expression name\n"
+    "and %%v by 1 or 0. If any term's PV disconnects, the command is called with\n"
+    "status 'disconnect' and %%v replaced by the PV name. The operators and\n"
+    "parentheses must be separated from values by white space.\n"
+    "\n"
+    "Sequences\n"
+    "A sequence detects an ordering of events across PVs. The sequence starts when\n"
+    "the first step enters the match state, and then each subsequent step must\n"
+    "enter the match state within the specified time (in seconds, measured from\n"
+    "the previous step) if any. The command is called with status 'match' when\n"
+    "the last step matches, %%v being the number of steps, or with status 'reject'\n"
+    "if a step does not match in time, %%v being the step number (from 0) that\n"
+    "timed out. %%p is replaced by the sequence name. Times are measured when\n"
+    "updates are processed, so have a resolution of about 0.05 seconds.\n"
+    "\n"
+    "Macros, includes and loops\n"
+    "The following directives, each on a line of its own, may be used to generate\n"
+    "repetitive specifications:\n"
+    "\n"
+    "    define NAME value\n"
+    "    include file [NAME=value, ...]\n"
+    "    for NAME in item ...\n"
+    "    end\n"
+    "\n"
+    "$(NAME) and ${NAME} are replaced by the macro's value in all other lines and\n"
+    "in the directives' operands; references to undefined macros are left as is.\n"
+    "A loop item is a value or an integer range, e.g. 1..10 or 01..14, where a\n"
+    "leading zero pads the values to the width of the first value. An included\n"
+    "file's name is relative to the including file's directory, and the include\n"
+    "macro assignments are local to the included file. Macros defined within an\n"
+    "included file or a loop body are local to that file or loop body.\n"
+    "Specifications are generated directly into the client list, and the\n"
+    "configuration file is then scanned sequentially.\n"
     "\n"
     "Build in commands\n"
     "quit - this causes kryten to terminate, with speficied exit code if given otherwise 0\n"
@@ -223,10 +497,49 @@ static const char *help_text =
     "#\n"
     "WAVEFORM:ARRAY [3] 199 /bin/echo\n"
     "\n"
+    "# Monitor waveform for at least 10 samples outside of the range -5.0 to 5.0\n"
+    "#\n"
+    "WAVEFORM:ARRAY [count >= 10] < -5.0 | > 5.0 /bin/echo\n"
+    "\n"
+    "# Monitor waveform elements 1 to 8 and 12 individually\n"
+    "#\n"
+    "WAVEFORM:ARRAY [1-8,12] > 5.0 /bin/echo\n"
+    "\n"
+    "# Call echo when the beam current is above 100 mA and the vacuum is poor, but\n"
+    "# only while the shutter is open.\n"
+    "#\n"
+    "expr BEAM_VAC { BEAM:CURRENT > 100.0 && VAC:GAUGE > 1e-7 && ! SHUTTER = Closed } /bin/echo\n"
+    "\n"
+    "# Call echo when the valve does not close within 0.5 s of the interlock tripping.\n"
+    "#\n"
+    "seq VALVE_TRIP { ILK:STATUS = Tripped then VALVE:STATUS = Closed within 0.5 } /bin/echo\n"
+    "\n"
+    "# Monitor the X and Y positions of BPMs 1 to 10 in sectors 1 to 14, i.e.\n"
+    "# SR01BPM01:X to SR14BPM10:Y.\n"
+    "#\n"
+    "define ALARM /usr/local/bin/bpm_alarm\n"
+    "for SECTOR in 01..14\n"
+    "   for BPM in 01..10\n"
+    "      SR$(SECTOR)BPM$(BPM):X < -1.5 | > 1.5 $(ALARM) %%p %%m %%v\n"
+    "      SR$(SECTOR)BPM$(BPM):Y < -0.5 | > 0.5 $(ALARM) %%p %%m %%v\n"
+    "   end\n"
+    "end\n"
+    "include rf_cavity.conf CAVITY=1\n"
+    "include rf_cavity.conf CAVITY=2\n"
+    "\n"
     "# Monitor for (small) prime numbers - just echo value \n"
     "#\n"
     "NATURAL:NUMBER 2 ~ 3 | 5 | 7 | 11 | 13 | 17 | 19 | 23 | 27 /bin/echo %%v\n"
     "\n"
+    "# Monitor for the interlock state being any one of the fault states \n"
+    "#\n"
+    "INTERLOCK:STATE in { FAULT TRIP \"HARD STOP\" } /bin/echo\n"
+    "INTERLOCK:REASON in @/etc/kryten/reasons.txt /bin/echo\n"
+    "\n"
+    "# Monitor status message for any kind of trip or fault \n"
+    "#\n"
+    "STATUS:MESSAGE regex \"^Interlock .*(TRIP|FAULT)\" | glob \"*Timeout*\" /bin/echo\n"
+    "\n"
     "# end%s\n"
     "\n"
     "Operations\n"
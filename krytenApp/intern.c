@@ -0,0 +1,147 @@
+/* intern.c
+ *
+ * Kryten is a EPICS PV monitoring program that calls a system command
+ * when the value of the PV matches/cease to match specified criteria.
+ *
+ * Copyright (C) 2011-2021  Andrew C. Starritt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact details:
+ * andrew.starritt@gmail.com
+ * PO Box 3118, Prahran East, Victoria 3181, Australia.
+ *
+ * Source code formatting:
+ * indent options:  -kr -pcs -i3 -cli3 -nbbo -nut
+ *
+ */
+
+#include <string.h>
+
+#include <epicsMutex.h>
+#include <epicsThread.h>
+
+#include "intern.h"
+#include "string_set.h"
+
+/* Must be a power of 2. The shard is selected using the top bits of the hash,
+ * as String_Set uses the bottom bits.
+ */
+#define NUMBER_OF_SHARDS   16
+#define SHARD_SHIFT        28
+
+typedef struct sIntern_Shard {
+   epicsMutexId mutex;
+   String_Set *set;
+} Intern_Shard;
+
+static Intern_Shard shards[NUMBER_OF_SHARDS];
+static String_Set *previous_sets[NUMBER_OF_SHARDS];   /* while rebuilding */
+static epicsThreadOnceId intern_once = EPICS_THREAD_ONCE_INIT;
+
+
+/*------------------------------------------------------------------------------
+ */
+static void Intern_Initialise (void *arg)
+{
+   int j;
+
+   for (j = 0; j < NUMBER_OF_SHARDS; j++) {
+      shards[j].mutex = epicsMutexMustCreate ();
+      shards[j].set = String_Set_Create ();
+   }
+}                               /* Intern_Initialise */
+
+
+/*------------------------------------------------------------------------------
+ * PUBLIC FUNCTIONS
+ *------------------------------------------------------------------------------
+ */
+const char *Intern_String_Length (const char *text, const size_t length)
+{
+   String_Set_Key key;
+   Intern_Shard *shard;
+   const char *result;
+
+   epicsThreadOnce (&intern_once, Intern_Initialise, NULL);
+
+   String_Set_Make_Key (&key, text, length);
+   shard = &shards[key.hash >> SHARD_SHIFT];
+
+   epicsMutexMustLock (shard->mutex);
+   result = String_Set_Add (shard->set, text, length);
+   epicsMutexUnlock (shard->mutex);
+
+   return result;
+}                               /* Intern_String_Length */
+
+
+/*------------------------------------------------------------------------------
+ */
+const char *Intern_String (const char *text)
+{
+   return Intern_String_Length (text, strlen (text));
+}                               /* Intern_String */
+
+
+/*------------------------------------------------------------------------------
+ */
+unsigned int Intern_Count ()
+{
+   unsigned int count = 0;
+   int j;
+
+   epicsThreadOnce (&intern_once, Intern_Initialise, NULL);
+
+   for (j = 0; j < NUMBER_OF_SHARDS; j++) {
+      epicsMutexMustLock (shards[j].mutex);
+      count += String_Set_Count (shards[j].set);
+      epicsMutexUnlock (shards[j].mutex);
+   }
+   return count;
+}                               /* Intern_Count */
+
+
+/*------------------------------------------------------------------------------
+ */
+void Intern_Rebuild_Begin ()
+{
+   int j;
+
+   epicsThreadOnce (&intern_once, Intern_Initialise, NULL);
+
+   for (j = 0; j < NUMBER_OF_SHARDS; j++) {
+      epicsMutexMustLock (shards[j].mutex);
+      previous_sets[j] = shards[j].set;
+      shards[j].set = String_Set_Create ();
+      epicsMutexUnlock (shards[j].mutex);
+   }
+}                               /* Intern_Rebuild_Begin */
+
+
+/*------------------------------------------------------------------------------
+ */
+void Intern_Rebuild_End ()
+{
+   int j;
+
+   for (j = 0; j < NUMBER_OF_SHARDS; j++) {
+      if (previous_sets[j]) {
+         String_Set_Free (previous_sets[j]);
+         previous_sets[j] = NULL;
+      }
+   }
+}                               /* Intern_Rebuild_End */
+
+/* end */
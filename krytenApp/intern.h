@@ -0,0 +1,63 @@
+/* intern.h
+ *
+ * Kryten is a EPICS PV monitoring program that calls a system command
+ * when the value of the PV matches/cease to match specified criteria.
+ *
+ * Copyright (C) 2011-2021  Andrew C. Starritt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact details:
+ * andrew.starritt@gmail.com
+ * PO Box 3118, Prahran East, Victoria 3181, Australia.
+ *
+ * Source code formatting:
+ * indent options:  -kr -pcs -i3 -cli3 -nbbo -nut
+ *
+ */
+
+#ifndef INTERN_H_
+#define INTERN_H_
+
+#include <stddef.h>
+
+#include "kryten.h"
+
+/* Interned strings. Each distinct string, e.g. a PV name, host name or command
+ * template, is stored once in a shared arena, and the same pointer is returned
+ * for all equal strings. Interned strings are immutable and remain valid until
+ * the table is rebuilt, so may be compared by pointer.
+ *
+ * The arena is split into shards, each with its own lock, so that strings may
+ * be interned concurrently, e.g. by the configuration scan threads.
+ */
+const char *Intern_String (const char *text);
+
+/* The text need not be '\0' terminated - length excludes any '\0'.
+ */
+const char *Intern_String_Length (const char *text, const size_t length);
+
+/* Returns the number of distinct strings interned.
+ */
+unsigned int Intern_Count ();
+
+/* Strings are not freed individually. Instead the table may be rebuilt: after
+ * Intern_Rebuild_Begin, strings are interned into a new table, so every string
+ * still in use must be re-interned, i.e. p = Intern_String (p). The previous
+ * table, and hence any string not re-interned, is freed by Intern_Rebuild_End.
+ */
+void Intern_Rebuild_Begin ();
+void Intern_Rebuild_End ();
+
+#endif                          /* INTERN_H_ */
@@ -36,7 +36,9 @@
 #include "kryten.h"
 #include "information.h"
 #include "gnu_public_licence.h"
+#include "host_events.h"
 #include "pv_client.h"
+#include "workers.h"
 #include "utilities.h"
 
 
@@ -52,7 +54,15 @@ extern int daemon (int nochdir, int noclose);
  * Visible to all units
  */
 bool is_verbose = false;
+bool use_array_filter = false;
+bool pv_disconnects = false;
+int number_workers = 0;
+int number_contexts = 1;
+const char *control_path = NULL;
+const char *metrics_path = NULL;
 bool quit_invoked = false;
+volatile bool diagnostics_requested = false;
+volatile bool reload_requested = false;
 int exit_code = 0;
 
 /*------------------------------------------------------------------------------
@@ -62,7 +72,9 @@ static volatile bool sig_term_received = false;
 
 
 /*------------------------------------------------------------------------------
- * Signal catcher function. Only handles interrupt and terminate signals.
+ * Signal catcher function. Handles interrupt and terminate signals, the
+ * user 1 signal which requests a diagnostics report, and the hang up signal
+ * which requests a configuration reload.
  */
 static void Signal_Catcher (int sig)
 {
@@ -79,6 +91,14 @@ static void Signal_Catcher (int sig)
          exit_code = 128 + sig;
          printf ("\nSIGTERM received - initiating orderly shutdown.\n");
          break;
+
+      case SIGUSR1:
+         diagnostics_requested = true;
+         break;
+
+      case SIGHUP:
+         reload_requested = true;
+         break;
    }
 }                               /* Signal_Catcher */
 
@@ -142,9 +162,20 @@ int main (int argc, char *argv[])
    bool status;
    const char *config_filename = "";
    const char* string_config = NULL;
+   const char* ioc_command = NULL;
+   const char* workers_image = NULL;
+   const char* contexts_image = NULL;
+   bool is_ioc_command;
+   bool is_workers;
+   bool is_contexts;
+   bool is_control;
+   bool is_metrics;
+   bool status_ok;
+   long ioc_window;
    bool is_daemon;
    bool is_suppress;
    bool is_just_check;
+   bool is_compile;
    bool is_command_line_config;
 
    /* Check for special options prior to main processing.
@@ -181,8 +212,16 @@ int main (int argc, char *argv[])
     */
    is_suppress = false;
    is_verbose = false;
+   use_array_filter = false;
+   pv_disconnects = false;
+   is_ioc_command = false;
+   is_workers = false;
+   is_contexts = false;
+   is_control = false;
+   is_metrics = false;
    is_daemon = false;
    is_just_check = false;
+   is_compile = false;
    is_command_line_config = false;
 
    while ((argc >= 2) && (argv[1][0] == '-')) {
@@ -190,6 +229,44 @@ int main (int argc, char *argv[])
       else if (check_flag (argv[1], "--verbose", "-v", &is_verbose)) { }
       else if (check_flag (argv[1], "--daemon", "-d", &is_daemon)) { }
       else if (check_flag (argv[1], "--check", "-c", &is_just_check)) { }
+      else if (check_flag (argv[1], "--compile", "-C", &is_compile)) { }
+      else if (check_flag (argv[1], "--array-filter", "-a", &use_array_filter)) { }
+      else if (check_flag (argv[1], "--pv-disconnects", "-p", &pv_disconnects)) { }
+      else if (check_argument (argv[1], argv[2], "--ioc-command", "-i",
+                               &is_ioc_command, &ioc_command))
+      {
+         /* skip option parameter */
+         argc--;
+         argv++;
+      }
+      else if (check_argument (argv[1], argv[2], "--threads", "-t",
+                               &is_workers, &workers_image))
+      {
+         /* skip option parameter */
+         argc--;
+         argv++;
+      }
+      else if (check_argument (argv[1], argv[2], "--contexts", "-x",
+                               &is_contexts, &contexts_image))
+      {
+         /* skip option parameter */
+         argc--;
+         argv++;
+      }
+      else if (check_argument (argv[1], argv[2], "--socket", "-u",
+                               &is_control, &control_path))
+      {
+         /* skip option parameter */
+         argc--;
+         argv++;
+      }
+      else if (check_argument (argv[1], argv[2], "--metrics", "-M",
+                               &is_metrics, &metrics_path))
+      {
+         /* skip option parameter */
+         argc--;
+         argv++;
+      }
       else if (check_argument (argv[1], argv[2], "--monitor", "-m",
                                &is_command_line_config, &string_config))
       {
@@ -206,6 +283,44 @@ int main (int argc, char *argv[])
       argv++;
    }
 
+   if (is_workers) {
+      number_workers = (int) long_value (workers_image ? workers_image : "",
+                                         &status_ok);
+      if (!status_ok || (number_workers < 0) ||
+          (number_workers > MAXIMUM_WORKERS)) {
+         printf ("%sError%s : --threads number must be 0 to %d.\n",
+                 red, reset, MAXIMUM_WORKERS);
+         return 1;
+      }
+   }
+
+   if (is_contexts) {
+      number_contexts = (int) long_value (contexts_image ? contexts_image : "",
+                                          &status_ok);
+      if (!status_ok || (number_contexts < 1) ||
+          (number_contexts > MAXIMUM_CONTEXTS)) {
+         printf ("%sError%s : --contexts number must be 1 to %d.\n",
+                 red, reset, MAXIMUM_CONTEXTS);
+         return 1;
+      }
+   }
+
+   if (is_control && ((control_path == NULL) || (strlen (control_path) == 0))) {
+      printf ("%sError%s : --socket requires a path.\n", red, reset);
+      return 1;
+   }
+
+   if (is_metrics && ((metrics_path == NULL) || (strlen (metrics_path) == 0))) {
+      printf ("%sError%s : --metrics requires a path.\n", red, reset);
+      return 1;
+   }
+
+   if (is_compile && is_command_line_config) {
+      printf ("%sError%s : --compile requires a configuration file.\n",
+              red, reset);
+      return 1;
+   }
+
    /* If not inline, check for one and only parameter.
     */
    if (!is_command_line_config) {
@@ -236,10 +351,31 @@ int main (int argc, char *argv[])
               yellow, reset, argc - 2);
    }
 
+   /* Host level disconnect/connect aggregation. The window is specified
+    * in milliseconds, default 1000.
+    */
+   ioc_window = get_long_env ("KRYTEN_IOC_WINDOW", &status_ok);
+   if (!status_ok || (ioc_window < 0)) {
+      ioc_window = 1000;
+   }
+   Host_Events_Initialise (ioc_command, 0.001 * (double) ioc_window);
+
+   if (pv_disconnects && !is_ioc_command) {
+      printf ("%swarning%s --pv-disconnects only applicable with --ioc-command.\n",
+              yellow, reset);
+   }
+
    /* Read configuration file / string to get list of required PVs
     * and create a list of PV clients.
     */
    int number = 0;
+   if (is_compile) {
+      /* Just write the rule cache and quit.
+       */
+      status = Compile_PV_Client_List (config_filename, &number);
+      return status ? 0 : 1;
+   }
+
    if (is_command_line_config) {
       status = Create_PV_Client_List_From_String (string_config, strlen (string_config), &number);
     } else {
@@ -262,6 +398,8 @@ int main (int argc, char *argv[])
     */
    old_handler = signal (SIGTERM, Signal_Catcher);
    old_handler = signal (SIGINT, Signal_Catcher);
+   old_handler = signal (SIGUSR1, Signal_Catcher);
+   old_handler = signal (SIGHUP, Signal_Catcher);
 
    status = Run (is_just_check, is_daemon);
    if (status) {
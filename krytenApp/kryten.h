@@ -40,7 +40,15 @@ typedef enum ebool {
 #define BOOL_IMAGE(zz)  ((zz) ?  "true " : "false")
 
 extern bool is_verbose;
+extern bool use_array_filter;
+extern bool pv_disconnects;
+extern int number_workers;
+extern int number_contexts;
+extern const char *control_path;        /* NULL means no control socket */
+extern const char *metrics_path;        /* NULL means no metrics file */
 extern bool quit_invoked;
+extern volatile bool diagnostics_requested;
+extern volatile bool reload_requested;
 extern int exit_code;
 
 #endif                          /* KRYTEN_H_ */
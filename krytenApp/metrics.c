@@ -0,0 +1,397 @@
+/* metrics.c
+ *
+ * Kryten is a EPICS PV monitoring program that calls a system command
+ * when the value of the PV matches/cease to match specified criteria.
+ *
+ * Copyright (C) 2011-2021  Andrew C. Starritt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact details:
+ * andrew.starritt@gmail.com
+ * PO Box 3118, Prahran East, Victoria 3181, Australia.
+ *
+ * Source code formatting:
+ * indent options:  -kr -pcs -i3 -cli3 -nbbo -nut
+ *
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cantProceed.h>
+#include <epicsThread.h>
+
+#include "buffered_callbacks.h"
+#include "metrics.h"
+#include "utilities.h"
+
+/* Histogram bucket upper bounds, in seconds. There is also an implicit +Inf
+ * bucket.
+ */
+#define NUMBER_OF_BUCKETS   7
+
+static const double bucket_bounds[NUMBER_OF_BUCKETS] = {
+   0.0001, 0.001, 0.01, 0.1, 1.0, 10.0, 60.0
+};
+
+typedef struct sMetrics_Histogram {
+   unsigned long long bucket[NUMBER_OF_BUCKETS + 1];    /* not cumulative */
+   unsigned long long count;
+   double sum;
+} Metrics_Histogram;
+
+/* The padding keeps slots updated by different threads in different cache
+ * lines.
+ */
+typedef struct sMetrics_Slot {
+   unsigned long long counter[NUMBER_OF_METRIC_COUNTERS];
+   Metrics_Histogram latency;
+   Metrics_Histogram duration;
+   char padding[64];
+} Metrics_Slot;
+
+static Metrics_Slot *slots = NULL;
+static int number_slots = 0;
+static epicsThreadPrivateId slot_id = NULL;
+
+static const char *counter_names[NUMBER_OF_METRIC_COUNTERS] = {
+   "kryten_events_total",
+   "kryten_received_bytes_total",
+   "kryten_commands_total",
+   "kryten_command_failures_total"
+};
+
+static const char *counter_help[NUMBER_OF_METRIC_COUNTERS] = {
+   "Channel value updates received.",
+   "Channel value update bytes received.",
+   "Match and disconnect commands called.",
+   "Commands that returned a non zero status."
+};
+
+
+/*------------------------------------------------------------------------------
+ * Returns the calling thread's slot, or NULL if not initialised.
+ */
+static Metrics_Slot *Thread_Slot ()
+{
+   Metrics_Slot *slot;
+
+   if (slots == NULL) {
+      return NULL;
+   }
+   slot = (Metrics_Slot *) epicsThreadPrivateGet (slot_id);
+   return slot ? slot : &slots[0];
+}                               /* Thread_Slot */
+
+
+/*------------------------------------------------------------------------------
+ */
+static void Observe (Metrics_Histogram * histogram, const double value)
+{
+   int j;
+
+   for (j = 0; j < NUMBER_OF_BUCKETS; j++) {
+      if (value <= bucket_bounds[j]) {
+         break;
+      }
+   }
+   histogram->bucket[j]++;
+   histogram->count++;
+   histogram->sum += value;
+}                               /* Observe */
+
+
+/*------------------------------------------------------------------------------
+ * Sums the histogram over all slots, and appends it.
+ */
+static void Append_Histogram (Metrics_Text * text, const char *name,
+                              const char *help, const size_t offset)
+{
+   Metrics_Histogram total;
+   const Metrics_Histogram *histogram;
+   unsigned long long cumulative;
+   int k;
+   int j;
+
+   memset (&total, 0, sizeof (total));
+   for (k = 0; k < number_slots; k++) {
+      histogram = (const Metrics_Histogram *) ((const char *) &slots[k] +
+                                               offset);
+      for (j = 0; j <= NUMBER_OF_BUCKETS; j++) {
+         total.bucket[j] += histogram->bucket[j];
+      }
+      total.count += histogram->count;
+      total.sum += histogram->sum;
+   }
+
+   Metrics_Printf (text, "# HELP %s %s\n# TYPE %s histogram\n", name, help,
+                   name);
+   cumulative = 0;
+   for (j = 0; j < NUMBER_OF_BUCKETS; j++) {
+      cumulative += total.bucket[j];
+      Metrics_Printf (text, "%s_bucket{le=\"%g\"} %llu\n", name,
+                      bucket_bounds[j], cumulative);
+   }
+   cumulative += total.bucket[NUMBER_OF_BUCKETS];
+   Metrics_Printf (text, "%s_bucket{le=\"+Inf\"} %llu\n", name, cumulative);
+   Metrics_Printf (text, "%s_sum %.9g\n", name, total.sum);
+   Metrics_Printf (text, "%s_count %llu\n", name, total.count);
+}                               /* Append_Histogram */
+
+
+/*------------------------------------------------------------------------------
+ * Returns the process resident set size in bytes, or 0 if unknown.
+ */
+static unsigned long long Resident_Memory ()
+{
+   unsigned long size;
+   unsigned long resident;
+   FILE *file;
+   int number;
+
+   file = fopen ("/proc/self/statm", "r");
+   if (file == NULL) {
+      return 0;
+   }
+   number = fscanf (file, "%lu %lu", &size, &resident);
+   fclose (file);
+
+   if (number != 2) {
+      return 0;
+   }
+   return (unsigned long long) resident *
+       (unsigned long long) sysconf (_SC_PAGESIZE);
+}                               /* Resident_Memory */
+
+
+/*------------------------------------------------------------------------------
+ * PUBLIC FUNCTIONS
+ *------------------------------------------------------------------------------
+ */
+void Metrics_Initialise (const int number_threads)
+{
+   number_slots = MAX (number_threads, 1);
+   slot_id = epicsThreadPrivateCreate ();
+   slots = (Metrics_Slot *) callocMustSucceed
+       (number_slots, sizeof (Metrics_Slot), "Metrics_Initialise");
+}                               /* Metrics_Initialise */
+
+
+/*------------------------------------------------------------------------------
+ */
+void Metrics_Register_Thread (const int slot)
+{
+   if ((slots != NULL) && (slot >= 0) && (slot < number_slots)) {
+      epicsThreadPrivateSet (slot_id, &slots[slot]);
+   }
+}                               /* Metrics_Register_Thread */
+
+
+/*------------------------------------------------------------------------------
+ */
+void Metrics_Count (const Metric_Counter counter, const unsigned long amount)
+{
+   Metrics_Slot *slot = Thread_Slot ();
+
+   if (slot) {
+      slot->counter[counter] += amount;
+   }
+}                               /* Metrics_Count */
+
+
+/*------------------------------------------------------------------------------
+ */
+void Metrics_Dispatch_Latency (const double latency)
+{
+   Metrics_Slot *slot = Thread_Slot ();
+
+   if (slot) {
+      Observe (&slot->latency, latency);
+   }
+}                               /* Metrics_Dispatch_Latency */
+
+
+/*------------------------------------------------------------------------------
+ */
+void Metrics_Command (const double duration, const bool failed)
+{
+   Metrics_Slot *slot = Thread_Slot ();
+
+   if (slot) {
+      slot->counter[mcCommands]++;
+      if (failed) {
+         slot->counter[mcCommandFailures]++;
+      }
+      Observe (&slot->duration, duration);
+   }
+}                               /* Metrics_Command */
+
+
+/*------------------------------------------------------------------------------
+ */
+void Metrics_Printf (Metrics_Text * text, const char *format, ...)
+{
+   char *enlarged;
+   size_t capacity;
+   va_list args;
+   int length;
+
+   va_start (args, format);
+   length = vsnprintf (text->text ? text->text + text->length : NULL,
+                       text->capacity - text->length, format, args);
+   va_end (args);
+
+   if (length < 0) {
+      return;
+   }
+
+   if (text->length + length + 1 > text->capacity) {
+      capacity = MAX (4096, 2 * (text->length + length + 1));
+      enlarged = (char *) callocMustSucceed (capacity, 1, "Metrics_Printf");
+      if (text->length > 0) {
+         memcpy (enlarged, text->text, text->length);
+      }
+      free (text->text);
+      text->text = enlarged;
+      text->capacity = capacity;
+
+      va_start (args, format);
+      (void) vsnprintf (text->text + text->length,
+                        text->capacity - text->length, format, args);
+      va_end (args);
+   }
+   text->length += length;
+}                               /* Metrics_Printf */
+
+
+/*------------------------------------------------------------------------------
+ * Label values escape backslash, double quote and line feed.
+ */
+void Metrics_Label (Metrics_Text * text, const char *value)
+{
+   const char *s = value;
+   size_t n;
+
+   Metrics_Printf (text, "\"");
+   while (*s) {
+      n = strcspn (s, "\\\"\n");
+      if (n > 0) {
+         Metrics_Printf (text, "%.*s", (int) n, s);
+         s += n;
+      }
+      if (*s == '\n') {
+         Metrics_Printf (text, "\\n");
+         s++;
+      } else if (*s) {
+         Metrics_Printf (text, "\\%c", *s);
+         s++;
+      }
+   }
+   Metrics_Printf (text, "\"");
+}                               /* Metrics_Label */
+
+
+/*------------------------------------------------------------------------------
+ */
+void Metrics_Append_Runtime (Metrics_Text * text)
+{
+   unsigned long long total;
+   int number_queues;
+   int k;
+   int j;
+
+   if (slots == NULL) {
+      return;
+   }
+
+   for (j = 0; j < NUMBER_OF_METRIC_COUNTERS; j++) {
+      total = 0;
+      for (k = 0; k < number_slots; k++) {
+         total += slots[k].counter[j];
+      }
+      Metrics_Printf (text, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n",
+                      counter_names[j], counter_help[j], counter_names[j],
+                      counter_names[j], total);
+   }
+
+   Append_Histogram (text, "kryten_dispatch_latency_seconds",
+                     "Time from a callback being queued to its dispatch.",
+                     offsetof (Metrics_Slot, latency));
+   Append_Histogram (text, "kryten_command_duration_seconds",
+                     "Time taken by each command called.",
+                     offsetof (Metrics_Slot, duration));
+
+   number_queues = number_of_buffered_callback_queues ();
+   Metrics_Printf (text, "# HELP kryten_queue_depth Callbacks waiting to be"
+                   " dispatched.\n# TYPE kryten_queue_depth gauge\n");
+   for (k = 0; k < number_queues; k++) {
+      Metrics_Printf (text, "kryten_queue_depth{queue=\"%d\"} %d\n", k,
+                      number_of_buffered_callbacks_on_queue (k));
+   }
+
+   Metrics_Printf (text, "# HELP process_resident_memory_bytes Resident"
+                   " memory size in bytes.\n"
+                   "# TYPE process_resident_memory_bytes gauge\n"
+                   "process_resident_memory_bytes %llu\n",
+                   Resident_Memory ());
+}                               /* Metrics_Append_Runtime */
+
+
+/*------------------------------------------------------------------------------
+ */
+bool Metrics_Write_File (const char *filename, const Metrics_Text * text)
+{
+   char *temporary;
+   FILE *file;
+   bool status;
+
+   temporary = (char *) callocMustSucceed (strlen (filename) + 5, 1,
+                                           "Metrics_Write_File");
+   sprintf (temporary, "%s.tmp", filename);
+
+   file = fopen (temporary, "w");
+   if (file == NULL) {
+      printf ("unable to create metrics file %s\n", temporary);
+      free (temporary);
+      return false;
+   }
+
+   status = (fwrite (text->text, 1, text->length, file) == text->length);
+   status = (fclose (file) == 0) && status;
+   status = status && (rename (temporary, filename) == 0);
+   if (!status) {
+      printf ("unable to write metrics file %s\n", filename);
+      (void) unlink (temporary);
+   }
+
+   free (temporary);
+   return status;
+}                               /* Metrics_Write_File */
+
+
+/*------------------------------------------------------------------------------
+ */
+void Metrics_Text_Free (Metrics_Text * text)
+{
+   free (text->text);
+   text->text = NULL;
+   text->length = 0;
+   text->capacity = 0;
+}                               /* Metrics_Text_Free */
+
+/* end */
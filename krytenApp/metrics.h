@@ -0,0 +1,100 @@
+/* metrics.h
+ *
+ * Kryten is a EPICS PV monitoring program that calls a system command
+ * when the value of the PV matches/cease to match specified criteria.
+ *
+ * Copyright (C) 2011-2021  Andrew C. Starritt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact details:
+ * andrew.starritt@gmail.com
+ * PO Box 3118, Prahran East, Victoria 3181, Australia.
+ *
+ * Source code formatting:
+ * indent options:  -kr -pcs -i3 -cli3 -nbbo -nut
+ *
+ */
+
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#include <stddef.h>
+
+#include "kryten.h"
+
+/* Runtime metrics, output in the Prometheus text exposition format.
+ *
+ * Each dispatch thread has its own slot of counters and histograms, which only
+ * that thread updates, without locking. The slots are summed when the metrics
+ * are scraped, so a scrape may see an update or so late, but never slows the
+ * dispatch threads. Threads that have not registered use slot 0, i.e. the
+ * main thread's slot.
+ */
+typedef enum eMetric_Counter {
+   mcEvents = 0,                /* value updates received */
+   mcBytes,                     /* value update bytes received */
+   mcCommands,                  /* commands spawned */
+   mcCommandFailures,           /* commands that returned a non zero status */
+   NUMBER_OF_METRIC_COUNTERS
+} Metric_Counter;
+
+/* Text buffer used to build the exposition.
+ */
+typedef struct sMetrics_Text {
+   char *text;
+   size_t length;
+   size_t capacity;
+} Metrics_Text;
+
+/* Allocates the slots, one per dispatch thread. Until called, the functions
+ * that update the metrics do nothing.
+ */
+void Metrics_Initialise (const int number_threads);
+
+/* Called by each dispatch thread before it processes any callbacks.
+ */
+void Metrics_Register_Thread (const int slot);
+
+void Metrics_Count (const Metric_Counter counter, const unsigned long amount);
+
+/* Time from a callback being queued to its processing starting, in seconds.
+ */
+void Metrics_Dispatch_Latency (const double latency);
+
+/* A command has been called, and took duration seconds.
+ */
+void Metrics_Command (const double duration, const bool failed);
+
+/* Appends formatted text, enlarging the buffer as required.
+ */
+void Metrics_Printf (Metrics_Text * text, const char *format, ...);
+
+/* Appends the text as a label value, i.e. quoted and escaped.
+ */
+void Metrics_Label (Metrics_Text * text, const char *value);
+
+/* Appends the summed counters and histograms, the callback queue depths and
+ * the process resident memory size.
+ */
+void Metrics_Append_Runtime (Metrics_Text * text);
+
+/* Writes the text to a temporary file, which is then renamed, so that a
+ * reader, e.g. the node exporter textfile collector, never sees part files.
+ */
+bool Metrics_Write_File (const char *filename, const Metrics_Text * text);
+
+void Metrics_Text_Free (Metrics_Text * text);
+
+#endif                          /* METRICS_H_ */
@@ -0,0 +1,394 @@
+/* pattern.c
+ *
+ * Kryten is a EPICS PV monitoring program that calls a system command
+ * when the value of the PV matches/cease to match specified criteria.
+ *
+ * Copyright (C) 2011-2021  Andrew C. Starritt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact details:
+ * andrew.starritt@gmail.com
+ * PO Box 3118, Prahran East, Victoria 3181, Australia.
+ *
+ * Source code formatting:
+ * indent options:  -kr -pcs -i3 -cli3 -nbbo -nut
+ *
+ */
+
+#include <fnmatch.h>
+#include <regex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cantProceed.h>
+#include <epicsString.h>
+
+#include "pattern.h"
+
+struct sPattern {
+   Pattern_Kind kind;
+   char *text;
+   regex_t regex;               /* only used for pkRegex */
+
+   char *prefix;                /* literal that all matches start with */
+   size_t prefix_length;
+   char *required;              /* literal that all matches contain */
+   size_t required_length;
+   bool is_literal;             /* glob with no wildcards at all */
+};
+
+
+/*------------------------------------------------------------------------------
+ */
+static char *copy_literal (const char *from, const size_t length)
+{
+   char *result;
+
+   result = (char *) mallocMustSucceed (length + 1, "Pattern literal");
+   memcpy (result, from, length);
+   result[length] = '\0';
+   return result;
+}                               /* copy_literal */
+
+
+/*------------------------------------------------------------------------------
+ * The literal runs found while analysing a pattern.
+ */
+typedef struct sLiteral_Runs {
+   char run[256];
+   size_t run_length;
+   bool run_is_prefix;          /* the current run starts the pattern */
+   char best[256];              /* longest run so far */
+   size_t best_length;
+} Literal_Runs;
+
+
+/*------------------------------------------------------------------------------
+ * Ends the current literal run, noting it as the pattern's prefix if it starts
+ * the pattern, and as the best run if it is the longest so far.
+ */
+static void end_of_run (Pattern * pattern, Literal_Runs * runs)
+{
+   if (runs->run_is_prefix && (runs->run_length > 0)) {
+      pattern->prefix = copy_literal (runs->run, runs->run_length);
+      pattern->prefix_length = runs->run_length;
+   }
+   if (runs->run_length > runs->best_length) {
+      memcpy (runs->best, runs->run, runs->run_length);
+      runs->best_length = runs->run_length;
+   }
+   runs->run_length = 0;
+   runs->run_is_prefix = false;
+}                               /* end_of_run */
+
+
+/*------------------------------------------------------------------------------
+ * Appends a character to the current literal run - any excess is ignored.
+ */
+static void add_to_run (Literal_Runs * runs, const char c)
+{
+   if (runs->run_length < sizeof (runs->run)) {
+      runs->run[runs->run_length++] = c;
+   }
+}                               /* add_to_run */
+
+
+/*------------------------------------------------------------------------------
+ * Notes the longest run as the required literal, unless it is no longer than
+ * the prefix, which is checked anyway.
+ */
+static void note_required (Pattern * pattern, const Literal_Runs * runs)
+{
+   if (runs->best_length > pattern->prefix_length) {
+      pattern->required = copy_literal (runs->best, runs->best_length);
+      pattern->required_length = runs->best_length;
+   }
+}                               /* note_required */
+
+
+/*------------------------------------------------------------------------------
+ * All glob literal segments are required, and in order. We note the prefix,
+ * i.e. the first segment if it is at the start, and the longest segment.
+ */
+static void analyse_glob (Pattern * pattern)
+{
+   const char *p = pattern->text;
+   Literal_Runs runs;
+   bool wildcards = false;
+
+   runs.run_length = 0;
+   runs.run_is_prefix = true;
+   runs.best_length = 0;
+
+   while (true) {
+      if ((*p == '\0') || (*p == '*') || (*p == '?') || (*p == '[')) {
+         end_of_run (pattern, &runs);
+
+         if (*p == '\0') {
+            break;
+         }
+
+         wildcards = true;
+         if (*p == '[') {
+            /* Skip the bracket expression - ']' may be first member.
+             */
+            p++;
+            if ((*p == '!') || (*p == '^')) {
+               p++;
+            }
+            if (*p == ']') {
+               p++;
+            }
+            while ((*p != '\0') && (*p != ']')) {
+               p++;
+            }
+            if (*p == '\0') {
+               break;
+            }
+         }
+         p++;
+         continue;
+      }
+
+      if ((*p == '\\') && (p[1] != '\0')) {
+         p++;
+      }
+      add_to_run (&runs, *p);
+      p++;
+   }
+
+   pattern->is_literal = !wildcards;
+   note_required (pattern, &runs);
+}                               /* analyse_glob */
+
+
+/*------------------------------------------------------------------------------
+ * Finds the longest run of literal characters that any match must contain.
+ * We are conservative: any alternation disables the analysis, and anything
+ * within a group, or followed by an optional quantifier, ends the run.
+ */
+static void analyse_regex (Pattern * pattern)
+{
+   static const char *special = ".[]()*+?{}|^$\\";
+   const char *p = pattern->text;
+   Literal_Runs runs;
+   char c;
+
+   if (strchr (p, '|') != NULL) {
+      return;
+   }
+
+   runs.run_length = 0;
+   runs.run_is_prefix = false;
+   runs.best_length = 0;
+
+   if (*p == '^') {
+      runs.run_is_prefix = true;
+      p++;
+   }
+
+   while (*p != '\0') {
+      c = *p;
+
+      if ((c == '\\') && (p[1] != '\0') && (strchr (special, p[1]) != NULL)) {
+         /* Escaped special character is a literal.
+          */
+         c = p[1];
+         p++;
+      } else if (strchr (special, c) != NULL) {
+         /* Not a literal character. Skip over groups, bracket expressions
+          * and bounds, e.g. {2,5}, in their entirety.
+          */
+         end_of_run (pattern, &runs);
+         if (c == '[') {
+            p++;
+            if (*p == '^') {
+               p++;
+            }
+            if (*p == ']') {
+               p++;
+            }
+            while ((*p != '\0') && (*p != ']')) {
+               p++;
+            }
+         } else if (c == '(') {
+            int depth = 1;
+            while ((p[1] != '\0') && (depth > 0)) {
+               p++;
+               if (*p == '(') {
+                  depth++;
+               } else if (*p == ')') {
+                  depth--;
+               }
+            }
+         } else if (c == '{') {
+            while ((*p != '\0') && (*p != '}')) {
+               p++;
+            }
+         } else if (c == '\\') {
+            /* e.g. \w, \b - skip the following character too.
+             */
+            p++;
+         }
+         if (*p != '\0') {
+            p++;
+         }
+         continue;
+      }
+
+      p++;
+
+      /* A literal followed by a quantifier that may be zero, or a bound, is
+       * not required - the bound itself is skipped above.
+       */
+      if ((*p == '*') || (*p == '?') || (*p == '{')) {
+         end_of_run (pattern, &runs);
+         continue;
+      }
+
+      add_to_run (&runs, c);
+
+      if (*p == '+') {
+         /* Required at least once - but the run ends here.
+          */
+         end_of_run (pattern, &runs);
+      }
+   }
+   end_of_run (pattern, &runs);
+
+   note_required (pattern, &runs);
+}                               /* analyse_regex */
+
+
+/*------------------------------------------------------------------------------
+ * PUBLIC FUNCTIONS
+ *------------------------------------------------------------------------------
+ */
+Pattern *Pattern_Create (const Pattern_Kind kind, const char *text,
+                         char *error, const size_t error_size)
+{
+   Pattern *result;
+   int status;
+
+   result = (Pattern *) callocMustSucceed (1, sizeof (Pattern),
+                                           "Pattern_Create");
+   result->kind = kind;
+   result->text = epicsStrDup (text);
+   result->prefix = NULL;
+   result->prefix_length = 0;
+   result->required = NULL;
+   result->required_length = 0;
+   result->is_literal = false;
+
+   switch (kind) {
+
+      case pkRegex:
+         status = regcomp (&result->regex, text, REG_EXTENDED | REG_NOSUB);
+         if (status != 0) {
+            regerror (status, &result->regex, error, error_size);
+            free (result->text);
+            free (result);
+            return NULL;
+         }
+         analyse_regex (result);
+         break;
+
+      case pkGlob:
+         analyse_glob (result);
+         break;
+
+      default:
+         snprintf (error, error_size, "unexpected pattern kind %d",
+                   (int) kind);
+         free (result->text);
+         free (result);
+         return NULL;
+   }
+
+   return result;
+}                               /* Pattern_Create */
+
+
+/*------------------------------------------------------------------------------
+ */
+void Pattern_Free (Pattern * pattern)
+{
+   if (pattern) {
+      if (pattern->kind == pkRegex) {
+         regfree (&pattern->regex);
+      }
+      free (pattern->prefix);
+      free (pattern->required);
+      free (pattern->text);
+      free (pattern);
+   }
+}                               /* Pattern_Free */
+
+
+/*------------------------------------------------------------------------------
+ */
+const char *Pattern_Text (const Pattern * pattern)
+{
+   return pattern->text;
+}                               /* Pattern_Text */
+
+
+/*------------------------------------------------------------------------------
+ */
+Pattern_Kind Pattern_Get_Kind (const Pattern * pattern)
+{
+   return pattern->kind;
+}                               /* Pattern_Get_Kind */
+
+
+/*------------------------------------------------------------------------------
+ */
+bool Pattern_Match (const Pattern * pattern, const char *text,
+                    const size_t length)
+{
+   /* Literal pre-filters first.
+    */
+   if (pattern->prefix_length > 0) {
+      if ((length < pattern->prefix_length) ||
+          (memcmp (text, pattern->prefix, pattern->prefix_length) != 0)) {
+         return false;
+      }
+   }
+
+   if (pattern->required_length > 0) {
+      if ((length < pattern->required_length) ||
+          (strstr (text, pattern->required) == NULL)) {
+         return false;
+      }
+   }
+
+   /* Now the full automaton.
+    */
+   switch (pattern->kind) {
+      case pkRegex:
+         return (regexec (&pattern->regex, text, 0, NULL, 0) == 0);
+
+      case pkGlob:
+         if (pattern->is_literal) {
+            return (length == pattern->prefix_length);
+         }
+         return (fnmatch (pattern->text, text, 0) == 0);
+   }
+
+   return false;
+}                               /* Pattern_Match */
+
+/* end */
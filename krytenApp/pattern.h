@@ -0,0 +1,65 @@
+/* pattern.h
+ *
+ * Kryten is a EPICS PV monitoring program that calls a system command
+ * when the value of the PV matches/cease to match specified criteria.
+ *
+ * Copyright (C) 2011-2021  Andrew C. Starritt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact details:
+ * andrew.starritt@gmail.com
+ * PO Box 3118, Prahran East, Victoria 3181, Australia.
+ *
+ * Source code formatting:
+ * indent options:  -kr -pcs -i3 -cli3 -nbbo -nut
+ *
+ */
+
+#ifndef PATTERN_H_
+#define PATTERN_H_
+
+#include <stddef.h>
+
+#include "kryten.h"
+
+typedef enum ePattern_Kind {
+   pkRegex,                     /* POSIX extended regular expression */
+   pkGlob                       /* shell wildcard pattern, as per fnmatch */
+} Pattern_Kind;
+
+/* A Pattern is compiled once, when the configuration is read. As well as the
+ * compiled automaton, it holds any literal prefix and/or literal substring
+ * that every matching string must contain. These are checked first, so that
+ * the vast majority of non-matching values are rejected with a memcmp/strstr.
+ */
+typedef struct sPattern Pattern;
+
+/* Returns NULL if the pattern is invalid, in which case a description of the
+ * error is written to error.
+ */
+Pattern *Pattern_Create (const Pattern_Kind kind, const char *text,
+                         char *error, const size_t error_size);
+
+void Pattern_Free (Pattern * pattern);
+
+const char *Pattern_Text (const Pattern * pattern);
+Pattern_Kind Pattern_Get_Kind (const Pattern * pattern);
+
+/* The text must be '\0' terminated - length is the length of text.
+ */
+bool Pattern_Match (const Pattern * pattern, const char *text,
+                    const size_t length);
+
+#endif                          /* PATTERN_H_ */
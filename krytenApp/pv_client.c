@@ -27,22 +27,30 @@
  *
  */
 
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <sys/stat.h>
 
 #include <caerr.h>
 #include <cantProceed.h>
 #include <db_access.h>
+#include <epicsMutex.h>
 #include <epicsString.h>
 #include <epicsThread.h>
 #include <epicsTypes.h>
 
 #include "buffered_callbacks.h"
+#include "control.h"
 #include "filter.h"
+#include "host_events.h"
+#include "metrics.h"
 #include "pv_client.h"
 #include "read_configuration.h"
+#include "rule_cache.h"
+#include "workers.h"
 
 
 /* EPICS timestamp epoch: This is Mon Jan  1 00:00:00 1990 UTC.
@@ -56,7 +64,7 @@ static const time_t epics_epoch = 631152000;
  * pointer to one of these as user data. It is the distinct address
  * as opposed to the content that is important.
  */
-static int Get;
+static int Property;
 static int Event;
 static int Put;
 
@@ -67,6 +75,109 @@ static long start_time = 0;
 static unsigned long cycle = 0;
 
 
+/*------------------------------------------------------------------------------
+ * LOCAL DATA
+ *------------------------------------------------------------------------------
+ */
+static ELLLIST CA_Client_List = ELLLIST_INIT;
+static ELLLIST PV_Channel_List = ELLLIST_INIT;
+
+/* Configuration reload, on SIGHUP or when the configuration file changes.
+ * Only available when the configuration is read from a file.
+ */
+static char *config_filename = NULL;
+static double reload_interval = 0.0;    /* seconds, 0 means SIGHUP only */
+static double metrics_interval = 15.0;  /* seconds */
+
+/* The configuration file and the files it includes, as last read.
+ */
+typedef struct sWatched_File {
+   char *name;
+   bool exists;
+   struct timespec mtime;
+   off_t size;
+} Watched_File;
+
+static Watched_File *watched_files = NULL;
+static int number_watched = 0;
+
+/* Channel table - hashed on PV name. Channels for the same PV name but with
+ * different channel options are distinct channels in the same chain.
+ */
+static PV_Channel **channel_table = NULL;
+static unsigned int channel_table_size = 0;
+
+/* Unit table - hashed on signature. Holds the first client of each unit, see
+ * Same_Unit, and so identifies the clients to keep on reload or to remove on
+ * request.
+ */
+static CA_Client **unit_table = NULL;
+static unsigned int unit_table_size = 0;
+static unsigned int number_units = 0;
+
+/* Channels whose subscribers or shard have changed since the channel changes
+ * were last applied, see Apply_Channel_Changes.
+ */
+static PV_Channel **changed_channels = NULL;
+static int number_changed = 0;
+static int changed_capacity = 0;
+
+/* Set once the current batch of control requests has paused the dispatch
+ * workers in order to add or remove units.
+ */
+static bool control_changing = false;
+
+/* Channel creation pacing and connection progress. Channels are created in
+ * batches, one batch per processing cycle, and each channel is allowed the
+ * connect timeout from its own creation time. The pending queue holds the
+ * created but not yet connected channels in creation order, and hence in
+ * connect timeout order. Likewise the not found queue, in park time order.
+ */
+static int create_batch = 1000;         /* channels per cycle, 0 means all */
+static double connect_timeout = 2.0;    /* seconds */
+static int timeout_reports = 20;        /* maximum reports per second */
+static const double progress_interval = 10.0;   /* seconds */
+
+/* Channels not found for park_after seconds are cleared, i.e. parked, and
+ * re-created after park_retry seconds. The retry interval doubles each time
+ * the channel is still not found, up to park_retry_max seconds.
+ */
+static double park_after = 60.0;        /* 0 means never park */
+static double park_retry = 30.0;
+static double park_retry_max = 3600.0;
+
+typedef struct sChannel_Queue {
+   PV_Channel **items;
+   int head;
+   int tail;
+   int capacity;
+} Channel_Queue;
+
+static PV_Channel *next_to_create = NULL;
+static Channel_Queue pending_queue = { NULL, 0, 0, 0 };
+static Channel_Queue not_found_queue = { NULL, 0, 0, 0 };
+static Channel_Queue parked_set = { NULL, 0, 0, 0 };      /* unordered */
+
+static int state_counts[NUMBER_CONNECTION_STATES];
+static unsigned long number_connects = 0;
+
+/* Protects the connection state of all channels, and the above counters and
+ * queues, as connection callbacks may be processed by dispatch workers.
+ */
+static epicsMutexId connection_mutex = NULL;
+
+/* Channel Access contexts. Each context has its own auxiliary threads, and
+ * hence its own receive threads, so that very large numbers of channels may
+ * be spread over several contexts. Each channel is assigned to one context.
+ */
+static struct ca_client_context *contexts[MAXIMUM_CONTEXTS];
+static int contexts_created = 0;
+
+static double report_window_start = 0.0;
+static int reports_in_window = 0;
+static int reports_suppressed = 0;
+
+
 /*------------------------------------------------------------------------------
  * PRIVATE FUNCTIONS
  *------------------------------------------------------------------------------
@@ -78,325 +189,806 @@ static void Report (const char *text)
 
 
 /*------------------------------------------------------------------------------
+ * FNV-1a hash of the PV name.
  */
-static void Create_Channel (CA_Client * pClient)
+static unsigned int Channel_Hash (const char *pv_name)
 {
-   int status;
+   unsigned int hash = 2166136261u;
+   const unsigned char *s;
 
-   pClient->is_connected = false;
-   status = ca_create_channel
-       (pClient->pv_name, buffered_connection_handler,
-        pClient, 10, &pClient->channel_id);
-   if (status != ECA_NORMAL) {
-      printf ("ca_create_channel (%s) failed (%s)\n", pClient->pv_name,
-              ca_message (status));
+   for (s = (const unsigned char *) pv_name; *s; s++) {
+      hash = (hash ^ *s) * 16777619u;
    }
-}                               /* Create_Channel */
+   return hash;
+}                               /* Channel_Hash */
 
 
 /*------------------------------------------------------------------------------
- * Get initial data and subscribe for updates.
+ * (Re)builds the channel table such that it has at least size entries.
  */
-static void Subscribe_Channel (CA_Client * pClient)
+static void Resize_Channel_Table (const unsigned int size)
 {
-   unsigned long count;
-   Variant_Kind kind;
-   chtype initial_type;
-   chtype update_type;
-   size_t size;
-   unsigned long truncated;
-   int status;
-
-   count = pClient->element_count;
-   if (count == 0) {
-      printf ("element count (%s) is zero\n", pClient->pv_name);
-      return;
+   PV_Channel *pChannel;
+   unsigned int slot;
+
+   free (channel_table);
+   channel_table_size = size;
+   channel_table = (PV_Channel **) callocMustSucceed
+       (size, sizeof (PV_Channel *), "Resize_Channel_Table");
+
+   pChannel = (PV_Channel *) ellFirst (&PV_Channel_List);
+   while (pChannel) {
+      slot = Channel_Hash (pChannel->pv_name) % size;
+      pChannel->hash_next = channel_table[slot];
+      channel_table[slot] = pChannel;
+      pChannel = (PV_Channel *) ellNext ((ELLNODE *) pChannel);
    }
+}                               /* Resize_Channel_Table */
 
-   /* Determine initial buffer request type and subscription buffer
-    * request type, based on the first match criteria field type.
-    */
-   kind = pClient->match_set_collection.item[0].lower.kind;
-   switch (kind) {
 
-      case vkString:
-         initial_type = DBR_STS_STRING;
-         update_type = DBR_TIME_STRING;
-         size = sizeof (dbr_string_t);
-         break;
+/*------------------------------------------------------------------------------
+ */
+static bool Same_Options (const Channel_Options * a,
+                          const Channel_Options * b)
+{
+   return (a->deadband == b->deadband) &&
+       (a->is_relative == b->is_relative) &&
+       (a->event_mask == b->event_mask) &&
+       (a->priority == b->priority);
+}                               /* Same_Options */
 
-      case vkInteger:
-         initial_type = DBR_CTRL_LONG;
-         update_type = DBR_TIME_LONG;
-         size = sizeof (dbr_long_t);
-         break;
 
-      case vkFloating:
-         initial_type = DBR_CTRL_DOUBLE;
-         update_type = DBR_TIME_DOUBLE;
-         size = sizeof (dbr_double_t);
-         break;
+/*------------------------------------------------------------------------------
+ * Finds the channel for the given (interned) PV name and channel options,
+ * creating a new channel if needs be.
+ */
+static PV_Channel *Find_Or_Create_Channel (const char *pv_name,
+                                           const Channel_Options * options)
+{
+   PV_Channel *pChannel;
+   unsigned int slot;
 
-      default:
-         printf ("%s: match type is invalid (%s)\n", pClient->pv_name,
-                 vkImage (kind));
-         return;
+   if (channel_table_size == 0) {
+      Resize_Channel_Table (256);
+   }
+
+   slot = Channel_Hash (pv_name) % channel_table_size;
+   for (pChannel = channel_table[slot]; pChannel;
+        pChannel = pChannel->hash_next) {
+      if ((pChannel->pv_name == pv_name) &&
+          Same_Options (&pChannel->options, options)) {
+         return pChannel;
+      }
    }
 
-   /* If the PV does not support request element, then do not read or
-    * subscrible for data.
+   pChannel = (PV_Channel *) callocMustSucceed
+       (1, sizeof (PV_Channel), "Find_Or_Create_Channel");
+
+   pChannel->magic1 = PV_CHANNEL_MAGIC;
+   pChannel->magic2 = PV_CHANNEL_MAGIC;
+   pChannel->pv_name = pv_name;
+   pChannel->ca_name = pv_name;
+   pChannel->host_name = "";
+   pChannel->options = *options;
+   pChannel->request_count = 1;
+   pChannel->lowest_index = 0;
+   pChannel->first_element = 0;
+   pChannel->filter_retried = false;
+   pChannel->is_connected = false;
+   pChannel->state = csNotCreated;
+   pChannel->channel_id = NULL;
+   pChannel->event_id = NULL;
+   pChannel->property_event_id = NULL;
+   pChannel->subscribers = NULL;
+   pChannel->last_subscriber = NULL;
+   pChannel->number_subscribers = 0;
+   pChannel->subscribers_added = false;
+   pChannel->shard_next = pChannel;
+
+   ellAdd (&PV_Channel_List, (ELLNODE *) pChannel);
+   state_counts[csNotCreated]++;
+
+   /* Keep load factor at most one.
     */
-   if (pClient->element_index > count) {
-      printf
-          ("%s has %lu elements, element %d not available\n",
-           pClient->pv_name, count, pClient->element_index);
-      return;
+   if ((unsigned int) ellCount (&PV_Channel_List) > channel_table_size) {
+      Resize_Channel_Table (2 * channel_table_size);
+   } else {
+      pChannel->hash_next = channel_table[slot];
+      channel_table[slot] = pChannel;
    }
 
-   if (pClient->element_index < count) {
-      truncated = pClient->element_index;
+   return pChannel;
+}                               /* Find_Or_Create_Channel */
 
-      printf
-          ("%s array get/subscription truncated from %lu (size %lu) to %lu elements\n",
-           pClient->pv_name, count, size, truncated);
 
-      count = truncated;
+/*------------------------------------------------------------------------------
+ * Adds the channel to the changed channels list, if not already on it.
+ */
+static void Mark_Changed (PV_Channel * pChannel)
+{
+   PV_Channel **enlarged;
+
+   if (pChannel->is_changed) {
+      return;
+   }
+
+   if (number_changed >= changed_capacity) {
+      changed_capacity = MAX (64, 2 * changed_capacity);
+      enlarged = (PV_Channel **) callocMustSucceed
+          (changed_capacity, sizeof (PV_Channel *), "Mark_Changed");
+      if (number_changed > 0) {
+         memcpy (enlarged, changed_channels,
+                 number_changed * sizeof (PV_Channel *));
+      }
+      free (changed_channels);
+      changed_channels = enlarged;
    }
+   changed_channels[number_changed++] = pChannel;
+   pChannel->is_changed = true;
+}                               /* Mark_Changed */
 
-   /* Initial request
+
+/*------------------------------------------------------------------------------
+ * Attaches the client to the channel for its PV name and channel options.
+ */
+static void Attach_Client (CA_Client * pClient)
+{
+   PV_Channel *pChannel;
+   CA_Client **last;
+   unsigned long lowest;
+
+   pChannel = Find_Or_Create_Channel (pClient->pv_name, &pClient->options);
+
+   /* Whole array predicates need every element, otherwise request upto
+    * the highest element index referenced by any subscriber. Alarm severity
+    * and status clients do not reference any element.
     */
-   status = ca_array_get_callback
-       (initial_type, count, pClient->channel_id,
-        buffered_event_handler, &Get);
+   if (pClient->target != mtValue) {
+      /* no element requirements */
+   } else if (pClient->array_predicate.kind != apNone) {
+      pChannel->request_count = 0;
+   } else if ((pChannel->request_count != 0) &&
+              (pClient->element_index > pChannel->request_count)) {
+      pChannel->request_count = pClient->element_index;
+   }
 
-   if (status != ECA_NORMAL) {
-      printf ("ca_array_get_callback (%s) failed (%s)\n", pClient->pv_name,
-              ca_message (status));
-      return;
+   /* Track the lowest element index referenced, for array filters.
+    */
+   if (pClient->target == mtValue) {
+      lowest = pClient->element_list ? pClient->element_list->index[0] :
+          pClient->element_index;
+      if ((pChannel->lowest_index == 0) || (lowest < pChannel->lowest_index)) {
+         pChannel->lowest_index = lowest;
+      }
    }
 
-   /* ... and now subscribe for time stamped data updates as well.
+   /* Append, so that subscribers are processed in configuration file order.
     */
-   status = ca_create_subscription
-       (update_type, count, pClient->channel_id,
-        DBE_VALUE | DBE_ALARM, buffered_event_handler,
-        &Event, &pClient->event_id);
+   last = pChannel->last_subscriber ?
+       &pChannel->last_subscriber->next_subscriber : &pChannel->subscribers;
+   *last = pClient;
+   pChannel->last_subscriber = pClient;
+   pClient->next_subscriber = NULL;
+   pClient->channel = pChannel;
+   pChannel->number_subscribers++;
+}                               /* Attach_Client */
 
-   if (status != ECA_NORMAL) {
-      printf ("ca_create_subscription (%s) failed (%s)\n",
-              pClient->pv_name, ca_message (status));
+
+/*------------------------------------------------------------------------------
+ * The clients of an expression or sequence are consecutive in the client
+ * list, and are added, removed and reloaded as one unit. Every other client
+ * is a unit on its own.
+ */
+static bool Same_Unit (const CA_Client * first, const CA_Client * pClient)
+{
+   if ((pClient == NULL) || (pClient == first)) {
+      return pClient == first;
    }
+   return ((first->expression != NULL) &&
+           (pClient->expression == first->expression)) ||
+       ((first->sequence != NULL) && (pClient->sequence == first->sequence));
+}                               /* Same_Unit */
 
-   pClient->is_first_update = true;
 
-}                               /* Subscribe_Channel */
+/*------------------------------------------------------------------------------
+ * Returns the first client of the next unit.
+ */
+static CA_Client *Next_Unit (const CA_Client * first)
+{
+   CA_Client *pClient;
+
+   pClient = (CA_Client *) ellNext ((ELLNODE *) first);
+   while (pClient && Same_Unit (first, pClient)) {
+      pClient = (CA_Client *) ellNext ((ELLNODE *) pClient);
+   }
+   return pClient;
+}                               /* Next_Unit */
 
 
 /*------------------------------------------------------------------------------
- * Processes received data
- *
- * Arguments passed to event handlers and get/put call back handlers.   
- *
- * The status field below is the CA ECA_XXX status of the requested
- * operation which is saved from when the operation was attempted in the
- * server and copied back to the clients call back routine.
- * If the status is not ECA_NORMAL then the dbr pointer will be NULL
- * and the requested operation can not be assumed to be successful.
- *
- *   typedef struct event_handler_args {
- *       void            *usr;    -- user argument supplied with request
- *       chanId          chid;    -- channel id
- *       long            type;    -- the type of the item returned
- *       long            count;   -- the element count of the item returned
- *       READONLY void   *dbr;    -- a pointer to the item returned
- *       int             status;  -- ECA_XXX status from the server
- *   } evargs;
- *
+ * Moves the unit starting at first from one list to the end of another.
  */
-static void Get_Event_Handler (CA_Client * pClient,
-                               const struct event_handler_args *args)
+static void Move_Unit (ELLLIST * from, ELLLIST * to, CA_Client * first)
 {
-   const char *function = "Get_Event_Handler";
+   CA_Client *next = Next_Unit (first);
+   CA_Client *pClient = first;
+   CA_Client *following;
+
+   while (pClient != next) {
+      following = (CA_Client *) ellNext ((ELLNODE *) pClient);
+      ellDelete (from, (ELLNODE *) pClient);
+      ellAdd (to, (ELLNODE *) pClient);
+      pClient = following;
+   }
+}                               /* Move_Unit */
+
 
-/* Local "functons" that make use of naming regularity 
+/*------------------------------------------------------------------------------
+ * Frees the client and all that it owns, other than any expression or
+ * sequence, which is shared by all the expression's or sequence's inputs.
  */
-#define ASSIGN_STATUS(from) {                                               \
-   pClient->status = from.status;                                           \
-   pClient->severity = from.severity;                                       \
-}
+static void Free_Client (CA_Client * pClient)
+{
+   Element_List *list = pClient->element_list;
+   unsigned int j;
+
+   for (j = 0; j < pClient->match_set_collection.count; j++) {
+      String_Set_Free (pClient->match_set_collection.item[j].set);
+      Pattern_Free (pClient->match_set_collection.item[j].pattern);
+   }
+   free (pClient->array_predicate.intervals);
+
+   if (list) {
+      free (list->index);
+      free (list->matched);
+      free (list->image);
+      free (list->previous);
+      free (list);
+   }
 
+   free (pClient->signature);
+   free (pClient);
+}                               /* Free_Client */
 
-/* Convert EPICS time to system time. 
- * EPICS is number secons since 01-Jan-1990 where as
- * System time is number secons since 01-Jan-1970. 
+
+/*------------------------------------------------------------------------------
+ * Removes the unit starting at first from the list, and frees its clients
+ * together with any expression or sequence.
  */
-#define ASSIGN_STATUS_AND_TIME(from) {                                      \
-   pClient->data_element_count = args->count;                               \
-   pClient->status = from.status;                                           \
-   pClient->severity = from.severity;                                       \
-   pClient->update_time = epics_epoch + from.stamp.secPastEpoch;            \
-   pClient->nano_sec = from.stamp.nsec;                                     \
-}
+static void Free_Unit (ELLLIST * list, CA_Client * first)
+{
+   CA_Client *next = Next_Unit (first);
+   Expression *expression = first->expression;
+   Sequence *sequence = first->sequence;
+   CA_Client *pClient = first;
+   CA_Client *following;
+
+   while (pClient != next) {
+      following = (CA_Client *) ellNext ((ELLNODE *) pClient);
+      ellDelete (list, (ELLNODE *) pClient);
+      Free_Client (pClient);
+      pClient = following;
+   }
 
+   Expression_Free (expression);
+   Sequence_Free (sequence);
+}                               /* Free_Unit */
 
 
-#define ASSIGN_NUMERIC(from, prec) {                                        \
-   pClient->precision = prec;                                               \
-   strcpy (pClient->units, pDbr->cfltval.units);                            \
-   pClient->num_states = 0;                                                 \
-   pClient->upper_disp_limit    = (double) from.upper_disp_limit;           \
-   pClient->lower_disp_limit    = (double) from.lower_disp_limit;           \
-   pClient->upper_alarm_limit   = (double) from.upper_alarm_limit;          \
-   pClient->upper_warning_limit = (double) from.upper_warning_limit;        \
-   pClient->lower_warning_limit = (double) from.lower_warning_limit;        \
-   pClient->lower_alarm_limit   = (double) from.lower_alarm_limit;          \
-   pClient->upper_ctrl_limit    = (double) from.upper_ctrl_limit;           \
-   pClient->lower_ctrl_limit    = (double) from.lower_ctrl_limit;           \
-}
+/*------------------------------------------------------------------------------
+ * Removes the client from its channel's subscribers.
+ */
+static void Detach_Client (CA_Client * pClient)
+{
+   PV_Channel *pChannel = pClient->channel;
+   CA_Client *previous = NULL;
+   CA_Client **link;
 
+   if (pChannel == NULL) {
+      return;
+   }
 
-#define CLEAR_NUMERIC {                                                     \
-   pClient->precision = 0;                                                  \
-   pClient->units[0] = '\0';                                                \
-   pClient->num_states = 0;                                                 \
-   pClient->upper_disp_limit    = 0.0;                                      \
-   pClient->lower_disp_limit    = 0.0;                                      \
-   pClient->upper_alarm_limit   = 0.0;                                      \
-   pClient->upper_warning_limit = 0.0;                                      \
-   pClient->lower_warning_limit = 0.0;                                      \
-   pClient->lower_alarm_limit   = 0.0;                                      \
-   pClient->upper_ctrl_limit    = 0.0;                                      \
-   pClient->lower_ctrl_limit    = 0.0;                                      \
-}
+   link = &pChannel->subscribers;
+   while (*link && (*link != pClient)) {
+      previous = *link;
+      link = &(*link)->next_subscriber;
+   }
+   if (*link) {
+      *link = pClient->next_subscriber;
+      pChannel->number_subscribers--;
+      if (pChannel->last_subscriber == pClient) {
+         pChannel->last_subscriber = previous;
+      }
+      Mark_Changed (pChannel);
+   }
+   pClient->channel = NULL;
+   pClient->next_subscriber = NULL;
+}                               /* Detach_Client */
 
 
-   const union db_access_val *pDbr = (union db_access_val *) args->dbr;
-   int number;
-   int e;
-   Variant_Kind kind;
-   bool enums_as_string;
-   dbr_short_t enum_value;
+/*------------------------------------------------------------------------------
+ * (Re)builds the unit table such that it has at least size entries. The
+ * existing entries are rehashed, as units being reloaded may not be in the
+ * client list.
+ */
+static void Resize_Unit_Table (const unsigned int size)
+{
+   CA_Client **old_table = unit_table;
+   const unsigned int old_size = unit_table_size;
+   CA_Client *first;
+   CA_Client *next;
+   unsigned int slot;
+   unsigned int j;
 
-   /* Get number of elements.
-    */
-   number = MAX (0, args->count);
+   unit_table_size = size;
+   unit_table = (CA_Client **) callocMustSucceed
+       (size, sizeof (CA_Client *), "Resize_Unit_Table");
 
-   if (number < pClient->element_index) {
-      printf
-          ("%s (%s): received elements (%d) less than expected (%d) for buffer type %ld\n",
-           function, pClient->pv_name, number, pClient->element_index,
-           args->type);
-      return;
+   for (j = 0; j < old_size; j++) {
+      for (first = old_table[j]; first; first = next) {
+         next = first->signature_next;
+         slot = Channel_Hash (first->signature) % size;
+         first->signature_next = unit_table[slot];
+         unit_table[slot] = first;
+      }
    }
-   /* Form aray access index 
-    */
-   e = number - 1;
+   free (old_table);
+}                               /* Resize_Unit_Table */
 
-   kind = pClient->match_set_collection.item[0].lower.kind;
-   enums_as_string = (kind == vkString);
 
-   switch (args->type) {
+/*------------------------------------------------------------------------------
+ * Enters the unit starting at first into the unit table.
+ */
+static void Unit_Table_Insert (CA_Client * first)
+{
+   unsigned int slot;
 
-   /** Control updates all meta data plus values (ingnored) **/
+   /* Keep load factor at most one.
+    */
+   if (number_units >= unit_table_size) {
+      Resize_Unit_Table (unit_table_size ? 2 * unit_table_size : 256);
+   }
 
-      case DBR_STS_STRING:
-         ASSIGN_STATUS (pDbr->sstrval);
-         CLEAR_NUMERIC;
-         pClient->data.kind = vkString;
-         strncpy (pClient->data.value.sval,
-                  (&pDbr->sstrval.value)[e], MAX_STRING_SIZE);
-         pClient->data.value.sval[MAX_STRING_SIZE] = '\0';
-         break;
+   slot = Channel_Hash (first->signature) % unit_table_size;
+   first->signature_next = unit_table[slot];
+   unit_table[slot] = first;
+   number_units++;
+}                               /* Unit_Table_Insert */
 
-      case DBR_CTRL_SHORT:
-         ASSIGN_STATUS (pDbr->cshrtval);
-         ASSIGN_NUMERIC (pDbr->cshrtval, 0);
-         pClient->data.kind = vkInteger;
-         pClient->data.value.ival = (long) (&pDbr->cshrtval.value)[e];
-         break;
 
-      case DBR_CTRL_FLOAT:
-         ASSIGN_STATUS (pDbr->cfltval);
-         ASSIGN_NUMERIC (pDbr->cfltval, pDbr->cfltval.precision);
-         pClient->data.kind = vkFloating;
-         pClient->data.value.dval = (double) (&pDbr->cfltval.value)[e];
-         break;
+/*------------------------------------------------------------------------------
+ */
+static void Unit_Table_Remove (CA_Client * first)
+{
+   CA_Client **link;
 
-      case DBR_CTRL_ENUM:
-         ASSIGN_STATUS (pDbr->cenmval);
-         CLEAR_NUMERIC;
-         pClient->num_states = pDbr->cenmval.no_str;
-         memcpy (pClient->enum_strings, pDbr->cenmval.strs,
-                 sizeof (pClient->enum_strings));
+   if (unit_table_size == 0) {
+      return;
+   }
 
-         enum_value = (dbr_short_t) (&pDbr->cenmval.value)[e];
-         if (enums_as_string) {
-            pClient->data.kind = vkString;
-            if (enum_value < pClient->num_states) {
-               strncpy (pClient->data.value.sval,
-                        pClient->enum_strings[enum_value],
-                        MAX_ENUM_STRING_SIZE);
-               pClient->data.value.sval[MAX_ENUM_STRING_SIZE] = '\0';
-            } else {
-               pClient->data.value.sval[0] = '\0';
-            }
-         } else {
-            pClient->data.kind = vkInteger;
-            pClient->data.value.ival = (long) enum_value;
-         }
-         break;
+   link = &unit_table[Channel_Hash (first->signature) % unit_table_size];
+   while (*link && (*link != first)) {
+      link = &(*link)->signature_next;
+   }
+   if (*link) {
+      *link = first->signature_next;
+      number_units--;
+   }
+   first->signature_next = NULL;
+}                               /* Unit_Table_Remove */
 
-      case DBR_CTRL_CHAR:
-         ASSIGN_STATUS (pDbr->cchrval);
-         ASSIGN_NUMERIC (pDbr->cchrval, 0);
-         pClient->data.kind = vkInteger;
-         pClient->data.value.ival = (long) (&pDbr->cchrval.value)[e];
-         break;
 
-      case DBR_CTRL_LONG:
-         ASSIGN_STATUS (pDbr->clngval);
-         ASSIGN_NUMERIC (pDbr->clngval, 0);
-         pClient->data.kind = vkInteger;
-         pClient->data.value.ival = (long) (&pDbr->clngval.value)[e];
-         break;
+/*------------------------------------------------------------------------------
+ * Returns the first client of a unit with the given signature, or NULL.
+ */
+static CA_Client *Unit_Table_Find (const char *signature)
+{
+   CA_Client *first;
 
-      case DBR_CTRL_DOUBLE:
-         ASSIGN_STATUS (pDbr->cdblval);
-         ASSIGN_NUMERIC (pDbr->cdblval, pDbr->cdblval.precision);
-         pClient->data.kind = vkFloating;
-         pClient->data.value.dval = (double) (&pDbr->cdblval.value)[e];
-         break;
+   if (unit_table_size == 0) {
+      return NULL;
+   }
 
-   /** Time updates values [count], time, severity and status **/
+   first = unit_table[Channel_Hash (signature) % unit_table_size];
+   while (first && (strcmp (first->signature, signature) != 0)) {
+      first = first->signature_next;
+   }
+   return first;
+}                               /* Unit_Table_Find */
 
-      case DBR_TIME_STRING:
-         ASSIGN_STATUS_AND_TIME (pDbr->tstrval);
-         pClient->data.kind = vkString;
-         strncpy (pClient->data.value.sval,
-                  (&pDbr->tstrval.value)[e], MAX_STRING_SIZE);
-         pClient->data.value.sval[MAX_STRING_SIZE] = '\0';
-         break;
 
-      case DBR_TIME_SHORT:
-         ASSIGN_STATUS_AND_TIME (pDbr->tshrtval);
-         pClient->data.kind = vkInteger;
-         pClient->data.value.ival = (long) (&pDbr->tshrtval.value)[e];
-         break;
+/*------------------------------------------------------------------------------
+ * Sets up the name used to connect the channel, which may include server side
+ * channel filters:
+ *
+ * When array filters are in use and only a slice of the array is required,
+ * an "arr" filter is added, e.g. WF.{"arr":{"s":9,"e":19}}, and the first
+ * element sent is then the zero based index of the lowest element required.
+ *
+ * When a deadband is specified, a "dbnd" filter is added, e.g.
+ * AI.{"dbnd":{"m":"rel","d":5}}.
+ */
+static void Set_Channel_Name (PV_Channel * pChannel)
+{
+   const Channel_Options *options = &pChannel->options;
+   char filters[120];
+   size_t n;
+
+   filters[0] = '\0';
+   n = 0;
+   pChannel->first_element = 0;
+
+   if (!pChannel->filter_retried) {
+      if (use_array_filter && (pChannel->request_count != 0) &&
+          (pChannel->lowest_index > 1)) {
+         pChannel->first_element = pChannel->lowest_index - 1;
+         n += snprintf (filters + n, sizeof (filters) - n,
+                        "%s\"arr\":{\"s\":%lu,\"e\":%lu}", n ? "," : "",
+                        pChannel->first_element, pChannel->request_count - 1);
+      }
 
-      case DBR_TIME_FLOAT:
-         ASSIGN_STATUS_AND_TIME (pDbr->tfltval);
-         pClient->data.kind = vkFloating;
-         pClient->data.value.dval = (double) (&pDbr->tfltval.value)[e];
-         break;
+      if ((options->deadband > 0.0) && (n < sizeof (filters))) {
+         n += snprintf (filters + n, sizeof (filters) - n,
+                        "%s\"dbnd\":{%s\"d\":%.15g}", n ? "," : "",
+                        options->is_relative ? "\"m\":\"rel\"," : "",
+                        options->deadband);
+      }
+   }
 
-      case DBR_TIME_ENUM:
-         ASSIGN_STATUS_AND_TIME (pDbr->tenmval);
-         enum_value = (dbr_short_t) (&pDbr->tenmval.value)[e];
-         if (enums_as_string) {
+   pChannel->is_filtered = (n > 0);
+   if (pChannel->is_filtered) {
+      /* A field name may already be specified, e.g. "WF.VAL".
+       */
+      const size_t size = strlen (pChannel->pv_name) + strlen (filters) + 4;
+      char *ca_name = (char *) callocMustSucceed (size, 1, "Set_Channel_Name");
+
+      snprintf (ca_name, size, "%s%s{%s}", pChannel->pv_name,
+                strchr (pChannel->pv_name, '.') ? "" : ".", filters);
+      pChannel->ca_name = Intern_String (ca_name);
+      free (ca_name);
+   } else {
+      pChannel->ca_name = pChannel->pv_name;
+   }
+}                               /* Set_Channel_Name */
+
+
+/*------------------------------------------------------------------------------
+ */
+static void Set_Connection_State (PV_Channel * pChannel,
+                                  const Connection_State state)
+{
+   state_counts[pChannel->state]--;
+   state_counts[state]++;
+   pChannel->state = state;
+}                               /* Set_Connection_State */
+
+
+/*------------------------------------------------------------------------------
+ * Appends the channel to the queue. The queue is compacted, or enlarged, as
+ * required.
+ */
+static void Queue_Append (Channel_Queue * queue, PV_Channel * pChannel)
+{
+   PV_Channel **items;
+   int count;
+
+   if (queue->tail >= queue->capacity) {
+      count = queue->tail - queue->head;
+      if ((queue->capacity == 0) || (2 * count > queue->capacity)) {
+         queue->capacity = queue->capacity ? 2 * queue->capacity : 1024;
+      }
+      items = (PV_Channel **) callocMustSucceed
+          (queue->capacity, sizeof (PV_Channel *), "Queue_Append");
+      if (count > 0) {
+         memcpy (items, &queue->items[queue->head],
+                 count * sizeof (PV_Channel *));
+      }
+      free (queue->items);
+      queue->items = items;
+      queue->head = 0;
+      queue->tail = count;
+   }
+
+   queue->items[queue->tail++] = pChannel;
+}                               /* Queue_Append */
+
+
+/*------------------------------------------------------------------------------
+ */
+static void Queue_Free (Channel_Queue * queue)
+{
+   free (queue->items);
+   queue->items = NULL;
+   queue->head = queue->tail = queue->capacity = 0;
+}                               /* Queue_Free */
+
+
+/*------------------------------------------------------------------------------
+ * Attaches the calling thread to the specified context, if need be. Only the
+ * creation of channels and the flushing of requests depend upon the calling
+ * thread's context; all other calls use the channel's own context.
+ */
+static void Use_Context (const int index)
+{
+   int status;
+
+   if (ca_current_context () != contexts[index]) {
+      ca_detach_context ();
+      status = ca_attach_context (contexts[index]);
+      if (status != ECA_NORMAL) {
+         printf ("ca_attach_context (%d) failed (%s)\n", index,
+                 ca_message (status));
+      }
+   }
+}                               /* Use_Context */
+
+
+/*------------------------------------------------------------------------------
+ */
+static void Create_Channel (PV_Channel * pChannel)
+{
+   int status;
+
+   Use_Context (pChannel->context);
+   Set_Channel_Name (pChannel);
+   if (debug >= 2) {
+      printf ("creating channel %s\n", pChannel->ca_name);
+   }
+
+   pChannel->is_connected = false;
+   status = ca_create_channel
+       (pChannel->ca_name, buffered_connection_handler,
+        pChannel, pChannel->options.priority, &pChannel->channel_id);
+   if (status != ECA_NORMAL) {
+      printf ("ca_create_channel (%s) failed (%s)\n", pChannel->pv_name,
+              ca_message (status));
+      return;
+   }
+
+   pChannel->create_time = monotonic_time ();
+   Set_Connection_State (pChannel, csPending);
+   Queue_Append (&pending_queue, pChannel);
+}                               /* Create_Channel */
+
+
+/*------------------------------------------------------------------------------
+ * Control information, i.e. enum strings and precision, is only required when
+ * a subscriber matches an enum or floating point value as a string.
+ */
+static bool Needs_Control_Info (const PV_Channel * pChannel)
+{
+   const CA_Client *pClient;
+
+   if ((pChannel->field_type != DBF_ENUM) &&
+       (pChannel->field_type != DBF_FLOAT) &&
+       (pChannel->field_type != DBF_DOUBLE)) {
+      return false;
+   }
+
+   for (pClient = pChannel->subscribers; pClient;
+        pClient = pClient->next_subscriber) {
+      if ((pClient->target == mtValue) &&
+          (pClient->array_predicate.kind == apNone) &&
+          (pClient->match_set_collection.item[0].lower.kind == vkString)) {
+         return true;
+      }
+   }
+   return false;
+}                               /* Needs_Control_Info */
+
+
+/*------------------------------------------------------------------------------
+ * Subscribe for updates. The subscription's first update provides the initial
+ * data, so no separate get is required. Data is requested using the channel's
+ * native field type; any conversion to the match kind is done client side, so
+ * that e.g. a DBF_CHAR waveform is not sent as doubles.
+ *
+ * Subscriptions are retained by Channel Access across disconnects, so this is
+ * only called on first connection, or if the PV's type or size changes.
+ */
+static void Subscribe_Channel (PV_Channel * pChannel)
+{
+   const unsigned long first = pChannel->first_element;
+   unsigned long count;
+   chtype initial_type;
+   chtype update_type;
+   size_t size;
+   long event_mask;
+   CA_Client *pClient;
+   int status;
+
+   count = pChannel->element_count;
+   if (count == 0) {
+      printf ("element count (%s) is zero\n", pChannel->pv_name);
+      return;
+   }
+
+   /* Determine initial buffer request type and subscription buffer
+    * request type, based on the channel's native field type.
+    */
+   if (INVALID_DB_FIELD (pChannel->field_type)) {
+      printf ("%s: field type is invalid (%d)\n", pChannel->pv_name,
+              (int) pChannel->field_type);
+      return;
+   }
+   initial_type = dbf_type_to_DBR_CTRL (pChannel->field_type);
+   update_type = dbf_type_to_DBR_TIME (pChannel->field_type);
+   size = dbr_value_size[update_type];
+
+   /* Report any subscribers whose requested element is not available -
+    * these subscribers are ignored, but other subscribers are unaffected.
+    * Element lists still evaluate those listed elements that are available.
+    * When filtered, the server only sends elements from first onwards.
+    */
+   for (pClient = pChannel->subscribers; pClient;
+        pClient = pClient->next_subscriber) {
+      if ((pClient->array_predicate.kind == apNone) &&
+          (pClient->element_index > first + count)) {
+         printf
+             ("%s has %lu elements, element %d not available\n",
+              pChannel->pv_name, first + count, pClient->element_index);
+      }
+   }
+
+   if (first > 0) {
+      if (is_verbose) {
+         printf ("%s array filter elements %lu to %lu\n", pChannel->pv_name,
+                 first + 1, first + count);
+      }
+
+   } else if (pChannel->request_count == 0) {
+      if (debug >= 2) {
+         printf ("%s whole array (%lu elements) using %s kernels\n",
+                 pChannel->pv_name, count, Array_Kernels_Image ());
+      }
+
+   } else if (pChannel->request_count < count) {
+      printf
+          ("%s array get/subscription truncated from %lu (size %lu) to %lu elements\n",
+           pChannel->pv_name, count, size, pChannel->request_count);
+
+      count = pChannel->request_count;
+   }
+
+   /* Control information, if needed, is obtained via a DBE_PROPERTY
+    * subscription, which sends the current meta data and thereafter only
+    * when the meta data changes. This is subscribed first, so that the
+    * initial meta data arrives ahead of the initial value.
+    */
+   if (Needs_Control_Info (pChannel)) {
+      status = ca_create_subscription
+          (initial_type, 1, pChannel->channel_id, DBE_PROPERTY,
+           buffered_event_handler, &Property, &pChannel->property_event_id);
+
+      if (status != ECA_NORMAL) {
+         printf ("ca_create_subscription (%s, property) failed (%s)\n",
+                 pChannel->pv_name, ca_message (status));
+      }
+   }
+
+   /* Use the specified event mask if any, otherwise if all subscribers only
+    * match the alarm severity/status, then only alarm events are required.
+    */
+   event_mask = pChannel->options.event_mask;
+   if (event_mask == 0) {
+      event_mask = DBE_ALARM;
+      for (pClient = pChannel->subscribers; pClient;
+           pClient = pClient->next_subscriber) {
+         if (pClient->target == mtValue) {
+            event_mask |= DBE_VALUE;
+            break;
+         }
+      }
+   }
+
+   /* ... and now subscribe for time stamped data updates as well.
+    */
+   status = ca_create_subscription
+       (update_type, count, pChannel->channel_id,
+        event_mask, buffered_event_handler,
+        &Event, &pChannel->event_id);
+
+   if (status != ECA_NORMAL) {
+      printf ("ca_create_subscription (%s) failed (%s)\n",
+              pChannel->pv_name, ca_message (status));
+      return;
+   }
+
+   pChannel->subscribed_type = pChannel->field_type;
+   pChannel->subscribed_count = pChannel->element_count;
+   pChannel->is_first_update = true;
+
+}                               /* Subscribe_Channel */
+
+
+/*------------------------------------------------------------------------------
+ * Converts the client's data to the client's match kind, if needs be. This
+ * replaces the server side conversion that would otherwise be done by
+ * requesting DBR_XXX_DOUBLE, DBR_XXX_LONG or DBR_XXX_STRING.
+ */
+static void Convert_Value (CA_Client * pClient, const Variant_Kind kind)
+{
+   Variant_Value *data = &pClient->data;
+
+   if ((data->kind == kind) || (data->kind == vkVoid)) {
+      return;
+   }
+
+   switch (kind) {
+
+      case vkString:
+         if (data->kind == vkInteger) {
+            snprintf (data->value.sval, sizeof (data->value.sval), "%ld",
+                      data->value.ival);
+         } else {
+            snprintf (data->value.sval, sizeof (data->value.sval), "%.*f",
+                      pClient->channel->meta ?
+                      (int) pClient->channel->meta->precision : 0,
+                      data->value.dval);
+         }
+         break;
+
+      case vkInteger:
+         if (data->kind == vkFloating) {
+            data->value.ival = (long) data->value.dval;
+         } else {
+            data->value.ival = strtol (data->value.sval, NULL, 0);
+         }
+         break;
+
+      case vkFloating:
+         if (data->kind == vkInteger) {
+            data->value.dval = (double) data->value.ival;
+         } else {
+            data->value.dval = strtod (data->value.sval, NULL);
+         }
+         break;
+
+      default:
+         return;
+   }
+   data->kind = kind;
+}                               /* Convert_Value */
+
+
+/*------------------------------------------------------------------------------
+ * Assigns the e'th (zero based) element of the values array of the given
+ * basic field type to the client's data, converted to the match kind.
+ */
+static void Assign_Element_Value (CA_Client * pClient, const short field_type,
+                                  const void *values, const int e)
+{
+   const PV_Channel *pChannel = pClient->channel;
+   const Variant_Kind kind = pClient->match_set_collection.item[0].lower.kind;
+   dbr_short_t enum_value;
+
+   switch (field_type) {
+
+      case DBF_STRING:
+         pClient->data.kind = vkString;
+         strncpy (pClient->data.value.sval,
+                  ((const dbr_string_t *) values)[e], MAX_STRING_SIZE);
+         pClient->data.value.sval[MAX_STRING_SIZE] = '\0';
+         break;
+
+      case DBF_SHORT:
+         pClient->data.kind = vkInteger;
+         pClient->data.value.ival = (long) ((const dbr_short_t *) values)[e];
+         break;
+
+      case DBF_FLOAT:
+         pClient->data.kind = vkFloating;
+         pClient->data.value.dval = (double) ((const dbr_float_t *) values)[e];
+         break;
+
+      case DBF_ENUM:
+         enum_value = (dbr_short_t) ((const dbr_enum_t *) values)[e];
+         if (kind == vkString) {
             pClient->data.kind = vkString;
-            if (enum_value < pClient->num_states) {
+            if (pChannel->meta &&
+                (enum_value < pChannel->meta->num_states)) {
                strncpy (pClient->data.value.sval,
-                        pClient->enum_strings[enum_value],
+                        pChannel->meta->enum_strings[enum_value],
                         MAX_ENUM_STRING_SIZE);
                pClient->data.value.sval[MAX_ENUM_STRING_SIZE] = '\0';
             } else {
@@ -408,409 +1000,2494 @@ static void Get_Event_Handler (CA_Client * pClient,
          }
          break;
 
-      case DBR_TIME_CHAR:
-         ASSIGN_STATUS_AND_TIME (pDbr->tchrval);
-         pClient->data.kind = vkInteger;
-         pClient->data.value.ival = (long) (&pDbr->tchrval.value)[e];
-         break;
+      case DBF_CHAR:
+         pClient->data.kind = vkInteger;
+         pClient->data.value.ival = (long) ((const dbr_char_t *) values)[e];
+         break;
+
+      case DBF_LONG:
+         pClient->data.kind = vkInteger;
+         pClient->data.value.ival = (long) ((const dbr_long_t *) values)[e];
+         break;
+
+      case DBF_DOUBLE:
+         pClient->data.kind = vkFloating;
+         pClient->data.value.dval = (double) ((const dbr_double_t *) values)[e];
+         break;
+
+      default:
+         pClient->data.kind = vkVoid;
+         break;
+   }
+
+   Convert_Value (pClient, kind);
+}                               /* Assign_Element_Value */
+
+
+/*------------------------------------------------------------------------------
+ * Assigns the channel's alarm severity or status to the client's data.
+ */
+static void Assign_Target_Value (CA_Client * pClient)
+{
+   const PV_Channel *pChannel = pClient->channel;
+   const int value = (pClient->target == mtSeverity) ?
+       (int) pChannel->severity : (int) pChannel->status;
+
+   if (pClient->match_set_collection.item[0].lower.kind == vkString) {
+      pClient->data.kind = vkString;
+      snprintf (pClient->data.value.sval, sizeof (pClient->data.value.sval),
+                "%s", Match_Target_Image (pClient->target, value));
+   } else {
+      pClient->data.kind = vkInteger;
+      pClient->data.value.ival = value;
+   }
+}                               /* Assign_Target_Value */
+
+
+/*------------------------------------------------------------------------------
+ * Processes an update for an element list client. The received values are
+ * compared with the previous update's values, and only those listed elements
+ * that have changed are evaluated. On the first update after (re)connection,
+ * all listed elements are evaluated. The values array holds elements first
+ * onwards, i.e. number - first elements. Listed elements beyond number are
+ * reported and skipped; the other listed elements are still evaluated.
+ */
+static void Process_Element_List (CA_Client * pClient,
+                                  const short field_type,
+                                  const void *values, const int first,
+                                  const int number)
+{
+   Element_List *list = pClient->element_list;
+   const size_t element_size = dbr_value_size[field_type];
+   const size_t size = element_size * (number - first);
+   size_t offset;
+   int count;
+   int slot;
+   int e;
+
+   /* The indices are sorted, so the available elements are a prefix.
+    * Elements beyond the channel's element count have already been
+    * reported when subscribed.
+    */
+   count = list->count;
+   while ((count > 0) && (list->index[count - 1] > number)) {
+      count--;
+   }
+   if ((count < list->count) &&
+       (pClient->channel->element_count >= pClient->element_index)) {
+      if (count == list->count - 1) {
+         printf ("%s: received elements (%d), element %d not available\n",
+                 pClient->pv_name, number, list->index[count]);
+      } else {
+         printf ("%s: received elements (%d), elements %d to %d of [%s]"
+                 " not available\n", pClient->pv_name, number,
+                 list->index[count], list->index[list->count - 1],
+                 list->image);
+      }
+   }
+   if (count == 0) {
+      return;
+   }
+
+   if (pClient->channel->is_first_update || (list->previous == NULL) ||
+       (list->previous_size != size)) {
+
+      for (slot = 0; slot < count; slot++) {
+         Assign_Element_Value (pClient, field_type, values,
+                               list->index[slot] - 1 - first);
+         Process_PV_Element_Update (pClient, slot);
+      }
+
+      /* (Re)allocate the previous values buffer as needs be.
+       */
+      if (list->previous_size != size) {
+         free (list->previous);
+         list->previous = callocMustSucceed (1, size, "Process_Element_List");
+         list->previous_size = size;
+      }
+
+   } else {
+      /* Find each difference in turn, skipping over unlisted elements.
+       */
+      slot = 0;
+      offset = Array_Next_Difference
+          (list->previous, values,
+           (list->index[0] - 1 - first) * element_size, size);
+
+      while (offset < size) {
+         e = (int) (offset / element_size) + first;
+
+         while ((slot < count) && (list->index[slot] - 1 < e)) {
+            slot++;
+         }
+         if (slot >= count) {
+            break;
+         }
+
+         if (list->index[slot] - 1 == e) {
+            Assign_Element_Value (pClient, field_type, values, e - first);
+            Process_PV_Element_Update (pClient, slot);
+            slot++;
+            if (slot >= count) {
+               break;
+            }
+         }
+
+         offset = Array_Next_Difference
+             (list->previous, values,
+              (list->index[slot] - 1 - first) * element_size, size);
+      }
+   }
+
+   memcpy (list->previous, values, size);
+}                               /* Process_Element_List */
+
+
+/*------------------------------------------------------------------------------
+ * Processes an update for a single subscriber of the channel. The values
+ * array holds elements first (zero based) to number - 1 inclusive.
+ */
+static void Process_Client_Update (CA_Client * pClient,
+                                   const short field_type,
+                                   const void *values, const int first,
+                                   const int number)
+{
+   pClient->data_element_count = number;
+
+   if (pClient->target != mtValue) {
+      /* The value is the channel's alarm severity or status, as a name if
+       * matched against sets or patterns.
+       */
+      Assign_Target_Value (pClient);
+      Process_PV_Update (pClient);
+
+   } else if (pClient->array_predicate.kind != apNone) {
+      /* For whole array predicates, the value is the number of elements
+       * that match. These are counted in situ, i.e. in the received buffer.
+       */
+      pClient->data.kind = vkInteger;
+      pClient->data.value.ival = (long) Array_Count_In
+          (pClient->array_predicate.intervals, field_type, values,
+           number - first);
+      Process_PV_Update (pClient);
+
+   } else if (pClient->element_list) {
+      Process_Element_List (pClient, field_type, values, first, number);
+
+   } else if (number < pClient->element_index) {
+      /* Elements beyond the channel's element count have already been
+       * reported when subscribed.
+       */
+      if (pClient->channel->element_count >= pClient->element_index) {
+         printf
+             ("%s: received elements (%d) less than expected (%d)\n",
+              pClient->pv_name, number, pClient->element_index);
+      }
+
+   } else {
+      Assign_Element_Value (pClient, field_type, values,
+                            pClient->element_index - 1 - first);
+      Process_PV_Update (pClient);
+   }
+}                               /* Process_Client_Update */
+
+
+/*------------------------------------------------------------------------------
+ * Returns the channel's meta data, allocating it on first use, as most
+ * channels never require control information.
+ */
+static Channel_Meta *Channel_Meta_Of (PV_Channel * pChannel)
+{
+   if (pChannel->meta == NULL) {
+      pChannel->meta = (Channel_Meta *) callocMustSucceed
+          (1, sizeof (Channel_Meta), "Channel_Meta_Of");
+   }
+   return pChannel->meta;
+}                               /* Channel_Meta_Of */
+
+
+/*------------------------------------------------------------------------------
+ * Processes received data
+ *
+ * Arguments passed to event handlers and get/put call back handlers.
+ *
+ * The status field below is the CA ECA_XXX status of the requested
+ * operation which is saved from when the operation was attempted in the
+ * server and copied back to the clients call back routine.
+ * If the status is not ECA_NORMAL then the dbr pointer will be NULL
+ * and the requested operation can not be assumed to be successful.
+ *
+ *   typedef struct event_handler_args {
+ *       void            *usr;    -- user argument supplied with request
+ *       chanId          chid;    -- channel id
+ *       long            type;    -- the type of the item returned
+ *       long            count;   -- the element count of the item returned
+ *       READONLY void   *dbr;    -- a pointer to the item returned
+ *       int             status;  -- ECA_XXX status from the server
+ *   } evargs;
+ *
+ * The meta data, status and time are decoded once per update into the
+ * channel; the values are then processed by each subscriber in turn.
+ */
+static void Get_Event_Handler (PV_Channel * pChannel,
+                               const struct event_handler_args *args)
+{
+   const char *function = "Get_Event_Handler";
+
+/* Local "functons" that make use of naming regularity
+ */
+#define ASSIGN_STATUS(from) {                                               \
+   pChannel->status = from.status;                                          \
+   pChannel->severity = from.severity;                                      \
+}
+
+
+/* Convert EPICS time to system time.
+ * EPICS is number secons since 01-Jan-1990 where as
+ * System time is number secons since 01-Jan-1970.
+ */
+#define ASSIGN_STATUS_AND_TIME(from) {                                      \
+   pChannel->status = from.status;                                          \
+   pChannel->severity = from.severity;                                      \
+   pChannel->update_time = epics_epoch + from.stamp.secPastEpoch;           \
+   pChannel->nano_sec = from.stamp.nsec;                                    \
+}
+
+
+
+#define ASSIGN_NUMERIC(from, prec) {                                        \
+   Channel_Meta *meta = Channel_Meta_Of (pChannel);                         \
+   meta->precision = prec;                                                  \
+   strcpy (meta->units, from.units);                                        \
+   meta->num_states = 0;                                                    \
+   meta->upper_disp_limit    = (double) from.upper_disp_limit;              \
+   meta->lower_disp_limit    = (double) from.lower_disp_limit;              \
+   meta->upper_alarm_limit   = (double) from.upper_alarm_limit;             \
+   meta->upper_warning_limit = (double) from.upper_warning_limit;           \
+   meta->lower_warning_limit = (double) from.lower_warning_limit;           \
+   meta->lower_alarm_limit   = (double) from.lower_alarm_limit;             \
+   meta->upper_ctrl_limit    = (double) from.upper_ctrl_limit;              \
+   meta->lower_ctrl_limit    = (double) from.lower_ctrl_limit;              \
+}
+
+
+#define CLEAR_NUMERIC {                                                     \
+   memset (Channel_Meta_Of (pChannel), 0, sizeof (Channel_Meta));           \
+}
+
+
+   const union db_access_val *pDbr = (union db_access_val *) args->dbr;
+   int number;
+   short field_type;
+   const void *values;
+   int first;
+   CA_Client *pClient;
+
+   /* Get number of elements. When filtered, the first element received is
+    * element first of the array.
+    */
+   number = MAX (0, args->count);
+   first = (int) pChannel->first_element;
+
+   switch (args->type) {
+
+   /** Control updates all meta data plus values **/
+
+      case DBR_STS_STRING:
+      case DBR_CTRL_STRING:
+         ASSIGN_STATUS (pDbr->sstrval);
+         CLEAR_NUMERIC;
+         break;
+
+      case DBR_CTRL_SHORT:
+         ASSIGN_STATUS (pDbr->cshrtval);
+         ASSIGN_NUMERIC (pDbr->cshrtval, 0);
+         break;
+
+      case DBR_CTRL_FLOAT:
+         ASSIGN_STATUS (pDbr->cfltval);
+         ASSIGN_NUMERIC (pDbr->cfltval, pDbr->cfltval.precision);
+         break;
+
+      case DBR_CTRL_ENUM:
+         ASSIGN_STATUS (pDbr->cenmval);
+         CLEAR_NUMERIC;
+         pChannel->meta->num_states = pDbr->cenmval.no_str;
+         memcpy (pChannel->meta->enum_strings, pDbr->cenmval.strs,
+                 sizeof (pChannel->meta->enum_strings));
+         break;
+
+      case DBR_CTRL_CHAR:
+         ASSIGN_STATUS (pDbr->cchrval);
+         ASSIGN_NUMERIC (pDbr->cchrval, 0);
+         break;
+
+      case DBR_CTRL_LONG:
+         ASSIGN_STATUS (pDbr->clngval);
+         ASSIGN_NUMERIC (pDbr->clngval, 0);
+         break;
+
+      case DBR_CTRL_DOUBLE:
+         ASSIGN_STATUS (pDbr->cdblval);
+         ASSIGN_NUMERIC (pDbr->cdblval, pDbr->cdblval.precision);
+         break;
+
+   /** Time updates values [count], time, severity and status **/
+
+      case DBR_TIME_STRING:
+         ASSIGN_STATUS_AND_TIME (pDbr->tstrval);
+         break;
+
+      case DBR_TIME_SHORT:
+         ASSIGN_STATUS_AND_TIME (pDbr->tshrtval);
+         break;
+
+      case DBR_TIME_FLOAT:
+         ASSIGN_STATUS_AND_TIME (pDbr->tfltval);
+         break;
+
+      case DBR_TIME_ENUM:
+         ASSIGN_STATUS_AND_TIME (pDbr->tenmval);
+         break;
+
+      case DBR_TIME_CHAR:
+         ASSIGN_STATUS_AND_TIME (pDbr->tchrval);
+         break;
+
+      case DBR_TIME_LONG:
+         ASSIGN_STATUS_AND_TIME (pDbr->tlngval);
+         break;
+
+      case DBR_TIME_DOUBLE:
+         ASSIGN_STATUS_AND_TIME (pDbr->tdblval);
+         break;
+
+      default:
+         printf ("%s (%s): unexpected buffer type %ld\n",
+                 function, pChannel->pv_name, args->type);
+         return;
+   }
+
+   pChannel->number_updates++;
+   pChannel->bytes_received += dbr_size_n (args->type, number);
+   Metrics_Count (mcEvents, 1);
+   Metrics_Count (mcBytes, dbr_size_n (args->type, number));
+
+   /* Property updates only provide meta data.
+    */
+   if (args->usr == &Property) {
+      return;
+   }
+
+   /* Now fan out the values to each subscriber.
+    */
+   field_type = args->type % (LAST_TYPE + 1);
+   values = dbr_value_ptr (args->dbr, args->type);
+
+   for (pClient = pChannel->subscribers; pClient;
+        pClient = pClient->next_subscriber) {
+      Process_Client_Update (pClient, field_type, values, first,
+                             first + number);
+   }
+   pChannel->is_first_update = false;
+
+#undef ASSIGN_STATUS
+#undef ASSIGN_STATUS_AND_TIME
+#undef ASSIGN_NUMERIC
+#undef CLEAR_NUMERIC
+}                               /* Get_Event_Handler */
+
+
+/*------------------------------------------------------------------------------
+ * Unsubscribes channel
+ */
+static void Unsubscribe_Channel (PV_Channel * pChannel)
+{
+   int status;
+
+   /* Unsubscribe iff needs be
+    */
+   if (pChannel->event_id) {
+      status = ca_clear_subscription (pChannel->event_id);
+      if (status != ECA_NORMAL) {
+         printf ("ca_clear_subscription (%s) failed (%s)\n",
+                 pChannel->pv_name, ca_message (status));
+      }
+      pChannel->event_id = NULL;
+   }
+
+   if (pChannel->property_event_id) {
+      status = ca_clear_subscription (pChannel->property_event_id);
+      if (status != ECA_NORMAL) {
+         printf ("ca_clear_subscription (%s, property) failed (%s)\n",
+                 pChannel->pv_name, ca_message (status));
+      }
+      pChannel->property_event_id = NULL;
+   }
+}                               /* Unsubscribe_Channel */
+
+
+/*------------------------------------------------------------------------------
+ * closes channel
+ */
+static void Clear_Channel (PV_Channel * pChannel)
+{
+   int status;
+
+   /* This function checks if we are subscribed.
+    */
+   Unsubscribe_Channel (pChannel);
+
+   /* Close channel iff needs be.
+    */
+   if (pChannel->channel_id) {
+      status = ca_clear_channel (pChannel->channel_id);
+      if (status != ECA_NORMAL) {
+         printf ("ca_clear_channel (%s) failed (%s)\n",
+                 pChannel->pv_name, ca_message (status));
+      }
+
+      /* Any already buffered callbacks refer to a now invalid channel id.
+       */
+      (void) discard_buffered_callbacks (pChannel->channel_id);
+      pChannel->channel_id = NULL;
+      pChannel->is_connected = false;
+   }
+   Set_Connection_State (pChannel, csNotCreated);
+}                               /* Clear_Channel */
+
+
+/* -----------------------------------------------------------------------------
+ */
+static PV_Channel *Validate_Channel_Id (const chid channel_id)
+{
+   void *user_data;
+   PV_Channel *result = NULL;
+
+   /* Hypothosize something wrong unless we pass all checks.
+    */
+   if (channel_id == NULL) {
+      Report ("Unassigned channel id");
+      return NULL;
+   }
+
+   user_data = ca_puser (channel_id);
+   if (user_data == NULL) {
+      Report ("Unassigned user data");
+      return NULL;
+   }
+
+   result = (PV_Channel *) user_data;
+   if ((result->magic1 != PV_CHANNEL_MAGIC)
+       || (result->magic2 != PV_CHANNEL_MAGIC)) {
+      Report ("User Data not a PV_Channel");
+      return NULL;
+   }
+
+   if (result->channel_id == NULL) {
+      Report ("PV Channel has unassigned channel id");
+      return NULL;
+   }
+
+   if (result->channel_id != channel_id) {
+      Report ("Channel id mis-match");
+      return NULL;
+   }
+
+   /* We passed all the checks.
+    */
+   return result;
+}                               /* Validate_Channel_Id */
+
+/*------------------------------------------------------------------------------
+ * Connection progress bookkeeping. Caller must hold the connection mutex.
+ */
+static void Update_Connection_State (PV_Channel * pChannel, const long op)
+{
+   if (op == CA_OP_CONN_UP) {
+      Set_Connection_State (pChannel, csConnected);
+      number_connects++;
+      if (pChannel->park_interval > 0.0) {
+         if (is_verbose) {
+            printf ("Channel '%s' connected after being parked\n",
+                    pChannel->pv_name);
+         }
+         pChannel->park_interval = 0.0;
+      }
+   } else if (op == CA_OP_CONN_DOWN) {
+      Set_Connection_State (pChannel, csDisconnected);
+   }
+}                               /* Update_Connection_State */
+
+
+/*------------------------------------------------------------------------------
+ * CALLBACK FUNCTIONS expected by the buffered_callbacks module
+ *------------------------------------------------------------------------------
+ *
+ * Connection handler
+ */
+void application_connection_handler (struct connection_handler_args *args)
+{
+   PV_Channel *pChannel;
+   CA_Client *pClient;
+
+   /* The channel may be being created by the main thread.
+    */
+   epicsMutexLock (connection_mutex);
+   pChannel = Validate_Channel_Id (args->chid);
+   if (pChannel) {
+      Update_Connection_State (pChannel, args->op);
+   }
+   epicsMutexUnlock (connection_mutex);
+
+   if (pChannel) {
+      switch (args->op) {
+
+         case CA_OP_CONN_UP:
+            if (debug >= 4) {
+               printf ("PV connected %s\n", pChannel->pv_name);
+            }
+            pChannel->is_connected = true;
+            pChannel->field_type = ca_field_type (pChannel->channel_id);
+            pChannel->element_count =
+                ca_element_count (pChannel->channel_id);
+            pChannel->host_name =
+                Intern_String (ca_host_name (pChannel->channel_id));
+            for (pClient = pChannel->subscribers; pClient;
+                 pClient = pClient->next_subscriber) {
+               pClient->data_element_count = 0; /* no data yet */
+            }
+
+            /* On reconnect, Channel Access re-establishes the existing
+             * subscriptions, and sends the current value and meta data.
+             * Only if the PV itself has changed, e.g. the IOC has been
+             * rebooted with a different database, must we resubscribe.
+             */
+            if (pChannel->event_id &&
+                ((pChannel->field_type != pChannel->subscribed_type) ||
+                 (pChannel->element_count != pChannel->subscribed_count))) {
+               if (is_verbose) {
+                  printf ("%s type/element count changed, resubscribing\n",
+                          pChannel->pv_name);
+               }
+               Unsubscribe_Channel (pChannel);
+            }
+
+            if (pChannel->event_id == NULL) {
+               Subscribe_Channel (pChannel);
+            }
+            pChannel->is_first_update = true;
+
+            /* Only reconnections are host events.
+             */
+            if (pChannel->disconnect_time != 0) {
+               Host_Event_Add (hkConnect, pChannel->host_name,
+                               pChannel->pv_name);
+            }
+            break;
+
+         case CA_OP_CONN_DOWN:
+            if (debug >= 4) {
+               printf ("PV disconnected %s\n", pChannel->pv_name);
+            }
+
+            /* The subscriptions are retained, and are re-established by
+             * Channel Access if/when we reconnect.
+             */
+            pChannel->is_connected = false;
+            (void) time (&pChannel->disconnect_time);
+
+            /* When host events are enabled, the disconnect is aggregated
+             * with the other disconnects from the same IOC, and the per PV
+             * disconnect commands are only called if requested.
+             */
+            Host_Event_Add (hkDisconnect, pChannel->host_name,
+                            pChannel->pv_name);
+            if (Host_Events_Enabled () && !pv_disconnects) {
+               break;
+            }
+
+            for (pClient = pChannel->subscribers; pClient;
+                 pClient = pClient->next_subscriber) {
+               Process_PV_Disconnect (pClient);
+            }
+            break;
+
+         default:
+            Report ("connection_handler: Unexpected args op");
+      }
+   }
+}                               /* application_connection_handler */
+
+/*------------------------------------------------------------------------------
+ * Event handler
+ */
+void application_event_handler (struct event_handler_args *args)
+{
+   PV_Channel *pChannel;
+
+   pChannel = Validate_Channel_Id (args->chid);
+   if (pChannel) {
+
+      /* Valid channel id - need some more event specific checks.
+       */
+      if (args->status == ECA_NORMAL) {
+
+         if (debug >= 4) {
+            printf ("PV event (%s) first %s\n", pChannel->pv_name,
+                    BOOL_IMAGE (pChannel->is_first_update));
+         }
+
+         if ((args->usr == &Property) || (args->usr == &Event)) {
+
+            if (args->dbr) {
+               Get_Event_Handler (pChannel, args);
+            } else {
+               printf ("event_handler (%s) args->dbr is null\n",
+                       pChannel->pv_name);
+            }
+
+         } else if (args->usr == &Put) {
+
+            /* place holder */
+            printf ("event_handler (%s) unexpected args->usr = Put\n",
+                    pChannel->pv_name);
+
+         } else {
+            printf ("event_handler (%s) unknown args->usr\n",
+                    pChannel->pv_name);
+         }
+
+      } else {
+         printf ("event_handler (%s) error (%s)\n",
+                 pChannel->pv_name, ca_message (args->status));
+      }
+   }
+}                               /* application_event_handler */
+
+
+/*------------------------------------------------------------------------------
+ * Priority handler - called from the Channel Access thread. The priority is
+ * part of the channel key, and hence is fixed for the life of the channel.
+ */
+int application_priority_handler (chid channel_id)
+{
+   PV_Channel *pChannel;
+
+   pChannel = (PV_Channel *) ca_puser (channel_id);
+   if ((pChannel == NULL) || (pChannel->magic1 != PV_CHANNEL_MAGIC)) {
+      return DEFAULT_CA_PRIORITY;
+   }
+   return pChannel->options.priority;
+}                               /* application_priority_handler */
+
+
+/*------------------------------------------------------------------------------
+ * Queue handler - called from the Channel Access thread. All of a channel's
+ * callbacks are processed by the one thread, so that per PV ordering is
+ * preserved.
+ */
+int application_queue_handler (chid channel_id)
+{
+   PV_Channel *pChannel;
+
+   pChannel = (PV_Channel *) ca_puser (channel_id);
+   if ((pChannel == NULL) || (pChannel->magic1 != PV_CHANNEL_MAGIC)) {
+      return 0;
+   }
+   return pChannel->queue;
+}                               /* application_queue_handler */
+
+
+/*------------------------------------------------------------------------------
+ * Dispatch handler - called by the thread processing the queue.
+ */
+void application_dispatch_handler (const int queue, const double latency)
+{
+   Metrics_Dispatch_Latency (latency);
+}                               /* application_dispatch_handler */
+
+
+/*------------------------------------------------------------------------------
+ * Replacement printf handler
+ */
+void application_printf_handler (char *formated_text)
+{
+   printf ("%s", formated_text);
+}                               /* application_printf_handler */
+
+
+/*------------------------------------------------------------------------------
+ * Returns the event mask image, e.g. "value|alarm".
+ */
+static const char *Event_Mask_Image (const long mask, char *image,
+                                     const size_t size)
+{
+   snprintf (image, size, "%s%s%s",
+             (mask & DBE_VALUE) ? "|value" : "",
+             (mask & DBE_ARCHIVE) ? "|archive" : "",
+             (mask & DBE_ALARM) ? "|alarm" : "");
+   return image[0] ? image + 1 : image;
+}                               /* Event_Mask_Image */
+
+
+/*------------------------------------------------------------------------------
+ */
+void Print_Match_Information (CA_Client * pClient)
+{
+   unsigned int j;
+   Variant_Kind kind;
+   char *request;
+   Variant_Range *pVR;
+   char lower[45];
+   char upper[45];
+   char *lq, *uq;
+   char index_image[64];
+   char events[40];
+
+   kind = pClient->match_set_collection.item[0].lower.kind;
+   switch (kind) {
+
+      case vkString:
+         request = "DBF_STRING";
+         break;
+
+      case vkInteger:
+         request = "DBF_LONG";
+         break;
+
+      case vkFloating:
+         request = "DBF_DOUBLE";
+         break;
+
+      default:
+         request = "NONE";
+         break;
+   }
+
+   printf ("PV Name: %s [%s]\n", pClient->pv_name,
+           Element_Index_Image (pClient, index_image, sizeof (index_image)));
+
+   printf ("Compare: %s\n", request);
+
+   if (pClient->target != mtValue) {
+      printf ("Target:  %s\n",
+              (pClient->target == mtSeverity) ? "severity" : "status");
+   }
+
+   if ((pClient->options.deadband > 0.0) || pClient->options.event_mask ||
+       (pClient->options.priority != DEFAULT_CA_PRIORITY)) {
+      printf ("Options:");
+      if (pClient->options.deadband > 0.0) {
+         printf (" %sdeadband=%g", pClient->options.is_relative ? "r" : "",
+                 pClient->options.deadband);
+      }
+      if (pClient->options.event_mask) {
+         printf (" events=%s", Event_Mask_Image (pClient->options.event_mask,
+                                                 events, sizeof (events)));
+      }
+      if (pClient->options.priority != DEFAULT_CA_PRIORITY) {
+         printf (" priority=%d", pClient->options.priority);
+      }
+      printf ("\n");
+   }
+
+   if (pClient->expression) {
+      printf ("Input:   term %d of expression %s\n", pClient->expression_term,
+              pClient->expression->name);
+   } else if (pClient->sequence) {
+      printf ("Input:   step %d of sequence %s\n", pClient->sequence_step,
+              pClient->sequence->name);
+   } else {
+      printf ("Command: %s\n", pClient->match_command);
+   }
+
+   for (j = 0; j < pClient->match_set_collection.count; j++) {
+      if (j == 0) {
+         printf ("Matches: ");
+      } else {
+         printf ("     or: ");
+      }
+
+      pVR = &pClient->match_set_collection.item[j];
+
+      if (pVR->comp == ckInSet) {
+         printf ("%d  in {%u strings}\n", pVR->comp,
+                 String_Set_Count (pVR->set));
+         continue;
+      }
+
+      if ((pVR->comp == ckRegex) || (pVR->comp == ckGlob)) {
+         printf ("%d  %s \"%s\"\n", pVR->comp,
+                 (pVR->comp == ckRegex) ? "regex" : "glob",
+                 Pattern_Text (pVR->pattern));
+         continue;
+      }
+
+      Variant_Image (lower, sizeof (lower), &pVR->lower);
+      lq = (pVR->lower.kind == vkString) ? "\"" : "";
+
+      Variant_Image (upper, sizeof (upper), &pVR->upper);
+      uq = (pVR->upper.kind == vkString) ? "\"" : "";
+
+      printf ("%d  %s%s%s", pVR->comp, lq, lower, lq);
+
+      if (pVR->comp == ckRange) {
+         printf (" to %s%s%s", uq, upper, uq);
+      }
+      printf ("\n");
+
+   }
+   printf ("\n");
+}                               /* Print_Match_Information */
+
+
+/*------------------------------------------------------------------------------
+ */
+const char *Element_Index_Image (const CA_Client * pClient, char *image,
+                                 const size_t size)
+{
+   const Array_Predicate *predicate = &pClient->array_predicate;
+
+   if (pClient->element_list) {
+      snprintf (image, size, "%s", pClient->element_list->image);
+      return image;
+   }
+
+   switch (predicate->kind) {
+      case apAny:
+         snprintf (image, size, "any");
+         break;
+
+      case apAll:
+         snprintf (image, size, "all");
+         break;
+
+      case apCount:
+         snprintf (image, size, "count%s%ld",
+                   Comparison_Image (predicate->count_comp),
+                   predicate->count_threshold);
+         break;
+
+      default:
+         snprintf (image, size, "%d", pClient->element_index);
+         break;
+   }
+   return image;
+}                               /* Element_Index_Image */
+
+
+/*------------------------------------------------------------------------------
+ * CLIENT LIST functions
+ *------------------------------------------------------------------------------
+ */
+static void Attach_All_Clients (ELLLIST * CA_Client_List)
+{
+   const unsigned int number = ellCount (CA_Client_List);
+   unsigned int size;
+   CA_Client *pClient;
+   CA_Client *next;
+
+   /* Size the unit and channel tables up front, there being at most one unit
+    * and one channel per client, rather than repeatedly enlarging them.
+    */
+   size = 256;
+   while (size < number) {
+      size *= 2;
+   }
+   if (size > unit_table_size) {
+      Resize_Unit_Table (size);
+   }
+   if (size > channel_table_size) {
+      Resize_Channel_Table (size);
+   }
+
+   pClient = (CA_Client *) ellFirst (CA_Client_List);
+   while (pClient) {
+      next = Next_Unit (pClient);
+      Unit_Table_Insert (pClient);
+      while (pClient != next) {
+         Attach_Client (pClient);
+         pClient = (CA_Client *) ellNext ((ELLNODE *) pClient);
+      }
+   }
+}                               /* Attach_All_Clients */
+
+
+/*------------------------------------------------------------------------------
+ * Creates the next batch of channels. Pacing channel creation limits the
+ * number of outstanding name search requests. Returns true when all channels
+ * have been created.
+ */
+static bool Create_Channel_Batch ()
+{
+   int number = 0;
+
+   if (next_to_create == NULL) {
+      return true;
+   }
+
+   while (next_to_create && ((create_batch == 0) || (number < create_batch))) {
+      /* Open this Channel Access channel
+       */
+      Create_Channel (next_to_create);
+      next_to_create = (PV_Channel *) ellNext ((ELLNODE *) next_to_create);
+      number++;
+   }
+   return (next_to_create == NULL);
+}                               /* Create_Channel_Batch */
+
+
+/*------------------------------------------------------------------------------
+ */
+static void Clear_All_Channels (ELLLIST * PV_Channel_List)
+{
+   PV_Channel *pChannel;
+
+   pChannel = (PV_Channel *) ellFirst (PV_Channel_List);
+   while (pChannel) {
+      /* Close this Channel Access channel
+       */
+      Clear_Channel (pChannel);
+      pChannel = (PV_Channel *) ellNext ((ELLNODE *) pChannel);
+   }
+}                               /* Clear_All_Channels */
+
+
+/*------------------------------------------------------------------------------
+ */
+static void Print_All_Match_Information (ELLLIST * CA_Client_List)
+{
+   CA_Client *pClient;
+
+   pClient = (CA_Client *) ellFirst (CA_Client_List);
+   while (pClient) {
+      Print_Match_Information (pClient);
+      pClient = (CA_Client *) ellNext ((ELLNODE *) pClient);
+   }
+}                               /* Print_All_Client_Information */
+
+
+/*------------------------------------------------------------------------------
+ */
+static void Flush_Timeout_Reports ()
+{
+   if (reports_suppressed > 0) {
+      printf ("... plus %d other channel connect timeout%s.\n",
+              reports_suppressed, (reports_suppressed == 1) ? "" : "s");
+      reports_suppressed = 0;
+   }
+}                               /* Flush_Timeout_Reports */
+
+
+/*------------------------------------------------------------------------------
+ * Reports a channel connect timeout. At most timeout_reports are output per
+ * second; any others are summarised when the reporting window ends.
+ */
+static void Report_Connection_Timeout (const PV_Channel * pChannel,
+                                       const double now)
+{
+   if (now >= report_window_start + 1.0) {
+      Flush_Timeout_Reports ();
+      report_window_start = now;
+      reports_in_window = 0;
+   }
+
+   if (pChannel == NULL) {
+      return;                   /* just closing the window */
+   }
+
+   if (reports_in_window < timeout_reports) {
+      printf ("Channel connect timed out: '%s' not found.\n",
+              pChannel->pv_name);
+      reports_in_window++;
+   } else {
+      reports_suppressed++;
+   }
+}                               /* Report_Connection_Timeout */
+
+
+/*------------------------------------------------------------------------------
+ * Clears the channel, so that it no longer generates name search requests,
+ * and schedules its re-creation. The retry interval doubles each time.
+ */
+static void Park_Channel (PV_Channel * pChannel, const double now)
+{
+   Clear_Channel (pChannel);
+
+   if (pChannel->park_interval <= 0.0) {
+      pChannel->park_interval = park_retry;
+   } else {
+      pChannel->park_interval = MIN (2.0 * pChannel->park_interval,
+                                     park_retry_max);
+   }
+   pChannel->retry_time = now + pChannel->park_interval;
+
+   if (debug >= 2) {
+      printf ("parking channel %s for %.0f s\n", pChannel->ca_name,
+              pChannel->park_interval);
+   }
+
+   Set_Connection_State (pChannel, csParked);
+   Queue_Append (&parked_set, pChannel);
+}                               /* Park_Channel */
+
+
+/*------------------------------------------------------------------------------
+ * Parks the channel, unless it has connected in the mean time. Called via the
+ * channel's callback queue, i.e. by the thread that owns the channel.
+ */
+static void Park_Call (void *arg)
+{
+   PV_Channel *pChannel = (PV_Channel *) arg;
+
+   epicsMutexLock (connection_mutex);
+   if ((pChannel->state == csPending) || (pChannel->state == csNotFound)) {
+      Park_Channel (pChannel, monotonic_time ());
+   }
+   epicsMutexUnlock (connection_mutex);
+}                               /* Park_Call */
+
+
+/*------------------------------------------------------------------------------
+ * Re-creates the channel using the plain PV name, unless it has connected in
+ * the mean time. Called via the channel's callback queue.
+ */
+static void Retry_Unfiltered_Call (void *arg)
+{
+   PV_Channel *pChannel = (PV_Channel *) arg;
+
+   epicsMutexLock (connection_mutex);
+   if (pChannel->state == csPending) {
+      if (is_verbose) {
+         printf ("Channel '%s' not connected, retrying without filters\n",
+                 pChannel->ca_name);
+      }
+      Clear_Channel (pChannel);
+      pChannel->filter_retried = true;
+      Create_Channel (pChannel);
+   }
+   epicsMutexUnlock (connection_mutex);
+}                               /* Retry_Unfiltered_Call */
+
+
+/*------------------------------------------------------------------------------
+ * Processes the channels at the head of the pending queue whose connect
+ * timeout has expired.
+ * Servers that pre-date channel filters, or that otherwise reject a filter,
+ * do not connect the filtered name. Such channels are re-created using the
+ * plain PV name, and allowed a further connect timeout.
+ * Channels with a channel id are only cleared by the thread that processes
+ * the channel's callbacks, hence the clearing is requested via buffered_call.
+ */
+static void Process_Connection_Timeouts (const double now)
+{
+   PV_Channel *pChannel;
+
+   while (pending_queue.head < pending_queue.tail) {
+      pChannel = pending_queue.items[pending_queue.head];
+      if ((pChannel->state == csPending) &&
+          (now < pChannel->create_time + connect_timeout)) {
+         break;                 /* and so are all the others */
+      }
+      pending_queue.head++;
+
+      if (pChannel->state != csPending) {
+         continue;              /* has connected in the mean time */
+      }
+
+      if (pChannel->is_filtered) {
+         buffered_call (pChannel->channel_id, Retry_Unfiltered_Call,
+                        pChannel);
+         continue;
+      }
+
+      /* A re-created parked channel has already been reported.
+       */
+      if (pChannel->park_interval > 0.0) {
+         buffered_call (pChannel->channel_id, Park_Call, pChannel);
+         continue;
+      }
+
+      Set_Connection_State (pChannel, csNotFound);
+      Report_Connection_Timeout (pChannel, now);
+      if (park_after > 0.0) {
+         Queue_Append (&not_found_queue, pChannel);
+      }
+   }
+
+   /* Close any expired reporting window.
+    */
+   Report_Connection_Timeout (NULL, now);
+}                               /* Process_Connection_Timeouts */
+
+
+/*------------------------------------------------------------------------------
+ * Parks channels that have not been found for park_after seconds, and
+ * re-creates parked channels that are due for a retry. The parked set is
+ * unordered, and is only checked once per second.
+ */
+static void Process_Parked_Channels (const double now)
+{
+   static double last_check = 0.0;
+   PV_Channel *pChannel;
+   int j;
+
+   while (not_found_queue.head < not_found_queue.tail) {
+      pChannel = not_found_queue.items[not_found_queue.head];
+      if ((pChannel->state == csNotFound) &&
+          (now < pChannel->create_time + connect_timeout + park_after)) {
+         break;                 /* and so are all the others */
+      }
+      not_found_queue.head++;
+
+      if (pChannel->state == csNotFound) {
+         buffered_call (pChannel->channel_id, Park_Call, pChannel);
+      }
+   }
+
+   if (now < last_check + 1.0) {
+      return;
+   }
+   last_check = now;
+
+   j = parked_set.head;
+   while (j < parked_set.tail) {
+      pChannel = parked_set.items[j];
+      if (now >= pChannel->retry_time) {
+         parked_set.items[j] = parked_set.items[--parked_set.tail];
+         Create_Channel (pChannel);
+      } else {
+         j++;
+      }
+   }
+}                               /* Process_Parked_Channels */
+
+
+/*------------------------------------------------------------------------------
+ * Reports the number of channels in each connection state, together with the
+ * connection rate since the previous report.
+ */
+static void Print_Connection_Progress (const double interval)
+{
+   static unsigned long last_connects = 0;
+   const int total = ellCount (&PV_Channel_List);
+
+   Flush_Timeout_Reports ();
+   printf ("Channels: %d of %d connected, %d pending, %d not found,"
+           " %d parked, %d disconnected, %d not created (%.1f connects/s)\n",
+           state_counts[csConnected], total, state_counts[csPending],
+           state_counts[csNotFound], state_counts[csParked],
+           state_counts[csDisconnected], state_counts[csNotCreated],
+           (interval > 0.0) ?
+           (double) (number_connects - last_connects) / interval : 0.0);
+   last_connects = number_connects;
+}                               /* Print_Connection_Progress */
+
+
+/*------------------------------------------------------------------------------
+ * Reports the number of channels, connected channels, updates and bytes
+ * received per Channel Access context, so as to show how the load is balanced.
+ */
+static void Print_Context_Statistics ()
+{
+   int channels[MAXIMUM_CONTEXTS];
+   int connected[MAXIMUM_CONTEXTS];
+   unsigned long updates[MAXIMUM_CONTEXTS];
+   unsigned long long bytes[MAXIMUM_CONTEXTS];
+   unsigned long long total = 0;
+   PV_Channel *pChannel;
+   int k;
+
+   for (k = 0; k < contexts_created; k++) {
+      channels[k] = 0;
+      connected[k] = 0;
+      updates[k] = 0;
+      bytes[k] = 0;
+   }
+
+   pChannel = (PV_Channel *) ellFirst (&PV_Channel_List);
+   while (pChannel) {
+      k = pChannel->context;
+      channels[k]++;
+      if (pChannel->is_connected) {
+         connected[k]++;
+      }
+      updates[k] += pChannel->number_updates;
+      bytes[k] += pChannel->bytes_received;
+      total += pChannel->bytes_received;
+      pChannel = (PV_Channel *) ellNext ((ELLNODE *) pChannel);
+   }
+
+   for (k = 0; k < contexts_created; k++) {
+      printf ("Context %2d: %7d channels, %7d connected, %10lu updates,"
+              " %12llu bytes (%5.1f%%)\n", k, channels[k], connected[k],
+              updates[k], bytes[k],
+              (total > 0) ? 100.0 * (double) bytes[k] / (double) total : 0.0);
+   }
+}                               /* Print_Context_Statistics */
+
+
+/*------------------------------------------------------------------------------
+ * Diagnostics report, as requested by SIGUSR1. Lists the parked channels.
+ */
+static void Print_Diagnostics (const double now, const double interval)
+{
+   PV_Channel *pChannel;
+   int j;
+
+   printf ("\nDiagnostics: %d buffered callbacks\n",
+           number_of_buffered_callbacks ());
+   Print_Connection_Progress (interval);
+   if (contexts_created > 1) {
+      Print_Context_Statistics ();
+   }
+
+   for (j = parked_set.head; j < parked_set.tail; j++) {
+      pChannel = parked_set.items[j];
+      printf ("parked: %-40s interval %6.0f s, retry in %6.0f s\n",
+              pChannel->ca_name, pChannel->park_interval,
+              MAX (pChannel->retry_time - now, 0.0));
+   }
+   printf ("\n");
+}                               /* Print_Diagnostics */
+
+
+/*------------------------------------------------------------------------------
+ * Reports the number of updates and bytes received per channel, together with
+ * the native field type requested.
+ */
+static void Print_All_Channel_Statistics (ELLLIST * PV_Channel_List)
+{
+   PV_Channel *pChannel;
+   unsigned long long total = 0;
+
+   pChannel = (PV_Channel *) ellFirst (PV_Channel_List);
+   while (pChannel) {
+      printf ("%-40s %-10s %8lu updates %12llu bytes\n", pChannel->ca_name,
+              pChannel->is_connected ?
+              dbf_type_to_text (pChannel->field_type) : "-",
+              pChannel->number_updates, pChannel->bytes_received);
+      total += pChannel->bytes_received;
+      pChannel = (PV_Channel *) ellNext ((ELLNODE *) pChannel);
+   }
+   printf ("Total bytes received: %llu\n", total);
+}                               /* Print_All_Channel_Statistics */
+
+
+/*------------------------------------------------------------------------------
+ */
+CA_Client *Allocate_Client (const int number_ranges)
+{
+   CA_Client *result;
+
+   /* One allocation for the client and its match ranges.
+    */
+   result = (CA_Client *) callocMustSucceed
+       (1, sizeof (CA_Client) + number_ranges * sizeof (Variant_Range),
+        "Allocate_Client");
+
+   result->magic1 = CA_CLIENT_MAGIC;
+   result->magic2 = CA_CLIENT_MAGIC;
+   result->channel = NULL;
+   result->next_subscriber = NULL;
+   result->pv_name = "";
+   result->match_set_collection.count = 0;
+   result->match_set_collection.item =
+       (number_ranges > 0) ? (Variant_Range *) (result + 1) : NULL;
+   result->match_command = "";
+   result->element_list = NULL;
+   result->number_transitions = 0;
+   result->options.priority = DEFAULT_CA_PRIORITY;
+   result->signature = NULL;
+   result->signature_next = NULL;
+   result->set_identity = 0;
+
+   return result;
+}                               /* Allocate_Client */
+
+
+/*------------------------------------------------------------------------------
+ * Attaches all the clients to their channels and reports the numbers, and
+ * when verbose, the time taken since start.
+ */
+static void Report_Client_List (int *number, const double start)
+{
+   double scanned;
+   int n;
+   int c;
+
+   scanned = monotonic_time ();
+   Attach_All_Clients (&CA_Client_List);
+
+   n = ellCount (&CA_Client_List);
+   c = ellCount (&PV_Channel_List);
+   printf ("PV client list created - %d %s.\n", n,
+           (n == 1 ? "entry" : " entries"));
+   if (is_verbose) {
+      printf ("PV channel list created - %d %s.\n", c,
+              (c == 1 ? "channel" : "channels"));
+      printf ("Configuration scanned in %.3f s, channels attached in %.3f s\n",
+              scanned - start, monotonic_time () - scanned);
+   }
+
+   *number = n;
+}                               /* Report_Client_List */
+
+
+/*------------------------------------------------------------------------------
+ */
+static PV_Channel *Shard_Root (PV_Channel * pChannel)
+{
+   while (pChannel->shard_parent) {
+      if (pChannel->shard_parent->shard_parent) {
+         pChannel->shard_parent = pChannel->shard_parent->shard_parent;
+      }
+      pChannel = pChannel->shard_parent;
+   }
+   return pChannel;
+}                               /* Shard_Root */
+
+
+/*------------------------------------------------------------------------------
+ * Joins the channel's shard to the anchor channel's shard, or sets the anchor.
+ * Each shard's members are also linked in a ring, so that the members of a
+ * shard can be found without visiting every channel. If note_moved, the
+ * members whose shard root changes, and hence may change queue, are marked as
+ * changed.
+ */
+static void Shard_Join (PV_Channel * a, void **anchor, const bool note_moved)
+{
+   PV_Channel *b;
+   PV_Channel *member;
+   PV_Channel *next;
+
+   if (*anchor == NULL) {
+      *anchor = a;
+      return;
+   }
 
-      case DBR_TIME_LONG:
-         ASSIGN_STATUS_AND_TIME (pDbr->tlngval);
-         pClient->data.kind = vkInteger;
-         pClient->data.value.ival = (long) (&pDbr->tlngval.value)[e];
-         break;
+   a = Shard_Root (a);
+   b = Shard_Root ((PV_Channel *) * anchor);
+   if (a != b) {
+      if (note_moved) {
+         member = a;
+         do {
+            Mark_Changed (member);
+            member = member->shard_next;
+         } while (member != a);
+      }
+      a->shard_parent = b;
 
-      case DBR_TIME_DOUBLE:
-         ASSIGN_STATUS_AND_TIME (pDbr->tdblval);
-         pClient->data.kind = vkFloating;
-         pClient->data.value.dval = (double) (&pDbr->tdblval.value)[e];
-         break;
+      /* Splice the rings.
+       */
+      next = a->shard_next;
+      a->shard_next = b->shard_next;
+      b->shard_next = next;
+   }
+}                               /* Shard_Join */
 
-      default:
-         printf ("%s (%s): unexpected buffer type %ld\n",
-                 function, pClient->pv_name, args->type);
-         pClient->data.kind = vkVoid;
-         return;
+
+/*------------------------------------------------------------------------------
+ * Removes the channel, which is about to be freed, from its shard. The other
+ * members are pointed directly at the shard root. If the channel was the root,
+ * the next member becomes the root, and as the shard's queue may then change,
+ * the members are marked as changed.
+ */
+static void Shard_Leave (PV_Channel * pChannel)
+{
+   PV_Channel *root = Shard_Root (pChannel);
+   const bool was_root = (root == pChannel);
+   PV_Channel *member;
+   PV_Channel *previous;
+
+   if (pChannel->shard_next == pChannel) {
+      pChannel->shard_parent = NULL;
+      return;
    }
 
-   Process_PV_Update (pClient);
-   pClient->is_first_update = false;
+   if (was_root) {
+      root = pChannel->shard_next;
+   }
 
-#undef ASSIGN_STATUS
-#undef ASSIGN_STATUS_AND_TIME
-#undef ASSIGN_NUMERIC
-#undef CLEAR_NUMERIC
-}                               /* Get_Event_Handler */
+   previous = pChannel;
+   for (member = pChannel->shard_next; member != pChannel;
+        member = member->shard_next) {
+      member->shard_parent = (member == root) ? NULL : root;
+      if (was_root) {
+         Mark_Changed (member);
+      }
+      previous = member;
+   }
+   previous->shard_next = pChannel->shard_next;
+   pChannel->shard_next = pChannel;
+   pChannel->shard_parent = NULL;
+}                               /* Shard_Leave */
 
 
 /*------------------------------------------------------------------------------
- * Unsubscribes channel
+ * Processes all the outstanding callbacks of every queue on this thread.
+ * Used while the dispatch workers are paused.
  */
-static void Unsubscribe_Channel (CA_Client * pClient)
+static void Drain_All_Callback_Queues ()
 {
-   int status;
+   const int maximum = 400;
+   int j;
 
-   /* Unsubscribe iff needs be
+   for (j = 0; j <= number_workers; j++) {
+      while (process_buffered_callback_queue (j, maximum) >= maximum) {
+         /* more to do */
+      }
+   }
+}                               /* Drain_All_Callback_Queues */
+
+
+/*------------------------------------------------------------------------------
+ * Returns the callback queue of the channel's shard.
+ */
+static int Shard_Queue (PV_Channel * pChannel, const int number)
+{
+   if (number <= 0) {
+      return 0;
+   }
+   return 1 + (int) (Channel_Hash (Shard_Root (pChannel)->pv_name) % number);
+}                               /* Shard_Queue */
+
+
+/*------------------------------------------------------------------------------
+ * Assigns each channel to a callback queue, i.e. a dispatch worker, by hashing
+ * the PV name. Channels that are inputs to the same expression or sequence
+ * are first joined into one shard, so that each expression and sequence is
+ * only ever evaluated by the one worker.
+ * Each channel is also assigned to a Channel Access context by hashing its
+ * own PV name - contexts need not follow the shards.
+ * The shards are rebuilt from scratch, as a reload may split them. If any
+ * created channel changes queue, the outstanding callbacks of all queues are
+ * processed first, so the dispatch workers must be paused.
+ */
+static void Assign_Channel_Queues (const int number)
+{
+   CA_Client *pClient;
+   PV_Channel *pChannel;
+   bool requeued = false;
+
+   pChannel = (PV_Channel *) ellFirst (&PV_Channel_List);
+   while (pChannel) {
+      pChannel->shard_parent = NULL;
+      pChannel->shard_next = pChannel;
+      pChannel = (PV_Channel *) ellNext ((ELLNODE *) pChannel);
+   }
+
+   pClient = (CA_Client *) ellFirst (&CA_Client_List);
+   while (pClient) {
+      if (pClient->expression) {
+         pClient->expression->anchor = NULL;
+      } else if (pClient->sequence) {
+         pClient->sequence->anchor = NULL;
+      }
+      pClient = (CA_Client *) ellNext ((ELLNODE *) pClient);
+   }
+
+   pClient = (CA_Client *) ellFirst (&CA_Client_List);
+   while (pClient) {
+      if (pClient->expression) {
+         Shard_Join (pClient->channel, &pClient->expression->anchor, false);
+      } else if (pClient->sequence) {
+         Shard_Join (pClient->channel, &pClient->sequence->anchor, false);
+      }
+      pClient = (CA_Client *) ellNext ((ELLNODE *) pClient);
+   }
+
+   /* A created channel may have callbacks waiting on its current queue.
+    * These are processed before any channel moves, otherwise they could be
+    * dispatched after later callbacks loaded onto the channel's new queue.
     */
-   if (pClient->event_id) {
-      status = ca_clear_subscription (pClient->event_id);
+   pChannel = (PV_Channel *) ellFirst (&PV_Channel_List);
+   while (pChannel && !requeued) {
+      if ((pChannel->channel_id != NULL) &&
+          (Shard_Queue (pChannel, number) != pChannel->queue)) {
+         requeued = true;
+      }
+      pChannel = (PV_Channel *) ellNext ((ELLNODE *) pChannel);
+   }
+
+   if (requeued) {
+      Drain_All_Callback_Queues ();
+   }
+
+   pChannel = (PV_Channel *) ellFirst (&PV_Channel_List);
+   while (pChannel) {
+      pChannel->queue = Shard_Queue (pChannel, number);
+      pChannel->context =
+          (int) (Channel_Hash (pChannel->pv_name) % contexts_created);
+      pChannel = (PV_Channel *) ellNext ((ELLNODE *) pChannel);
+   }
+}                               /* Assign_Channel_Queues */
+
+
+/*------------------------------------------------------------------------------
+ * As per Assign_Channel_Queues, but only for the changed channels. The shards
+ * of added units have already been joined as the units were added, and any
+ * channels that may have moved shard are marked as changed. Removed units do
+ * not split shards; the members of a stale shard just stay on the one queue.
+ */
+static void Assign_Changed_Queues (const int number)
+{
+   PV_Channel *pChannel;
+   bool requeued = false;
+   int j;
+
+   for (j = 0; (j < number_changed) && !requeued; j++) {
+      pChannel = changed_channels[j];
+      if ((pChannel->channel_id != NULL) &&
+          (Shard_Queue (pChannel, number) != pChannel->queue)) {
+         requeued = true;
+      }
+   }
+
+   if (requeued) {
+      Drain_All_Callback_Queues ();
+   }
+
+   for (j = 0; j < number_changed; j++) {
+      pChannel = changed_channels[j];
+      pChannel->queue = Shard_Queue (pChannel, number);
+      pChannel->context =
+          (int) (Channel_Hash (pChannel->pv_name) % contexts_created);
+   }
+}                               /* Assign_Changed_Queues */
+
+
+/*------------------------------------------------------------------------------
+ * Creates the specified number of Channel Access contexts, and leaves the
+ * calling thread attached to the first.
+ */
+static bool Create_Contexts (const int number)
+{
+   int status;
+   int k;
+
+   for (k = 0; k < number; k++) {
+      ca_detach_context ();
+      status = ca_context_create (ca_enable_preemptive_callback);
       if (status != ECA_NORMAL) {
-         printf ("ca_clear_subscription (%s) failed (%s)\n",
-                 pClient->pv_name, ca_message (status));
+         printf ("ca_context_create failed (%s)\n", ca_message (status));
+         return false;
       }
-      pClient->event_id = NULL;
+      contexts[k] = ca_current_context ();
+      contexts_created = k + 1;
 
-      /* Set connection closed in database
+      /* Replace the CA Client Library report handler.
        */
-      (void) time (&pClient->disconnect_time);
+      status = ca_replace_printf_handler (buffered_printf_handler);
+      if (status != ECA_NORMAL) {
+         printf ("ca_replace_printf_handler failed (%s)\n",
+                 ca_message (status));
+         /* This is not return-worthy. Carry on
+          */
+      }
    }
-}
+
+   Use_Context (0);
+   if (is_verbose && (number > 1)) {
+      printf ("Created %d Channel Access contexts\n", number);
+   }
+   return true;
+}                               /* Create_Contexts */
 
 
 /*------------------------------------------------------------------------------
- * closes channel
+ * Flushes the send buffers of every context.
  */
-static void Clear_Channel (CA_Client * pClient)
+static void Flush_All_Contexts ()
 {
    int status;
+   int k;
 
-   /* This function checks if we are subscribed.
-    */
-   Unsubscribe_Channel (pClient);
-
-   /* Close channel iff needs be.
-    */
-   if (pClient->channel_id) {
-      status = ca_clear_channel (pClient->channel_id);
+   for (k = 0; k < contexts_created; k++) {
+      Use_Context (k);
+      status = ca_flush_io ();
       if (status != ECA_NORMAL) {
-         printf ("ca_clear_channel (%s) failed (%s)\n",
-                 pClient->pv_name, ca_message (status));
+         printf ("ca_flush_io (%d) failed (%s)\n", k, ca_message (status));
       }
+   }
+}                               /* Flush_All_Contexts */
+
+
+/*------------------------------------------------------------------------------
+ */
+static void Destroy_All_Contexts ()
+{
+   int k;
+
+   for (k = 0; k < contexts_created; k++) {
+      Use_Context (k);
 
-      pClient->channel_id = NULL;
-      pClient->is_connected = false;
+      /* Reset the CA Client Library report handler.
+       */
+      (void) ca_replace_printf_handler (NULL);
+      ca_context_destroy ();
+      contexts[k] = NULL;
    }
-}                               /* Clear_Channel */
+   contexts_created = 0;
+}                               /* Destroy_All_Contexts */
 
 
-/* -----------------------------------------------------------------------------
+/*------------------------------------------------------------------------------
+ * Removes channels that no longer have any subscribers, i.e. that are about
+ * to be freed, from the queue.
  */
-static CA_Client *Validate_Channel_Id (const chid channel_id)
+static void Queue_Purge (Channel_Queue * queue)
 {
-   void *user_data;
-   CA_Client *result = NULL;
+   int n = queue->head;
+   int j;
 
-   /* Hypothosize something wrong unless we pass all checks.
-    */
-   if (channel_id == NULL) {
-      Report ("Unassigned channel id");
-      return NULL;
+   for (j = queue->head; j < queue->tail; j++) {
+      if (queue->items[j]->number_subscribers > 0) {
+         queue->items[n++] = queue->items[j];
+      }
    }
+   queue->tail = n;
+}                               /* Queue_Purge */
 
-   user_data = ca_puser (channel_id);
-   if (user_data == NULL) {
-      Report ("Unassigned user data");
-      return NULL;
+
+/*------------------------------------------------------------------------------
+ * Removes the (already cleared and purged) channel from the channel table and
+ * channel list, and frees it.
+ */
+static void Free_Channel (PV_Channel * pChannel)
+{
+   PV_Channel **link;
+
+   link = &channel_table[Channel_Hash (pChannel->pv_name) %
+                         channel_table_size];
+   while (*link && (*link != pChannel)) {
+      link = &(*link)->hash_next;
+   }
+   if (*link) {
+      *link = pChannel->hash_next;
    }
 
-   result = (CA_Client *) user_data;
-   if ((result->magic1 != CA_CLIENT_MAGIC)
-       || (result->magic2 != CA_CLIENT_MAGIC)) {
-      Report ("User Data not a CA_Client");
-      return NULL;
+   ellDelete (&PV_Channel_List, (ELLNODE *) pChannel);
+   state_counts[pChannel->state]--;
+   free (pChannel->meta);
+   free (pChannel);
+}                               /* Free_Channel */
+
+
+/*------------------------------------------------------------------------------
+ * Notes the file's existence, modification time and size.
+ */
+static void Note_Watched_File (Watched_File * file)
+{
+   struct stat info;
+
+   file->exists = (stat (file->name, &info) == 0);
+   if (file->exists) {
+      file->mtime = info.st_mtim;
+      file->size = info.st_size;
    }
+}                               /* Note_Watched_File */
 
-   if (result->channel_id == NULL) {
-      Report ("CA Client has unassigned channel id");
-      return NULL;
+
+/*------------------------------------------------------------------------------
+ * Notes the modification time and size of the configuration file, and of the
+ * files it includes. Called after the configuration has been read, as only
+ * then are the included files known.
+ */
+static void Note_Config_File ()
+{
+   int number;
+   int j;
+
+   for (j = 0; j < number_watched; j++) {
+      free (watched_files[j].name);
    }
+   free (watched_files);
 
-   if (result->channel_id != channel_id) {
-      Report ("Channel id mis-match");
-      return NULL;
+   number = 0;
+   while (Scan_Included_File (number)) {
+      number++;
    }
+   number_watched = number + 1;
+   watched_files = (Watched_File *) callocMustSucceed
+       (number_watched, sizeof (Watched_File), "Note_Config_File");
+
+   watched_files[0].name = epicsStrDup (config_filename);
+   for (j = 0; j < number; j++) {
+      watched_files[j + 1].name = epicsStrDup (Scan_Included_File (j));
+   }
+   for (j = 0; j < number_watched; j++) {
+      Note_Watched_File (&watched_files[j]);
+   }
+}                               /* Note_Config_File */
 
-   /* We passed all the checks.
-    */
-   return result;
-}                               /* Validate_Channel_Id */
 
 /*------------------------------------------------------------------------------
- * CALLBACK FUNCTIONS expected by the buffered_callbacks module
- *------------------------------------------------------------------------------
- *
- * Connection handler
+ * Checks, at most once every reload_interval seconds, whether the
+ * configuration file, or any file it includes, has been modified.
  */
-void application_connection_handler (struct connection_handler_args *args)
+static bool Config_File_Changed (const double now)
+{
+   static double last_check = 0.0;
+   Watched_File current;
+   int j;
+
+   if ((reload_interval <= 0.0) || (config_filename == NULL) ||
+       (now < last_check + reload_interval)) {
+      return false;
+   }
+   last_check = now;
+
+   for (j = 0; j < number_watched; j++) {
+      current.name = watched_files[j].name;
+      Note_Watched_File (&current);
+      if ((current.exists != watched_files[j].exists) ||
+          (current.exists &&
+           ((current.mtime.tv_sec != watched_files[j].mtime.tv_sec) ||
+            (current.mtime.tv_nsec != watched_files[j].mtime.tv_nsec) ||
+            (current.size != watched_files[j].size)))) {
+         return true;
+      }
+   }
+   return false;
+}                               /* Config_File_Changed */
+
+
+/*------------------------------------------------------------------------------
+ * Moves the unit starting at first to the end of the client list, and
+ * attaches its clients to their channels.
+ */
+static void Add_Unit (ELLLIST * list, CA_Client * first)
 {
    CA_Client *pClient;
 
-   pClient = Validate_Channel_Id (args->chid);
+   Move_Unit (list, &CA_Client_List, first);
+   for (pClient = first; pClient;
+        pClient = (CA_Client *) ellNext ((ELLNODE *) pClient)) {
+      Attach_Client (pClient);
+      pClient->channel->subscribers_added = true;
+      Mark_Changed (pClient->channel);
+      if (pClient->expression) {
+         Shard_Join (pClient->channel, &pClient->expression->anchor, true);
+      } else if (pClient->sequence) {
+         Shard_Join (pClient->channel, &pClient->sequence->anchor, true);
+      }
+   }
+   Unit_Table_Insert (first);
+}                               /* Add_Unit */
 
-   if (pClient) {
-      switch (args->op) {
 
-         case CA_OP_CONN_UP:
-            if (debug >= 4) {
-               printf ("PV connected %s\n", pClient->pv_name);
-            }
-            pClient->is_connected = true;
-            pClient->field_type = ca_field_type (pClient->channel_id);
-            pClient->element_count =
-                ca_element_count (pClient->channel_id);
-            strncpy (pClient->host_name,
-                     ca_host_name (pClient->channel_id),
-                     sizeof (pClient->host_name));
-            pClient->data_element_count = 0;    /* no data yet */
-            Subscribe_Channel (pClient);
-            break;
+/*------------------------------------------------------------------------------
+ * Detaches the unit starting at first from its channels, and frees it.
+ */
+static void Remove_Unit (ELLLIST * list, CA_Client * first)
+{
+   CA_Client *next = Next_Unit (first);
+   CA_Client *pClient;
 
-         case CA_OP_CONN_DOWN:
-            if (debug >= 4) {
-               printf ("PV disconnected %s\n", pClient->pv_name);
-            }
+   Unit_Table_Remove (first);
+   for (pClient = first; pClient != next;
+        pClient = (CA_Client *) ellNext ((ELLNODE *) pClient)) {
+      Detach_Client (pClient);
+   }
+   Free_Unit (list, first);
+}                               /* Remove_Unit */
 
-            /* We unsubscribe here to avoid a duplicate subscriptions
-             * if/when we reconnect. In principle we could keep the same
-             * subscription active, but doing a new Subscribe on connect
-             * will do a new Array_Get and Subscribe which is good in case
-             * any PV meta data parameters (units, precision) have changed.
-             */
-            Unsubscribe_Channel (pClient);
-            Process_PV_Disconnect (pClient);
-            break;
 
-         default:
-            Report ("connection_handler: Unexpected args op");
+typedef struct sChannel_Changes {
+   int added;
+   int recreated;
+   int cleared;
+} Channel_Changes;
+
+/*------------------------------------------------------------------------------
+ * Interned strings are not freed individually, so those of removed
+ * specifications accumulate over reloads and control requests. Once the number
+ * of interned strings has doubled since the last rebuild, every string still
+ * in use is re-interned into a new table, and the old table is freed. So the
+ * table is at most about twice the size of the strings in use, at an amortised
+ * cost of re-interning each string once.
+ *
+ * Unless just noting the initial size, the caller must hold the connection
+ * mutex, and the dispatch workers must be paused, so that no other thread
+ * holds a string from the old table.
+ */
+static void Rebuild_Interned_Strings (const bool just_note)
+{
+   static unsigned int limit = 0;
+   CA_Client *pClient;
+   PV_Channel *pChannel;
+   const char *pv_name;
+   double start;
+
+   if (!just_note && (Intern_Count () >= limit)) {
+      start = monotonic_time ();
+      Intern_Rebuild_Begin ();
+
+      for (pClient = (CA_Client *) ellFirst (&CA_Client_List); pClient;
+           pClient = (CA_Client *) ellNext ((ELLNODE *) pClient)) {
+         pClient->pv_name = Intern_String (pClient->pv_name);
+         pClient->match_command = Intern_String (pClient->match_command);
+      }
+
+      for (pChannel = (PV_Channel *) ellFirst (&PV_Channel_List); pChannel;
+           pChannel = (PV_Channel *) ellNext ((ELLNODE *) pChannel)) {
+         pv_name = Intern_String (pChannel->pv_name);
+         pChannel->ca_name = (pChannel->ca_name == pChannel->pv_name) ?
+             pv_name : Intern_String (pChannel->ca_name);
+         pChannel->pv_name = pv_name;
+         pChannel->host_name = Intern_String (pChannel->host_name);
+      }
+
+      Intern_Rebuild_End ();
+      if (is_verbose) {
+         printf ("Interned strings rebuilt - %u strings in %.3f s\n",
+                 Intern_Count (), monotonic_time () - start);
       }
    }
-}                               /* application_connection_handler */
+
+   limit = MAX (4096, 2 * Intern_Count ());
+}                               /* Rebuild_Interned_Strings */
+
 
 /*------------------------------------------------------------------------------
- * Event handler
+ * Applies the channel changes following units being added and/or removed.
+ * Any new channels follow previous_last, and are created in batches as per
+ * the initial channels. Only the changed channels are visited: existing
+ * channels that have gained subscribers are re-created, so that the new
+ * subscribers receive the current value and the request count is
+ * re-evaluated, and channels without subscribers are cleared and freed.
+ * Lastly the channels are (re-)assigned to callback queues, all of them if
+ * reassign_all, e.g. on reload, otherwise just the changed channels.
+ *
+ * The caller must hold the connection mutex, and the dispatch workers must be
+ * paused, as any callbacks of a channel that changes queue are processed
+ * first.
  */
-void application_event_handler (struct event_handler_args *args)
+static void Apply_Channel_Changes (PV_Channel * previous_last,
+                                   const bool reassign_all,
+                                   Channel_Changes * changes)
 {
-   CA_Client *pClient;
+   PV_Channel *pChannel;
+   PV_Channel *next;
+   int number;
+   int j;
+
+   changes->added = 0;
+   changes->recreated = 0;
+   changes->cleared = 0;
+
+   next = previous_last ? (PV_Channel *) ellNext ((ELLNODE *) previous_last) :
+       (PV_Channel *) ellFirst (&PV_Channel_List);
+   for (pChannel = next; pChannel;
+        pChannel = (PV_Channel *) ellNext ((ELLNODE *) pChannel)) {
+      pChannel->subscribers_added = false;
+      changes->added++;
+   }
+   if (next_to_create == NULL) {
+      next_to_create = next;
+   }
 
-   pClient = Validate_Channel_Id (args->chid);
-   if (pClient) {
+   for (j = 0; j < number_changed; j++) {
+      pChannel = changed_channels[j];
+      if (pChannel->number_subscribers == 0) {
+         Clear_Channel (pChannel);
+         changes->cleared++;
+
+      } else if (pChannel->subscribers_added) {
+         pChannel->subscribers_added = false;
+         if ((pChannel->state != csNotCreated) &&
+             (pChannel->state != csParked)) {
+            Clear_Channel (pChannel);
+            pChannel->disconnect_time = 0;
+            Create_Channel (pChannel);
+            changes->recreated++;
+         }
+      }
+   }
 
-      /* Valid channel id - need some more event specific checks.
+   if (changes->cleared > 0) {
+      Queue_Purge (&pending_queue);
+      Queue_Purge (&not_found_queue);
+      Queue_Purge (&parked_set);
+      while (next_to_create && (next_to_create->number_subscribers == 0)) {
+         next_to_create = (PV_Channel *) ellNext ((ELLNODE *) next_to_create);
+      }
+
+      /* Leaving a shard may mark further channels, so all the channels to be
+       * freed leave their shards first, and are then freed and taken off the
+       * changed list.
        */
-      if (args->status == ECA_NORMAL) {
+      for (j = 0; j < number_changed; j++) {
+         if (changed_channels[j]->number_subscribers == 0) {
+            Shard_Leave (changed_channels[j]);
+         }
+      }
 
-         if (debug >= 4) {
-            printf ("PV event (%s) first %s\n", pClient->pv_name,
-                    BOOL_IMAGE (pClient->is_first_update));
+      number = 0;
+      for (j = 0; j < number_changed; j++) {
+         pChannel = changed_channels[j];
+         if (pChannel->number_subscribers == 0) {
+            Free_Channel (pChannel);
+         } else {
+            changed_channels[number++] = pChannel;
          }
+      }
+      number_changed = number;
+   }
 
-         if ((args->usr == &Get) || (args->usr == &Event)) {
+   if (reassign_all) {
+      Assign_Channel_Queues (number_workers);
+   } else {
+      Assign_Changed_Queues (number_workers);
+   }
 
-            if (args->dbr) {
-               Get_Event_Handler (pClient, args);
-            } else {
-               printf ("event_handler (%s) args->dbr is null\n",
-                       pClient->pv_name);
-            }
+   for (j = 0; j < number_changed; j++) {
+      changed_channels[j]->is_changed = false;
+   }
+   number_changed = 0;
 
-         } else if (args->usr == &Put) {
+   Rebuild_Interned_Strings (false);
+}                               /* Apply_Channel_Changes */
 
-            /* place holder */
-            printf ("event_handler (%s) unexpected args->usr = Put\n",
-                    pClient->pv_name);
 
-         } else {
-            printf ("event_handler (%s) unknown args->usr\n",
-                    pClient->pv_name);
-         }
+/*------------------------------------------------------------------------------
+ * Reads the configuration file into list, from the file's rule cache if it is
+ * up to date, otherwise by scanning the file.
+ */
+static bool Read_Configuration_File (const char *filename, ELLLIST * list)
+{
+   CA_Client *first;
+
+   if (Rule_Cache_Read (filename, &Allocate_Client, list)) {
+      return true;
+   }
+
+   /* Discard anything loaded from an unusable cache.
+    */
+   while ((first = (CA_Client *) ellFirst (list)) != NULL) {
+      Free_Unit (list, first);
+   }
+   return Scan_Configuration_File (filename, &Allocate_Client, list);
+}                               /* Read_Configuration_File */
+
+
+/*------------------------------------------------------------------------------
+ * Re-reads the configuration file, and reconciles the new specifications with
+ * the current clients. A specification with the same signature as a current
+ * unit, i.e. the same PV name, index, options, match criteria and command,
+ * keeps the current unit, and hence its match state. Only the channels whose
+ * subscribers have changed are created, re-created or cleared.
+ */
+static bool Reload_Configuration ()
+{
+   ELLLIST old_list = ELLLIST_INIT;
+   ELLLIST new_list = ELLLIST_INIT;
+   Channel_Changes changes;
+   CA_Client **matches;
+   CA_Client *first;
+   PV_Channel *previous_last;
+   int number_old;
+   int number_new;
+   int kept = 0;
+   int j;
+   bool status;
+
+   if (config_filename == NULL) {
+      printf ("Configuration reload is only available for a configuration file\n");
+      return false;
+   }
+
+   printf ("Reloading configuration file %s\n", config_filename);
+   status = Read_Configuration_File (config_filename, &new_list);
+   Note_Config_File ();
+
+   if (!status) {
+      printf ("Configuration reload failed - configuration unchanged\n");
+      while ((first = (CA_Client *) ellFirst (&new_list)) != NULL) {
+         Free_Unit (&new_list, first);
+      }
+      return false;
+   }
+
+   /* Match each new unit to an unchanged current unit, if any. Matched
+    * units are taken out of the unit table, so that duplicate specifications
+    * match distinct units.
+    */
+   number_new = 0;
+   for (first = (CA_Client *) ellFirst (&new_list); first;
+        first = Next_Unit (first)) {
+      number_new++;
+   }
+   matches = (CA_Client **) callocMustSucceed
+       (number_new + 1, sizeof (CA_Client *), "Reload_Configuration");
+
+   j = 0;
+   for (first = (CA_Client *) ellFirst (&new_list); first;
+        first = Next_Unit (first)) {
+      matches[j] = Unit_Table_Find (first->signature);
+      if (matches[j] && (matches[j]->set_identity != first->set_identity)) {
+         matches[j] = NULL;     /* a set file has changed */
+      }
+      if (matches[j]) {
+         Unit_Table_Remove (matches[j]);
+      }
+      j++;
+   }
+
+   Workers_Pause ();
+   epicsMutexLock (connection_mutex);
 
+   /* Rebuild the client list in the new configuration order, keeping the
+    * unchanged units and adding the new units.
+    */
+   ellConcat (&old_list, &CA_Client_List);
+   previous_last = (PV_Channel *) ellLast (&PV_Channel_List);
+
+   j = 0;
+   while ((first = (CA_Client *) ellFirst (&new_list)) != NULL) {
+      if (matches[j]) {
+         Move_Unit (&old_list, &CA_Client_List, matches[j]);
+         Unit_Table_Insert (matches[j]);
+         Free_Unit (&new_list, first);
+         kept++;
       } else {
-         printf ("event_handler (%s) error (%s)\n",
-                 pClient->pv_name, ca_message (args->status));
+         Add_Unit (&new_list, first);
       }
+      j++;
    }
-}                               /* application_event_handler */
+
+   /* What remains of the old list are the removed units.
+    */
+   number_old = 0;
+   while ((first = (CA_Client *) ellFirst (&old_list)) != NULL) {
+      Remove_Unit (&old_list, first);
+      number_old++;
+   }
+   number_old += kept;
+
+   Apply_Channel_Changes (previous_last, true, &changes);
+   epicsMutexUnlock (connection_mutex);
+   Workers_Resume ();
+
+   free (matches);
+
+   printf ("Configuration reloaded: %d unchanged, %d new and %d removed"
+           " specifications; %d channels added, %d re-created, %d cleared\n",
+           kept, number_new - kept, number_old - kept, changes.added,
+           changes.recreated, changes.cleared);
+   return true;
+}                               /* Reload_Configuration */
 
 
 /*------------------------------------------------------------------------------
- * Replacement printf handler
+ * CONTROL REQUESTS
+ *------------------------------------------------------------------------------
  */
-void application_printf_handler (char *formated_text)
+static const char *Connection_State_Image (const Connection_State state)
 {
-   printf ("%s", formated_text);
-}                               /* application_printf_handler */
+   static const char *images[NUMBER_CONNECTION_STATES] = {
+      "not created", "pending", "not found", "connected", "disconnected",
+      "parked"
+   };
+
+   if ((state < 0) || (state >= NUMBER_CONNECTION_STATES)) {
+      return "unknown";
+   }
+   return images[state];
+}                               /* Connection_State_Image */
 
 
 /*------------------------------------------------------------------------------
+ * Appends all the metrics. The caller must hold the connection mutex. Rule
+ * transitions are only output for rules that have changed state at least once,
+ * as there may be a very large number of rules.
  */
-void Print_Match_Information (CA_Client * pClient)
+static void Append_Metrics (Metrics_Text * text)
 {
-   unsigned int j;
-   Variant_Kind kind;
-   char *request;
-   Variant_Range *pVR;
-   char lower[45];
-   char upper[45];
-   char *lq, *uq;
+   CA_Client *first;
+   unsigned long transitions;
+   int number = 0;
+   int state;
+
+   Metrics_Printf (text, "# HELP kryten_start_time_seconds Start time, in"
+                   " seconds since the epoch.\n"
+                   "# TYPE kryten_start_time_seconds gauge\n"
+                   "kryten_start_time_seconds %ld\n", start_time);
+
+   Metrics_Printf (text, "# HELP kryten_channels Channels in each connection"
+                   " state.\n# TYPE kryten_channels gauge\n");
+   for (state = 0; state < NUMBER_CONNECTION_STATES; state++) {
+      Metrics_Printf (text, "kryten_channels{state=\"%s\"} %d\n",
+                      Connection_State_Image (state), state_counts[state]);
+   }
 
-   kind = pClient->match_set_collection.item[0].lower.kind;
-   switch (kind) {
+   Metrics_Printf (text, "# HELP kryten_channel_connects_total Channel"
+                   " connections, including reconnections.\n"
+                   "# TYPE kryten_channel_connects_total counter\n"
+                   "kryten_channel_connects_total %lu\n", number_connects);
+
+   Metrics_Printf (text, "# HELP kryten_rule_transitions_total Match state"
+                   " changes, by specification.\n"
+                   "# TYPE kryten_rule_transitions_total counter\n");
+   for (first = (CA_Client *) ellFirst (&CA_Client_List); first;
+        first = Next_Unit (first)) {
+      if (first->expression) {
+         transitions = first->expression->number_transitions;
+      } else if (first->sequence) {
+         transitions = first->sequence->number_transitions;
+      } else {
+         transitions = first->number_transitions;
+      }
+      number++;
 
-      case vkString:
-         request = "DBF_STRING";
-         break;
+      if (transitions > 0) {
+         Metrics_Printf (text, "kryten_rule_transitions_total{rule=");
+         Metrics_Label (text, first->signature ? first->signature : "");
+         Metrics_Printf (text, "} %lu\n", transitions);
+      }
+   }
 
-      case vkInteger:
-         request = "DBF_LONG";
-         break;
+   Metrics_Printf (text, "# HELP kryten_rules Channel specifications,"
+                   " expressions and sequences.\n"
+                   "# TYPE kryten_rules gauge\nkryten_rules %d\n", number);
 
-      case vkFloating:
-         request = "DBF_DOUBLE";
-         break;
+   Metrics_Append_Runtime (text);
+}                               /* Append_Metrics */
 
-      default:
-         request = "NONE";
-         break;
-   }
 
-   printf ("PV Name: %s [%d]\n", pClient->pv_name, pClient->element_index);
+/*------------------------------------------------------------------------------
+ * Writes the metrics file, e.g. for the node exporter textfile collector.
+ */
+static void Write_Metrics_File ()
+{
+   Metrics_Text text = { NULL, 0, 0 };
 
-   printf ("Request: %s\n", request);
+   epicsMutexLock (connection_mutex);
+   Append_Metrics (&text);
+   epicsMutexUnlock (connection_mutex);
 
-   printf ("Command: %s\n", pClient->match_command);
+   (void) Metrics_Write_File (metrics_path, &text);
+   Metrics_Text_Free (&text);
+}                               /* Write_Metrics_File */
 
-   for (j = 0; j < pClient->match_set_collection.count; j++) {
-      if (j == 0) {
-         printf ("Matches: ");
-      } else {
-         printf ("     or: ");
-      }
 
-      pVR = &pClient->match_set_collection.item[j];
+/*------------------------------------------------------------------------------
+ * Pauses the dispatch workers, if not already paused by the current batch of
+ * control requests, before a request adds or removes units. As per reload,
+ * the workers are paused before the connection mutex is taken.
+ */
+static void Control_Begin_Change ()
+{
+   if (!control_changing) {
+      epicsMutexUnlock (connection_mutex);
+      Workers_Pause ();
+      epicsMutexLock (connection_mutex);
+      control_changing = true;
+   }
+}                               /* Control_Begin_Change */
 
-      Variant_Image (lower, sizeof (lower), &pVR->lower);
-      lq = (pVR->lower.kind == vkString) ? "\"" : "";
 
-      Variant_Image (upper, sizeof (upper), &pVR->upper);
-      uq = (pVR->upper.kind == vkString) ? "\"" : "";
+/*------------------------------------------------------------------------------
+ * add <specification>
+ * The specification is as per a configuration file line, i.e. it may be an
+ * expression or a sequence, or several ';' separated specifications.
+ */
+static void Control_Add (Control_Request * request, const char *specification)
+{
+   ELLLIST new_list = ELLLIST_INIT;
+   CA_Client *first;
+   int number = 0;
 
-      printf ("%d  %s%s%s", pVR->comp, lq, lower, lq);
+   (void) Scan_Specification_String (specification, strlen (specification),
+                                     "control request", &Allocate_Client,
+                                     &new_list);
 
-      if (pVR->comp == ckRange) {
-         printf (" to %s%s%s", uq, upper, uq);
-      }
-      printf ("\n");
+   if (ellCount (&new_list) > 0) {
+      Control_Begin_Change ();
+   }
+   while ((first = (CA_Client *) ellFirst (&new_list)) != NULL) {
+      Add_Unit (&new_list, first);
+      number++;
+   }
 
+   if (number == 0) {
+      Control_Reply (request, "error invalid specification\n");
+   } else {
+      Control_Reply (request, "ok added %d\n", number);
    }
-   printf ("\n");
-}                               /* Print_Match_Information */
+}                               /* Control_Add */
 
 
 /*------------------------------------------------------------------------------
+ * remove <specification>
+ * The specification must be as added, or as per the configuration file, save
+ * for leading and trailing white space.
  */
-void Print_Connection_Timeout (CA_Client * pClient)
+static void Control_Remove (Control_Request * request,
+                            const char *specification)
 {
-   if (pClient->is_connected != true) {
-      printf ("Channel connect timed out: '%s' not found.\n",
-              pClient->pv_name);
+   CA_Client *first;
+
+   first = Unit_Table_Find (specification);
+   if (first == NULL) {
+      Control_Reply (request, "error not found\n");
+      return;
    }
-}                               /* Print_Connection_Timeout */
+
+   Control_Begin_Change ();
+   Remove_Unit (&CA_Client_List, first);
+   Control_Reply (request, "ok removed\n");
+}                               /* Control_Remove */
 
 
 /*------------------------------------------------------------------------------
- * CLIENT LIST functions
- *------------------------------------------------------------------------------
+ * list
+ * One line per specification, in order.
  */
-static void Create_All_Channels (ELLLIST * CA_Client_List)
+static void Control_List (Control_Request * request)
 {
-   CA_Client *pClient;
+   CA_Client *first;
+   int number = 0;
 
-   pClient = (CA_Client *) ellFirst (CA_Client_List);
-   while (pClient) {
-      /* Open this Channel Access channel
-       */
-      Create_Channel (pClient);
-      pClient = (CA_Client *) ellNext ((ELLNODE *) pClient);
+   for (first = (CA_Client *) ellFirst (&CA_Client_List); first;
+        first = Next_Unit (first)) {
+      Control_Reply (request, "%s\n", first->signature);
+      number++;
    }
-}                               /* Create_All_Channels */
+   Control_Reply (request, "ok %d\n", number);
+}                               /* Control_List */
 
 
 /*------------------------------------------------------------------------------
+ * metrics
+ * The metrics in the Prometheus text exposition format, as per the metrics
+ * file.
  */
-static void Clear_All_Channels (ELLLIST * CA_Client_List)
+static void Control_Metrics (Control_Request * request)
 {
-   CA_Client *pClient;
+   Metrics_Text text = { NULL, 0, 0 };
 
-   pClient = (CA_Client *) ellFirst (CA_Client_List);
-   while (pClient) {
-      /* Close this Channel Access channel
-       */
-      Clear_Channel (pClient);
-      pClient = (CA_Client *) ellNext ((ELLNODE *) pClient);
-   }
-}                               /* Clear_All_Channels */
+   Append_Metrics (&text);
+   Control_Reply (request, "%s", text.text ? text.text : "");
+   Control_Reply (request, "ok\n");
+   Metrics_Text_Free (&text);
+}                               /* Control_Metrics */
 
 
 /*------------------------------------------------------------------------------
+ * state [<pv name>]
+ * Without a PV name, the number of channels in each connection state.
+ * Otherwise the state and current value of each specification referencing
+ * the PV.
  */
-static void Print_All_Match_Information (ELLLIST * CA_Client_List)
+static void Control_State (Control_Request * request, const char *pv_name)
 {
+   PV_Channel *pChannel;
    CA_Client *pClient;
+   char image[80];
+   int number = 0;
+
+   if (*pv_name == '\0') {
+      Control_Reply (request, "channels %d connected %d pending %d"
+                     " not-found %d parked %d disconnected %d"
+                     " not-created %d\n", ellCount (&PV_Channel_List),
+                     state_counts[csConnected], state_counts[csPending],
+                     state_counts[csNotFound], state_counts[csParked],
+                     state_counts[csDisconnected],
+                     state_counts[csNotCreated]);
+      Control_Reply (request, "ok\n");
+      return;
+   }
 
-   pClient = (CA_Client *) ellFirst (CA_Client_List);
-   while (pClient) {
-      Print_Match_Information (pClient);
-      pClient = (CA_Client *) ellNext ((ELLNODE *) pClient);
+   if (channel_table_size > 0) {
+      pChannel = channel_table[Channel_Hash (pv_name) % channel_table_size];
+      for (; pChannel; pChannel = pChannel->hash_next) {
+         if (strcmp (pChannel->pv_name, pv_name) != 0) {
+            continue;
+         }
+
+         for (pClient = pChannel->subscribers; pClient;
+              pClient = pClient->next_subscriber) {
+            if (pClient->data_element_count > 0) {
+               Variant_Image (image, sizeof (image), &pClient->data);
+            } else {
+               snprintf (image, sizeof (image), "-");
+            }
+            Control_Reply (request, "%s | %s | %s | %s\n",
+                           pClient->signature,
+                           Connection_State_Image (pChannel->state),
+                           pClient->last_update_matched ? "matched" :
+                           "not matched", image);
+            number++;
+         }
+      }
    }
-}                               /* Print_All_Client_Information */
+
+   if (number == 0) {
+      Control_Reply (request, "error unknown PV %s\n", pv_name);
+   } else {
+      Control_Reply (request, "ok %d\n", number);
+   }
+}                               /* Control_State */
 
 
 /*------------------------------------------------------------------------------
+ * Splits the request line into the command and its argument, the latter sans
+ * leading and trailing white space, and dispatches the request.
  */
-static void Print_All_Connection_Timeouts (ELLLIST * CA_Client_List)
+static void Control_Request_Handler (Control_Request * request,
+                                     const char *line)
 {
-   CA_Client *pClient;
+   char command[16];
+   char *argument;
+   int len;
 
-   pClient = (CA_Client *) ellFirst (CA_Client_List);
-   while (pClient) {
-      Print_Connection_Timeout (pClient);
-      pClient = (CA_Client *) ellNext ((ELLNODE *) pClient);
+   while (isspace (*line)) {
+      line++;
+   }
+   len = 0;
+   while ((line[len] != '\0') && !isspace (line[len])) {
+      len++;
+   }
+   if (len >= (int) sizeof (command)) {
+      Control_Reply (request, "error unknown command\n");
+      return;
+   }
+   memcpy (command, line, len);
+   command[len] = '\0';
+
+   line += len;
+   while (isspace (*line)) {
+      line++;
    }
-}                               /* Verify_All_Clients_Are_Connected */
+   argument = epicsStrDup (line);
+   len = strlen (argument);
+   while ((len > 0) && isspace (argument[len - 1])) {
+      argument[--len] = '\0';
+   }
+
+   if (strcmp (command, "add") == 0) {
+      Control_Add (request, argument);
+   } else if (strcmp (command, "remove") == 0) {
+      Control_Remove (request, argument);
+   } else if (strcmp (command, "list") == 0) {
+      Control_List (request);
+   } else if (strcmp (command, "state") == 0) {
+      Control_State (request, argument);
+   } else if (strcmp (command, "metrics") == 0) {
+      Control_Metrics (request);
+   } else if (strcmp (command, "help") == 0) {
+      Control_Reply (request, "add <specification>\n"
+                     "remove <specification>\n"
+                     "list\n" "state [<pv name>]\n" "metrics\n" "ok\n");
+   } else {
+      Control_Reply (request, "error unknown command '%s'\n", command);
+   }
+
+   free (argument);
+}                               /* Control_Request_Handler */
 
 
 /*------------------------------------------------------------------------------
- * LOCAL DATA
- *------------------------------------------------------------------------------
+ * Processes any waiting control requests as a batch, holding the connection
+ * mutex. The dispatch workers are only paused once a request adds or removes
+ * units, and the channel changes are then applied incrementally. So batches of
+ * read only requests do not hold up event processing.
  */
-static ELLLIST CA_Client_List = ELLLIST_INIT;
+static void Process_Control_Requests ()
+{
+   const int maximum = 1000;    /* maximum requests processed per cycle */
+
+   Channel_Changes changes;
+   PV_Channel *previous_last;
+   int number;
+
+   if (!Control_Pending ()) {
+      return;
+   }
+
+   epicsMutexLock (connection_mutex);
+
+   control_changing = false;
+   previous_last = (PV_Channel *) ellLast (&PV_Channel_List);
+   number = Control_Process (Control_Request_Handler, maximum);
+
+   if (!control_changing) {
+      epicsMutexUnlock (connection_mutex);
+      return;
+   }
+
+   Apply_Channel_Changes (previous_last, false, &changes);
+   epicsMutexUnlock (connection_mutex);
+   Workers_Resume ();
+   control_changing = false;
+
+   if (debug > 0) {
+      printf ("Control: %d requests; %d channels added, %d re-created,"
+              " %d cleared\n", number, changes.added, changes.recreated,
+              changes.cleared);
+   }
+}                               /* Process_Control_Requests */
 
 
 /*------------------------------------------------------------------------------
+ * Reads the channel creation and connection reporting parameters from the
+ * environment: KRYTEN_CREATE_BATCH (channels per cycle, 0 means all at once),
+ * KRYTEN_CONNECT_TIMEOUT (milliseconds), KRYTEN_TIMEOUT_REPORTS (maximum
+ * number of connect timeouts reported per second), and the parking policy
+ * KRYTEN_PARK_AFTER (milliseconds, 0 means never park), KRYTEN_PARK_RETRY and
+ * KRYTEN_PARK_RETRY_MAX (milliseconds). Also the configuration file check
+ * interval, KRYTEN_RELOAD_INTERVAL (milliseconds, 0 means SIGHUP only), and
+ * the metrics file write interval, KRYTEN_METRICS_INTERVAL (milliseconds).
  */
-CA_Client *Allocate_Client ()
+static void Get_Connection_Parameters ()
 {
-   CA_Client *result;
+   bool status;
+   long value;
 
-   result = (CA_Client *) callocMustSucceed
-       (1, sizeof (CA_Client), "Allocate_Client");
+   value = get_long_env ("KRYTEN_CREATE_BATCH", &status);
+   if (status && (value >= 0)) {
+      create_batch = (int) value;
+   }
 
-   result->magic1 = CA_CLIENT_MAGIC;
-   result->magic2 = CA_CLIENT_MAGIC;
-   result->is_connected = false;
-   result->channel_id = NULL;
-   result->event_id = NULL;
-   result->pv_name[0] = '\0';
-   result->match_set_collection.count = 0;
-   result->match_command[0] = '\0';
+   value = get_long_env ("KRYTEN_CONNECT_TIMEOUT", &status);
+   if (status && (value > 0)) {
+      connect_timeout = 0.001 * (double) value;
+   }
 
-   /* Lastly add to client list.
-    */
-   ellAdd (&CA_Client_List, (ELLNODE *) result);
+   value = get_long_env ("KRYTEN_TIMEOUT_REPORTS", &status);
+   if (status && (value > 0)) {
+      timeout_reports = (int) value;
+   }
 
-   return result;
-}                               /* Allocate_Client */
+   value = get_long_env ("KRYTEN_PARK_AFTER", &status);
+   if (status && (value >= 0)) {
+      park_after = 0.001 * (double) value;
+   }
+
+   value = get_long_env ("KRYTEN_PARK_RETRY", &status);
+   if (status && (value > 0)) {
+      park_retry = 0.001 * (double) value;
+   }
+
+   value = get_long_env ("KRYTEN_PARK_RETRY_MAX", &status);
+   if (status && (value > 0)) {
+      park_retry_max = 0.001 * (double) value;
+   }
+   park_retry_max = MAX (park_retry_max, park_retry);
+
+   value = get_long_env ("KRYTEN_RELOAD_INTERVAL", &status);
+   if (status && (value >= 0)) {
+      reload_interval = 0.001 * (double) value;
+   }
+
+   value = get_long_env ("KRYTEN_METRICS_INTERVAL", &status);
+   if (status && (value > 0)) {
+      metrics_interval = 0.001 * (double) value;
+   }
+}                               /* Get_Connection_Parameters */
 
 
 /*------------------------------------------------------------------------------
@@ -819,44 +3496,131 @@ CA_Client *Allocate_Client ()
  */
 bool Create_PV_Client_List_From_File (const char *pv_list_filename, int *number)
 {
+   double start;
    bool result;
-   int n;
 
    /* Initialialise the list of clients.
     */
    ellInit (&CA_Client_List);
 
-   result = Scan_Configuration_File (pv_list_filename, &Allocate_Client);
+   start = monotonic_time ();
+   result = Read_Configuration_File (pv_list_filename, &CA_Client_List);
 
-   n = ellCount (&CA_Client_List);
-   printf ("PV client list created - %d %s.\n", n,
-           (n == 1 ? "entry" : " entries"));
+   /* On start up, specification errors are reported but do not prevent the
+    * valid specifications being used.
+    */
+   result = result || (ellCount (&CA_Client_List) > 0);
 
-   *number = n;
+   /* Retained for any subsequent reload.
+    */
+   config_filename = epicsStrDup (pv_list_filename);
+   Note_Config_File ();
+
+   Report_Client_List (number, start);
    return result;
 }                               /* Create_PV_Client_List */
 
+/*------------------------------------------------------------------------------
+ */
+bool Compile_PV_Client_List (const char *pv_list_filename, int *number)
+{
+   struct stat info;
+   bool result;
+
+   ellInit (&CA_Client_List);
+
+   /* The file status is taken before the scan, so that any modification made
+    * while scanning makes the cache stale.
+    */
+   if (stat (pv_list_filename, &info) != 0) {
+      printf ("unable to open file %s.\n", pv_list_filename);
+      return false;
+   }
+
+   result = Scan_Configuration_File (pv_list_filename, &Allocate_Client,
+                                     &CA_Client_List);
+   *number = ellCount (&CA_Client_List);
+   printf ("PV client list created - %d %s.\n", *number,
+           (*number == 1 ? "entry" : " entries"));
+
+   return result && Rule_Cache_Write (pv_list_filename, &info,
+                                      &CA_Client_List);
+}                               /* Compile_PV_Client_List */
+
 /*------------------------------------------------------------------------------
  */
 bool Create_PV_Client_List_From_String (const char *buffer, const size_t size, int *number)
 {
+   double start;
    bool result;
-   int n;
 
    /* Initialialise the list of clients.
     */
    ellInit (&CA_Client_List);
 
-   result = Scan_Configuration_String (buffer, size, &Allocate_Client);
-
-   n = ellCount (&CA_Client_List);
-   printf ("PV client list created - %d %s.\n", n,
-           (n == 1 ? "entry" : " entries"));
+   start = monotonic_time ();
+   result = Scan_Configuration_String (buffer, size, &Allocate_Client,
+                                       &CA_Client_List);
+   result = result || (ellCount (&CA_Client_List) > 0);
 
-   *number = n;
+   Report_Client_List (number, start);
    return result;
 }
 
+/*------------------------------------------------------------------------------
+ */
+int Match_Target_Value (const Match_Target target, const char *name)
+{
+   const char **names;
+   int number;
+   int j;
+
+   if (target == mtSeverity) {
+      names = epicsAlarmSeverityStrings;
+      number = ALARM_NSEV;
+   } else {
+      names = epicsAlarmConditionStrings;
+      number = ALARM_NSTATUS;
+   }
+
+   for (j = 0; j < number; j++) {
+      if (strcmp (name, names[j]) == 0) {
+         return j;
+      }
+   }
+   return -1;
+}                               /* Match_Target_Value */
+
+
+/*------------------------------------------------------------------------------
+ */
+const char *Match_Target_Image (const Match_Target target, const int value)
+{
+   if (target == mtSeverity) {
+      return ((value >= 0) && (value < ALARM_NSEV)) ?
+          epicsAlarmSeverityStrings[value] : "UNKNOWN";
+   } else {
+      return ((value >= 0) && (value < ALARM_NSTATUS)) ?
+          epicsAlarmConditionStrings[value] : "UNKNOWN";
+   }
+}                               /* Match_Target_Image */
+
+
+/*------------------------------------------------------------------------------
+ */
+const char *Comparison_Image (const Comparision_Kind comp)
+{
+   /* Must be consistant with Comparision_Kind
+    */
+   static const char *comparison_operators[7] = {
+      "", "/=", "<=", ">=", "=", "<", ">"
+   };
+
+   return ((comp >= ckVoid) && (comp <= ckGreaterThan)) ?
+       comparison_operators[comp] : "";
+}                               /* Comparison_Image */
+
+
 /*------------------------------------------------------------------------------
  */
 void Print_Clients_Info ()
@@ -873,81 +3637,174 @@ bool Process_Clients (Bool_Function_Handle shut_down)
    const int maximum = 400;     /* maximum items processed at one time */
    const double delay = 0.05;   /* delay between processing burst */
 
-   bool connection_timouts_are_done;
-   int status;
-/*
-   static long last_time;
-   static long this_time;
-*/
+   bool all_created;
+   bool all_reported;
+   double now;
+   double progress_time;
+   double last_progress_time;
+   double metrics_time;
+   unsigned long last_connects;
 
-   initialise_buffered_callbacks ();
+   /* Queue 0 is processed by this thread, and queues 1 to number_workers by
+    * the dispatch workers.
+    */
+   initialise_buffered_callback_queues (number_workers + 1);
+   connection_mutex = epicsMutexCreate ();
 
-   /* Create Channel Access context.
+   /* Metrics are only gathered when they may be output. There is one slot per
+    * dispatch thread, and this thread uses slot 0.
     */
-   status = ca_context_create (ca_enable_preemptive_callback);
-   if (status != ECA_NORMAL) {
-      printf ("ca_context_create failed (%s)\n", ca_message (status));
-      return false;
+   if ((metrics_path != NULL) || (control_path != NULL)) {
+      Metrics_Initialise (number_workers + 1);
+      Metrics_Register_Thread (0);
    }
 
-   /* Replace the CA Client Library report handler.
+   /* Create Channel Access context(s).
     */
-   status = ca_replace_printf_handler (buffered_printf_handler);
-   if (status != ECA_NORMAL) {
-      printf ("ca_replace_printf_handler failed (%s)\n",
-              ca_message (status));
-      /* This is not return-worthy. Carry on 
-       */
+   if (!Create_Contexts (number_contexts)) {
+      Destroy_All_Contexts ();
+      return false;
+   }
+
+   Assign_Channel_Queues (number_workers);
+   Rebuild_Interned_Strings (true);
+   if ((number_workers > 0) &&
+       !Workers_Start (number_workers, contexts, contexts_created)) {
+      Destroy_All_Contexts ();
+      return false;
+   }
+
+   if ((control_path != NULL) && !Control_Start (control_path)) {
+      if (number_workers > 0) {
+         Workers_Stop ();
+      }
+      Destroy_All_Contexts ();
+      return false;
    }
 
+   Get_Connection_Parameters ();
+
    if (is_verbose) {
-      printf ("Creating all PV channels\n");
+      printf ("Creating all PV channels");
+      if (create_batch > 0) {
+         printf (" in batches of %d", create_batch);
+      }
+      printf ("\n");
    }
-   Create_All_Channels (&CA_Client_List);
+
+   next_to_create = (PV_Channel *) ellFirst (&PV_Channel_List);
 
    start_time = ((long) time (NULL));
+   progress_time = monotonic_time ();
+   last_progress_time = progress_time;
+   metrics_time = progress_time;
+   last_connects = 0;
 
-   connection_timouts_are_done = false;
+   all_created = false;
+   all_reported = false;
    cycle = 0;
    while ((*shut_down) () == false) {
       cycle++;
 
-      status = ca_flush_io ();
-      if (status != ECA_NORMAL) {
-         printf ("ca_flush_io failed (%s)\n", ca_message (status));
+      epicsMutexLock (connection_mutex);
+      if (!all_created) {
+         all_created = Create_Channel_Batch ();
+         if (all_created && is_verbose) {
+            printf ("All %d PV channels created in %.1f s\n",
+                    ellCount (&PV_Channel_List),
+                    monotonic_time () - progress_time);
+         }
+      } else if (next_to_create != NULL) {
+         /* Channels added by a reload or a control request.
+          */
+         (void) Create_Channel_Batch ();
       }
+      epicsMutexUnlock (connection_mutex);
+
+      Flush_All_Contexts ();
 
       process_buffered_callbacks (maximum);
+      Process_Sequence_Timeouts ();
+      Process_Host_Events ();
+
+      epicsMutexLock (connection_mutex);
+      now = monotonic_time ();
+      Process_Connection_Timeouts (now);
+      Process_Parked_Channels (now);
+
+      if (diagnostics_requested) {
+         diagnostics_requested = false;
+         Print_Diagnostics (now, now - last_progress_time);
+         last_progress_time = now;
+         last_connects = number_connects;
+      }
+
+      /* Report progress periodically while anything is changing, and once
+       * all channels have either connected or timed out.
+       */
+      if (is_verbose) {
+         if (all_created && !all_reported &&
+             (state_counts[csPending] == 0)) {
+            Print_Connection_Progress (now - last_progress_time);
+            last_progress_time = now;
+            last_connects = number_connects;
+            all_reported = true;
+         } else if ((now >= last_progress_time + progress_interval) &&
+                    ((number_connects != last_connects) ||
+                     (state_counts[csPending] > 0))) {
+            Print_Connection_Progress (now - last_progress_time);
+            last_progress_time = now;
+            last_connects = number_connects;
+         }
+      }
+      epicsMutexUnlock (connection_mutex);
+
+      /* Reload the configuration on SIGHUP, or if the file has changed.
+       */
+      if (reload_requested || Config_File_Changed (now)) {
+         reload_requested = false;
+         if (Reload_Configuration () && (next_to_create != NULL)) {
+            all_reported = false;
+         }
+      }
 
-      /* Allow channels 2 seconds to connect before we test for
-       * connection timeouts.
+      /* Add/remove monitors as per any runtime control requests.
        */
-      if ((connection_timouts_are_done == false) &&
-          ((cycle * delay) >= 2.0)) {
-         Print_All_Connection_Timeouts (&CA_Client_List);
-         connection_timouts_are_done = true;
+      Process_Control_Requests ();
+      if (next_to_create != NULL) {
+         all_reported = false;
       }
 
-      /** TODO Maybe ??
-      this_time = ((long) time (NULL));
-      if (this_time >= last_time + 60) {
-         printf ("re-reading /etc/kryton.conf\n");
-         last_time += 60;
+      if ((metrics_path != NULL) && (now >= metrics_time)) {
+         Write_Metrics_File ();
+         metrics_time = now + metrics_interval;
       }
-      **/
 
       epicsThreadSleep (delay);
    }
 
+   /* Stop accepting control requests, and stop the workers before clearing
+    * the channels they own.
+    */
+   Control_Stop ();
+   if (number_workers > 0) {
+      Workers_Stop ();
+   }
+
    if (is_verbose) {
+      Print_All_Channel_Statistics (&PV_Channel_List);
+      if (contexts_created > 1) {
+         Print_Context_Statistics ();
+      }
+      Print_Connection_Progress (monotonic_time () - last_progress_time);
       printf ("Clearing all PV channels\n");
    }
-   Clear_All_Channels (&CA_Client_List);
+   Clear_All_Channels (&PV_Channel_List);
+   Destroy_All_Contexts ();
 
-   /* Reset the CA Client Library report handler.
-    */
-   status = ca_replace_printf_handler (NULL);
-   ca_context_destroy ();
+   Queue_Free (&pending_queue);
+   Queue_Free (&not_found_queue);
+   Queue_Free (&parked_set);
 
    return true;
 }                               /* Process_Clients */
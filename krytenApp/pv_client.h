@@ -38,15 +38,21 @@
 #include <ellLib.h>
 
 #include "kryten.h"
+#include "array_kernels.h"
+#include "expression.h"
+#include "intern.h"
+#include "pattern.h"
+#include "sequence.h"
+#include "string_set.h"
 #include "utilities.h"
 
 /* For use with an ELLLIST objects
  */
 #define CA_CLIENT_MAGIC   0xEB1C5314
 
-#define MAXIMUM_PVNAME_SIZE        80
 #define NUMBER_OF_VARIENT_RANGES   20
-#define MATCH_COMMAND_LENGTH      120
+#define DEFAULT_CA_PRIORITY        10
+#define MAXIMUM_CONTEXTS           16
 
 /* Defines the types of value copmparisons that may be performed.
  * Order is significant, e.g. <= comes before <.
@@ -59,13 +65,18 @@ typedef enum eComparision_Kind {
    ckEqual,               /* =  */
    ckLessThan,            /* <  */
    ckGreaterThan,         /* >  */
-   ckRange                /* ~  */
+   ckRange,               /* ~  */
+   ckInSet,               /* in */
+   ckRegex,               /* regex */
+   ckGlob                 /* glob */
 } Comparision_Kind;
 
 typedef struct sVariant_Range {
    Comparision_Kind comp;
    Variant_Value lower;
    Variant_Value upper;
+   String_Set *set;             /* only used by ckInSet */
+   Pattern *pattern;            /* only used by ckRegex and ckGlob */
 } Variant_Range;
 
 
@@ -75,24 +86,86 @@ typedef struct sVariant_Range_Collection {
 } Variant_Range_Collection;
 
 
-struct sCA_Client {
-   ELLNODE node;
-   int magic1;                  /* used when void pointer cast to a sCA_Client */
+/* A client's match ranges, as parsed into a Variant_Range_Collection. The items
+ * are allocated with, and immediately follow, the client.
+ */
+typedef struct sVariant_Range_List {
+   unsigned int count;
+   Variant_Range *item;
+} Variant_Range_List;
 
-   /* Channel Access connection info
-    */
-   char pv_name[MAXIMUM_PVNAME_SIZE];
-   int element_index;
-   chid channel_id;
-   evid event_id;
-   char host_name[80];
-   short int field_type;
-   unsigned long int element_count;
 
-   /* Meta data (apart from time stamp, returned first update)
-    * Essentially as out of dbr_ctrl_double and/or dbr_ctrl_enum.
-    * Use double as this caters for all types (float, long, short etc.)
-    */
+/* Whole array predicates, i.e. [any], [all] and [count op n].
+ */
+typedef enum eArray_Predicate_Kind {
+   apNone = 0,
+   apAny,
+   apAll,
+   apCount
+} Array_Predicate_Kind;
+
+typedef struct sArray_Predicate {
+   Array_Predicate_Kind kind;
+   Comparision_Kind count_comp; /* only used by apCount */
+   long count_threshold;        /* only used by apCount */
+   Interval_Set *intervals;     /* the match list as a set of intervals */
+} Array_Predicate;
+
+
+/* Element index lists and ranges, e.g. [1,5,10-20]. All the elements share
+ * the one channel and subscription, but each element has its own match state.
+ */
+typedef struct sElement_List {
+   int count;                   /* number of elements */
+   int *index;                  /* sorted, distinct, one based element indices */
+   bool *matched;               /* per element last update matched */
+   char *image;                 /* list as specified (sans white space) */
+   void *previous;              /* previous update's values, or NULL */
+   size_t previous_size;        /* size of previous in bytes */
+} Element_List;
+
+
+/* What a channel specification matches: the value, or the alarm severity or
+ * alarm status. Severity and status are matched as integers, or by name for
+ * sets and patterns.
+ */
+typedef enum eMatch_Target {
+   mtValue = 0,
+   mtSeverity,                  /* severity */
+   mtStatus                     /* status */
+} Match_Target;
+
+
+/* Per channel specification subscription options, e.g.
+ * {deadband=0.5, events=value|alarm, priority=50}. A deadband is implemented
+ * using the server side "dbnd" channel filter.
+ */
+typedef struct sChannel_Options {
+   double deadband;             /* 0.0 means no deadband filter */
+   bool is_relative;            /* deadband is a percentage of the value */
+   long event_mask;             /* 0 means default, i.e. value|alarm */
+   int priority;                /* Channel Access priority, 0 to 99 */
+} Channel_Options;
+
+
+/* Channel connection state, used for connection progress tracking.
+ */
+typedef enum eConnection_State {
+   csNotCreated = 0,
+   csPending,                   /* created, awaiting first connection */
+   csNotFound,                  /* connect timed out, still searching */
+   csConnected,
+   csDisconnected,
+   csParked,                    /* cleared, awaiting re-creation */
+   NUMBER_CONNECTION_STATES
+} Connection_State;
+
+
+/* Meta data, only requested when needed. Essentially as out of
+ * dbr_ctrl_double and/or dbr_ctrl_enum.
+ * Use double as this caters for all types (float, long, short etc.)
+ */
+typedef struct sChannel_Meta {
    dbr_short_t precision;       /* number of decimal places */
    char units[MAX_UNITS_SIZE];  /* units of value */
    dbr_short_t num_states;      /* number of strings (was no_str) */
@@ -105,12 +178,60 @@ struct sCA_Client {
    double lower_alarm_limit;
    double upper_ctrl_limit;     /* upper control limit */
    double lower_ctrl_limit;     /* lower control limit */
+} Channel_Meta;
+
+
+typedef struct sCA_Client CA_Client;
+
+/* One PV_Channel exists per distinct PV name and channel options. It owns the
+ * Channel Access channel and subscription, and the received meta data, and
+ * fans out each update to its subscribers, i.e. the clients (rules) that
+ * reference the PV.
+ * Data is requested in the channel's native field type and converted to
+ * each subscriber's match kind client side.
+ */
+#define PV_CHANNEL_MAGIC  0x5C4A3E71
+
+struct sPV_Channel {
+   ELLNODE node;
+   int magic1;                  /* used when void pointer cast to a sPV_Channel */
+
+   const char *pv_name;         /* interned, so compared by pointer */
+   const char *ca_name;         /* interned, pv_name plus any filters */
+   Channel_Options options;     /* part of the channel key */
+   bool is_filtered;            /* ca_name includes a channel filter */
+   unsigned long request_count; /* highest element required, 0 means all */
+   unsigned long lowest_index;  /* lowest element required */
+   unsigned long first_element; /* zero based offset of first element sent */
+   bool filter_retried;         /* array filter rejected, now unfiltered */
+   struct sPV_Channel *hash_next;       /* channel table chain */
+
+   /* Dispatch - all callbacks for the channel are processed by the thread
+    * that processes this callback queue. Channels that are inputs to the same
+    * expression or sequence are in the same shard, and so use the same queue.
+    */
+   int queue;
+   struct sPV_Channel *shard_parent;    /* union-find parent, NULL if root */
+   struct sPV_Channel *shard_next;      /* shard member ring, self if alone */
+   int context;                 /* Channel Access context index */
+
+   /* Channel Access connection info
+    */
+   chid channel_id;
+   evid event_id;
+   evid property_event_id;      /* only when control info required */
+   short int subscribed_type;   /* field type when subscribed */
+   unsigned long int subscribed_count;  /* element count when subscribed */
+   const char *host_name;       /* interned */
+   short int field_type;
+   unsigned long int element_count;
+
+   Channel_Meta *meta;          /* NULL until control info received */
 
    /* Per update channel information.
     */
    bool is_connected;
    bool is_first_update;
-   long int data_element_count; /* number of elements received */
 
    epicsAlarmCondition status;  /* status of value */
    epicsAlarmSeverity severity; /* severity of alarm */
@@ -119,29 +240,111 @@ struct sCA_Client {
 
    time_t disconnect_time;      /* system time */
 
+   /* Connection progress.
+    */
+   Connection_State state;
+   double create_time;          /* monotonic time */
+   double park_interval;        /* seconds, 0 means never parked */
+   double retry_time;           /* monotonic time, only when parked */
+
+   /* Statistics - data is requested in the native field type.
+    */
+   unsigned long number_updates;
+   unsigned long long bytes_received;
+
+   CA_Client *subscribers;      /* linked via CA_Client next_subscriber */
+   CA_Client *last_subscriber;  /* for appending */
+   int number_subscribers;
+   bool subscribers_added;      /* by a reload or control request */
+   bool is_changed;             /* on the changed channels list */
+
+   int magic2;
+};
+
+typedef struct sPV_Channel PV_Channel;
+
+
+struct sCA_Client {
+   ELLNODE node;
+   int magic1;                  /* used when void pointer cast to a sCA_Client */
+
+   const char *pv_name;         /* interned */
+   int element_index;
+   Channel_Options options;
+   Match_Target target;
+
+   /* The shared channel, and next client subscribed to the same channel.
+    */
+   PV_Channel *channel;
+   CA_Client *next_subscriber;
+
+   /* Per update client information.
+    */
+   long int data_element_count; /* number of elements received */
    Variant_Value data;          /* current data value */
 
-   char match_command[MATCH_COMMAND_LENGTH + 1];        /* system command to be called */
-   Variant_Range_Collection match_set_collection;
+   const char *match_command;   /* interned system command to be called */
+   Variant_Range_List match_set_collection;
+   Array_Predicate array_predicate;
+   Element_List *element_list;  /* NULL unless index list/range specified */
    bool last_update_matched;
+   unsigned long number_transitions;    /* match state changes, see metrics.h */
+
+   /* Expression inputs only: the expression and this client's term number.
+    */
+   Expression *expression;
+   int expression_term;
+
+   /* Sequence inputs only: the sequence and this client's step number.
+    */
+   Sequence *sequence;
+   int sequence_step;
+
+   /* The specification text, shared by all the inputs of an expression or
+    * sequence. Used to identify unchanged clients on configuration reload.
+    */
+   char *signature;
+   CA_Client *signature_next;   /* unit table chain, first client only */
+   unsigned int set_identity;   /* set files' names, sizes and times, or 0 */
 
    int magic2;
 };
 
-typedef struct sCA_Client CA_Client;
-
 
 /* pointer to a function that returns a boolean
  */
 typedef bool (*Bool_Function_Handle) ();
 
-typedef CA_Client *(*Allocate_Client_Handle) ();
+/* Allocates a client with space for the specified number of match ranges.
+ * Must be thread safe, as large configurations are scanned in parallel.
+ */
+typedef CA_Client *(*Allocate_Client_Handle) (const int number_ranges);
 
 bool Create_PV_Client_List_From_File (const char *pv_list_filename, int *number);
 bool Create_PV_Client_List_From_String (const char *buffer, const size_t size, int *number);
 
+/* Scans the configuration file and writes its rule cache, see rule_cache.h.
+ */
+bool Compile_PV_Client_List (const char *pv_list_filename, int *number);
+
 void Print_Clients_Info ();
 
+/* Returns the element index image, e.g. "3", "1,5,10-20" or "count>=10".
+ */
+const char *Element_Index_Image (const CA_Client * pClient, char *image,
+                                 const size_t size);
+
+/* Converts alarm severity/status names, e.g. "MAJOR" or "HIHI", to/from
+ * values. Match_Target_Value returns -1 if the name is unknown.
+ */
+int Match_Target_Value (const Match_Target target, const char *name);
+const char *Match_Target_Image (const Match_Target target, const int value);
+
+/* Returns the operator text, e.g. "<=", of the simple comparisons ckVoid up
+ * to ckGreaterThan; returns "" for any other kind.
+ */
+const char *Comparison_Image (const Comparision_Kind comp);
+
 bool Process_Clients (Bool_Function_Handle shut_down);
 
 #endif                          /* PV_CLIENT_H_ */
@@ -32,8 +32,20 @@
 #endif
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <cantProceed.h>
+#include <epicsEvent.h>
+#include <epicsString.h>
+#include <epicsThread.h>
 
 #include "read_configuration.h"
 #include "utilities.h"
@@ -74,6 +86,25 @@ static int debug = 0;
    QUIT_ON_EOL (input);                                                  \
 }
 
+/*------------------------------------------------------------------------------
+ * Extracts the lexical item from start up to finish into dest, which has room
+ * for n characters including the trailing '\0'. An item that does not fit is
+ * reported as an error rather than silently truncated.
+ */
+static bool extract_item (char *dest, const size_t n, const char *start,
+                          const char *finish, const char *data_source,
+                          const int line_num)
+{
+   if ((size_t) (finish - start) >= n) {
+      printf ("%s:%d error item '%.20s...' exceeds %d characters\n",
+              data_source, line_num, start, (int) n - 1);
+      return false;
+   }
+
+   extract (dest, n, start, finish);
+   return true;
+}                               /* extract_item */
+
 /*------------------------------------------------------------------------------
  * Input format is general, e.g.  123, 0x123, 456.67, 32.99e+8, Text, "text".
  */
@@ -130,7 +161,10 @@ static bool parse_value (char *input, Variant_Value * data, char **endptr,
 
    /* Extract lexical item into a local copy
     */
-   extract (item, sizeof (item), start, finish);
+   if (!extract_item (item, sizeof (item), start, finish, data_source,
+                      line_num)) {
+      return false;
+   }
    n = strlen (item);
 
    if (debug) {
@@ -187,403 +221,3033 @@ static bool parse_value (char *input, Variant_Value * data, char **endptr,
 }                               /* scan_value */
 
 /*------------------------------------------------------------------------------
- * Valid format is
- *    value or
- *    value ~ value or
- *    op value where op is <=, >=, = , /= <, >
+ * Returns the whole of the file's content, for files that cannot be mapped,
+ * e.g. a pipe.
  */
-static bool parse_match (char *line, Variant_Range* item, char **endptr,
-                         const char *data_source, const int line_num)
+static char *Read_Whole_File (const int fd, size_t * size)
 {
-   /* Must be consistant with Comparision_Kind
-    */
-   static const char* comparison_operators [7] = {
-      "", "/=", "<=", ">=", "=", "<", ">"
-   };
-
-   /* Ensure not erroneous.
-    */
-   item->comp = ckVoid;
-   item->lower.kind = vkVoid;
-   item->upper.kind = vkVoid;
-
-   bool status;
-   char *source = line;
-
-   /* Skip white space (if any) - error return if at end of line.
-    */
-   SKIP_WHITE_QUIT_ON_EOL (source);
-
-
-   /* Check for equality operator
-    */
-   Comparision_Kind e;
+   char *buffer = NULL;
+   char *enlarged;
+   size_t capacity = 0;
+   ssize_t number;
+
+   *size = 0;
+   for (;;) {
+      if (*size == capacity) {
+         capacity = MAX (65536, 2 * capacity);
+         enlarged = (char *) callocMustSucceed (capacity, 1,
+                                                "Read_Whole_File");
+         if (*size > 0) {
+            memcpy (enlarged, buffer, *size);
+         }
+         free (buffer);
+         buffer = enlarged;
+      }
+      number = read (fd, buffer + *size, capacity - *size);
+      if (number <= 0) {
+         break;
+      }
+      *size += number;
+   }
+   return buffer;
+}                               /* Read_Whole_File */
 
-   for (e = 1; e <= 6; e++) {
-      size_t n = strlen (comparison_operators [e]);
 
-      if (strncmp (source, comparison_operators [e], n) == 0) {
-         /* found an operator
-          */
-         item->comp = e;
+/*------------------------------------------------------------------------------
+ * Returns the file's content, memory mapped if possible, or NULL if the file
+ * cannot be opened. Release using Unload_File.
+ */
+static char *Load_File (const char *filename, size_t * size, bool * is_mapped)
+{
+   struct stat info;
+   char *buffer = NULL;
+   int fd;
 
-         source += n; /* skip the operator */
+   *size = 0;
+   *is_mapped = false;
 
-         SKIP_WHITE_QUIT_ON_EOL (source);
+   fd = open (filename, O_RDONLY);
+   if (fd < 0) {
+      return NULL;
+   }
 
-         status = parse_value
-             (source, &item->lower, endptr, data_source, line_num);
-         return status;
+   if ((fstat (fd, &info) == 0) && S_ISREG (info.st_mode)) {
+      *size = info.st_size;
+      if (*size > 0) {
+         buffer = (char *) mmap (NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+         if (buffer == MAP_FAILED) {
+            buffer = NULL;
+         } else {
+            (void) madvise (buffer, *size, MADV_SEQUENTIAL);
+            *is_mapped = true;
+         }
       }
    }
 
-   /* must be value or value ~ value.
-    */
-   status = parse_value
-       (source, &item->lower, endptr, data_source, line_num);
-   if (status == false) {
-      return false;
+   if (!*is_mapped) {
+      buffer = Read_Whole_File (fd, size);
    }
-   source = *endptr;
+   (void) close (fd);
 
-   SKIP_WHITE_QUIT_ON_EOL (source);
+   return buffer;
+}                               /* Load_File */
 
-   /* Range operator ? */
-   if (*source == '~') {
-      source++;
-      SKIP_WHITE_QUIT_ON_EOL (source);
-      status = parse_value
-          (source, &item->upper, endptr, data_source, line_num);
-      if (status == false) {
-         return false;
-      }
-      item->comp = ckRange;
+
+/*------------------------------------------------------------------------------
+ */
+static void Unload_File (char *buffer, const size_t size, const bool is_mapped)
+{
+   if (is_mapped) {
+      (void) munmap (buffer, size);
    } else {
-      item->comp = ckEqual;
+      free (buffer);
    }
+}                               /* Unload_File */
 
-   return true;
-}
 
 /*------------------------------------------------------------------------------
- * pv_name and command must be large enough.
- * filename and line_num used for error reports
+ * Returns the path of name, which is relative to the directory of base if it is
+ * not absolute. base may be NULL, or have no directory, e.g. "memory buffer".
+ * Release using free.
  */
-static bool parse_line (char *line, char *pv_name, int *index,
-                        Variant_Range_Collection * pVRC, char *command,
-                        const char *data_source, const int line_num)
+static char *Relative_Path (const char *base, const char *name)
 {
-   static const char* type_mis_match =
-       "%s:%d warning: %s value of sub-match %d is %s, expecting %s.\n";
+   const char *slash;
+   char *path;
+   size_t n;
 
-   char *source;
-   char *target;
-   char *start;
-   char *finish;
-   char item[MAX_LINE_LENGTH];
-   char *endptr;
-   bool status;
-   int j;
-   Variant_Kind expected;
-   Variant_Kind lower_kind;
-   Variant_Kind upper_kind;
-   bool simple_command;
+   slash = base ? strrchr (base, '/') : NULL;
+   if ((name[0] == '/') || (slash == NULL)) {
+      return epicsStrDup (name);
+   }
 
-   /* Ensure not erroneous/set defaults.
-    */
-   *pv_name = '\0';
-   *index = 1;
-   pVRC->count = 0;
-   *command = '\0';
+   n = slash - base + 1;
+   path = (char *) callocMustSucceed (n + strlen (name) + 1, 1,
+                                      "Relative_Path");
+   memcpy (path, base, n);
+   strcpy (path + n, name);
+   return path;
+}                               /* Relative_Path */
 
-   source = line;
 
-   /* Skip white space (if any) - error return if at end of line.
-    */
-   SKIP_WHITE_QUIT_ON_EOL (source);
+/*------------------------------------------------------------------------------
+ * Adds a single set member, quoted or unquoted, to the set.
+ */
+static bool add_set_member (String_Set * set, const char *start,
+                            const char *finish, const char *data_source,
+                            const int line_num)
+{
+   size_t n;
 
-   target = pv_name;
-   while ((*source != '\0') && (isspace (*source) == false)) {
-      *target = *source;
-      source++;
-      target++;
+   /* exclude leading/trailing quotes
+    */
+   if ((*start == '"') && (finish - start >= 2) && (finish[-1] == '"')) {
+      start++;
+      finish--;
    }
-   *target = '\0';
 
-   /* Check for sensible PV name, check it starts okay at least.
-    */
-   if ((isalnum (*pv_name) == false) && (*pv_name != '$')) {
-      printf ("%s:%d error invalid PV name: %s\n", data_source, line_num,
-              pv_name);
+   n = finish - start;
+   if (n > MAX_STRING_SIZE) {
+      printf ("%s:%d set member too big: %.*s\n", data_source, line_num,
+              (int) n, start);
       return false;
    }
 
-   if (debug > 4) {
-      printf ("%s:%d  pv = %s\n", data_source, line_num, pv_name);
-   }
+   (void) String_Set_Add (set, start, n);
+   return true;
+}                               /* add_set_member */
 
-   SKIP_WHITE_QUIT_ON_EOL (source);
 
-   if (*source == '[') {
-      source++;                 /* skip the '['  */
+static void Note_Set_File (const char *path);
 
-      start = source;
+/*------------------------------------------------------------------------------
+ * Reads set members from a file, one member per line. Blank lines and lines
+ * starting with a # character are ignored. A relative file name is relative
+ * to the directory of the data source, i.e. the including file.
+ */
+static bool load_set_file (String_Set * set, const char *filename,
+                           const char *data_source, const int line_num)
+{
+   char *path;
+   char *buffer;
+   const char *next;
+   const char *start;
+   const char *finish;
+   const char *end;
+   size_t size;
+   bool is_mapped;
+   int set_line_num;
+   bool status;
 
-      /* Find the ']'
-       */
-      while ((*source != '\0') && (*source != ']')) {
-         source++;
+   path = Relative_Path (data_source, filename);
+   buffer = Load_File (path, &size, &is_mapped);
+   if (buffer == NULL) {
+      printf ("%s:%d unable to open set file %s.\n", data_source, line_num,
+              path);
+      free (path);
+      return false;
+   }
+   Note_Set_File (path);
+
+   status = true;
+   set_line_num = 0;
+   for (next = buffer; next < buffer + size; next = end + 1) {
+      end = (const char *) memchr (next, '\n', buffer + size - next);
+      if (end == NULL) {
+         end = buffer + size;
       }
+      set_line_num++;
 
-      if (*source != ']') {
-         printf ("%s:%d error missing ']'\n", data_source, line_num);
-         return false;
+      start = next;
+      while ((start < end) && isspace (*start)) {
+         start++;
       }
-      finish = source;
-      source++;                 /* skip the ']'  */
 
-      /* Extract lexical item into a local copy
+      /* Ignore empty lines and comment lines.
        */
-      extract (item, sizeof (item), start, finish);
-
-      *index = (int) long_value (item, &status);
-
-      if (status == false) {
-         printf ("%s:%d  index item [%s] is not a valid integer\n",
-                 data_source, line_num, item);
-         return false;
+      if ((start == end) || (*start == '#')) {
+         continue;
       }
 
-      if (debug > 4) {
-         printf ("%s:%d [%s] index = %d\n", data_source, line_num, item,
-                 *index);
+      /* Remove trailing white space, e.g. any \r character.
+       */
+      finish = end;
+      while ((finish > start) && isspace (finish[-1])) {
+         finish--;
       }
 
-      if (*index < 1) {
-         printf ("%s:%d error invalid PV index: %d\n", data_source, line_num,
-                 *index);
-         return false;
+      if (!add_set_member (set, start, finish, path, set_line_num)) {
+         status = false;
       }
+   }
 
-      if (*index > 1000) {
-         printf ("%s:%d query valid PV index: %d ???\n", data_source,
-                 line_num, *index);
-      }
+   Unload_File (buffer, size, is_mapped);
 
-      SKIP_WHITE_QUIT_ON_EOL (source);
-   } else {
-      *index = 1;
+   if (debug) {
+      printf ("%s:%d  set file %s: %u members\n", data_source, line_num,
+              path, String_Set_Count (set));
    }
 
-   /* Parse match criteria
-    */
-   for (j = 0; j < NUMBER_OF_VARIENT_RANGES; j++) {
+   free (path);
+   return status;
+}                               /* load_set_file */
 
-      SKIP_WHITE_QUIT_ON_EOL (source);
 
-      status = parse_match (source, &pVRC->item[j], &endptr, data_source, line_num);
-      if (status == false) {
-         return false;
-      }
-      source = endptr;
+/*------------------------------------------------------------------------------
+ * Valid format is
+ *    '{' value value ... '}' or
+ *    '@' filename
+ * Set members may also be separated by commas.
+ */
+static bool parse_set (char *input, String_Set * set, char **endptr,
+                       const char *data_source, const int line_num)
+{
+   char *source;
+   char *start;
+   char *filename;
+   bool status;
 
-      /* Update number of valid entries so far
-       */
-      pVRC->count = j + 1;
+   source = input;
+   SKIP_WHITE_QUIT_ON_EOL (source);
 
-      /* Are value kinds consistent?
-       */
-      expected = pVRC->item[0].lower.kind;
-      lower_kind = pVRC->item[j].lower.kind;
-      upper_kind = pVRC->item[j].upper.kind;
+   if (*source == '@') {
+      source++;
+      start = source;
+      while ((*source != '\0') && (isspace (*source) == 0)) {
+         source++;
+      }
+      *endptr = source;
 
-      /* Never fails for zeroth lower entry
-       */
-      if (lower_kind != expected) {
-         printf (type_mis_match, data_source, line_num,
-                 (pVRC->item[j].comp == ckRange ? "1st" : "the"), pVRC->count,
-                 vkImage (lower_kind), vkImage (expected));
+      if (source == start) {
+         printf ("%s:%d error missing set file name\n", data_source,
+                 line_num);
+         return false;
       }
 
-      if ((pVRC->item[j].comp == ckRange) && (upper_kind != expected)) {
-         printf (type_mis_match, data_source, line_num,
-                 "2nd", pVRC->count,
-                 vkImage (upper_kind), vkImage (expected));
+      filename = (char *) callocMustSucceed (source - start + 1, 1,
+                                             "parse_set");
+      extract (filename, source - start + 1, start, source);
+      status = load_set_file (set, filename, data_source, line_num);
+      free (filename);
+      return status;
+   }
+
+   if (*source != '{') {
+      printf ("%s:%d error expecting '{' or '@' after 'in'\n", data_source,
+              line_num);
+      return false;
+   }
+   source++;                    /* skip the '{' */
+
+   while (true) {
+      while (isspace (*source) || (*source == ',')) {
+         source++;
       }
 
-      SKIP_WHITE_QUIT_ON_EOL (source);
-      if (*source != '|') {
+      if (*source == '}') {
+         source++;              /* skip the '}' */
          break;
       }
-      source++;                 /* skip the '|' */
 
-      if (pVRC->count >= NUMBER_OF_VARIENT_RANGES) {
-         printf ("%s:%d error attempting to specify more than %d sub-matches\n",
-                 data_source, line_num, NUMBER_OF_VARIENT_RANGES);
+      if (*source == '\0') {
+         printf ("%s:%d error missing '}'\n", data_source, line_num);
          return false;
       }
-   }
-
-   SKIP_WHITE_QUIT_ON_EOL (source);
 
-   simple_command = true;
-
-   /* Copy rest of line to command
-    */
-   target = command;
-   while (*source != '\0') {
-      if (isspace (*source) == 0) {
-         /* Not white space - just copy and increment pointers.
-          */
-         *target = *source;
+      start = source;
+      if (*source == '"') {
          source++;
-         target++;
+         while ((*source != '\0') && (*source != '"')) {
+            source++;
+         }
+         if (*source == '"') {
+            source++;
+         }
       } else {
-         SKIP_WHITE_SPACE (source);
-         /* If not end of line then add a sigle space and
-          * flag as non simple command
-          */
-         if (*source != '\0') {
-            *target = ' ';
-            target++;
-            simple_command = false;
+         while ((*source != '\0') && (*source != '}') && (*source != ',') &&
+                (isspace (*source) == 0)) {
+            source++;
          }
       }
-   }
-   *target = '\0';
 
-   SKIP_WHITE_SPACE (source);
+      if (!add_set_member (set, start, source, data_source, line_num)) {
+         return false;
+      }
+   }
+   *endptr = source;
 
-   /* Append default parameter spec if simple command
-    */
-   if (simple_command) {
-      strcat (command, " %p %m %v %e");
+   if (String_Set_Count (set) == 0) {
+      printf ("%s:%d error empty set\n", data_source, line_num);
+      return false;
    }
 
    return true;
-}                               /* parse_line */
+}                               /* parse_set */
 
 
 /*------------------------------------------------------------------------------
+ * Valid format is a quoted pattern, which may contain white space, '|' and
+ * '~' characters.
  */
-static bool Scan_Configuration (FILE *input_file,
-                                const char* data_source,
-                                const Allocate_Client_Handle allocate)
+static bool parse_pattern (char *input, const Pattern_Kind kind,
+                           Pattern ** pattern, char **endptr,
+                           const char *data_source, const int line_num)
 {
-   CA_Client *pClient = NULL;
+   char *source;
+   char *start;
+   char *finish;
+   char *item;
+   char error[80];
+   bool status;
+
+   source = input;
+   SKIP_WHITE_QUIT_ON_EOL (source);
+
+   if (*source != '"') {
+      printf ("%s:%d error expecting quoted pattern\n", data_source,
+              line_num);
+      return false;
+   }
+   source++;
+   start = source;
+   while ((*source != '\0') && (*source != '"')) {
+      source++;
+   }
+   if (*source != '"') {
+      printf ("%s:%d error missing closing '\"'\n", data_source, line_num);
+      return false;
+   }
+   finish = source;
+   source++;
+   *endptr = source;
+
+   /* Patterns are not length limited - size the copy from the item.
+    */
+   item = (char *) callocMustSucceed (finish - start + 1, 1,
+                                      "parse_pattern");
+   extract (item, finish - start + 1, start, finish);
+
+   *pattern = Pattern_Create (kind, item, error, sizeof (error));
+   status = (*pattern != NULL);
+   if (!status) {
+      printf ("%s:%d invalid pattern %s: %s\n", data_source, line_num, item,
+              error);
+   }
+
+   free (item);
+   return status;
+}                               /* parse_pattern */
+
+
+/*------------------------------------------------------------------------------
+ * Checks for keyword followed by white space.
+ */
+static bool is_keyword (const char *source, const char *keyword)
+{
+   const size_t n = strlen (keyword);
+
+   return (strncmp (source, keyword, n) == 0) && isspace (source[n]);
+}                               /* is_keyword */
+
+
+/*------------------------------------------------------------------------------
+ * Checks for the in keyword followed by a set, i.e. '{' or '@'. Otherwise,
+ * e.g. "in /bin/echo", the word is just an unquoted string value.
+ */
+static bool is_set_keyword (const char *source)
+{
+   if (strncmp (source, "in", 2) != 0) {
+      return false;
+   }
+   source += 2;
+
+   SKIP_WHITE_SPACE (source);
+   return (*source == '{') || (*source == '@');
+}                               /* is_set_keyword */
+
+
+/*------------------------------------------------------------------------------
+ * Checks for the regex or glob keyword followed by a quoted pattern. Otherwise,
+ * e.g. "glob /bin/echo", the word is just an unquoted string value.
+ */
+static bool is_pattern_keyword (const char *source, Pattern_Kind * kind)
+{
+   if (is_keyword (source, "regex")) {
+      *kind = pkRegex;
+      source += 5;
+   } else if (is_keyword (source, "glob")) {
+      *kind = pkGlob;
+      source += 4;
+   } else {
+      return false;
+   }
+
+   SKIP_WHITE_SPACE (source);
+   return (*source == '"');
+}                               /* is_pattern_keyword */
+
+
+/*------------------------------------------------------------------------------
+ * Checks for the severity or status keyword followed by a match item for the
+ * target, i.e. an operator, a set, a pattern, an alarm name or an integer.
+ * Otherwise, e.g. "status /bin/echo", the word is just an unquoted string
+ * value.
+ */
+static bool is_target_keyword (const char *source, const char *keyword,
+                               const Match_Target target)
+{
+   char name[MAX_STRING_SIZE + 1];
+   const char *start;
+   Pattern_Kind kind;
+   Comparision_Kind e;
+   size_t n;
+
+   if (!is_keyword (source, keyword)) {
+      return false;
+   }
+   source += strlen (keyword);
+   SKIP_WHITE_SPACE (source);
+
+   if (is_set_keyword (source) || is_pattern_keyword (source, &kind)) {
+      return true;
+   }
+
+   for (e = ckNotEqual; e <= ckGreaterThan; e++) {
+      n = strlen (Comparison_Image (e));
+      if (strncmp (source, Comparison_Image (e), n) == 0) {
+         return true;
+      }
+   }
+
+   /* Alarm name or integer, quoted or unquoted.
+    */
+   if (*source == '"') {
+      start = ++source;
+      while ((*source != '\0') && (*source != '"')) {
+         source++;
+      }
+   } else {
+      start = source;
+      while ((*source != '\0') && !isspace (*source) &&
+             (*source != ALTERNATIVE) && (*source != RANGE)) {
+         source++;
+      }
+   }
+   n = source - start;
+   if ((n == 0) || (n > MAX_STRING_SIZE)) {
+      return false;
+   }
+   memcpy (name, start, n);
+   name[n] = '\0';
+
+   if (Match_Target_Value (target, name) >= 0) {
+      return true;
+   }
+
+   start = name;
+   if ((*start == '+') || (*start == '-')) {
+      start++;
+   }
+   if (*start == '\0') {
+      return false;
+   }
+   while (isdigit (*start)) {
+      start++;
+   }
+   return (*start == '\0');
+}                               /* is_target_keyword */
+
+
+/*------------------------------------------------------------------------------
+ * Valid format is
+ *    value or
+ *    value ~ value or
+ *    op value where op is <=, >=, = , /= <, > or
+ *    in set or
+ *    regex "pattern" or
+ *    glob "pattern"
+ */
+static bool parse_match (char *line, Variant_Range* item, char **endptr,
+                         const char *data_source, const int line_num)
+{
+   /* Ensure not erroneous.
+    */
+   item->comp = ckVoid;
+   item->lower.kind = vkVoid;
+   item->upper.kind = vkVoid;
+   item->set = NULL;
+   item->pattern = NULL;
+
+   bool status;
+   char *source = line;
+   Pattern_Kind kind;
+
+   /* Skip white space (if any) - error return if at end of line.
+    */
+   SKIP_WHITE_QUIT_ON_EOL (source);
+
+   /* Check for set membership. Set values are always strings.
+    */
+   if (is_set_keyword (source)) {
+      item->set = String_Set_Create ();
+      status = parse_set (source + 2, item->set, endptr, data_source,
+                          line_num);
+      if (status == false) {
+         String_Set_Free (item->set);
+         item->set = NULL;
+         return false;
+      }
+
+      item->comp = ckInSet;
+      item->lower.kind = vkString;
+      item->lower.value.sval[0] = '\0';
+      return true;
+   }
+
+   /* Check for regular expression or glob pattern. Like sets, patterns
+    * are always matched against the value as a string.
+    */
+   if (is_pattern_keyword (source, &kind)) {
+      source += (kind == pkRegex) ? 5 : 4;
+      status = parse_pattern (source, kind, &item->pattern, endptr,
+                              data_source, line_num);
+      if (status == false) {
+         return false;
+      }
+
+      item->comp = (kind == pkRegex) ? ckRegex : ckGlob;
+      item->lower.kind = vkString;
+      item->lower.value.sval[0] = '\0';
+      return true;
+   }
+
+
+   /* Check for equality operator
+    */
+   Comparision_Kind e;
+
+   for (e = 1; e <= 6; e++) {
+      size_t n = strlen (Comparison_Image (e));
+
+      if (strncmp (source, Comparison_Image (e), n) == 0) {
+         /* found an operator
+          */
+         item->comp = e;
+
+         source += n; /* skip the operator */
+
+         SKIP_WHITE_QUIT_ON_EOL (source);
+
+         status = parse_value
+             (source, &item->lower, endptr, data_source, line_num);
+         return status;
+      }
+   }
+
+   /* must be value or value ~ value.
+    */
+   status = parse_value
+       (source, &item->lower, endptr, data_source, line_num);
+   if (status == false) {
+      return false;
+   }
+   source = *endptr;
+
+   SKIP_WHITE_QUIT_ON_EOL (source);
+
+   /* Range operator ? */
+   if (*source == '~') {
+      source++;
+      SKIP_WHITE_QUIT_ON_EOL (source);
+      status = parse_value
+          (source, &item->upper, endptr, data_source, line_num);
+      if (status == false) {
+         return false;
+      }
+      item->comp = ckRange;
+   } else {
+      item->comp = ckEqual;
+   }
+
+   return true;
+}
+
+/*------------------------------------------------------------------------------
+ * Valid format is
+ *    any or
+ *    all or
+ *    count op integer where op is <=, >=, = , /= <, >
+ */
+static bool parse_array_predicate (char *item, Array_Predicate * predicate,
+                                   const char *data_source,
+                                   const int line_num)
+{
+   char *source = item;
+   Comparision_Kind e;
+   size_t n;
+   bool status;
+
+   /* Remove any trailing white space.
+    */
+   n = strlen (item);
+   while ((n > 0) && isspace (item[n - 1])) {
+      item[--n] = '\0';
+   }
+
+   if (strcmp (source, "any") == 0) {
+      predicate->kind = apAny;
+      return true;
+   }
+
+   if (strcmp (source, "all") == 0) {
+      predicate->kind = apAll;
+      return true;
+   }
+
+   if (strncmp (source, "count", 5) == 0) {
+      source += 5;
+      SKIP_WHITE_SPACE (source);
+
+      for (e = 1; e <= 6; e++) {
+         n = strlen (Comparison_Image (e));
+         if (strncmp (source, Comparison_Image (e), n) == 0) {
+            predicate->kind = apCount;
+            predicate->count_comp = e;
+            predicate->count_threshold =
+                long_value (source + n, &status);
+
+            if ((status == false) || (predicate->count_threshold < 0)) {
+               printf ("%s:%d error invalid count in [%s]\n",
+                       data_source, line_num, item);
+               return false;
+            }
+            return true;
+         }
+      }
+   }
+
+   printf ("%s:%d error invalid array predicate [%s]\n", data_source,
+           line_num, item);
+   return false;
+}                               /* parse_array_predicate */
+
+
+/*------------------------------------------------------------------------------
+ * Converts the match list into an equivalent set of closed intervals.
+ * Open interval ends use the adjacent representable double value.
+ */
+static bool make_intervals (const Variant_Range_Collection * pVRC,
+                            Interval_Set * set,
+                            const char *data_source, const int line_num)
+{
+   unsigned int j;
+   const Variant_Range *pVR;
+   double lower;
+   double upper;
+   bool status = true;
+
+   set->count = 0;
+   for (j = 0; j < pVRC->count; j++) {
+      pVR = &pVRC->item[j];
+
+      if ((pVR->lower.kind != vkInteger) && (pVR->lower.kind != vkFloating)) {
+         printf ("%s:%d error array predicates require numeric matches\n",
+                 data_source, line_num);
+         return false;
+      }
+
+      lower = (pVR->lower.kind == vkInteger) ?
+          (double) pVR->lower.value.ival : pVR->lower.value.dval;
+
+      switch (pVR->comp) {
+         case ckEqual:
+            status = Interval_Set_Add (set, lower, lower);
+            break;
+
+         case ckNotEqual:
+            status = Interval_Set_Add (set, -INFINITY,
+                                       nextafter (lower, -INFINITY)) &&
+                     Interval_Set_Add (set, nextafter (lower, INFINITY),
+                                       INFINITY);
+            break;
+
+         case ckLessThan:
+            status = Interval_Set_Add (set, -INFINITY,
+                                       nextafter (lower, -INFINITY));
+            break;
+
+         case ckLessThanEqual:
+            status = Interval_Set_Add (set, -INFINITY, lower);
+            break;
+
+         case ckGreaterThan:
+            status = Interval_Set_Add (set, nextafter (lower, INFINITY),
+                                       INFINITY);
+            break;
+
+         case ckGreaterThanEqual:
+            status = Interval_Set_Add (set, lower, INFINITY);
+            break;
+
+         case ckRange:
+            if ((pVR->upper.kind != vkInteger) &&
+                (pVR->upper.kind != vkFloating)) {
+               printf ("%s:%d error array predicates require numeric matches\n",
+                       data_source, line_num);
+               return false;
+            }
+            upper = (pVR->upper.kind == vkInteger) ?
+                (double) pVR->upper.value.ival : pVR->upper.value.dval;
+            status = Interval_Set_Add (set, lower, upper);
+            break;
+
+         default:
+            printf ("%s:%d error array predicates require numeric matches\n",
+                    data_source, line_num);
+            return false;
+      }
+
+      if (status == false) {
+         printf ("%s:%d error too many intervals for array predicate\n",
+                 data_source, line_num);
+         return false;
+      }
+   }
+
+   return true;
+}                               /* make_intervals */
+
+
+/*------------------------------------------------------------------------------
+ * qsort comparison function for element indices.
+ */
+static int compare_index (const void *a, const void *b)
+{
+   const int x = *(const int *) a;
+   const int y = *(const int *) b;
+
+   return (x > y) - (x < y);
+}                               /* compare_index */
+
+
+/*------------------------------------------------------------------------------
+ * Valid format is a comma separated list of element indices and/or element
+ * index ranges, e.g. 1,5,10-20. The resultant element indices are sorted and
+ * any duplicates removed. The list may hold at most MAXIMUM_ELEMENT_LIST_SIZE
+ * indices, counting duplicates.
+ */
+#define MAXIMUM_ELEMENT_LIST_SIZE   10000
+
+static Element_List *parse_element_list (const char *item,
+                                         const char *data_source,
+                                         const int line_num)
+{
+   char *copy;
+   char *token;
+   char *save = NULL;
+   char *dash;
+   char *target;
+   const char *source;
+   long first;
+   long last = 0;
+   long k;
+   long total;
+   int pass;
+   int j;
+   int n;
+   bool status;
+   Element_List *list = NULL;
+
+   copy = (char *) callocMustSucceed (strlen (item) + 1, 1,
+                                      "parse_element_list");
+
+   /* Two passes - the first validates and counts, the second populates.
+    */
+   for (pass = 0; pass < 2; pass++) {
+      strcpy (copy, item);
+      total = 0;
+
+      for (token = strtok_r (copy, ",", &save); token != NULL;
+           token = strtok_r (NULL, ",", &save)) {
+
+         dash = strchr (token, '-');
+         if (dash) {
+            *dash = '\0';
+            first = long_value (token, &status);
+            if (status) {
+               last = long_value (dash + 1, &status);
+            }
+         } else {
+            first = long_value (token, &status);
+            last = first;
+         }
+
+         if ((status == false) || (first < 1) || (last < first) ||
+             (last > INT_MAX)) {
+            printf ("%s:%d error invalid element index list [%s]\n",
+                    data_source, line_num, item);
+            free (copy);
+            return NULL;
+         }
+
+         if (list) {
+            for (k = first; k <= last; k++) {
+               list->index[total++] = (int) k;
+            }
+         } else {
+            total += last - first + 1;
+            if (total > MAXIMUM_ELEMENT_LIST_SIZE) {
+               printf ("%s:%d error element index list [%s] exceeds %d"
+                       " elements\n", data_source, line_num, item,
+                       MAXIMUM_ELEMENT_LIST_SIZE);
+               free (copy);
+               return NULL;
+            }
+         }
+      }
+
+      if ((pass == 0) && (total == 0)) {
+         printf ("%s:%d error empty element index list [%s]\n",
+                 data_source, line_num, item);
+         free (copy);
+         return NULL;
+      }
+
+      if (pass == 0) {
+         list = (Element_List *) callocMustSucceed
+             (1, sizeof (Element_List), "parse_element_list");
+         list->index = (int *) callocMustSucceed
+             (total, sizeof (int), "parse_element_list");
+      }
+   }
+   free (copy);
+
+   /* Sort and remove duplicates.
+    */
+   qsort (list->index, total, sizeof (int), compare_index);
+   n = 0;
+   for (j = 0; j < total; j++) {
+      if ((n == 0) || (list->index[j] != list->index[n - 1])) {
+         list->index[n++] = list->index[j];
+      }
+   }
+   list->count = n;
+   list->matched = (bool *) callocMustSucceed
+       (n, sizeof (bool), "parse_element_list");
+   list->previous = NULL;
+   list->previous_size = 0;
+
+   /* Save image, sans white space, for %e and diagnostics.
+    */
+   list->image = (char *) callocMustSucceed
+       (strlen (item) + 1, sizeof (char), "parse_element_list");
+   target = list->image;
+   for (source = item; *source != '\0'; source++) {
+      if (!isspace (*source)) {
+         *target++ = *source;
+      }
+   }
+   *target = '\0';
+
+   return list;
+}                               /* parse_element_list */
+
+
+/*------------------------------------------------------------------------------
+ * Converts the alarm severity or status names, e.g. MAJOR, within the match
+ * list to integer values. Sets and patterns match names, so are unchanged.
+ */
+static bool convert_target_names (Variant_Range_Collection * pVRC,
+                                  const Match_Target target,
+                                  const char *data_source,
+                                  const int line_num)
+{
+   const char *target_name = (target == mtSeverity) ? "severity" : "status";
+   Variant_Value *value;
+   unsigned int j;
+   int k;
+   int v;
+
+   for (j = 0; j < pVRC->count; j++) {
+      if ((pVRC->item[j].comp == ckInSet) || (pVRC->item[j].comp == ckRegex) ||
+          (pVRC->item[j].comp == ckGlob)) {
+         continue;
+      }
+
+      for (k = 0; k < ((pVRC->item[j].comp == ckRange) ? 2 : 1); k++) {
+         value = (k == 0) ? &pVRC->item[j].lower : &pVRC->item[j].upper;
+
+         switch (value->kind) {
+            case vkString:
+               v = Match_Target_Value (target, value->value.sval);
+               if (v < 0) {
+                  printf ("%s:%d error unknown alarm %s '%s'\n", data_source,
+                          line_num, target_name, value->value.sval);
+                  return false;
+               }
+               value->kind = vkInteger;
+               value->value.ival = v;
+               break;
+
+            case vkInteger:
+               break;
+
+            default:
+               printf ("%s:%d error alarm %s must be a name or an integer\n",
+                       data_source, line_num, target_name);
+               return false;
+         }
+      }
+   }
+   return true;
+}                               /* convert_target_names */
+
+
+/*------------------------------------------------------------------------------
+ * Removes leading and trailing white space in situ.
+ */
+static char *trim (char *item)
+{
+   size_t n;
+
+   SKIP_WHITE_SPACE (item);
+   n = strlen (item);
+   while ((n > 0) && isspace (item[n - 1])) {
+      item[--n] = '\0';
+   }
+   return item;
+}                               /* trim */
+
+
+/*------------------------------------------------------------------------------
+ * Valid format is a comma separated list of
+ *    deadband = value or
+ *    rdeadband = value or
+ *    events = event-name { | event-name } or
+ *    priority = value
+ * where event-name is value, archive or alarm, and the priority value is a
+ * Channel Access priority, i.e. 0 to 99.
+ */
+static bool parse_channel_options (char *item, Channel_Options * options,
+                                   const char *data_source,
+                                   const int line_num)
+{
+   static const struct {
+      const char *name;
+      long mask;
+   } event_names[] = {
+      { "value",   DBE_VALUE   },
+      { "archive", DBE_ARCHIVE },
+      { "alarm",   DBE_ALARM   }
+   };
+
+   char *option;
+   char *key;
+   char *value;
+   char *event;
+   char *save_option;
+   char *save_event;
+   bool status;
+   long priority;
+   size_t j;
+
+   for (option = strtok_r (item, ",", &save_option); option;
+        option = strtok_r (NULL, ",", &save_option)) {
+
+      value = strchr (option, '=');
+      if (value == NULL) {
+         printf ("%s:%d error option '%s' missing '='\n", data_source,
+                 line_num, trim (option));
+         return false;
+      }
+      *value = '\0';
+      value = trim (value + 1);
+      key = trim (option);
+
+      if ((strcmp (key, "deadband") == 0) || (strcmp (key, "rdeadband") == 0)) {
+         /* Allow integer as well as floating values.
+          */
+         options->deadband = (double) long_value (value, &status);
+         if (status == false) {
+            options->deadband = double_value (value, &status);
+         }
+         options->is_relative = (key[0] == 'r');
+         if ((status == false) || (options->deadband <= 0.0)) {
+            printf ("%s:%d error invalid %s value '%s'\n", data_source,
+                    line_num, key, value);
+            return false;
+         }
+
+      } else if (strcmp (key, "events") == 0) {
+         options->event_mask = 0;
+         for (event = strtok_r (value, "|", &save_event); event;
+              event = strtok_r (NULL, "|", &save_event)) {
+            event = trim (event);
+            for (j = 0; j < NELEMENTS (event_names); j++) {
+               if (strcmp (event, event_names[j].name) == 0) {
+                  options->event_mask |= event_names[j].mask;
+                  break;
+               }
+            }
+            if (j >= NELEMENTS (event_names)) {
+               printf ("%s:%d error unknown event '%s'\n", data_source,
+                       line_num, event);
+               return false;
+            }
+         }
+         if (options->event_mask == 0) {
+            printf ("%s:%d error missing events\n", data_source, line_num);
+            return false;
+         }
+
+      } else if (strcmp (key, "priority") == 0) {
+         priority = long_value (value, &status);
+         if ((status == false) || (priority < CA_PRIORITY_MIN) ||
+             (priority > CA_PRIORITY_MAX)) {
+            printf ("%s:%d error invalid priority '%s' (%d to %d)\n",
+                    data_source, line_num, value, CA_PRIORITY_MIN,
+                    CA_PRIORITY_MAX);
+            return false;
+         }
+         options->priority = (int) priority;
+
+      } else {
+         printf ("%s:%d error unknown option '%s'\n", data_source, line_num,
+                 key);
+         return false;
+      }
+   }
+
+   return true;
+}                               /* parse_channel_options */
+
+
+/*------------------------------------------------------------------------------
+ * Copies the rest of line to command, compressing white space. The command
+ * must be large enough, i.e. the length of source plus 13 characters.
+ */
+static void copy_command (char *source, char *command)
+{
+   char *target;
+   bool simple_command;
+
+   simple_command = true;
+
+   /* Copy rest of line to command
+    */
+   target = command;
+   while (*source != '\0') {
+      if (isspace (*source) == 0) {
+         /* Not white space - just copy and increment pointers.
+          */
+         *target = *source;
+         source++;
+         target++;
+      } else {
+         SKIP_WHITE_SPACE (source);
+         /* If not end of line then add a sigle space and
+          * flag as non simple command
+          */
+         if (*source != '\0') {
+            *target = ' ';
+            target++;
+            simple_command = false;
+         }
+      }
+   }
+   *target = '\0';
+
+   /* Append default parameter spec if simple command
+    */
+   if (simple_command) {
+      strcat (command, " %p %m %v %e");
+   }
+}                               /* copy_command */
+
+
+/*------------------------------------------------------------------------------
+ * pv_name and command must be large enough.
+ * filename and line_num used for error reports
+ */
+static bool parse_line (char *line, char *pv_name, int *index,
+                        Channel_Options * options, Match_Target * match_target,
+                        Array_Predicate * predicate,
+                        Element_List ** element_list,
+                        Variant_Range_Collection * pVRC, char *command,
+                        const char *data_source, const int line_num)
+{
+   static const char* type_mis_match =
+       "%s:%d warning: %s value of sub-match %d is %s, expecting %s.\n";
+
+   char *source;
+   char *target;
+   char *start;
+   char *finish;
+   char item[MAX_LINE_LENGTH];
+   char list_item[MAX_LINE_LENGTH];
+   char *endptr;
+   bool status;
+   int j;
+   Variant_Kind expected;
+   Variant_Kind lower_kind;
+   Variant_Kind upper_kind;
+
+   /* Ensure not erroneous/set defaults.
+    */
+   *pv_name = '\0';
+   *index = 1;
+   options->deadband = 0.0;
+   options->is_relative = false;
+   options->event_mask = 0;
+   options->priority = DEFAULT_CA_PRIORITY;
+   *match_target = mtValue;
+   predicate->kind = apNone;
+   predicate->count_comp = ckVoid;
+   predicate->count_threshold = 0;
+   predicate->intervals = NULL;
+   *element_list = NULL;
+   list_item[0] = '\0';
+   pVRC->count = 0;
+   *command = '\0';
+
+   source = line;
+
+   /* Skip white space (if any) - error return if at end of line.
+    */
+   SKIP_WHITE_QUIT_ON_EOL (source);
+
+   target = pv_name;
+   while ((*source != '\0') && (isspace (*source) == false)) {
+      *target = *source;
+      source++;
+      target++;
+   }
+   *target = '\0';
+
+   /* Check for sensible PV name, check it starts okay at least.
+    */
+   if ((isalnum (*pv_name) == false) && (*pv_name != '$')) {
+      printf ("%s:%d error invalid PV name: %s\n", data_source, line_num,
+              pv_name);
+      return false;
+   }
+
+   if (debug > 4) {
+      printf ("%s:%d  pv = %s\n", data_source, line_num, pv_name);
+   }
+
+   SKIP_WHITE_QUIT_ON_EOL (source);
+
+   if (*source == '[') {
+      source++;                 /* skip the '['  */
+
+      start = source;
+
+      /* Find the ']'
+       */
+      while ((*source != '\0') && (*source != ']')) {
+         source++;
+      }
+
+      if (*source != ']') {
+         printf ("%s:%d error missing ']'\n", data_source, line_num);
+         return false;
+      }
+      finish = source;
+      source++;                 /* skip the ']'  */
+
+      /* Extract lexical item into a local copy
+       */
+      if (!extract_item (item, sizeof (item), start, finish, data_source,
+                         line_num)) {
+         return false;
+      }
+
+      start = item;
+      SKIP_WHITE_SPACE (start);
+      if (isalpha (*start)) {
+         /* Whole array predicate - element index not applicable.
+          */
+         if (!parse_array_predicate (start, predicate, data_source,
+                                     line_num)) {
+            return false;
+         }
+         *index = 0;
+
+      } else if (strpbrk (item, ",-") != NULL) {
+         /* Element index list and/or range - parsed once the match list has
+          * been successfully parsed.
+          */
+         snprintf (list_item, sizeof (list_item), "%s", item);
+
+      } else {
+         *index = (int) long_value (item, &status);
+
+         if (status == false) {
+            printf ("%s:%d  index item [%s] is not a valid integer\n",
+                    data_source, line_num, item);
+            return false;
+         }
+
+         if (debug > 4) {
+            printf ("%s:%d [%s] index = %d\n", data_source, line_num, item,
+                    *index);
+         }
+
+         if (*index < 1) {
+            printf ("%s:%d error invalid PV index: %d\n", data_source,
+                    line_num, *index);
+            return false;
+         }
+
+         if (*index > 1000) {
+            printf ("%s:%d query valid PV index: %d ???\n", data_source,
+                    line_num, *index);
+         }
+      }
+
+      SKIP_WHITE_QUIT_ON_EOL (source);
+   } else {
+      *index = 1;
+   }
+
+   /* Optional channel options
+    */
+   if (*source == '{') {
+      source++;                 /* skip the '{'  */
+      start = source;
+
+      while ((*source != '\0') && (*source != '}')) {
+         source++;
+      }
+
+      if (*source != '}') {
+         printf ("%s:%d error missing '}'\n", data_source, line_num);
+         return false;
+      }
+      finish = source;
+      source++;                 /* skip the '}'  */
+
+      if (!extract_item (item, sizeof (item), start, finish, data_source,
+                         line_num)) {
+         return false;
+      }
+      if (!parse_channel_options (item, options, data_source, line_num)) {
+         return false;
+      }
+
+      SKIP_WHITE_QUIT_ON_EOL (source);
+   }
+
+   /* Optional match target - the default is the value.
+    */
+   if (is_target_keyword (source, "severity", mtSeverity)) {
+      *match_target = mtSeverity;
+      source += 8;
+   } else if (is_target_keyword (source, "status", mtStatus)) {
+      *match_target = mtStatus;
+      source += 6;
+   }
+
+   if (*match_target != mtValue) {
+      if ((predicate->kind != apNone) || (list_item[0] != '\0')) {
+         printf ("%s:%d error alarm %s may not be combined with an element"
+                 " list or array predicate\n", data_source, line_num,
+                 (*match_target == mtSeverity) ? "severity" : "status");
+         return false;
+      }
+      SKIP_WHITE_QUIT_ON_EOL (source);
+   }
+
+   /* Parse match criteria
+    */
+   for (j = 0; j < NUMBER_OF_VARIENT_RANGES; j++) {
+
+      SKIP_WHITE_QUIT_ON_EOL (source);
+
+      status = parse_match (source, &pVRC->item[j], &endptr, data_source, line_num);
+      if (status == false) {
+         return false;
+      }
+      source = endptr;
+
+      /* Update number of valid entries so far
+       */
+      pVRC->count = j + 1;
+
+      /* Are value kinds consistent?
+       */
+      expected = pVRC->item[0].lower.kind;
+      lower_kind = pVRC->item[j].lower.kind;
+      upper_kind = pVRC->item[j].upper.kind;
+
+      /* Never fails for zeroth lower entry
+       */
+      if (lower_kind != expected) {
+         printf (type_mis_match, data_source, line_num,
+                 (pVRC->item[j].comp == ckRange ? "1st" : "the"), pVRC->count,
+                 vkImage (lower_kind), vkImage (expected));
+      }
+
+      if ((pVRC->item[j].comp == ckRange) && (upper_kind != expected)) {
+         printf (type_mis_match, data_source, line_num,
+                 "2nd", pVRC->count,
+                 vkImage (upper_kind), vkImage (expected));
+      }
+
+      SKIP_WHITE_QUIT_ON_EOL (source);
+      if (*source != '|') {
+         break;
+      }
+      source++;                 /* skip the '|' */
+
+      if (pVRC->count >= NUMBER_OF_VARIENT_RANGES) {
+         printf ("%s:%d error attempting to specify more than %d sub-matches\n",
+                 data_source, line_num, NUMBER_OF_VARIENT_RANGES);
+         return false;
+      }
+   }
+
+   SKIP_WHITE_QUIT_ON_EOL (source);
+
+   if ((*match_target != mtValue) &&
+       !convert_target_names (pVRC, *match_target, data_source, line_num)) {
+      return false;
+   }
+
+   /* Whole array predicates are evaluated using intervals.
+    */
+   if (predicate->kind != apNone) {
+      predicate->intervals = (Interval_Set *) callocMustSucceed
+          (1, sizeof (Interval_Set), "parse_line");
+      if (!make_intervals (pVRC, predicate->intervals, data_source, line_num)) {
+         free (predicate->intervals);
+         predicate->intervals = NULL;
+         return false;
+      }
+   }
+
+   /* Element lists: the highest element index determines the number of
+    * elements requested.
+    */
+   if (list_item[0] != '\0') {
+      *element_list = parse_element_list (list_item, data_source, line_num);
+      if (*element_list == NULL) {
+         return false;
+      }
+      *index = (*element_list)->index[(*element_list)->count - 1];
+   }
+
+   copy_command (source, command);
+
+   return true;
+}                               /* parse_line */
+
+
+/*------------------------------------------------------------------------------
+ * EXPRESSION and SEQUENCE functions
+ *------------------------------------------------------------------------------
+ * Expression terms and sequence steps are held until the whole line has been
+ * successfully parsed, and only then are the input clients allocated.
+ */
+typedef struct sRule_Term {
+   const char *pv_name;         /* interned */
+   int index;
+   Variant_Range range;
+} Rule_Term;
+
+typedef struct sExpression_Parse {
+   Expression *expression;
+   Rule_Term term[MAXIMUM_EXPRESSION_TERMS];
+   int nesting;
+   const char *data_source;
    int line_num;
-   char line[MAX_LINE_LENGTH + 1];
-   /* The extracted pv name can't be longer than the input line.
-    * And the command can have at most 12 characters added to it.
+} Expression_Parse;
+
+#define MAXIMUM_EXPRESSION_NESTING   20
+
+static bool parse_expression_or (char **input, Expression_Parse * context);
+
+
+/*------------------------------------------------------------------------------
+ * Valid format is
+ *    name '{'
+ * The name is interned.
+ */
+static bool parse_rule_name (char **input, const char **name,
+                             const char *data_source, const int line_num)
+{
+   char *source = *input;
+   char *start;
+   size_t n;
+
+   SKIP_WHITE_QUIT_ON_EOL (source);
+
+   start = source;
+   while ((*source != '\0') && (*source != '{') &&
+          (isspace (*source) == false)) {
+      source++;
+   }
+   n = source - start;
+
+   if (n == 0) {
+      printf ("%s:%d error missing rule name\n", data_source, line_num);
+      return false;
+   }
+   *name = Intern_String_Length (start, n);
+
+   SKIP_WHITE_QUIT_ON_EOL (source);
+   if (*source != '{') {
+      printf ("%s:%d error missing '{'\n", data_source, line_num);
+      return false;
+   }
+   source++;
+
+   *input = source;
+   return true;
+}                               /* parse_rule_name */
+
+
+/*------------------------------------------------------------------------------
+ * Valid format is
+ *    pv-name match-item or
+ *    pv-name [index] match-item
+ */
+static bool parse_rule_term (char **input, Rule_Term * term,
+                             const char *data_source, const int line_num)
+{
+   char *source = *input;
+   char *start;
+   char *endptr;
+   long index;
+   bool status;
+
+   SKIP_WHITE_QUIT_ON_EOL (source);
+
+   start = source;
+   while ((*source != '\0') && (isspace (*source) == false)) {
+      source++;
+   }
+   term->pv_name = Intern_String_Length (start, source - start);
+
+   if ((isalnum (term->pv_name[0]) == false) && (term->pv_name[0] != '$')) {
+      printf ("%s:%d error invalid PV name in rule: %s\n",
+              data_source, line_num, term->pv_name);
+      return false;
+   }
+
+   SKIP_WHITE_QUIT_ON_EOL (source);
+
+   /* Optional element index
+    */
+   term->index = 1;
+   if (*source == '[') {
+      index = strtol (source + 1, &endptr, 10);
+      if ((endptr == source + 1) || (*endptr != ']') || (index < 1)) {
+         printf ("%s:%d error invalid element index for %s\n",
+                 data_source, line_num, term->pv_name);
+         return false;
+      }
+      term->index = (int) index;
+      source = endptr + 1;
+      SKIP_WHITE_QUIT_ON_EOL (source);
+   }
+
+   status = parse_match (source, &term->range, &endptr, data_source,
+                         line_num);
+   if (status == false) {
+      return false;
+   }
+
+   *input = endptr;
+   return true;
+}                               /* parse_rule_term */
+
+
+/*------------------------------------------------------------------------------
+ */
+static bool parse_expression_term (char **input, Expression_Parse * context)
+{
+   int number;
+
+   number = Expression_Add_Term (context->expression);
+   if (number < 0) {
+      printf ("%s:%d error expression has more than %d terms\n",
+              context->data_source, context->line_num,
+              MAXIMUM_EXPRESSION_TERMS);
+      return false;
+   }
+
+   if (!parse_rule_term (input, &context->term[number],
+                         context->data_source, context->line_num)) {
+      return false;
+   }
+
+   return Expression_Emit (context->expression, eoTerm, number);
+}                               /* parse_expression_term */
+
+
+/*------------------------------------------------------------------------------
+ * Valid format is
+ *    '!' unary or
+ *    '(' or-expression ')' or
+ *    term
+ */
+static bool parse_expression_unary (char **input, Expression_Parse * context)
+{
+   const char *data_source = context->data_source;
+   const int line_num = context->line_num;
+   char *source = *input;
+
+   SKIP_WHITE_QUIT_ON_EOL (source);
+
+   if (*source == '!') {
+      source++;
+      if (!parse_expression_unary (&source, context)) {
+         return false;
+      }
+      *input = source;
+      return Expression_Emit (context->expression, eoNot, 0);
+   }
+
+   if (*source == '(') {
+      source++;
+      if (++context->nesting > MAXIMUM_EXPRESSION_NESTING) {
+         printf ("%s:%d error expression nested too deeply\n", data_source,
+                 line_num);
+         return false;
+      }
+      if (!parse_expression_or (&source, context)) {
+         return false;
+      }
+      SKIP_WHITE_QUIT_ON_EOL (source);
+      if (*source != ')') {
+         printf ("%s:%d error missing ')' in expression\n", data_source,
+                 line_num);
+         return false;
+      }
+      source++;
+      context->nesting--;
+      *input = source;
+      return true;
+   }
+
+   if (!parse_expression_term (&source, context)) {
+      return false;
+   }
+   *input = source;
+   return true;
+}                               /* parse_expression_unary */
+
+
+/*------------------------------------------------------------------------------
+ * Valid format is
+ *    unary or
+ *    unary '&&' and-expression
+ */
+static bool parse_expression_and (char **input, Expression_Parse * context)
+{
+   const char *data_source = context->data_source;
+   const int line_num = context->line_num;
+   char *source = *input;
+
+   if (!parse_expression_unary (&source, context)) {
+      return false;
+   }
+
+   SKIP_WHITE_QUIT_ON_EOL (source);
+   while (strncmp (source, "&&", 2) == 0) {
+      source += 2;
+      if (!parse_expression_unary (&source, context) ||
+          !Expression_Emit (context->expression, eoAnd, 0)) {
+         return false;
+      }
+      SKIP_WHITE_QUIT_ON_EOL (source);
+   }
+
+   *input = source;
+   return true;
+}                               /* parse_expression_and */
+
+
+/*------------------------------------------------------------------------------
+ * Valid format is
+ *    and-expression or
+ *    and-expression '||' or-expression
+ */
+static bool parse_expression_or (char **input, Expression_Parse * context)
+{
+   const char *data_source = context->data_source;
+   const int line_num = context->line_num;
+   char *source = *input;
+
+   if (!parse_expression_and (&source, context)) {
+      return false;
+   }
+
+   SKIP_WHITE_QUIT_ON_EOL (source);
+   while (strncmp (source, "||", 2) == 0) {
+      source += 2;
+      if (!parse_expression_and (&source, context) ||
+          !Expression_Emit (context->expression, eoOr, 0)) {
+         return false;
+      }
+      SKIP_WHITE_QUIT_ON_EOL (source);
+   }
+
+   *input = source;
+   return true;
+}                               /* parse_expression_or */
+
+
+/*------------------------------------------------------------------------------
+ * Valid format is
+ *    'expr' name '{' or-expression '}' command
+ *
+ * On success, allocates one input client per expression term. Each client is
+ * given the specification's signature.
+ */
+static bool parse_expression_line (char *line,
+                                   const Allocate_Client_Handle allocate,
+                                   ELLLIST * list,
+                                   const char *signature,
+                                   const char *data_source,
+                                   const int line_num)
+{
+   Expression_Parse *context;
+   Expression *expression;
+   CA_Client *pClient;
+   const char *name;
+   char *command = NULL;
+   char image[80];
+   char *source = line;
+   int j;
+   bool status;
+
+   SKIP_WHITE_SPACE (source);
+   source += 4;                 /* skip the 'expr' */
+   if (!parse_rule_name (&source, &name, data_source, line_num)) {
+      return false;
+   }
+
+   context = (Expression_Parse *) callocMustSucceed
+       (1, sizeof (Expression_Parse), "parse_expression_line");
+   context->expression = expression = Expression_Create (name);
+   context->nesting = 0;
+   context->data_source = data_source;
+   context->line_num = line_num;
+
+   status = parse_expression_or (&source, context);
+
+   if (status) {
+      SKIP_WHITE_SPACE (source);
+      if (*source != '}') {
+         printf ("%s:%d error missing '}'\n", data_source, line_num);
+         status = false;
+      } else {
+         source++;
+      }
+   }
+
+   if (status && !Expression_Finalise (expression)) {
+      printf ("%s:%d error invalid expression\n", data_source, line_num);
+      status = false;
+   }
+
+   if (status) {
+      SKIP_WHITE_SPACE (source);
+      if (*source == '\0') {
+         printf ("%s:%d premature end of line.\n", data_source, line_num);
+         status = false;
+      }
+   }
+
+   if (status) {
+      command = (char *) callocMustSucceed (strlen (source) + 13, 1,
+                                            "parse_expression_line");
+      copy_command (source, command);
+   }
+
+   if (status == false) {
+      Expression_Free (expression);
+      free (context);
+      free (command);
+      return false;
+   }
+
+   expression->command = command;
+
+   if (debug >= 2) {
+      printf ("processing expression: %s {%s} %s\n", name,
+              Expression_Code_Image (expression, image, sizeof (image)),
+              command);
+   }
+
+   /* Now allocate the input clients - these have no command of their own.
+    */
+   for (j = 0; j < expression->number_terms; j++) {
+      pClient = allocate (1);
+      if (pClient) {
+         pClient->pv_name = context->term[j].pv_name;
+         pClient->element_index = context->term[j].index;
+         pClient->array_predicate.kind = apNone;
+         pClient->match_set_collection.count = 1;
+         pClient->match_set_collection.item[0] = context->term[j].range;
+         pClient->expression = expression;
+         pClient->expression_term = j;
+         pClient->signature = epicsStrDup (signature);
+         ellAdd (list, (ELLNODE *) pClient);
+      }
+   }
+
+   free (context);
+   return true;
+}                               /* parse_expression_line */
+
+
+/*------------------------------------------------------------------------------
+ * Valid format is
+ *    'seq' name '{' step { 'then' step ['within' seconds] } '}' command
+ *
+ * On success, allocates one input client per sequence step. Each client is
+ * given the specification's signature.
+ */
+static bool parse_sequence_line (char *line,
+                                 const Allocate_Client_Handle allocate,
+                                 ELLLIST * list,
+                                 const char *signature,
+                                 const char *data_source, const int line_num)
+{
+   Rule_Term *steps;
+   Sequence *sequence;
+   CA_Client *pClient;
+   const char *name;
+   char *command = NULL;
+   char *source = line;
+   char *endptr;
+   double within;
+   int number;
+   int j;
+   bool status;
+
+   SKIP_WHITE_SPACE (source);
+   source += 3;                 /* skip the 'seq' */
+   if (!parse_rule_name (&source, &name, data_source, line_num)) {
+      return false;
+   }
+
+   steps = (Rule_Term *) callocMustSucceed
+       (MAXIMUM_SEQUENCE_STEPS, sizeof (Rule_Term), "parse_sequence_line");
+   sequence = Sequence_Create (name);
+
+   status = true;
+   number = 0;
+   while (status) {
+      if (number >= MAXIMUM_SEQUENCE_STEPS) {
+         printf ("%s:%d error sequence has more than %d steps\n",
+                 data_source, line_num, MAXIMUM_SEQUENCE_STEPS);
+         status = false;
+         break;
+      }
+
+      status = parse_rule_term (&source, &steps[number], data_source,
+                                line_num);
+      if (status == false) {
+         break;
+      }
+
+      SKIP_WHITE_SPACE (source);
+      if ((number > 0) && is_keyword (source, "within")) {
+         source += 6;
+         within = strtod (source, &endptr);
+         if ((endptr == source) || (within < 0.0) ||
+             ((*endptr != '\0') && !isspace (*endptr) && (*endptr != '}'))) {
+            printf ("%s:%d error invalid within time\n", data_source,
+                    line_num);
+            status = false;
+            break;
+         }
+         sequence->within[number] = within;
+         source = endptr;
+         SKIP_WHITE_SPACE (source);
+      }
+      number++;
+
+      if (*source == '}') {
+         source++;
+         break;
+      }
+
+      if (!is_keyword (source, "then")) {
+         printf ("%s:%d error expecting 'then' or '}'\n", data_source,
+                 line_num);
+         status = false;
+         break;
+      }
+      source += 4;
+   }
+
+   if (status) {
+      SKIP_WHITE_SPACE (source);
+      if (*source == '\0') {
+         printf ("%s:%d premature end of line.\n", data_source, line_num);
+         status = false;
+      }
+   }
+
+   if (status) {
+      command = (char *) callocMustSucceed (strlen (source) + 13, 1,
+                                            "parse_sequence_line");
+      copy_command (source, command);
+   }
+
+   if (status == false) {
+      Sequence_Free (sequence);
+      free (steps);
+      free (command);
+      return false;
+   }
+
+   sequence->number_steps = number;
+   sequence->command = command;
+
+   if (debug >= 2) {
+      printf ("processing sequence: %s (%d steps) %s\n", name, number,
+              command);
+   }
+
+   /* Now allocate the input clients - these have no command of their own.
     */
-   char pv_name[MAX_LINE_LENGTH + 1];
-   char command[MAX_LINE_LENGTH + 13];
+   for (j = 0; j < number; j++) {
+      pClient = allocate (1);
+      if (pClient) {
+         pClient->pv_name = steps[j].pv_name;
+         pClient->element_index = steps[j].index;
+         pClient->array_predicate.kind = apNone;
+         pClient->match_set_collection.count = 1;
+         pClient->match_set_collection.item[0] = steps[j].range;
+         pClient->sequence = sequence;
+         pClient->sequence_step = j;
+         pClient->signature = epicsStrDup (signature);
+         ellAdd (list, (ELLNODE *) pClient);
+      }
+   }
+
+   free (steps);
+   return true;
+}                               /* parse_sequence_line */
+
+
+/*------------------------------------------------------------------------------
+ * Copies the specification text less any leading and trailing white space.
+ * This is the specification's signature, i.e. the PV name, index, options,
+ * match criteria and command, used to identify unchanged specifications when
+ * the configuration is reloaded.
+ */
+static void copy_signature (const char *source, char *signature)
+{
    int len;
+
+   SKIP_WHITE_SPACE (source);
+   len = strlen (source);
+   while ((len > 0) && isspace (source[len - 1])) {
+      len--;
+   }
+   memcpy (signature, source, len);
+   signature[len] = '\0';
+}                               /* copy_signature */
+
+
+/*------------------------------------------------------------------------------
+ * CONFIGURATION SCANNING
+ *------------------------------------------------------------------------------
+ * The configuration is scanned from a single buffer, i.e. the memory mapped
+ * configuration file or the configuration string, and there is no limit on
+ * the line length. A large configuration is split at line boundaries into
+ * chunks that are scanned in parallel, each into its own client list, and the
+ * lists are then concatenated in order.
+ */
+#define MINIMUM_CHUNK_SIZE    (1024 * 1024)
+#define MAXIMUM_CHUNKS        16
+
+/* A list of file names.
+ */
+typedef struct sName_List {
+   char **name;
+   int count;
+   int capacity;
+} Name_List;
+
+typedef struct sMacro {
+   char *name;
+   char *value;
+} Macro;
+
+typedef struct sScan_Chunk {
+   const char *start;
+   const char *finish;
+   int line_num;                /* number of lines before start */
+   const char *data_source;
+   bool is_file;                /* data source is a file name */
+   bool allow_directives;       /* otherwise directive lines are errors */
+   Allocate_Client_Handle allocate;
+   ELLLIST list;                /* clients allocated from this chunk */
+   epicsEventId done;
+
+   /* Working buffers, large enough for the longest line so far.
+    */
+   size_t size;
+   char *line;
+   char *pv_name;
+   char *command;
+   char *signature;
+
+   /* Macros, includes and loops - only used when scanning sequentially.
+    */
+   Macro *macros;
+   int number_macros;
+   int macro_capacity;
+   char *expansion;             /* macro substitution buffer */
+   size_t expansion_length;
+   size_t expansion_size;
+   int include_depth;
+   Name_List *included;         /* files included, or NULL */
+
+   /* Set files read by this chunk, and the identity of those read by the
+    * current specification, see Note_Set_File.
+    */
+   Name_List set_files;
+   unsigned int set_identity;
+
+   int number_errors;           /* specification and directive errors */
+} Scan_Chunk;
+
+/* The files included by the most recently scanned configuration file,
+ * followed by the set files it read.
+ */
+static Name_List included_files = { NULL, 0, 0 };
+static int number_include_files = 0;
+
+/* The chunk being scanned by the calling thread.
+ */
+static epicsThreadPrivateId chunk_id = NULL;
+static epicsThreadOnceId chunk_once = EPICS_THREAD_ONCE_INIT;
+
+static void Scan_Block (Scan_Chunk * chunk, const char *start,
+                        const char *finish, int line_num);
+
+
+/*------------------------------------------------------------------------------
+ */
+static void Add_Name (Name_List * list, const char *name)
+{
+   char **enlarged;
+
+   if (list->count >= list->capacity) {
+      list->capacity = MAX (8, 2 * list->capacity);
+      enlarged = (char **) callocMustSucceed (list->capacity, sizeof (char *),
+                                              "Add_Name");
+      if (list->count > 0) {
+         memcpy (enlarged, list->name, list->count * sizeof (char *));
+      }
+      free (list->name);
+      list->name = enlarged;
+   }
+   list->name[list->count++] = epicsStrDup (name);
+}                               /* Add_Name */
+
+
+/*------------------------------------------------------------------------------
+ */
+static void Free_Names (Name_List * list)
+{
+   while (list->count > 0) {
+      free (list->name[--list->count]);
+   }
+   free (list->name);
+   list->name = NULL;
+   list->capacity = 0;
+}                               /* Free_Names */
+
+
+/*------------------------------------------------------------------------------
+ */
+static bool Has_Name (const Name_List * list, const char *name)
+{
+   int j;
+
+   for (j = 0; j < list->count; j++) {
+      if (strcmp (list->name[j], name) == 0) {
+         return true;
+      }
+   }
+   return false;
+}                               /* Has_Name */
+
+
+/*------------------------------------------------------------------------------
+ */
+static void Chunk_Initialise (void *arg)
+{
+   chunk_id = epicsThreadPrivateCreate ();
+}                               /* Chunk_Initialise */
+
+
+/*------------------------------------------------------------------------------
+ * Records a set file read by the calling thread's chunk, so that it is watched
+ * for changes like an included file, and adds the file's name, size and
+ * modification time to the identity of the specification being scanned. So
+ * on reload, a specification whose set file has changed is not unchanged.
+ */
+static void Note_Set_File (const char *path)
+{
+   Scan_Chunk *chunk;
+   struct stat info;
+   unsigned int hash;
+   const unsigned char *s;
+   long long values[3];
+   size_t j;
+
+   epicsThreadOnce (&chunk_once, Chunk_Initialise, NULL);
+   chunk = (Scan_Chunk *) epicsThreadPrivateGet (chunk_id);
+   if (chunk == NULL) {
+      return;
+   }
+
+   if (!Has_Name (&chunk->set_files, path)) {
+      Add_Name (&chunk->set_files, path);
+   }
+
+   memset (&info, 0, sizeof (info));
+   (void) stat (path, &info);
+   values[0] = (long long) info.st_size;
+   values[1] = (long long) info.st_mtim.tv_sec;
+   values[2] = (long long) info.st_mtim.tv_nsec;
+
+   hash = (chunk->set_identity ^ 0x5bd1e995u) * 16777619u;
+   for (s = (const unsigned char *) path; *s; s++) {
+      hash = (hash ^ *s) * 16777619u;
+   }
+   s = (const unsigned char *) values;
+   for (j = 0; j < sizeof (values); j++) {
+      hash = (hash ^ s[j]) * 16777619u;
+   }
+   chunk->set_identity = hash ? hash : 1;
+}                               /* Note_Set_File */
+
+
+/*------------------------------------------------------------------------------
+ * Sets the set file identity of the clients allocated since last, i.e. those
+ * of the current specification.
+ */
+static void Set_Identity (Scan_Chunk * chunk, CA_Client * last)
+{
+   CA_Client *pClient;
+
+   if (chunk->set_identity == 0) {
+      return;
+   }
+   pClient = last ? (CA_Client *) ellNext ((ELLNODE *) last) :
+       (CA_Client *) ellFirst (&chunk->list);
+   for (; pClient; pClient = (CA_Client *) ellNext ((ELLNODE *) pClient)) {
+      pClient->set_identity = chunk->set_identity;
+   }
+}                               /* Set_Identity */
+
+
+/*------------------------------------------------------------------------------
+ */
+static void Free_Work_Buffers (Scan_Chunk * chunk)
+{
+   free (chunk->line);
+   free (chunk->pv_name);
+   free (chunk->command);
+   free (chunk->signature);
+   chunk->line = NULL;
+   chunk->pv_name = NULL;
+   chunk->command = NULL;
+   chunk->signature = NULL;
+   chunk->size = 0;
+}                               /* Free_Work_Buffers */
+
+
+/*------------------------------------------------------------------------------
+ * Ensures the working buffers can hold a line of the given length. The command
+ * can have at most 12 characters added to it.
+ */
+static void Size_Work_Buffers (Scan_Chunk * chunk, const size_t length)
+{
+   size_t size;
+
+   if (length < chunk->size) {
+      return;
+   }
+
+   Free_Work_Buffers (chunk);
+   size = MAX (MAX_LINE_LENGTH, 2 * length + 1);
+   chunk->line = (char *) callocMustSucceed (size, 1, "Size_Work_Buffers");
+   chunk->pv_name = (char *) callocMustSucceed (size, 1, "Size_Work_Buffers");
+   chunk->command = (char *) callocMustSucceed (size + 13, 1,
+                                                "Size_Work_Buffers");
+   chunk->signature = (char *) callocMustSucceed (size, 1,
+                                                  "Size_Work_Buffers");
+   chunk->size = size;
+}                               /* Size_Work_Buffers */
+
+
+/*------------------------------------------------------------------------------
+ * Scans one configuration line, which may hold several ';' separated
+ * specifications. The line is modified.
+ */
+static void Scan_Line (Scan_Chunk * chunk, char *line, const int line_num)
+{
+   const char *data_source = chunk->data_source;
+   char *pv_name = chunk->pv_name;
+   char *command = chunk->command;
+   char *signature = chunk->signature;
+   CA_Client *pClient;
+   CA_Client *last;
+   int index;
+   Channel_Options options;
+   Match_Target target;
+   Array_Predicate array_predicate;
+   Element_List *element_list;
+   Variant_Range_Collection match_set_collection;
+   bool status;
+   char *source;
+
+   source = line;
+   SKIP_WHITE_SPACE (source);
+
+   /* Ignore empty lines and comment lines.
+    */
+   if ((*source == '\0') || (*source == '#')) {
+      return;
+   }
+
+   /* Split line into sublines using ';' character - strtok not smart enough.
+    * A ';' within quotes, e.g. within a pattern, does not split the line.
+    */
+   while (*source != '\0') {
+      char* sub_line = source; /* save where we parse from */
+      bool is_quoted = false;
+
+      char* scan = source;
+      while (*scan != '\0' && (*scan != ';' || is_quoted)) {
+         if (*scan == '"') {
+            is_quoted = !is_quoted;
+         }
+         scan++;
+      }
+
+      char* next_source = scan;  /* end of string or ';' */
+      if (*scan == ';') {
+         /* terminate string and set up next source */
+         *scan = '\0';
+         next_source++;
+      }
+      source = next_source;
+
+      /* Taken before parsing, as parsing may modify the sub line.
+       */
+      copy_signature (sub_line, signature);
+      last = (CA_Client *) ellLast (&chunk->list);
+      chunk->set_identity = 0;
+
+      /* Expression and sequence lines are handled separately.
+       */
+      scan = sub_line;
+      SKIP_WHITE_SPACE (scan);
+      if (is_keyword (scan, "expr")) {
+         if (!parse_expression_line (sub_line, chunk->allocate, &chunk->list,
+                                     signature, data_source, line_num)) {
+            printf ("%s:%d %s\n", data_source, line_num, sub_line);
+            chunk->number_errors++;
+         }
+         Set_Identity (chunk, last);
+         continue;
+      }
+
+      if (is_keyword (scan, "seq")) {
+         if (!parse_sequence_line (sub_line, chunk->allocate, &chunk->list,
+                                   signature, data_source, line_num)) {
+            printf ("%s:%d %s\n", data_source, line_num, sub_line);
+            chunk->number_errors++;
+         }
+         Set_Identity (chunk, last);
+         continue;
+      }
+
+      status = parse_line (sub_line, pv_name, &index, &options, &target,
+                           &array_predicate, &element_list,
+                           &match_set_collection, command,
+                           data_source, line_num);
+
+      if (status == false) {
+         /* Any errors already reported - just print whole line.
+          */
+         printf ("%s:%d %s\n", data_source, line_num, sub_line);
+         chunk->number_errors++;
+         continue;
+      }
+
+      if (debug >= 2) {
+         printf ("processing PV: %s [%d] {match}%d %s\n", pv_name, index,
+                 match_set_collection.count, command);
+      }
+
+      pClient = chunk->allocate (match_set_collection.count);
+      if (pClient) {
+         pClient->pv_name = Intern_String (pv_name);
+         pClient->match_command = Intern_String (command);
+         pClient->element_index = index;
+         pClient->options = options;
+         pClient->target = target;
+         pClient->array_predicate = array_predicate;
+         pClient->element_list = element_list;
+         pClient->match_set_collection.count = match_set_collection.count;
+         memcpy (pClient->match_set_collection.item,
+                 match_set_collection.item,
+                 match_set_collection.count * sizeof (Variant_Range));
+         pClient->signature = epicsStrDup (signature);
+         pClient->set_identity = chunk->set_identity;
+         ellAdd (&chunk->list, (ELLNODE *) pClient);
+      }
+   }
+}                               /* Scan_Line */
+
+
+/*------------------------------------------------------------------------------
+ * MACROS, INCLUDES AND LOOPS
+ *------------------------------------------------------------------------------
+ * Configuration files may contain the directives:
+ *
+ *    define NAME value
+ *    include file [NAME=value, ...]
+ *    for NAME in item ...
+ *    end
+ *
+ * where a loop item is either a value or an integer range first..last, e.g.
+ * 01..14 (a leading zero pads the values to the width of first). $(NAME) and
+ * ${NAME} are replaced by the macro's value in all other lines, and in the
+ * directives' operands. References to undefined macros are left as is, so
+ * that shell variable references in commands are unaffected.
+ *
+ * Loop bodies and included files are expanded line by line, directly into the
+ * client list. Macros defined within an included file or loop body are local
+ * to that file or loop body.
+ */
+#define MAXIMUM_INCLUDE_DEPTH   16
+
+typedef enum eDirective_Kind {
+   dkNone = 0,
+   dkDefine,
+   dkInclude,
+   dkFor,
+   dkEnd
+} Directive_Kind;
+
+
+/*------------------------------------------------------------------------------
+ * Returns the directive, if any, at the start of the text. The text need not
+ * be '\0' terminated. If a directive, operand is set to the text following
+ * the directive keyword.
+ */
+static Directive_Kind Get_Directive (const char *text, const char *end,
+                                     const char **operand)
+{
+   static const struct {
+      const char *keyword;
+      Directive_Kind kind;
+   } directives[] = {
+      { "define",  dkDefine  },
+      { "include", dkInclude },
+      { "for",     dkFor     },
+      { "end",     dkEnd     }
+   };
+   size_t n;
+   int j;
+
+   while ((text < end) && isspace (*text)) {
+      text++;
+   }
+
+   for (j = 0; j < (int) NELEMENTS (directives); j++) {
+      n = strlen (directives[j].keyword);
+      if ((end - text >= (long) n) &&
+          (memcmp (text, directives[j].keyword, n) == 0) &&
+          ((text + n == end) || isspace (text[n]))) {
+         *operand = text + n;
+         return directives[j].kind;
+      }
+   }
+   return dkNone;
+}                               /* Get_Directive */
+
+
+/*------------------------------------------------------------------------------
+ * Returns true if the buffer contains any directives. Such configurations are
+ * scanned sequentially.
+ */
+static bool Has_Directives (const char *buffer, const size_t size)
+{
+   const char *next;
+   const char *end;
+   const char *finish = buffer + size;
+   const char *operand;
+
+   for (next = buffer; next < finish; next = end + 1) {
+      end = (const char *) memchr (next, '\n', finish - next);
+      if (end == NULL) {
+         end = finish;
+      }
+      if (Get_Directive (next, end, &operand) != dkNone) {
+         return true;
+      }
+   }
+   return false;
+}                               /* Has_Directives */
+
+
+/*------------------------------------------------------------------------------
+ * Returns the index of the macro, most recent definition first, or -1.
+ */
+static int Find_Macro (const Scan_Chunk * chunk, const char *name,
+                       const size_t length)
+{
+   int j;
+
+   for (j = chunk->number_macros - 1; j >= 0; j--) {
+      if ((strncmp (chunk->macros[j].name, name, length) == 0) &&
+          (chunk->macros[j].name[length] == '\0')) {
+         return j;
+      }
+   }
+   return -1;
+}                               /* Find_Macro */
+
+
+/*------------------------------------------------------------------------------
+ * Defines a macro - any previous definition is hidden until the macro table
+ * is truncated.
+ */
+static void Define_Macro (Scan_Chunk * chunk, const char *name,
+                          const size_t length, const char *value)
+{
+   Macro *enlarged;
+   Macro *macro;
+
+   if (chunk->number_macros >= chunk->macro_capacity) {
+      chunk->macro_capacity = MAX (16, 2 * chunk->macro_capacity);
+      enlarged = (Macro *) callocMustSucceed
+          (chunk->macro_capacity, sizeof (Macro), "Define_Macro");
+      if (chunk->number_macros > 0) {
+         memcpy (enlarged, chunk->macros, chunk->number_macros * sizeof (Macro));
+      }
+      free (chunk->macros);
+      chunk->macros = enlarged;
+   }
+
+   macro = &chunk->macros[chunk->number_macros++];
+   macro->name = epicsStrnDup (name, length);
+   macro->value = epicsStrDup (value);
+}                               /* Define_Macro */
+
+
+/*------------------------------------------------------------------------------
+ * Discards all macros defined after the first number macros.
+ */
+static void Truncate_Macros (Scan_Chunk * chunk, const int number)
+{
+   while (chunk->number_macros > number) {
+      chunk->number_macros--;
+      free (chunk->macros[chunk->number_macros].name);
+      free (chunk->macros[chunk->number_macros].value);
+   }
+}                               /* Truncate_Macros */
+
+
+/*------------------------------------------------------------------------------
+ * Appends text to the expansion buffer.
+ */
+static void Append_Expansion (Scan_Chunk * chunk, const char *text,
+                              const size_t length)
+{
+   char *enlarged;
+
+   if (chunk->expansion_length + length + 1 > chunk->expansion_size) {
+      chunk->expansion_size = MAX (MAX_LINE_LENGTH,
+                                   2 * (chunk->expansion_length + length + 1));
+      enlarged = (char *) callocMustSucceed (chunk->expansion_size, 1,
+                                             "Append_Expansion");
+      if (chunk->expansion_length > 0) {
+         memcpy (enlarged, chunk->expansion, chunk->expansion_length);
+      }
+      free (chunk->expansion);
+      chunk->expansion = enlarged;
+   }
+
+   memcpy (chunk->expansion + chunk->expansion_length, text, length);
+   chunk->expansion_length += length;
+   chunk->expansion[chunk->expansion_length] = '\0';
+}                               /* Append_Expansion */
+
+
+/*------------------------------------------------------------------------------
+ * Substitutes the macro references in text (which need not be '\0'
+ * terminated) into the expansion buffer.
+ */
+static void Expand_Macros (Scan_Chunk * chunk, const char *text,
+                           const char *end)
+{
+   const char *dollar;
+   const char *close;
+   char closing;
    int index;
-   Variant_Range_Collection match_set_collection;
-   bool status;
-   char *source;
 
-   /* Read lines from file
+   chunk->expansion_length = 0;
+   Append_Expansion (chunk, "", 0);
+
+   while ((text < end) &&
+          (dollar = (const char *) memchr (text, '$', end - text))) {
+      Append_Expansion (chunk, text, dollar - text);
+      text = dollar + 1;
+
+      if ((text >= end) || ((*text != '(') && (*text != '{'))) {
+         Append_Expansion (chunk, "$", 1);
+         continue;
+      }
+
+      closing = (*text == '(') ? ')' : '}';
+      close = (const char *) memchr (text, closing, end - text);
+      index = close ? Find_Macro (chunk, text + 1, close - text - 1) : -1;
+      if (index < 0) {
+         Append_Expansion (chunk, "$", 1);  /* leave as is */
+         continue;
+      }
+
+      Append_Expansion (chunk, chunk->macros[index].value,
+                        strlen (chunk->macros[index].value));
+      text = close + 1;
+   }
+
+   if (text < end) {
+      Append_Expansion (chunk, text, end - text);
+   }
+}                               /* Expand_Macros */
+
+
+/*------------------------------------------------------------------------------
+ * Returns the length of the macro name at the start of text, or 0 if none.
+ */
+static size_t Macro_Name_Length (const char *text)
+{
+   size_t n = 0;
+
+   if (!isalpha (text[0]) && (text[0] != '_')) {
+      return 0;
+   }
+   while (isalnum (text[n]) || (text[n] == '_')) {
+      n++;
+   }
+   return n;
+}                               /* Macro_Name_Length */
+
+
+/*------------------------------------------------------------------------------
+ * Returns a copy of the directive's operand, with any macros substituted and
+ * leading and trailing white space removed. Caller must free.
+ */
+static char *Expand_Operand (Scan_Chunk * chunk, const char *operand,
+                             const char *end)
+{
+   char *result;
+   int len;
+
+   Expand_Macros (chunk, operand, end);
+   result = chunk->expansion;
+   SKIP_WHITE_SPACE (result);
+   result = epicsStrDup (result);
+   len = strlen (result);
+   while ((len > 0) && isspace (result[len - 1])) {
+      result[--len] = '\0';
+   }
+   return result;
+}                               /* Expand_Operand */
+
+
+/*------------------------------------------------------------------------------
+ * Handles: define NAME value
+ */
+static void Define_Directive (Scan_Chunk * chunk, char *operand,
+                              const int line_num)
+{
+   size_t n = Macro_Name_Length (operand);
+   char *value = operand + n;
+
+   if ((n == 0) || ((*value != '\0') && !isspace (*value))) {
+      chunk->number_errors++;
+      printf ("%s:%d error invalid macro name in define\n",
+              chunk->data_source, line_num);
+      return;
+   }
+   SKIP_WHITE_SPACE (value);
+   Define_Macro (chunk, operand, n, value);
+}                               /* Define_Directive */
+
+
+/*------------------------------------------------------------------------------
+ * Handles: include file [NAME=value, ...]
+ * A relative file name is relative to the directory of the including file.
+ */
+static void Include_Directive (Scan_Chunk * chunk, char *operand,
+                               const int line_num)
+{
+   const char *data_source = chunk->data_source;
+   const int number_macros = chunk->number_macros;
+   char *name;
+   char *path;
+   char *value;
+   char *buffer;
+   size_t size;
+   size_t n;
+   bool is_mapped;
+
+   if (chunk->include_depth >= MAXIMUM_INCLUDE_DEPTH) {
+      chunk->number_errors++;
+      printf ("%s:%d error includes nested more than %d deep\n",
+              data_source, line_num, MAXIMUM_INCLUDE_DEPTH);
+      return;
+   }
+
+   /* The file name may be quoted.
     */
-   line_num = 0;
-   while (fgets (line, MAX_LINE_LENGTH, input_file)) {
+   name = operand;
+   if (*name == '"') {
+      name++;
+      operand = strchr (name, '"');
+      if (operand == NULL) {
+         chunk->number_errors++;
+         printf ("%s:%d error missing closing quote\n", data_source, line_num);
+         return;
+      }
+   } else {
+      operand = name;
+      while ((*operand != '\0') && !isspace (*operand)) {
+         operand++;
+      }
+   }
+   if (*operand != '\0') {
+      *operand++ = '\0';
+   }
 
-      line_num++;
+   if (*name == '\0') {
+      chunk->number_errors++;
+      printf ("%s:%d error missing include file name\n", data_source, line_num);
+      return;
+   }
 
-      /* Remove trailing \n char if it exists.
-       */
-      len = strlen (line);
-      if ((len > 0) && (line[len - 1] == '\n')) {
-         line[len - 1] = '\0';
+   /* Any macro assignments are local to the included file.
+    */
+   for (;;) {
+      while (isspace (*operand) || (*operand == ',')) {
+         operand++;
+      }
+      if (*operand == '\0') {
+         break;
+      }
+      n = Macro_Name_Length (operand);
+      if ((n == 0) || (operand[n] != '=')) {
+         chunk->number_errors++;
+         printf ("%s:%d error invalid macro assignment '%s'\n",
+                 data_source, line_num, operand);
+         Truncate_Macros (chunk, number_macros);
+         return;
       }
+      value = operand + n + 1;
+      operand = value;
+      while ((*operand != '\0') && (*operand != ',') && !isspace (*operand)) {
+         operand++;
+      }
+      if (*operand != '\0') {
+         *operand++ = '\0';
+      }
+      Define_Macro (chunk, value - n - 1, n, value);
+   }
 
-      source = line;
-      SKIP_WHITE_SPACE (source);
+   path = Relative_Path (chunk->is_file ? data_source : NULL, name);
 
-      /* Ignore empty lines and comment lines.
-       */
-      if ((*source == '\0') || (*source == '#')) {
-         continue;
+   buffer = Load_File (path, &size, &is_mapped);
+   if (buffer == NULL) {
+      chunk->number_errors++;
+      printf ("%s:%d error unable to open include file %s\n",
+              data_source, line_num, path);
+   } else {
+      if (chunk->included) {
+         Add_Name (chunk->included, path);
+      }
+      chunk->data_source = path;
+      chunk->include_depth++;
+      Scan_Block (chunk, buffer, buffer + size, 0);
+      chunk->include_depth--;
+      chunk->data_source = data_source;
+      Unload_File (buffer, size, is_mapped);
+   }
+
+   free (path);
+   Truncate_Macros (chunk, number_macros);
+}                               /* Include_Directive */
+
+
+/*------------------------------------------------------------------------------
+ * Scans the loop body with the loop macro, i.e. the index'th macro, set to
+ * value. Any macros defined by the body are then discarded.
+ */
+static void Loop_Body (Scan_Chunk * chunk, const int index,
+                       const char *value, const char *start,
+                       const char *finish, const int line_num)
+{
+   free (chunk->macros[index].value);
+   chunk->macros[index].value = epicsStrDup (value);
+   Scan_Block (chunk, start, finish, line_num);
+   Truncate_Macros (chunk, index + 1);
+}                               /* Loop_Body */
+
+
+/*------------------------------------------------------------------------------
+ * Handles: for NAME in item ...
+ * The body is from start to finish, and starts after line line_num.
+ */
+static void For_Directive (Scan_Chunk * chunk, char *operand,
+                           const char *start, const char *finish,
+                           const int line_num)
+{
+   const char *data_source = chunk->data_source;
+   size_t n = Macro_Name_Length (operand);
+   char *name = operand;
+   char *item;
+   char *dots;
+   char *endptr;
+   char value[32];
+   int index;
+   long first;
+   long last;
+   long step;
+   long j;
+   int width;
+
+   operand += n;
+   SKIP_WHITE_SPACE (operand);
+   if ((n == 0) || !is_keyword (operand, "in")) {
+      chunk->number_errors++;
+      printf ("%s:%d error expecting 'for NAME in item ...'\n",
+              data_source, line_num);
+      return;
+   }
+   operand += 2;
+
+   index = chunk->number_macros;
+   Define_Macro (chunk, name, n, "");
+
+   for (;;) {
+      while (isspace (*operand) || (*operand == ',')) {
+         operand++;
+      }
+      if (*operand == '\0') {
+         break;
       }
 
-      /* Split line into sublines using ';' character - strtok not smart enough.
+      item = operand;
+      while ((*operand != '\0') && (*operand != ',') && !isspace (*operand)) {
+         operand++;
+      }
+      if (*operand != '\0') {
+         *operand++ = '\0';
+      }
+
+      /* Integer range, e.g. 1..10 or 01..14.
        */
-      while (*source != '\0') {
-         char* sub_line = source; /* save where we parse from */
-
-         /* TODO: check if ; within quotes */
-         char* scan = source;
-         while (*scan != '\0' && *scan != ';') scan++;
-
-         char* next_source = scan;  /* end of string or ';' */
-         if (*scan == ';') {
-            /* terminate string and set up next source */
-            *scan = '\0';
-            next_source++;
+      dots = strstr (item, "..");
+      if (dots) {
+         *dots = '\0';
+         first = strtol (item, &endptr, 10);
+         if ((endptr == item) || (*endptr != '\0')) {
+            dots = NULL;
+         } else {
+            last = strtol (dots + 2, &endptr, 10);
+            if ((endptr == dots + 2) || (*endptr != '\0')) {
+               dots = NULL;
+            }
+         }
+         if (dots == NULL) {
+            chunk->number_errors++;
+            printf ("%s:%d error invalid loop range\n", data_source, line_num);
+            break;
          }
-         source = next_source;
 
-         status = parse_line (sub_line, pv_name, &index, &match_set_collection,
-                              command, data_source, line_num);
+         width = ((item[0] == '0') && (item[1] != '\0')) ? strlen (item) : 0;
+         step = (last >= first) ? 1 : -1;
+         for (j = first;; j += step) {
+            snprintf (value, sizeof (value), "%0*ld", width, j);
+            Loop_Body (chunk, index, value, start, finish, line_num);
+            if (j == last) {
+               break;
+            }
+         }
+      } else {
+         Loop_Body (chunk, index, item, start, finish, line_num);
+      }
+   }
 
-         if (status == false) {
-            /* Any errors already reported - just print whole line.
+   Truncate_Macros (chunk, index);
+}                               /* For_Directive */
+
+
+/*------------------------------------------------------------------------------
+ * Scans the lines from start to finish; line_num is the number of the line
+ * before start. Each line is copied, with any macros substituted, into the
+ * line working buffer, as parsing modifies the line.
+ */
+static void Scan_Block (Scan_Chunk * chunk, const char *start,
+                        const char *finish, int line_num)
+{
+   const char *next;
+   const char *end;
+   const char *body;
+   const char *operand;
+   const char *scan;
+   const char *scan_end;
+   char *expanded;
+   Directive_Kind directive;
+   size_t length;
+   int body_line_num;
+   int depth;
+
+   for (next = start; next < finish; next = end + 1) {
+      end = (const char *) memchr (next, '\n', finish - next);
+      if (end == NULL) {
+         end = finish;
+      }
+      line_num++;
+
+      directive = Get_Directive (next, end, &operand);
+      if ((directive != dkNone) && !chunk->allow_directives) {
+         chunk->number_errors++;
+         printf ("%s:%d error directives are not allowed here\n",
+                 chunk->data_source, line_num);
+         continue;
+      }
+
+      switch (directive) {
+
+         case dkNone:
+            length = end - next;
+            if ((chunk->number_macros > 0) && memchr (next, '$', length)) {
+               Expand_Macros (chunk, next, end);
+               length = chunk->expansion_length;
+               Size_Work_Buffers (chunk, length);
+               memcpy (chunk->line, chunk->expansion, length);
+            } else {
+               Size_Work_Buffers (chunk, length);
+               memcpy (chunk->line, next, length);
+            }
+            chunk->line[length] = '\0';
+            Scan_Line (chunk, chunk->line, line_num);
+            break;
+
+         case dkDefine:
+            expanded = Expand_Operand (chunk, operand, end);
+            Define_Directive (chunk, expanded, line_num);
+            free (expanded);
+            break;
+
+         case dkInclude:
+            expanded = Expand_Operand (chunk, operand, end);
+            Include_Directive (chunk, expanded, line_num);
+            free (expanded);
+            break;
+
+         case dkFor:
+            /* Find the matching end.
              */
-            printf ("%s:%d %s\n", data_source, line_num, sub_line);
-            continue;
-         }
+            body = end + 1;
+            body_line_num = line_num;
+            depth = 1;
+            for (scan = body; scan < finish; scan = scan_end + 1) {
+               scan_end = (const char *) memchr (scan, '\n', finish - scan);
+               if (scan_end == NULL) {
+                  scan_end = finish;
+               }
+               line_num++;
+               switch (Get_Directive (scan, scan_end, &operand)) {
+                  case dkFor:
+                     depth++;
+                     break;
+                  case dkEnd:
+                     depth--;
+                     break;
+                  default:
+                     break;
+               }
+               if (depth == 0) {
+                  break;
+               }
+            }
+
+            /* Skip just the unmatched for line, and carry on.
+             */
+            if (depth > 0) {
+               chunk->number_errors++;
+               printf ("%s:%d error 'for' without matching 'end'\n",
+                       chunk->data_source, body_line_num);
+               line_num = body_line_num;
+               break;
+            }
+
+            (void) Get_Directive (next, end, &operand);
+            expanded = Expand_Operand (chunk, operand, end);
+            For_Directive (chunk, expanded, body, scan, body_line_num);
+            free (expanded);
+            end = scan_end;
+            break;
+
+         case dkEnd:
+            chunk->number_errors++;
+            printf ("%s:%d error 'end' without matching 'for'\n",
+                    chunk->data_source, line_num);
+            break;
+      }
+   }
+}                               /* Scan_Block */
 
-         /* Check sizes
-          */
-         if (strlen (pv_name) > sizeof (pClient->pv_name) - 1) {
-            printf ("%s:%d pv name too long\n", data_source, line_num);
-            printf ("%s:%d %s\n", data_source, line_num, sub_line);
-            continue;
-         }
 
-         if (strlen (command) > sizeof (pClient->match_command) - 1) {
-            printf ("%s:%d command too long\n", data_source, line_num);
-            printf ("%s:%d %s\n", data_source, line_num, sub_line);
-            continue;
+/*------------------------------------------------------------------------------
+ * Scans each line of the chunk.
+ */
+static void Scan_Chunk_Lines (Scan_Chunk * chunk)
+{
+   epicsThreadOnce (&chunk_once, Chunk_Initialise, NULL);
+   epicsThreadPrivateSet (chunk_id, chunk);
+   Scan_Block (chunk, chunk->start, chunk->finish, chunk->line_num);
+   epicsThreadPrivateSet (chunk_id, NULL);
+
+   Truncate_Macros (chunk, 0);
+   free (chunk->macros);
+   free (chunk->expansion);
+   Free_Work_Buffers (chunk);
+}                               /* Scan_Chunk_Lines */
+
+
+/*------------------------------------------------------------------------------
+ */
+static void Scan_Chunk_Thread (void *arg)
+{
+   Scan_Chunk *chunk = (Scan_Chunk *) arg;
+
+   Scan_Chunk_Lines (chunk);
+   epicsEventSignal (chunk->done);
+}                               /* Scan_Chunk_Thread */
+
+
+/*------------------------------------------------------------------------------
+ * Returns the number of scan threads, as per KRYTEN_SCAN_THREADS, which
+ * defaults to the number of processors.
+ */
+static int Scan_Threads ()
+{
+   bool status;
+   long value;
+
+   value = get_long_env ("KRYTEN_SCAN_THREADS", &status);
+   if (!status || (value < 1)) {
+      value = sysconf (_SC_NPROCESSORS_ONLN);
+   }
+   return (int) MIN (MAX (value, 1), MAXIMUM_CHUNKS);
+}                               /* Scan_Threads */
+
+
+/*------------------------------------------------------------------------------
+ * Returns the number of lines, i.e. new line characters, from start to finish.
+ */
+static int Count_Lines (const char *start, const char *finish)
+{
+   int count = 0;
+
+   while ((start < finish) &&
+          (start = (const char *) memchr (start, '\n', finish - start))) {
+      start++;
+      count++;
+   }
+   return count;
+}                               /* Count_Lines */
+
+
+/*------------------------------------------------------------------------------
+ * Scans the buffer, appending the new clients to list in configuration order.
+ * Returns false if there were any errors.
+ */
+static bool Scan_Configuration (const char *buffer, const size_t size,
+                                const char *data_source, const bool is_file,
+                                const bool allow_directives,
+                                const Allocate_Client_Handle allocate,
+                                ELLLIST * list, Name_List * included,
+                                Name_List * set_files)
+{
+   Scan_Chunk chunks[MAXIMUM_CHUNKS];
+   const char *start;
+   const char *finish;
+   const char *end = buffer + size;
+   int line_num;
+   int number;
+   int number_errors;
+   int j;
+   int k;
+
+   if (debug > 0) {
+      printf ("%s: entry: data='%s'.\n", __FUNCTION__, data_source);
+   }
+
+   number = (int) MIN ((size_t) Scan_Threads (), size / MINIMUM_CHUNK_SIZE);
+   number = MAX (number, 1);
+
+   /* Macros and loops span lines, so such configurations are scanned
+    * sequentially.
+    */
+   if ((number > 1) && Has_Directives (buffer, size)) {
+      number = 1;
+   }
+
+   /* Split into chunks at line boundaries.
+    */
+   start = buffer;
+   line_num = 0;
+   for (j = 0; j < number; j++) {
+      if (j == number - 1) {
+         finish = end;
+      } else {
+         finish = buffer + (size / number) * (j + 1);
+         if (finish <= start) {
+            finish = start;
+         } else {
+            finish = (const char *) memchr (finish, '\n', end - finish);
+            finish = finish ? finish + 1 : end;
          }
+      }
+
+      memset (&chunks[j], 0, sizeof (Scan_Chunk));
+      chunks[j].start = start;
+      chunks[j].finish = finish;
+      chunks[j].line_num = line_num;
+      chunks[j].data_source = data_source;
+      chunks[j].is_file = is_file;
+      chunks[j].allow_directives = allow_directives;
+      chunks[j].allocate = allocate;
+      chunks[j].included = included;
+      ellInit (&chunks[j].list);
+
+      if (j < number - 1) {
+         line_num += Count_Lines (start, finish);
+      }
+      start = finish;
+   }
 
-         if (debug >= 2) {
-            printf ("processing PV: %s [%d] {match}%d %s\n", pv_name, index,
-                    match_set_collection.count, command);
+   if (number == 1) {
+      Scan_Chunk_Lines (&chunks[0]);
+   } else {
+      for (j = 0; j < number; j++) {
+         chunks[j].done = epicsEventCreate (epicsEventEmpty);
+         if (!epicsThreadCreate ("kryten_scan", epicsThreadPriorityMedium,
+                                 epicsThreadGetStackSize
+                                 (epicsThreadStackMedium),
+                                 Scan_Chunk_Thread, &chunks[j])) {
+            /* Just scan it here.
+             */
+            Scan_Chunk_Thread (&chunks[j]);
          }
+      }
+      for (j = 0; j < number; j++) {
+         epicsEventWait (chunks[j].done);
+         epicsEventDestroy (chunks[j].done);
+      }
+   }
 
-         pClient = allocate ();
-         if (pClient) {
-            /* Unlike strncpy, snprintf includes tailing '\0'
-          */
-            snprintf (pClient->pv_name, sizeof (pClient->pv_name), "%s",
-                      pv_name);
-            snprintf (pClient->match_command, sizeof (pClient->match_command),
-                      "%s", command);
-            pClient->element_index = index;
-            pClient->match_set_collection = match_set_collection;
-
-            continue;
+   number_errors = 0;
+   for (j = 0; j < number; j++) {
+      number_errors += chunks[j].number_errors;
+      ellConcat (list, &chunks[j].list);
+      for (k = 0; set_files && (k < chunks[j].set_files.count); k++) {
+         if (!Has_Name (set_files, chunks[j].set_files.name[k])) {
+            Add_Name (set_files, chunks[j].set_files.name[k]);
          }
       }
+      Free_Names (&chunks[j].set_files);
    }
 
    if (debug > 0) {
-      printf ("%s: exit: data='%s'.\n", __FUNCTION__, data_source);
+      printf ("%s: exit: data='%s' (%d chunks).\n", __FUNCTION__,
+              data_source, number);
    }
 
-   return true;
+   if (number_errors > 0) {
+      printf ("%s: %d %s\n", data_source, number_errors,
+              (number_errors == 1) ? "error" : "errors");
+   }
+   return (number_errors == 0);
 }                               /* Scan_Configuration */
 
 
 /*------------------------------------------------------------------------------
  */
 bool Scan_Configuration_File (const char *filename,
-                               const Allocate_Client_Handle allocate)
+                              const Allocate_Client_Handle allocate,
+                              ELLLIST * list)
 {
+   Name_List set_files = { NULL, 0, 0 };
+   char *buffer;
+   size_t size;
+   bool is_mapped;
    bool result;
-   FILE* f;
+   int j;
 
    if (debug > 0) {
       printf ("%s: entry: filename='%s'.\n", __FUNCTION__, filename);
@@ -591,44 +3255,79 @@ bool Scan_Configuration_File (const char *filename,
 
    /* Attempt to open the specified file.
     */
-   f = fopen (filename, "r");
-   if (!f) {
+   buffer = Load_File (filename, &size, &is_mapped);
+   if (buffer == NULL) {
       printf ("%s: unable to open file %s.\n", __FUNCTION__, filename);
       return false;
    }
 
-   result = Scan_Configuration (f, filename, allocate);
+   Free_Names (&included_files);
+   result = Scan_Configuration (buffer, size, filename, true, true, allocate,
+                                list, &included_files, &set_files);
 
-   /* Close file
-    */
-   (void) fclose (f);
+   number_include_files = included_files.count;
+   for (j = 0; j < set_files.count; j++) {
+      if (!Has_Name (&included_files, set_files.name[j])) {
+         Add_Name (&included_files, set_files.name[j]);
+      }
+   }
+   Free_Names (&set_files);
 
+   Unload_File (buffer, size, is_mapped);
    return result;
-}
+}                               /* Scan_Configuration_File */
 
 /*------------------------------------------------------------------------------
  */
-bool Scan_Configuration_String (const char *buffer,
-                                const size_t size,
-                                const Allocate_Client_Handle allocate)
+const char *Scan_Included_File (const int index)
 {
-   bool result;
-   FILE* f;
+   return ((index >= 0) && (index < included_files.count)) ?
+       included_files.name[index] : NULL;
+}                               /* Scan_Included_File */
 
-   /* Read only mode  - allow casting from const */
-   f = fmemopen ((char *)buffer, size, "r");
+/*------------------------------------------------------------------------------
+ */
+bool Scan_Is_Set_File (const int index)
+{
+   return (index >= number_include_files) && (index < included_files.count);
+}                               /* Scan_Is_Set_File */
 
-   if (!f) {
-      printf ("%s: unable to open memory stream.\n", __FUNCTION__);
-      return false;
-   }
-   result = Scan_Configuration (f, "memory buffer", allocate);
+/*------------------------------------------------------------------------------
+ */
+void Scan_Clear_Included_Files ()
+{
+   Free_Names (&included_files);
+   number_include_files = 0;
+}                               /* Scan_Clear_Included_Files */
 
-   /* Close file
-    */
-   (void) fclose (f);
+/*------------------------------------------------------------------------------
+ */
+void Scan_Add_Included_File (const char *name)
+{
+   Add_Name (&included_files, name);
+}                               /* Scan_Add_Included_File */
 
-   return result;
-}
+/*------------------------------------------------------------------------------
+ */
+bool Scan_Configuration_String (const char *buffer,
+                                const size_t size,
+                                const Allocate_Client_Handle allocate,
+                                ELLLIST * list)
+{
+   return Scan_Configuration (buffer, size, "memory buffer", false, true,
+                              allocate, list, NULL, NULL);
+}                               /* Scan_Configuration_String */
+
+/*------------------------------------------------------------------------------
+ */
+bool Scan_Specification_String (const char *buffer,
+                                const size_t size,
+                                const char *data_source,
+                                const Allocate_Client_Handle allocate,
+                                ELLLIST * list)
+{
+   return Scan_Configuration (buffer, size, data_source, false, false,
+                              allocate, list, NULL, NULL);
+}                               /* Scan_Specification_String */
 
 /* end */
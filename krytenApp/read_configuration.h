@@ -35,11 +35,47 @@
 #include "kryten.h"
 #include "pv_client.h"
 
+/* Scans the configuration, appending the allocated clients to list in
+ * configuration order. Large configurations are scanned in parallel, using
+ * up to KRYTEN_SCAN_THREADS threads (default is the number of processors),
+ * unless they use the define, include or for directives. Returns false if the
+ * file cannot be read, or if any specification or directive is in error; the
+ * valid specifications are still appended to the list.
+ */
 bool Scan_Configuration_File (const char *filename,
-                              const Allocate_Client_Handle allocate);
+                              const Allocate_Client_Handle allocate,
+                              ELLLIST * list);
 
 bool Scan_Configuration_String (const char *buffer,
                                 const size_t size,
-                                const Allocate_Client_Handle allocate);
+                                const Allocate_Client_Handle allocate,
+                                ELLLIST * list);
+
+/* As per Scan_Configuration_String, but the define, include and for directives
+ * are rejected, e.g. for specifications received via the control socket. The
+ * data source is used in messages, and relative set file names are relative
+ * to its directory, if any.
+ */
+bool Scan_Specification_String (const char *buffer,
+                                const size_t size,
+                                const char *data_source,
+                                const Allocate_Client_Handle allocate,
+                                ELLLIST * list);
+
+/* Returns the name of each file included by the most recently scanned
+ * configuration file, followed by each set file it read, or NULL when index is
+ * past the last file.
+ */
+const char *Scan_Included_File (const int index);
+
+/* Returns true if the index'th file is a set file.
+ */
+bool Scan_Is_Set_File (const int index);
+
+/* Replace the included files list, e.g. with the files recorded by the rule
+ * cache when a configuration is loaded from the cache.
+ */
+void Scan_Clear_Included_Files ();
+void Scan_Add_Included_File (const char *name);
 
 #endif                          /* READ_PV_LIST_H_ */
@@ -0,0 +1,980 @@
+/* rule_cache.c
+ *
+ * Kryten is a EPICS PV monitoring program that calls a system command
+ * when the value of the PV matches/cease to match specified criteria.
+ *
+ * Copyright (C) 2011-2021  Andrew C. Starritt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact details:
+ * andrew.starritt@gmail.com
+ * PO Box 3118, Prahran East, Victoria 3181, Australia.
+ *
+ * Source code formatting:
+ * indent options:  -kr -pcs -i3 -cli3 -nbbo -nut
+ *
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <cantProceed.h>
+#include <epicsString.h>
+#include <epicsTypes.h>
+
+#include "information.h"
+#include "read_configuration.h"
+#include "rule_cache.h"
+
+#define CACHE_SUFFIX      ".cache"
+#define CACHE_MAGIC       "KRYTENRC"
+#define CACHE_VERSION     2
+
+/* Any change to the scanner may change the scanned clients, so a cache is
+ * only used by the build of kryten that wrote it.
+ */
+#define CACHE_BUILD       KRYTEN_VERSION " " BUILD_DATETIME
+
+/* The cache file is the header followed by the body. The body comprises the
+ * unit, rule, range, interval and dependency (included or set file) tables
+ * followed by the string table. All table entries are multiples of 8 bytes, and all strings are referenced by
+ * their offset within the string table.
+ */
+typedef struct sCache_Header {
+   char magic[8];
+   epicsUInt32 version;
+   epicsUInt32 header_size;
+   char build[48];
+   epicsUInt64 source_size;
+   epicsInt64 source_mtime;     /* seconds */
+   epicsInt64 source_mtime_nsec;
+   epicsUInt64 source_inode;
+   epicsUInt64 source_device;
+   epicsUInt32 number_units;
+   epicsUInt32 number_rules;
+   epicsUInt32 number_ranges;
+   epicsUInt32 number_intervals;
+   epicsUInt32 number_dependencies;
+   epicsUInt32 spare;
+   epicsUInt64 strings_size;
+   epicsUInt64 body_size;
+   epicsUInt64 checksum;        /* of the body */
+} Cache_Header;
+
+typedef enum eCache_Unit_Kind {
+   cuRule = 1,                  /* index is the rule number */
+   cuText                       /* index is the specification text offset */
+} Cache_Unit_Kind;
+
+typedef struct sCache_Unit {
+   epicsUInt32 kind;
+   epicsUInt32 index;
+} Cache_Unit;
+
+typedef struct sCache_Value {
+   epicsInt32 kind;
+   epicsUInt32 sval;            /* only used by vkString */
+   epicsFloat64 dval;           /* only used by vkFloating */
+   epicsInt64 ival;             /* only used by vkInteger */
+} Cache_Value;
+
+typedef struct sCache_Range {
+   epicsInt32 comp;
+   epicsInt32 spare;
+   Cache_Value lower;
+   Cache_Value upper;
+} Cache_Range;
+
+typedef struct sCache_Interval {
+   epicsFloat64 lower;
+   epicsFloat64 upper;
+} Cache_Interval;
+
+/* An included file, identified as per the configuration file.
+ */
+typedef struct sCache_Dependency {
+   epicsUInt32 name;
+   epicsUInt32 spare;
+   epicsUInt64 size;
+   epicsInt64 mtime;
+   epicsInt64 mtime_nsec;
+   epicsUInt64 inode;
+   epicsUInt64 device;
+} Cache_Dependency;
+
+typedef struct sCache_Rule {
+   epicsUInt32 pv_name;
+   epicsUInt32 command;
+   epicsUInt32 signature;
+   epicsInt32 element_index;
+   epicsFloat64 deadband;
+   epicsInt64 event_mask;
+   epicsInt32 is_relative;
+   epicsInt32 priority;
+   epicsInt32 target;
+   epicsInt32 predicate_kind;
+   epicsInt32 count_comp;
+   epicsInt32 number_intervals; /* -1 if no intervals */
+   epicsInt64 count_threshold;
+   epicsUInt32 first_interval;
+   epicsUInt32 first_range;
+   epicsUInt32 number_ranges;
+   epicsUInt32 spare;
+} Cache_Rule;
+
+/* The tables, as laid out in the body.
+ */
+typedef struct sCache_Tables {
+   Cache_Unit *units;
+   Cache_Rule *rules;
+   Cache_Range *ranges;
+   Cache_Interval *intervals;
+   Cache_Dependency *dependencies;
+   char *strings;
+   size_t strings_used;         /* only used when writing */
+} Cache_Tables;
+
+
+/*------------------------------------------------------------------------------
+ * Returns the cache file name - caller must free.
+ */
+static char *Cache_Name (const char *filename, const char *suffix)
+{
+   size_t size = strlen (filename) + strlen (suffix) + 1;
+   char *name;
+
+   name = (char *) callocMustSucceed (size, 1, "Cache_Name");
+   snprintf (name, size, "%s%s", filename, suffix);
+   return name;
+}                               /* Cache_Name */
+
+
+/*------------------------------------------------------------------------------
+ * FNV-1a, applied to 64 bit words. The size must be a multiple of 8.
+ */
+static epicsUInt64 Cache_Checksum (const void *data, const size_t size)
+{
+   const epicsUInt64 *word = (const epicsUInt64 *) data;
+   epicsUInt64 hash = 0xcbf29ce484222325ULL;
+   size_t j;
+
+   for (j = 0; j < size / 8; j++) {
+      hash ^= word[j];
+      hash *= 0x100000001b3ULL;
+   }
+   return hash;
+}                               /* Cache_Checksum */
+
+
+/*------------------------------------------------------------------------------
+ * Returns the body size for the given table sizes.
+ */
+static size_t Body_Size (const Cache_Header * header)
+{
+   return (size_t) header->number_units * sizeof (Cache_Unit) +
+       (size_t) header->number_rules * sizeof (Cache_Rule) +
+       (size_t) header->number_ranges * sizeof (Cache_Range) +
+       (size_t) header->number_intervals * sizeof (Cache_Interval) +
+       (size_t) header->number_dependencies * sizeof (Cache_Dependency) +
+       (size_t) header->strings_size;
+}                               /* Body_Size */
+
+
+/*------------------------------------------------------------------------------
+ * Locates the tables within the body.
+ */
+static void Locate_Tables (const Cache_Header * header, char *body,
+                           Cache_Tables * tables)
+{
+   tables->units = (Cache_Unit *) body;
+   tables->rules = (Cache_Rule *) (tables->units + header->number_units);
+   tables->ranges = (Cache_Range *) (tables->rules + header->number_rules);
+   tables->intervals =
+       (Cache_Interval *) (tables->ranges + header->number_ranges);
+   tables->dependencies =
+       (Cache_Dependency *) (tables->intervals + header->number_intervals);
+   tables->strings =
+       (char *) (tables->dependencies + header->number_dependencies);
+   tables->strings_used = 0;
+}                               /* Locate_Tables */
+
+
+/*------------------------------------------------------------------------------
+ * Records the configuration file's identity in the header.
+ */
+static void Set_Source (Cache_Header * header, const struct stat *source)
+{
+   header->source_size = (epicsUInt64) source->st_size;
+   header->source_mtime = (epicsInt64) source->st_mtim.tv_sec;
+   header->source_mtime_nsec = (epicsInt64) source->st_mtim.tv_nsec;
+   header->source_inode = (epicsUInt64) source->st_ino;
+   header->source_device = (epicsUInt64) source->st_dev;
+}                               /* Set_Source */
+
+
+/*------------------------------------------------------------------------------
+ * Returns true if the header's source identity is as per source.
+ */
+static bool Same_Source (const Cache_Header * header,
+                         const struct stat *source)
+{
+   Cache_Header current;
+
+   Set_Source (&current, source);
+   return (header->source_size == current.source_size) &&
+       (header->source_mtime == current.source_mtime) &&
+       (header->source_mtime_nsec == current.source_mtime_nsec) &&
+       (header->source_inode == current.source_inode) &&
+       (header->source_device == current.source_device);
+}                               /* Same_Source */
+
+
+/*------------------------------------------------------------------------------
+ * Records the included file's identity in the dependency. Returns false if the
+ * file cannot be accessed.
+ */
+static bool Set_Dependency (Cache_Dependency * dependency, const char *name)
+{
+   Cache_Header header;
+   struct stat info;
+
+   if (stat (name, &info) != 0) {
+      return false;
+   }
+   Set_Source (&header, &info);
+   dependency->size = header.source_size;
+   dependency->mtime = header.source_mtime;
+   dependency->mtime_nsec = header.source_mtime_nsec;
+   dependency->inode = header.source_inode;
+   dependency->device = header.source_device;
+   return true;
+}                               /* Set_Dependency */
+
+
+/*------------------------------------------------------------------------------
+ * WRITING
+ *------------------------------------------------------------------------------
+ * Returns true if the client can be held as a rule, i.e. it owns no compiled
+ * objects and is not an expression or sequence input.
+ */
+static bool Is_Simple_Client (const CA_Client * pClient)
+{
+   unsigned int j;
+
+   if (pClient->expression || pClient->sequence || pClient->element_list) {
+      return false;
+   }
+
+   for (j = 0; j < pClient->match_set_collection.count; j++) {
+      if (pClient->match_set_collection.item[j].set ||
+          pClient->match_set_collection.item[j].pattern) {
+         return false;
+      }
+   }
+   return true;
+}                               /* Is_Simple_Client */
+
+
+/*------------------------------------------------------------------------------
+ * Returns true if the client is a subsequent input of the same expression or
+ * sequence as the previous client, and so is part of the previous unit.
+ */
+static bool Is_Same_Unit (const CA_Client * previous,
+                          const CA_Client * pClient)
+{
+   if (previous == NULL) {
+      return false;
+   }
+   return ((pClient->expression != NULL) &&
+           (pClient->expression == previous->expression)) ||
+       ((pClient->sequence != NULL) &&
+        (pClient->sequence == previous->sequence));
+}                               /* Is_Same_Unit */
+
+
+/*------------------------------------------------------------------------------
+ * Returns the string table space required by the string.
+ */
+static size_t String_Space (const char *text)
+{
+   return text ? strlen (text) + 1 : 1;
+}                               /* String_Space */
+
+
+/*------------------------------------------------------------------------------
+ * Appends a string to the string table, and returns its offset.
+ */
+static epicsUInt32 Add_String (Cache_Tables * tables, const char *text)
+{
+   size_t offset = tables->strings_used;
+   size_t size = String_Space (text);
+
+   if (text) {
+      memcpy (tables->strings + offset, text, size);
+   }
+   tables->strings_used += size;
+   return (epicsUInt32) offset;
+}                               /* Add_String */
+
+
+/*------------------------------------------------------------------------------
+ */
+static size_t Value_Space (const Variant_Value * value)
+{
+   return (value->kind == vkString) ? String_Space (value->value.sval) : 0;
+}                               /* Value_Space */
+
+
+/*------------------------------------------------------------------------------
+ */
+static void Put_Value (Cache_Tables * tables, Cache_Value * target,
+                       const Variant_Value * value)
+{
+   target->kind = (epicsInt32) value->kind;
+   switch (value->kind) {
+      case vkString:
+         target->sval = Add_String (tables, value->value.sval);
+         break;
+      case vkInteger:
+         target->ival = (epicsInt64) value->value.ival;
+         break;
+      case vkFloating:
+         target->dval = (epicsFloat64) value->value.dval;
+         break;
+      default:
+         break;
+   }
+}                               /* Put_Value */
+
+
+/*------------------------------------------------------------------------------
+ * Sizes the tables required for the list.
+ */
+static void Size_Tables (const ELLLIST * list, Cache_Header * header)
+{
+   const CA_Client *previous = NULL;
+   const CA_Client *pClient;
+   const Variant_Range *range;
+   size_t strings_size = 0;
+   unsigned int j;
+
+   for (pClient = (const CA_Client *) ellFirst (list); pClient;
+        previous = pClient,
+        pClient = (const CA_Client *) ellNext ((ELLNODE *) pClient)) {
+
+      if (Is_Same_Unit (previous, pClient)) {
+         continue;
+      }
+
+      header->number_units++;
+      if (!Is_Simple_Client (pClient)) {
+         strings_size += String_Space (pClient->signature);
+         continue;
+      }
+
+      header->number_rules++;
+      header->number_ranges += pClient->match_set_collection.count;
+      if (pClient->array_predicate.intervals) {
+         header->number_intervals += pClient->array_predicate.intervals->count;
+      }
+      strings_size += String_Space (pClient->pv_name);
+      strings_size += String_Space (pClient->match_command);
+      strings_size += String_Space (pClient->signature);
+      for (j = 0; j < pClient->match_set_collection.count; j++) {
+         range = &pClient->match_set_collection.item[j];
+         strings_size += Value_Space (&range->lower);
+         strings_size += Value_Space (&range->upper);
+      }
+   }
+
+   for (j = 0; Scan_Included_File (j); j++) {
+      header->number_dependencies++;
+      strings_size += String_Space (Scan_Included_File (j));
+   }
+
+   /* Keep the body a multiple of 8 bytes.
+    */
+   header->strings_size = (strings_size + 7) & ~((size_t) 7);
+}                               /* Size_Tables */
+
+
+/*------------------------------------------------------------------------------
+ * Populates the (zeroed) tables from the list.
+ */
+static void Fill_Tables (const ELLLIST * list, Cache_Tables * tables)
+{
+   const CA_Client *previous = NULL;
+   const CA_Client *pClient;
+   const Variant_Range *range;
+   const Interval_Set *intervals;
+   Cache_Unit *unit = tables->units;
+   Cache_Rule *rule = tables->rules;
+   Cache_Range *cache_range = tables->ranges;
+   Cache_Interval *cache_interval = tables->intervals;
+   unsigned int j;
+
+   for (j = 0; Scan_Included_File (j); j++) {
+      tables->dependencies[j].name =
+          Add_String (tables, Scan_Included_File (j));
+   }
+
+   for (pClient = (const CA_Client *) ellFirst (list); pClient;
+        previous = pClient,
+        pClient = (const CA_Client *) ellNext ((ELLNODE *) pClient)) {
+
+      if (Is_Same_Unit (previous, pClient)) {
+         continue;
+      }
+
+      if (!Is_Simple_Client (pClient)) {
+         unit->kind = cuText;
+         unit->index = Add_String (tables, pClient->signature);
+         unit++;
+         continue;
+      }
+
+      unit->kind = cuRule;
+      unit->index = (epicsUInt32) (rule - tables->rules);
+      unit++;
+
+      rule->pv_name = Add_String (tables, pClient->pv_name);
+      rule->command = Add_String (tables, pClient->match_command);
+      rule->signature = Add_String (tables, pClient->signature);
+      rule->element_index = pClient->element_index;
+      rule->deadband = pClient->options.deadband;
+      rule->event_mask = pClient->options.event_mask;
+      rule->is_relative = pClient->options.is_relative;
+      rule->priority = pClient->options.priority;
+      rule->target = pClient->target;
+      rule->predicate_kind = pClient->array_predicate.kind;
+      rule->count_comp = pClient->array_predicate.count_comp;
+      rule->count_threshold = pClient->array_predicate.count_threshold;
+
+      intervals = pClient->array_predicate.intervals;
+      rule->number_intervals = intervals ? (epicsInt32) intervals->count : -1;
+      rule->first_interval =
+          (epicsUInt32) (cache_interval - tables->intervals);
+      if (intervals) {
+         for (j = 0; j < intervals->count; j++) {
+            cache_interval->lower = intervals->item[j].lower;
+            cache_interval->upper = intervals->item[j].upper;
+            cache_interval++;
+         }
+      }
+
+      rule->first_range = (epicsUInt32) (cache_range - tables->ranges);
+      rule->number_ranges = pClient->match_set_collection.count;
+      for (j = 0; j < pClient->match_set_collection.count; j++) {
+         range = &pClient->match_set_collection.item[j];
+         cache_range->comp = range->comp;
+         Put_Value (tables, &cache_range->lower, &range->lower);
+         Put_Value (tables, &cache_range->upper, &range->upper);
+         cache_range++;
+      }
+      rule++;
+   }
+}                               /* Fill_Tables */
+
+
+/*------------------------------------------------------------------------------
+ * Writes the file, via a temporary file, so that the cache is replaced
+ * atomically.
+ */
+static bool Write_Cache_File (const char *name, const Cache_Header * header,
+                              const char *body)
+{
+   char *temporary;
+   FILE *file;
+   bool status;
+
+   temporary = Cache_Name (name, ".tmp");
+   file = fopen (temporary, "wb");
+   if (file == NULL) {
+      printf ("unable to create rule cache %s (%s)\n", temporary,
+              strerror (errno));
+      free (temporary);
+      return false;
+   }
+
+   status = (fwrite (header, sizeof (Cache_Header), 1, file) == 1) &&
+       ((header->body_size == 0) ||
+        (fwrite (body, header->body_size, 1, file) == 1));
+   status = (fclose (file) == 0) && status;
+   status = status && (rename (temporary, name) == 0);
+
+   if (!status) {
+      printf ("unable to write rule cache %s (%s)\n", name, strerror (errno));
+      (void) unlink (temporary);
+   }
+
+   free (temporary);
+   return status;
+}                               /* Write_Cache_File */
+
+
+/*------------------------------------------------------------------------------
+ * Returns true if the specification text uses a relative set file name, e.g.
+ * "in @reasons.txt".
+ */
+static bool Has_Relative_Set_File (const char *text)
+{
+   const char *at;
+   const char *scan;
+
+   for (at = strchr (text, '@'); at; at = strchr (at + 1, '@')) {
+      scan = at;
+      while ((scan > text) && isspace (scan[-1])) {
+         scan--;
+      }
+      if ((at[1] != '/') && (scan - text >= 2) &&
+          (strncmp (scan - 2, "in", 2) == 0) &&
+          ((scan - 2 == text) || isspace (scan[-3]))) {
+         return true;
+      }
+   }
+   return false;
+}                               /* Has_Relative_Set_File */
+
+
+/*------------------------------------------------------------------------------
+ * Returns true if both file names have the same directory part.
+ */
+static bool Same_Directory (const char *a, const char *b)
+{
+   const char *a_slash = strrchr (a, '/');
+   const char *b_slash = strrchr (b, '/');
+
+   if ((a_slash == NULL) || (b_slash == NULL)) {
+      return (a_slash == NULL) && (b_slash == NULL);
+   }
+   return (a_slash - a == b_slash - b) && (strncmp (a, b, a_slash - a) == 0);
+}                               /* Same_Directory */
+
+
+/*------------------------------------------------------------------------------
+ * Specifications held as text are re-scanned as if from the configuration
+ * file itself, so a relative set file name within an included file in another
+ * directory would be resolved differently. Returns true if that may be so.
+ */
+static bool Set_Files_Moved (const char *filename, const ELLLIST * list)
+{
+   const CA_Client *pClient;
+   bool elsewhere = false;
+   int j;
+
+   for (j = 0; Scan_Included_File (j); j++) {
+      if (!Scan_Is_Set_File (j) &&
+          !Same_Directory (filename, Scan_Included_File (j))) {
+         elsewhere = true;
+      }
+   }
+   if (!elsewhere) {
+      return false;
+   }
+
+   for (pClient = (const CA_Client *) ellFirst (list); pClient;
+        pClient = (const CA_Client *) ellNext ((ELLNODE *) pClient)) {
+      if (!Is_Simple_Client (pClient) &&
+          Has_Relative_Set_File (pClient->signature)) {
+         return true;
+      }
+   }
+   return false;
+}                               /* Set_Files_Moved */
+
+
+/*------------------------------------------------------------------------------
+ */
+bool Rule_Cache_Write (const char *filename, const struct stat *source,
+                       const ELLLIST * list)
+{
+   Cache_Header header;
+   Cache_Tables tables;
+   struct stat current;
+   char *name;
+   char *body;
+   unsigned int j;
+   bool status;
+
+   /* The configuration must not have changed since it was scanned.
+    */
+   memset (&header, 0, sizeof (header));
+   Set_Source (&header, source);
+   if ((stat (filename, &current) != 0) || !Same_Source (&header, &current)) {
+      printf ("%s modified while being compiled - cache not written\n",
+              filename);
+      return false;
+   }
+
+   if (Set_Files_Moved (filename, list)) {
+      printf ("%s includes relative set files from another directory"
+              " - cache not written\n", filename);
+      return false;
+   }
+
+   memcpy (header.magic, CACHE_MAGIC, sizeof (header.magic));
+   header.version = CACHE_VERSION;
+   header.header_size = sizeof (Cache_Header);
+   snprintf (header.build, sizeof (header.build), "%s", CACHE_BUILD);
+
+   Size_Tables (list, &header);
+   header.body_size = Body_Size (&header);
+
+   body = (char *) callocMustSucceed (header.body_size + 1, 1,
+                                      "Rule_Cache_Write");
+   Locate_Tables (&header, body, &tables);
+   Fill_Tables (list, &tables);
+   for (j = 0; j < header.number_dependencies; j++) {
+      if (!Set_Dependency (&tables.dependencies[j],
+                           tables.strings + tables.dependencies[j].name)) {
+         printf ("unable to access included file %s - cache not written\n",
+                 tables.strings + tables.dependencies[j].name);
+         free (body);
+         return false;
+      }
+   }
+   header.checksum = Cache_Checksum (body, header.body_size);
+
+   name = Cache_Name (filename, CACHE_SUFFIX);
+   status = Write_Cache_File (name, &header, body);
+   if (status) {
+      printf ("Rule cache %s written - %u rules, %u specifications held as text.\n",
+              name, header.number_rules,
+              header.number_units - header.number_rules);
+   }
+
+   free (name);
+   free (body);
+   return status;
+}                               /* Rule_Cache_Write */
+
+
+/*------------------------------------------------------------------------------
+ * READING
+ *------------------------------------------------------------------------------
+ * Returns the string at offset, or NULL if the offset is invalid, or the
+ * string is longer than maximum (excluding the terminating '\0').
+ */
+static const char *Get_String (const Cache_Header * header,
+                               const Cache_Tables * tables,
+                               const epicsUInt32 offset, const size_t maximum)
+{
+   const char *text;
+   const char *end;
+
+   if (offset >= header->strings_size) {
+      return NULL;
+   }
+   text = tables->strings + offset;
+   end = (const char *) memchr (text, '\0',
+                                MIN (maximum + 1,
+                                     header->strings_size - offset));
+   return end ? text : NULL;
+}                               /* Get_String */
+
+
+/*------------------------------------------------------------------------------
+ */
+static bool Get_Value (const Cache_Header * header,
+                       const Cache_Tables * tables,
+                       const Cache_Value * source, Variant_Value * value)
+{
+   const char *text;
+
+   value->kind = (Variant_Kind) source->kind;
+   switch (value->kind) {
+      case vkVoid:
+         break;
+      case vkString:
+         text = Get_String (header, tables, source->sval,
+                            sizeof (value->value.sval) - 1);
+         if (text == NULL) {
+            return false;
+         }
+         strcpy (value->value.sval, text);
+         break;
+      case vkInteger:
+         value->value.ival = (long) source->ival;
+         break;
+      case vkFloating:
+         value->value.dval = (double) source->dval;
+         break;
+      default:
+         return false;
+   }
+   return true;
+}                               /* Get_Value */
+
+
+/*------------------------------------------------------------------------------
+ * Creates the client for a rule, and appends it to the list.
+ */
+static bool Load_Rule (const Cache_Header * header,
+                       const Cache_Tables * tables, const Cache_Rule * rule,
+                       const Allocate_Client_Handle allocate, ELLLIST * list)
+{
+   const char *pv_name;
+   const char *command;
+   const char *signature;
+   const Cache_Interval *interval;
+   Interval_Set *intervals;
+   CA_Client *pClient;
+   Variant_Range *range;
+   unsigned int j;
+
+   pv_name = Get_String (header, tables, rule->pv_name,
+                         header->strings_size);
+   command = Get_String (header, tables, rule->command,
+                         header->strings_size);
+   signature = Get_String (header, tables, rule->signature,
+                           header->strings_size);
+
+   if (!pv_name || !command || !signature ||
+       (rule->first_range > header->number_ranges) ||
+       (rule->number_ranges > header->number_ranges - rule->first_range) ||
+       (rule->number_intervals > MAXIMUM_INTERVALS) ||
+       ((rule->number_intervals > 0) &&
+        ((rule->first_interval > header->number_intervals) ||
+         ((epicsUInt32) rule->number_intervals >
+          header->number_intervals - rule->first_interval)))) {
+      return false;
+   }
+
+   pClient = allocate (rule->number_ranges);
+   if (pClient == NULL) {
+      return true;
+   }
+
+   pClient->pv_name = Intern_String (pv_name);
+   pClient->match_command = Intern_String (command);
+   pClient->element_index = rule->element_index;
+   pClient->options.deadband = rule->deadband;
+   pClient->options.is_relative = (rule->is_relative != 0);
+   pClient->options.event_mask = (long) rule->event_mask;
+   pClient->options.priority = rule->priority;
+   pClient->target = (Match_Target) rule->target;
+   pClient->array_predicate.kind = (Array_Predicate_Kind) rule->predicate_kind;
+   pClient->array_predicate.count_comp = (Comparision_Kind) rule->count_comp;
+   pClient->array_predicate.count_threshold = (long) rule->count_threshold;
+   pClient->signature = epicsStrDup (signature);
+
+   /* The client is added before the values are checked, so that the caller
+    * frees it along with the rest of the list should a value be invalid.
+    */
+   ellAdd (list, (ELLNODE *) pClient);
+
+   if (rule->number_intervals >= 0) {
+      intervals = (Interval_Set *) callocMustSucceed
+          (1, sizeof (Interval_Set), "Load_Rule");
+      interval = &tables->intervals[rule->first_interval];
+      for (j = 0; j < (unsigned int) rule->number_intervals; j++) {
+         intervals->item[j].lower = interval[j].lower;
+         intervals->item[j].upper = interval[j].upper;
+      }
+      intervals->count = rule->number_intervals;
+      pClient->array_predicate.intervals = intervals;
+   }
+
+   pClient->match_set_collection.count = rule->number_ranges;
+   for (j = 0; j < rule->number_ranges; j++) {
+      const Cache_Range *source = &tables->ranges[rule->first_range + j];
+
+      range = &pClient->match_set_collection.item[j];
+      range->comp = (Comparision_Kind) source->comp;
+      if (!Get_Value (header, tables, &source->lower, &range->lower) ||
+          !Get_Value (header, tables, &source->upper, &range->upper)) {
+         return false;
+      }
+   }
+
+   return true;
+}                               /* Load_Rule */
+
+
+/*------------------------------------------------------------------------------
+ * Checks the cache header and body. Returns NULL if all is well, otherwise
+ * the reason the cache is not usable.
+ */
+static const char *Check_Cache (const char *filename, const char *image,
+                                const size_t size)
+{
+   const Cache_Header *header = (const Cache_Header *) image;
+   const char *body = image + sizeof (Cache_Header);
+   const Cache_Dependency *dependency;
+   Cache_Dependency current;
+   Cache_Tables tables;
+   const char *name;
+   struct stat source;
+   unsigned int j;
+
+   if ((size < sizeof (Cache_Header)) ||
+       (memcmp (header->magic, CACHE_MAGIC, sizeof (header->magic)) != 0) ||
+       (header->header_size != sizeof (Cache_Header))) {
+      return "not a rule cache";
+   }
+
+   if ((header->version != CACHE_VERSION) ||
+       (strncmp (header->build, CACHE_BUILD, sizeof (header->build)) != 0)) {
+      return "written by a different build of kryten";
+   }
+
+   if ((stat (filename, &source) != 0) || !Same_Source (header, &source)) {
+      return "out of date";
+   }
+
+   if ((header->body_size != size - sizeof (Cache_Header)) ||
+       (header->body_size != Body_Size (header)) ||
+       ((header->strings_size > 0) &&
+        (body[header->body_size - 1] != '\0'))) {
+      return "truncated or corrupt";
+   }
+
+   if (Cache_Checksum (body, header->body_size) != header->checksum) {
+      return "checksum mismatch";
+   }
+
+   /* And neither must any included file.
+    */
+   Locate_Tables (header, (char *) body, &tables);
+   for (j = 0; j < header->number_dependencies; j++) {
+      dependency = &tables.dependencies[j];
+      name = Get_String (header, &tables, dependency->name,
+                         header->strings_size);
+      if ((name == NULL) || !Set_Dependency (&current, name) ||
+          (current.size != dependency->size) ||
+          (current.mtime != dependency->mtime) ||
+          (current.mtime_nsec != dependency->mtime_nsec) ||
+          (current.inode != dependency->inode) ||
+          (current.device != dependency->device)) {
+         return "out of date";
+      }
+   }
+
+   return NULL;
+}                               /* Check_Cache */
+
+
+/*------------------------------------------------------------------------------
+ */
+bool Rule_Cache_Read (const char *filename,
+                      const Allocate_Client_Handle allocate, ELLLIST * list)
+{
+   const Cache_Header *header;
+   const Cache_Unit *unit;
+   const char *reason;
+   const char *text;
+   Cache_Tables tables;
+   struct stat info;
+   char *image;
+   char *name;
+   size_t size;
+   unsigned int j;
+   bool status;
+   int fd;
+
+   name = Cache_Name (filename, CACHE_SUFFIX);
+   fd = open (name, O_RDONLY);
+   if (fd < 0) {
+      free (name);              /* no cache - quietly use the configuration */
+      return false;
+   }
+
+   image = NULL;
+   size = 0;
+   if ((fstat (fd, &info) == 0) && S_ISREG (info.st_mode) &&
+       (info.st_size > 0)) {
+      size = info.st_size;
+      image = (char *) mmap (NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (image == MAP_FAILED) {
+         image = NULL;
+      }
+   }
+   (void) close (fd);
+
+   reason = image ? Check_Cache (filename, image, size) : "unreadable";
+   if (reason) {
+      printf ("Rule cache %s %s - scanning %s\n", name, reason, filename);
+      if (image) {
+         (void) munmap (image, size);
+      }
+      free (name);
+      return false;
+   }
+
+   (void) madvise (image, size, MADV_SEQUENTIAL);
+   header = (const Cache_Header *) image;
+   Locate_Tables (header, image + sizeof (Cache_Header), &tables);
+
+   status = true;
+   for (j = 0; status && (j < header->number_units); j++) {
+      unit = &tables.units[j];
+
+      switch (unit->kind) {
+         case cuRule:
+            status = (unit->index < header->number_rules) &&
+                Load_Rule (header, &tables, &tables.rules[unit->index],
+                           allocate, list);
+            break;
+
+         case cuText:
+            /* Specifications that own compiled objects are re-scanned.
+             */
+            text = Get_String (header, &tables, unit->index,
+                               header->strings_size);
+            status = (text != NULL) &&
+                Scan_Specification_String (text, strlen (text), filename,
+                                           allocate, list);
+            break;
+
+         default:
+            status = false;
+            break;
+      }
+   }
+
+   /* As if scanned, so that changes to the included files are noticed.
+    */
+   if (status) {
+      Scan_Clear_Included_Files ();
+      for (j = 0; j < header->number_dependencies; j++) {
+         Scan_Add_Included_File (tables.strings + tables.dependencies[j].name);
+      }
+   }
+
+   if (!status) {
+      printf ("Rule cache %s corrupt - scanning %s\n", name, filename);
+   } else if (is_verbose) {
+      printf ("Rule cache %s loaded - %u rules, %u specifications re-scanned.\n",
+              name, header->number_rules,
+              header->number_units - header->number_rules);
+   }
+
+   (void) munmap (image, size);
+   free (name);
+   return status;
+}                               /* Rule_Cache_Read */
+
+/* end */
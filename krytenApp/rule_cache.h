@@ -0,0 +1,69 @@
+/* rule_cache.h
+ *
+ * Kryten is a EPICS PV monitoring program that calls a system command
+ * when the value of the PV matches/cease to match specified criteria.
+ *
+ * Copyright (C) 2011-2021  Andrew C. Starritt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact details:
+ * andrew.starritt@gmail.com
+ * PO Box 3118, Prahran East, Victoria 3181, Australia.
+ *
+ * Source code formatting:
+ * indent options:  -kr -pcs -i3 -cli3 -nbbo -nut
+ *
+ */
+
+#ifndef RULE_CACHE_H_
+#define RULE_CACHE_H_
+
+#include <sys/stat.h>
+
+#include <ellLib.h>
+
+#include "kryten.h"
+#include "pv_client.h"
+
+/* The rule cache is a pre-compiled, binary image of a configuration file's
+ * scanned client list, held in the file filename.cache. Loading the cache
+ * avoids re-scanning (and re-reporting any warnings for) the configuration.
+ *
+ * Simple specifications are held as fixed size records plus a string table.
+ * Specifications that own compiled objects, i.e. expressions, sequences,
+ * sets, patterns and element lists, are held as their specification text,
+ * and are re-scanned when the cache is loaded.
+ *
+ * The cache records the size, modification time and inode of the
+ * configuration file and of any files it includes, together with the kryten
+ * version and build time, and is checksummed. It is not used if any of these
+ * do not match.
+ */
+
+/* Writes the cache for the configuration file. The source is the status of
+ * the configuration file as taken before the file was scanned.
+ */
+bool Rule_Cache_Write (const char *filename, const struct stat *source,
+                       const ELLLIST * list);
+
+/* Appends the cached clients of the configuration file to list. Returns false
+ * if there is no cache, or the cache is stale or invalid, in which case the
+ * configuration file must be scanned. The list may have been partially
+ * populated when false is returned.
+ */
+bool Rule_Cache_Read (const char *filename,
+                      const Allocate_Client_Handle allocate, ELLLIST * list);
+
+#endif                          /* RULE_CACHE_H_ */
@@ -0,0 +1,285 @@
+/* sequence.c
+ *
+ * Kryten is a EPICS PV monitoring program that calls a system command
+ * when the value of the PV matches/cease to match specified criteria.
+ *
+ * Copyright (C) 2011-2021  Andrew C. Starritt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact details:
+ * andrew.starritt@gmail.com
+ * PO Box 3118, Prahran East, Victoria 3181, Australia.
+ *
+ * Source code formatting:
+ * indent options:  -kr -pcs -i3 -cli3 -nbbo -nut
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cantProceed.h>
+#include <epicsMutex.h>
+#include <epicsString.h>
+#include <epicsThread.h>
+
+#include "sequence.h"
+
+/* Timer heap - ordered on deadline.
+ */
+static Sequence **heap = NULL;
+static int heap_count = 0;
+static int heap_size = 0;
+
+/* Sequence steps may be matched by dispatch workers, while timeouts are
+ * processed by the main thread.
+ */
+static epicsMutexId heap_mutex = NULL;
+static epicsThreadOnceId heap_once = EPICS_THREAD_ONCE_INIT;
+
+
+/*------------------------------------------------------------------------------
+ * Sequences may be created by several configuration scan threads at once.
+ */
+static void heap_initialise (void *arg)
+{
+   heap_mutex = epicsMutexCreate ();
+}                               /* heap_initialise */
+
+
+/*------------------------------------------------------------------------------
+ */
+static void heap_set (const int index, Sequence * sequence)
+{
+   heap[index] = sequence;
+   sequence->state.heap_index = index;
+}                               /* heap_set */
+
+
+/*------------------------------------------------------------------------------
+ */
+static void heap_sift_up (int index)
+{
+   Sequence *sequence = heap[index];
+   int parent;
+
+   while (index > 0) {
+      parent = (index - 1) / 2;
+      if (heap[parent]->state.deadline <= sequence->state.deadline) {
+         break;
+      }
+      heap_set (index, heap[parent]);
+      index = parent;
+   }
+   heap_set (index, sequence);
+}                               /* heap_sift_up */
+
+
+/*------------------------------------------------------------------------------
+ */
+static void heap_sift_down (int index)
+{
+   Sequence *sequence = heap[index];
+   int child;
+
+   for (;;) {
+      child = 2 * index + 1;
+      if (child >= heap_count) {
+         break;
+      }
+      if ((child + 1 < heap_count) &&
+          (heap[child + 1]->state.deadline < heap[child]->state.deadline)) {
+         child++;
+      }
+      if (sequence->state.deadline <= heap[child]->state.deadline) {
+         break;
+      }
+      heap_set (index, heap[child]);
+      index = child;
+   }
+   heap_set (index, sequence);
+}                               /* heap_sift_down */
+
+
+/*------------------------------------------------------------------------------
+ */
+static void heap_remove (Sequence * sequence)
+{
+   const int index = sequence->state.heap_index;
+
+   if (index < 0) {
+      return;
+   }
+
+   sequence->state.heap_index = -1;
+   heap_count--;
+   if (index < heap_count) {
+      Sequence *moved = heap[heap_count];
+
+      heap_set (index, moved);
+      heap_sift_down (index);
+      heap_sift_up (moved->state.heap_index);
+   }
+}                               /* heap_remove */
+
+
+/*------------------------------------------------------------------------------
+ * Inserts, or re-positions, the sequence in the heap.
+ */
+static void heap_schedule (Sequence * sequence, const double deadline)
+{
+   Sequence **larger;
+
+   heap_remove (sequence);
+   sequence->state.deadline = deadline;
+
+   if (heap_count >= heap_size) {
+      heap_size = (heap_size == 0) ? 64 : 2 * heap_size;
+      larger = (Sequence **) callocMustSucceed
+          (heap_size, sizeof (Sequence *), "heap_schedule");
+      if (heap) {
+         memcpy (larger, heap, heap_count * sizeof (Sequence *));
+         free (heap);
+      }
+      heap = larger;
+   }
+
+   heap_set (heap_count, sequence);
+   heap_count++;
+   heap_sift_up (heap_count - 1);
+}                               /* heap_schedule */
+
+
+/*------------------------------------------------------------------------------
+ * Moves sequence to the given step, and (re)schedules or cancels the timer.
+ */
+static void enter_step (Sequence * sequence, const int step, const double now)
+{
+   sequence->state.step = step;
+
+   if ((step > 0) && (sequence->within[step] >= 0.0)) {
+      heap_schedule (sequence, now + sequence->within[step]);
+   } else {
+      heap_remove (sequence);
+   }
+}                               /* enter_step */
+
+
+/*------------------------------------------------------------------------------
+ * PUBLIC FUNCTIONS
+ *------------------------------------------------------------------------------
+ */
+Sequence *Sequence_Create (const char *name)
+{
+   Sequence *result;
+   int j;
+
+   epicsThreadOnce (&heap_once, heap_initialise, NULL);
+
+   result = (Sequence *) callocMustSucceed
+       (1, sizeof (Sequence), "Sequence_Create");
+
+   result->name = epicsStrDup (name);
+   result->command = NULL;
+   result->number_steps = 0;
+   for (j = 0; j < MAXIMUM_SEQUENCE_STEPS; j++) {
+      result->within[j] = -1.0;
+   }
+   result->state.step = 0;
+   result->state.heap_index = -1;
+   result->state.deadline = 0.0;
+   result->number_transitions = 0;
+   result->anchor = NULL;
+
+   return result;
+}                               /* Sequence_Create */
+
+
+/*------------------------------------------------------------------------------
+ */
+void Sequence_Free (Sequence * sequence)
+{
+   if (sequence) {
+      epicsMutexLock (heap_mutex);
+      heap_remove (sequence);
+      epicsMutexUnlock (heap_mutex);
+      free (sequence->name);
+      free (sequence->command);
+      free (sequence);
+   }
+}                               /* Sequence_Free */
+
+
+/*------------------------------------------------------------------------------
+ */
+Sequence_Result Sequence_Step_Matched (Sequence * sequence, const int step,
+                                       const double now)
+{
+   Sequence_Result result = srNone;
+
+   epicsMutexLock (heap_mutex);
+
+   /* The next step matched - advance or complete.
+    */
+   if ((step == sequence->state.step) && (step > 0)) {
+      if (step + 1 >= sequence->number_steps) {
+         enter_step (sequence, 0, now);
+         result = srCompleted;
+      } else {
+         enter_step (sequence, step + 1, now);
+         result = srAdvanced;
+      }
+
+   } else if (step == 0) {
+      /* The first step (re)starts the sequence.
+       */
+      if (sequence->number_steps <= 1) {
+         result = srCompleted;
+      } else {
+         enter_step (sequence, 1, now);
+         result = srStarted;
+      }
+   }
+
+   epicsMutexUnlock (heap_mutex);
+   return result;
+}                               /* Sequence_Step_Matched */
+
+
+/*------------------------------------------------------------------------------
+ */
+Sequence *Sequence_Next_Expired (const double now, int *step)
+{
+   Sequence *sequence = NULL;
+
+   if (heap_mutex == NULL) {
+      return NULL;              /* no sequences */
+   }
+
+   epicsMutexLock (heap_mutex);
+
+   if ((heap_count > 0) && (heap[0]->state.deadline <= now)) {
+      sequence = heap[0];
+      heap_remove (sequence);
+      *step = sequence->state.step;
+      sequence->state.step = 0;
+   }
+
+   epicsMutexUnlock (heap_mutex);
+   return sequence;
+}                               /* Sequence_Next_Expired */
+
+/* end */
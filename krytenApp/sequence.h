@@ -0,0 +1,90 @@
+/* sequence.h
+ *
+ * Kryten is a EPICS PV monitoring program that calls a system command
+ * when the value of the PV matches/cease to match specified criteria.
+ *
+ * Copyright (C) 2011-2021  Andrew C. Starritt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact details:
+ * andrew.starritt@gmail.com
+ * PO Box 3118, Prahran East, Victoria 3181, Australia.
+ *
+ * Source code formatting:
+ * indent options:  -kr -pcs -i3 -cli3 -nbbo -nut
+ *
+ */
+
+#ifndef SEQUENCE_H_
+#define SEQUENCE_H_
+
+#include <epicsTypes.h>
+
+#include "kryten.h"
+
+/* A Sequence is a small state machine rule driven by the match transitions
+ * of its steps' input clients, e.g.
+ *
+ *    A:INTERLOCK = Tripped then B:VALVE = Closed within 0.5
+ *
+ * The sequence starts when step 0 enters the match state, and advances when
+ * the next step enters the match state within the step's time limit (if any).
+ * The sequence completes when the last step matches, and times out if a step
+ * does not match in time. Either way, the sequence then returns to step 0.
+ *
+ * The per sequence run time state is just the current step and deadline, and
+ * the position in the timer heap. Deadlines are held in a binary min-heap, so
+ * only expired sequences are visited by Sequence_Next_Expired.
+ */
+#define MAXIMUM_SEQUENCE_STEPS   16
+
+typedef struct sSequence_State {
+   epicsUInt16 step;            /* next step to match, 0 when idle */
+   epicsInt32 heap_index;       /* position in timer heap, -1 if none */
+   double deadline;             /* monotonic time */
+} Sequence_State;
+
+typedef struct sSequence {
+   char *name;                  /* used for %p */
+   char *command;               /* system command to be called */
+   int number_steps;
+   double within[MAXIMUM_SEQUENCE_STEPS];       /* seconds, < 0 if no limit */
+   Sequence_State state;
+   unsigned long number_transitions;    /* completions and time outs */
+   void *anchor;                /* an input channel, used to shard inputs */
+} Sequence;
+
+typedef enum eSequence_Result {
+   srNone = 0,                  /* not relevant to the current state */
+   srStarted,                   /* step 0 matched */
+   srAdvanced,                  /* an intermediate step matched */
+   srCompleted                  /* the last step matched */
+} Sequence_Result;
+
+Sequence *Sequence_Create (const char *name);
+void Sequence_Free (Sequence * sequence);
+
+/* To be called when the given step's input enters the match state.
+ */
+Sequence_Result Sequence_Step_Matched (Sequence * sequence, const int step,
+                                       const double now);
+
+/* Removes and returns the next sequence whose deadline has expired, having
+ * reset it to step 0, or returns NULL if there are no expired sequences.
+ * The step that did not match in time is returned via step.
+ */
+Sequence *Sequence_Next_Expired (const double now, int *step);
+
+#endif                          /* SEQUENCE_H_ */
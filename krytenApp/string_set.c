@@ -0,0 +1,261 @@
+/* string_set.c
+ *
+ * Kryten is a EPICS PV monitoring program that calls a system command
+ * when the value of the PV matches/cease to match specified criteria.
+ *
+ * Copyright (C) 2011-2021  Andrew C. Starritt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact details:
+ * andrew.starritt@gmail.com
+ * PO Box 3118, Prahran East, Victoria 3181, Australia.
+ *
+ * Source code formatting:
+ * indent options:  -kr -pcs -i3 -cli3 -nbbo -nut
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <cantProceed.h>
+
+#include "string_set.h"
+#include "utilities.h"
+
+#define INITIAL_CAPACITY   16
+#define ARENA_BLOCK_SIZE   4096
+
+/* Each slot holds the full hash as well as the length so that the vast
+ * majority of non-matching probes are rejected without a memcmp.
+ */
+typedef struct sSlot {
+   const char *text;            /* NULL if slot is unused */
+   unsigned int hash;
+   unsigned int length;
+} Slot;
+
+typedef struct sArena_Block {
+   struct sArena_Block *next;
+   size_t used;
+   size_t size;
+   char data[1];                /* actually size bytes */
+} Arena_Block;
+
+struct sString_Set {
+   Slot *slots;
+   unsigned int capacity;       /* always a power of 2 */
+   unsigned int count;
+   Arena_Block *arena;
+};
+
+
+/*------------------------------------------------------------------------------
+ * FNV-1a - simple, quick and good enough for PV values and names.
+ */
+static unsigned int hash_of (const char *text, const size_t length)
+{
+   unsigned int result = 2166136261u;
+   size_t j;
+
+   for (j = 0; j < length; j++) {
+      result ^= (unsigned char) text[j];
+      result *= 16777619u;
+   }
+   return result;
+}                               /* hash_of */
+
+
+/*------------------------------------------------------------------------------
+ * Allocates space for, and copies, the string into the set's arena.
+ */
+static const char *arena_copy (String_Set * set, const char *item,
+                               const size_t length)
+{
+   Arena_Block *block = set->arena;
+   size_t size;
+   char *result;
+
+   if ((block == NULL) || (block->used + length + 1 > block->size)) {
+      size = MAX (ARENA_BLOCK_SIZE, length + 1);
+      block = (Arena_Block *) mallocMustSucceed
+          (sizeof (Arena_Block) + size, "String_Set arena");
+      block->size = size;
+      block->used = 0;
+      block->next = set->arena;
+      set->arena = block;
+   }
+
+   result = &block->data[block->used];
+   memcpy (result, item, length);
+   result[length] = '\0';
+   block->used += length + 1;
+
+   return result;
+}                               /* arena_copy */
+
+
+/*------------------------------------------------------------------------------
+ * Returns slot index of either matching entry or first unused slot.
+ */
+static unsigned int find_slot (const Slot * slots, const unsigned int capacity,
+                               const char *text, const size_t length,
+                               const unsigned int hash)
+{
+   const unsigned int mask = capacity - 1;
+   unsigned int j;
+
+   j = hash & mask;
+   while (slots[j].text != NULL) {
+      if ((slots[j].hash == hash) && (slots[j].length == length) &&
+          (memcmp (slots[j].text, text, length) == 0)) {
+         break;
+      }
+      j = (j + 1) & mask;
+   }
+   return j;
+}                               /* find_slot */
+
+
+/*------------------------------------------------------------------------------
+ * Double the number of slots - re-insert existing entries.
+ */
+static void grow (String_Set * set)
+{
+   const unsigned int new_capacity = 2 * set->capacity;
+   Slot *new_slots;
+   unsigned int j;
+   unsigned int k;
+
+   new_slots = (Slot *) callocMustSucceed
+       (new_capacity, sizeof (Slot), "String_Set grow");
+
+   for (j = 0; j < set->capacity; j++) {
+      if (set->slots[j].text != NULL) {
+         k = find_slot (new_slots, new_capacity, set->slots[j].text,
+                        set->slots[j].length, set->slots[j].hash);
+         new_slots[k] = set->slots[j];
+      }
+   }
+
+   free (set->slots);
+   set->slots = new_slots;
+   set->capacity = new_capacity;
+}                               /* grow */
+
+
+/*------------------------------------------------------------------------------
+ * PUBLIC FUNCTIONS
+ *------------------------------------------------------------------------------
+ */
+String_Set *String_Set_Create ()
+{
+   String_Set *result;
+
+   result = (String_Set *) callocMustSucceed
+       (1, sizeof (String_Set), "String_Set_Create");
+
+   result->capacity = INITIAL_CAPACITY;
+   result->count = 0;
+   result->arena = NULL;
+   result->slots = (Slot *) callocMustSucceed
+       (result->capacity, sizeof (Slot), "String_Set_Create");
+
+   return result;
+}                               /* String_Set_Create */
+
+
+/*------------------------------------------------------------------------------
+ */
+void String_Set_Free (String_Set * set)
+{
+   Arena_Block *block;
+
+   if (set) {
+      while (set->arena) {
+         block = set->arena;
+         set->arena = block->next;
+         free (block);
+      }
+      free (set->slots);
+      free (set);
+   }
+}                               /* String_Set_Free */
+
+
+/*------------------------------------------------------------------------------
+ */
+const char *String_Set_Add (String_Set * set, const char *item,
+                            const size_t length)
+{
+   unsigned int hash;
+   unsigned int j;
+
+   hash = hash_of (item, length);
+   j = find_slot (set->slots, set->capacity, item, length, hash);
+
+   if (set->slots[j].text == NULL) {
+      set->slots[j].text = arena_copy (set, item, length);
+      set->slots[j].hash = hash;
+      set->slots[j].length = (unsigned int) length;
+      set->count++;
+
+      /* Keep load factor at or below 1/2 so probe sequences stay short.
+       */
+      if (2 * set->count > set->capacity) {
+         grow (set);
+         j = find_slot (set->slots, set->capacity, item, length, hash);
+      }
+   }
+
+   return set->slots[j].text;
+}                               /* String_Set_Add */
+
+
+/*------------------------------------------------------------------------------
+ */
+unsigned int String_Set_Count (const String_Set * set)
+{
+   return set ? set->count : 0;
+}                               /* String_Set_Count */
+
+
+/*------------------------------------------------------------------------------
+ */
+void String_Set_Make_Key (String_Set_Key * key, const char *text,
+                          const size_t length)
+{
+   key->text = text;
+   key->length = length;
+   key->hash = hash_of (text, length);
+}                               /* String_Set_Make_Key */
+
+
+/*------------------------------------------------------------------------------
+ */
+bool String_Set_Contains (const String_Set * set, const String_Set_Key * key)
+{
+   unsigned int j;
+
+   if (set == NULL) {
+      return false;
+   }
+
+   j = find_slot (set->slots, set->capacity, key->text, key->length,
+                  key->hash);
+   return (set->slots[j].text != NULL);
+}                               /* String_Set_Contains */
+
+/* end */
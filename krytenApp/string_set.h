@@ -0,0 +1,70 @@
+/* string_set.h
+ *
+ * Kryten is a EPICS PV monitoring program that calls a system command
+ * when the value of the PV matches/cease to match specified criteria.
+ *
+ * Copyright (C) 2011-2021  Andrew C. Starritt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact details:
+ * andrew.starritt@gmail.com
+ * PO Box 3118, Prahran East, Victoria 3181, Australia.
+ *
+ * Source code formatting:
+ * indent options:  -kr -pcs -i3 -cli3 -nbbo -nut
+ *
+ */
+
+#ifndef STRING_SET_H_
+#define STRING_SET_H_
+
+#include <stddef.h>
+
+#include "kryten.h"
+
+/* A String_Set is an open addressing (linear probe) hash set of strings.
+ * The set is populated once, when the configuration is read, and thereafter
+ * is only used for membership tests. The strings themselves are held in a
+ * private arena, so pointers returned by String_Set_Add remain valid for the
+ * life of the set.
+ */
+typedef struct sString_Set String_Set;
+
+/* A pre-computed lookup key. This allows a value's length and hash to be
+ * calculated once per update irrespective of the number of sets tested.
+ */
+typedef struct sString_Set_Key {
+   const char *text;
+   size_t length;
+   unsigned int hash;
+} String_Set_Key;
+
+String_Set *String_Set_Create ();
+void String_Set_Free (String_Set * set);
+
+/* Adds item to the set, if not already present, and returns a pointer to the
+ * set's copy of the string. The length excludes any terminating '\0'.
+ */
+const char *String_Set_Add (String_Set * set, const char *item,
+                            const size_t length);
+
+unsigned int String_Set_Count (const String_Set * set);
+
+void String_Set_Make_Key (String_Set_Key * key, const char *text,
+                          const size_t length);
+
+bool String_Set_Contains (const String_Set * set, const String_Set_Key * key);
+
+#endif                          /* STRING_SET_H_ */
@@ -32,6 +32,9 @@
 #include <math.h>
 #include <ctype.h>
 #include <errno.h>
+#include <time.h>
+
+#include <cantProceed.h>
 
 #include "utilities.h"
 
@@ -170,6 +173,44 @@ char *substitute (char *dest, const size_t n, const char *src,
 }                               /* substitute */
 
 
+/*------------------------------------------------------------------------------
+ */
+size_t substitute_size (const char *src, const char *find,
+                        const char *replace)
+{
+   const size_t find_len = strlen (find);
+   const size_t replace_len = strlen (replace);
+   size_t result;
+   const char *src_find;
+
+   result = strlen (src) + 1;
+   if (find_len <= 0) {
+      return result;
+   }
+
+   src_find = strstr (src, find);
+   while (src_find != NULL) {
+      result = result - find_len + replace_len;
+      src_find = strstr (src_find + find_len, find);
+   }
+   return result;
+}                               /* substitute_size */
+
+
+/*------------------------------------------------------------------------------
+ */
+char *substitute_step (char *src, const char *find, const char *replace)
+{
+   const size_t size = substitute_size (src, find, replace);
+   char *result;
+
+   result = (char *) callocMustSucceed (size, 1, "substitute_step");
+   substitute (result, size, src, find, replace);
+   free (src);
+   return result;
+}                               /* substitute_step */
+
+
 /*------------------------------------------------------------------------------
  */
 long long_value (const char *image, bool * status)
@@ -306,6 +347,17 @@ long get_long_env (const char *name, bool * status)
 }                               /* get_int_env */
 
 
+/*------------------------------------------------------------------------------
+ */
+double monotonic_time ()
+{
+   struct timespec ts;
+
+   clock_gettime (CLOCK_MONOTONIC, &ts);
+   return (double) ts.tv_sec + 1.0e-9 * (double) ts.tv_nsec;
+}                               /* monotonic_time */
+
+
 /*------------------------------------------------------------------------------
  */
 const char *vkImage (const Variant_Kind kind)
@@ -105,6 +105,18 @@ char * extract (char *dest, const size_t n, const char *src, const char *upto);
 char *substitute (char *dest, const size_t n, const char *src,
                   const char *find, const char *replace);
 
+/* Returns the size of the buffer, including the terminating '\0' character,
+ * that substitute () requires to copy src without truncation.
+ */
+size_t substitute_size (const char *src, const char *find,
+                        const char *replace);
+
+/* Allocates a buffer just large enough for the substitution, and frees src,
+ * which must have been allocated, e.g. by epicsStrDup. Neither PV names nor
+ * commands have a length limit.
+ */
+char *substitute_step (char *src, const char *find, const char *replace);
+
 
 /*------------------------------------------------------------------------------
  * This function returns a long value given an image of the value as a string,
@@ -125,6 +137,13 @@ double double_value (const char *image, bool * status);
 long get_long_env (const char *name, bool * status);
 
 
+/*------------------------------------------------------------------------------
+ * Returns the monotonic clock time in seconds. Only differences between
+ * values are meaningful.
+ */
+double monotonic_time ();
+
+
 /*------------------------------------------------------------------------------
  * own varient type
  */
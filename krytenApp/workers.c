@@ -0,0 +1,167 @@
+/* workers.c
+ *
+ * Kryten is a EPICS PV monitoring program that calls a system command
+ * when the value of the PV matches/cease to match specified criteria.
+ *
+ * Copyright (C) 2011-2021  Andrew C. Starritt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact details:
+ * andrew.starritt@gmail.com
+ * PO Box 3118, Prahran East, Victoria 3181, Australia.
+ *
+ * Source code formatting:
+ * indent options:  -kr -pcs -i3 -cli3 -nbbo -nut
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <cadef.h>
+#include <cantProceed.h>
+#include <epicsEvent.h>
+#include <epicsMutex.h>
+#include <epicsThread.h>
+
+#include "buffered_callbacks.h"
+#include "metrics.h"
+#include "workers.h"
+
+typedef struct sWorker {
+   int queue;
+   struct ca_client_context *context;
+   epicsMutexId pause;          /* held while processing a burst */
+   epicsEventId done;
+} Worker;
+
+static Worker *workers = NULL;
+static int number_started = 0;
+static volatile bool stop_requested = false;
+
+
+/*------------------------------------------------------------------------------
+ */
+static void Worker_Thread (void *arg)
+{
+   const int maximum = 400;     /* maximum items processed at one time */
+   const double delay = 0.05;   /* maximum wait for items */
+
+   Worker *worker = (Worker *) arg;
+   int status;
+
+   status = ca_attach_context (worker->context);
+   if (status != ECA_NORMAL) {
+      printf ("worker %d: ca_attach_context failed (%s)\n", worker->queue,
+              ca_message (status));
+   }
+
+   Metrics_Register_Thread (worker->queue);
+
+   while (!stop_requested) {
+      wait_buffered_callbacks (worker->queue, delay);
+      epicsMutexLock (worker->pause);
+      process_buffered_callback_queue (worker->queue, maximum);
+      epicsMutexUnlock (worker->pause);
+   }
+
+   ca_detach_context ();
+   epicsEventSignal (worker->done);
+}                               /* Worker_Thread */
+
+
+/*------------------------------------------------------------------------------
+ */
+bool Workers_Start (const int number, struct ca_client_context **contexts,
+                    const int number_contexts)
+{
+   char name[20];
+   int j;
+
+   number_started = number;
+   stop_requested = false;
+   workers = (Worker *) callocMustSucceed
+       (number, sizeof (Worker), "Workers_Start");
+
+   for (j = 0; j < number; j++) {
+      workers[j].queue = j + 1;
+      workers[j].context = contexts[j % number_contexts];
+      workers[j].pause = epicsMutexCreate ();
+      workers[j].done = epicsEventCreate (epicsEventEmpty);
+
+      snprintf (name, sizeof (name), "kryten%d", j + 1);
+      if (!epicsThreadCreate (name, epicsThreadPriorityMedium,
+                              epicsThreadGetStackSize
+                              (epicsThreadStackMedium), Worker_Thread,
+                              &workers[j])) {
+         printf ("epicsThreadCreate (%s) failed\n", name);
+         number_started = j;
+         Workers_Stop ();
+         return false;
+      }
+   }
+
+   if (is_verbose) {
+      printf ("Started %d dispatch worker%s\n", number,
+              (number == 1) ? "" : "s");
+   }
+   return true;
+}                               /* Workers_Start */
+
+
+/*------------------------------------------------------------------------------
+ */
+void Workers_Stop ()
+{
+   int j;
+
+   stop_requested = true;
+   for (j = 0; j < number_started; j++) {
+      wake_buffered_callbacks (workers[j].queue);
+      epicsEventWait (workers[j].done);
+      epicsEventDestroy (workers[j].done);
+      epicsMutexDestroy (workers[j].pause);
+   }
+
+   free (workers);
+   workers = NULL;
+   number_started = 0;
+}                               /* Workers_Stop */
+
+
+/*------------------------------------------------------------------------------
+ */
+void Workers_Pause ()
+{
+   int j;
+
+   for (j = 0; j < number_started; j++) {
+      epicsMutexLock (workers[j].pause);
+   }
+}                               /* Workers_Pause */
+
+
+/*------------------------------------------------------------------------------
+ */
+void Workers_Resume ()
+{
+   int j;
+
+   for (j = 0; j < number_started; j++) {
+      epicsMutexUnlock (workers[j].pause);
+   }
+}                               /* Workers_Resume */
+
+/* end */
@@ -0,0 +1,59 @@
+/* workers.h
+ *
+ * Kryten is a EPICS PV monitoring program that calls a system command
+ * when the value of the PV matches/cease to match specified criteria.
+ *
+ * Copyright (C) 2011-2021  Andrew C. Starritt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact details:
+ * andrew.starritt@gmail.com
+ * PO Box 3118, Prahran East, Victoria 3181, Australia.
+ *
+ * Source code formatting:
+ * indent options:  -kr -pcs -i3 -cli3 -nbbo -nut
+ *
+ */
+
+#ifndef WORKERS_H_
+#define WORKERS_H_
+
+#include <cadef.h>
+
+#include "kryten.h"
+
+#define MAXIMUM_WORKERS   64
+
+/* Dispatch workers. Each worker is a thread that processes one buffered
+ * callback queue, i.e. worker n processes queue n (1 to number). Queue 0
+ * remains with the main thread. The workers are attached to the given Channel
+ * Access contexts in turn, and so must be started after the contexts are
+ * created.
+ */
+bool Workers_Start (const int number, struct ca_client_context **contexts,
+                    const int number_contexts);
+
+/* Stops, and waits for, all the workers.
+ */
+void Workers_Stop ();
+
+/* Waits for each worker to complete its current burst of callbacks, and holds
+ * all the workers until resumed. Callbacks continue to be buffered while the
+ * workers are paused. Does nothing if there are no workers.
+ */
+void Workers_Pause ();
+void Workers_Resume ();
+
+#endif                          /* WORKERS_H_ */